@@ -1,12 +1,23 @@
 include(darling_lib)
-#include(CMakeParseArguments)
+include(CMakeParseArguments)
 
+# wrap_elf(name elfname [destination] [LAZY])
+#
+# LAZY: load the ELF library when the first symbol is resolved instead of at load time
 function(wrap_elf name elfname)
+	cmake_parse_arguments(WRAP "LAZY" "" "" ${ARGN})
+
+	set(wrapgen_flags "")
+	if (WRAP_LAZY)
+		set(wrapgen_flags "--lazy")
+	endif (WRAP_LAZY)
+
 	add_custom_command(
 		OUTPUT
 			${CMAKE_CURRENT_BINARY_DIR}/${name}.c
 		COMMAND
 			${CMAKE_BINARY_DIR}/src/libelfloader/wrapgen/wrapgen
+				${wrapgen_flags}
 				${elfname} 
 				${CMAKE_CURRENT_BINARY_DIR}/${name}.c
 				${CMAKE_CURRENT_BINARY_DIR}/${name}_vars.h
@@ -14,11 +25,11 @@ function(wrap_elf name elfname)
 			wrapgen
 	)
 
-	if (ARGC LESS 3)
+	if (NOT WRAP_UNPARSED_ARGUMENTS)
 		set(destination "/usr/lib/native")
-	else (ARGC LESS 3)
-		set(destination ${ARGV2})
-	endif (ARGC LESS 3)
+	else (NOT WRAP_UNPARSED_ARGUMENTS)
+		list(GET WRAP_UNPARSED_ARGUMENTS 0 destination)
+	endif (NOT WRAP_UNPARSED_ARGUMENTS)
 
 	set(DYLIB_INSTALL_NAME "${destination}/lib${name}.dylib")
 	include_directories(${CMAKE_SOURCE_DIR}/src/startup/mldr/elfcalls)
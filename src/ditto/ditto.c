@@ -0,0 +1,986 @@
+/*
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2026 Darling Team
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <fts.h>
+#include <pthread.h>
+#include <copyfile.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/xattr.h>
+#include <sys/clonefile.h>
+#include <libarchive/archive.h>
+#include <libarchive/archive_entry.h>
+
+#define QUARANTINE_XATTR "com.apple.quarantine"
+#define RESOURCE_FORK_XATTR "com.apple.ResourceFork"
+#define FINDER_INFO_XATTR "com.apple.FinderInfo"
+
+#define ARCHIVE_BLOCK_SIZE (1024 * 1024)
+#define JOBS_PER_WORKER 64
+#define LINK_BUCKETS 4096
+
+static struct
+{
+	bool verbose;
+	bool very_verbose;
+	bool xdev;
+	bool rsrc;
+	bool extattr;
+	bool acl;
+	bool qtn;
+	bool keep_parent;
+	bool zip;
+	char compression;
+} opts = {
+	.rsrc = true,
+	.extattr = true,
+	.acl = true,
+	.qtn = true,
+};
+
+static int status = 0;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: ditto [ <options> ] src [ ... src ] dst\n"
+		"\n"
+		"    <options> are any of:\n"
+		"    -h                         print full usage\n"
+		"    -v                         print a line of status for each source copied\n"
+		"    -V                         print a line of status for every file copied\n"
+		"    -X                         do not descend into directories with a different device ID\n"
+		"\n"
+		"    -c                         create an archive at dst (by default CPIO format)\n"
+		"    -x                         src(s) are archives to extract into dst\n"
+		"    -z                         gzip compress CPIO archive\n"
+		"    -j                         bzip2 compress CPIO archive\n"
+		"    -k                         archives are PKZip\n"
+		"    --keepParent               parent directory name src is embedded in dst_archive\n"
+		"\n"
+		"    --rsrc                     preserve resource forks and HFS meta-data (default)\n"
+		"    --norsrc                   don't preserve resource forks and HFS meta-data\n"
+		"    --extattr                  preserve extended attributes (requires --rsrc, default)\n"
+		"    --noextattr                don't preserve extended attributes\n"
+		"    --acl                      preserve Access Control Lists (default)\n"
+		"    --noacl                    don't preserve Access Control Lists\n"
+		"    --qtn                      preserve quarantine information (default)\n"
+		"    --noqtn                    don't preserve quarantine information\n");
+}
+
+static void fail(const char* what, const char* path, int error)
+{
+	fprintf(stderr, "ditto: %s: %s: %s\n", path, what, strerror(error));
+	status = 1;
+}
+
+static char* path_join(const char* dir, const char* name)
+{
+	char* result;
+	if (asprintf(&result, "%s%s%s", dir, (*dir && dir[strlen(dir) - 1] != '/' && name[0] != '/') ? "/" : "", name) < 0)
+	{
+		perror("asprintf");
+		exit(1);
+	}
+	return result;
+}
+
+static char* strip_trailing_slashes(const char* path)
+{
+	char* result = strdup(path);
+	size_t length = strlen(result);
+	while (length > 1 && result[length - 1] == '/')
+		result[--length] = '\0';
+	return result;
+}
+
+static void make_parents(const char* path, bool including_self)
+{
+	char* copy = strdup(path);
+	for (char* slash = strchr(copy + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+	{
+		*slash = '\0';
+		mkdir(copy, 0755);
+		*slash = '/';
+	}
+	if (including_self)
+		mkdir(copy, 0755);
+	free(copy);
+}
+
+static bool is_directory(const char* path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+//
+// Copying
+//
+// The tree is walked on the main thread, which creates directories as it
+// goes (so they exist before anything is copied into them) and hands every
+// file to a pool of worker threads. Directory metadata and hard links are
+// dealt with once all the files are in place.
+//
+
+struct copy_job
+{
+	char* src;
+	char* dst;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct copy_job* jobs;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	bool done;
+	pthread_t* threads;
+	size_t thread_count;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+struct copied_dir
+{
+	char* src;
+	char* dst;
+};
+
+static struct copied_dir* dirs;
+static size_t dir_count, dir_capacity;
+
+struct hard_link
+{
+	dev_t dev;
+	ino_t ino;
+	char* dst;
+	struct hard_link* next;
+};
+
+struct pending_link
+{
+	char* target;
+	char* dst;
+};
+
+static struct hard_link* hard_links[LINK_BUCKETS];
+static struct pending_link* pending_links;
+static size_t pending_link_count, pending_link_capacity;
+
+static copyfile_flags_t copy_flags(void)
+{
+	copyfile_flags_t flags = COPYFILE_STAT | COPYFILE_NOFOLLOW;
+	if (opts.acl)
+		flags |= COPYFILE_ACL;
+	if (opts.rsrc && opts.extattr)
+		flags |= COPYFILE_XATTR;
+	return flags;
+}
+
+// --rsrc without --extattr keeps just the classic HFS metadata
+static void copy_rsrc_only(const char* src, const char* dst)
+{
+	static const char* const names[] = { RESOURCE_FORK_XATTR, FINDER_INFO_XATTR };
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		ssize_t size = getxattr(src, names[i], NULL, 0, 0, XATTR_NOFOLLOW);
+		if (size <= 0)
+			continue;
+
+		void* value = malloc(size);
+		if (!value)
+			continue;
+		size = getxattr(src, names[i], value, size, 0, XATTR_NOFOLLOW);
+		if (size > 0 && setxattr(dst, names[i], value, size, 0, XATTR_NOFOLLOW) < 0)
+			fail("setxattr", dst, errno);
+		free(value);
+	}
+}
+
+static void finish_metadata(const char* src, const char* dst)
+{
+	if (opts.rsrc && !opts.extattr)
+		copy_rsrc_only(src, dst);
+	if (!opts.qtn)
+		removexattr(dst, QUARANTINE_XATTR, XATTR_NOFOLLOW);
+}
+
+static bool copy_file(const char* src, const char* dst)
+{
+	// A clone shares the data and carries every bit of metadata along, so it's
+	// only an option when all of it is to be kept
+	if (opts.rsrc && opts.extattr && opts.acl)
+	{
+		unlink(dst);
+		if (clonefile(src, dst, CLONE_NOFOLLOW) == 0)
+		{
+			finish_metadata(src, dst);
+			return true;
+		}
+	}
+
+	if (copyfile(src, dst, NULL, copy_flags() | COPYFILE_DATA | COPYFILE_UNLINK) < 0)
+		return false;
+
+	finish_metadata(src, dst);
+	return true;
+}
+
+static void* copy_worker(void* arg)
+{
+	pthread_mutex_lock(&pool.lock);
+	for (;;)
+	{
+		while (pool.count == 0 && !pool.done)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		if (pool.count == 0)
+			break;
+
+		struct copy_job job = pool.jobs[pool.head];
+		pool.head = (pool.head + 1) % pool.capacity;
+		pool.count--;
+		pthread_cond_broadcast(&pool.cond);
+		pthread_mutex_unlock(&pool.lock);
+
+		if (!copy_file(job.src, job.dst))
+		{
+			int error = errno;
+			pthread_mutex_lock(&pool.lock);
+			fail("copy", job.src, error);
+			pthread_mutex_unlock(&pool.lock);
+		}
+		free(job.src);
+		free(job.dst);
+
+		pthread_mutex_lock(&pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+static void pool_start(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	pool.thread_count = cpus > 0 ? cpus : 1;
+	pool.capacity = pool.thread_count * JOBS_PER_WORKER;
+	pool.jobs = calloc(pool.capacity, sizeof(*pool.jobs));
+	pool.threads = calloc(pool.thread_count, sizeof(*pool.threads));
+	if (!pool.jobs || !pool.threads)
+	{
+		perror("calloc");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < pool.thread_count; i++)
+	{
+		if (pthread_create(&pool.threads[i], NULL, copy_worker, NULL) != 0)
+		{
+			// whatever did start is enough to get the job done
+			pool.thread_count = i;
+			break;
+		}
+	}
+}
+
+static void pool_submit(const char* src, const char* dst)
+{
+	if (pool.thread_count == 0)
+	{
+		if (!copy_file(src, dst))
+			fail("copy", src, errno);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.count == pool.capacity)
+		pthread_cond_wait(&pool.cond, &pool.lock);
+	pool.jobs[(pool.head + pool.count) % pool.capacity] = (struct copy_job) { strdup(src), strdup(dst) };
+	pool.count++;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void pool_finish(void)
+{
+	pthread_mutex_lock(&pool.lock);
+	pool.done = true;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (size_t i = 0; i < pool.thread_count; i++)
+		pthread_join(pool.threads[i], NULL);
+
+	free(pool.jobs);
+	free(pool.threads);
+}
+
+// Returns the first copy of a file with several links, remembering `dst` as that copy if there isn't one yet
+static const char* hard_link_target(const struct stat* st, const char* dst)
+{
+	struct hard_link** bucket = &hard_links[(st->st_ino ^ st->st_dev * 0x9e3779b97f4a7c15ULL) % LINK_BUCKETS];
+
+	for (struct hard_link* link = *bucket; link; link = link->next)
+	{
+		if (link->dev == st->st_dev && link->ino == st->st_ino)
+			return link->dst;
+	}
+
+	struct hard_link* link = malloc(sizeof(*link));
+	link->dev = st->st_dev;
+	link->ino = st->st_ino;
+	link->dst = strdup(dst);
+	link->next = *bucket;
+	*bucket = link;
+	return NULL;
+}
+
+static void copy_special(const char* src, const char* dst, const struct stat* st)
+{
+	unlink(dst);
+	if (mknod(dst, st->st_mode, st->st_rdev) < 0)
+	{
+		fail("mknod", dst, errno);
+		return;
+	}
+	if (copyfile(src, dst, NULL, copy_flags()) < 0)
+		fail("copy metadata", src, errno);
+	finish_metadata(src, dst);
+}
+
+static void copy_entry(const char* src, const char* dst, const struct stat* st)
+{
+	if (opts.very_verbose)
+		fprintf(stderr, "copying file %s ... %lld bytes\n", src, (long long) st->st_size);
+
+	if (S_ISREG(st->st_mode) && st->st_nlink > 1)
+	{
+		const char* target = hard_link_target(st, dst);
+		if (target)
+		{
+			// the first copy may still be in progress, so link to it at the end
+			if (pending_link_count == pending_link_capacity)
+			{
+				pending_link_capacity = pending_link_capacity ? pending_link_capacity * 2 : 64;
+				pending_links = realloc(pending_links, pending_link_capacity * sizeof(*pending_links));
+			}
+			pending_links[pending_link_count++] = (struct pending_link) { strdup(target), strdup(dst) };
+			return;
+		}
+	}
+
+	if (S_ISREG(st->st_mode) || S_ISLNK(st->st_mode))
+		pool_submit(src, dst);
+	else
+		copy_special(src, dst, st);
+}
+
+static void copy_directory(const char* src, const char* dst, const struct stat* st)
+{
+	if (mkdir(dst, (st->st_mode & 07777) | S_IRWXU) < 0 && errno == ENOENT)
+	{
+		make_parents(dst, false);
+		mkdir(dst, (st->st_mode & 07777) | S_IRWXU);
+	}
+	if (!is_directory(dst))
+	{
+		fail("mkdir", dst, errno ? errno : ENOTDIR);
+		return;
+	}
+
+	if (dir_count == dir_capacity)
+	{
+		dir_capacity = dir_capacity ? dir_capacity * 2 : 256;
+		dirs = realloc(dirs, dir_capacity * sizeof(*dirs));
+	}
+	dirs[dir_count++] = (struct copied_dir) { strdup(src), strdup(dst) };
+}
+
+static void copy_source(const char* src, const char* dst)
+{
+	struct stat st;
+
+	if (lstat(src, &st) < 0)
+	{
+		fail("lstat", src, errno);
+		return;
+	}
+
+	if (opts.verbose)
+		fprintf(stderr, ">>> Copying %s\n", src);
+
+	if (!S_ISDIR(st.st_mode))
+	{
+		char* path = is_directory(dst) ? path_join(dst, basename((char*) src)) : strdup(dst);
+		make_parents(path, false);
+		copy_entry(src, path, &st);
+		free(path);
+		return;
+	}
+
+	char* root = strip_trailing_slashes(src);
+	char* const paths[] = { root, NULL };
+	FTS* fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR | (opts.xdev ? FTS_XDEV : 0), NULL);
+	if (!fts)
+	{
+		fail("fts_open", src, errno);
+		free(root);
+		return;
+	}
+
+	size_t root_length = strlen(root);
+	FTSENT* ent;
+	while ((ent = fts_read(fts)))
+	{
+		const char* relative = ent->fts_level > 0 ? ent->fts_path + (strcmp(root, "/") == 0 ? 0 : root_length) : "";
+		char* path = *relative ? path_join(dst, relative) : strdup(dst);
+
+		switch (ent->fts_info)
+		{
+			case FTS_D:
+				errno = 0;
+				copy_directory(ent->fts_path, path, ent->fts_statp);
+				break;
+			case FTS_DP:
+				break;
+			case FTS_F:
+			case FTS_SL:
+			case FTS_SLNONE:
+			case FTS_DEFAULT:
+				copy_entry(ent->fts_path, path, ent->fts_statp);
+				break;
+			case FTS_DC:
+				fprintf(stderr, "ditto: %s: directory cycle\n", ent->fts_path);
+				status = 1;
+				break;
+			case FTS_DNR:
+			case FTS_ERR:
+			case FTS_NS:
+				fail("read", ent->fts_path, ent->fts_errno);
+				break;
+		}
+
+		free(path);
+	}
+
+	fts_close(fts);
+	free(root);
+}
+
+static void copy_finish(void)
+{
+	pool_finish();
+
+	for (size_t i = 0; i < pending_link_count; i++)
+	{
+		unlink(pending_links[i].dst);
+		if (link(pending_links[i].target, pending_links[i].dst) < 0)
+			fail("link", pending_links[i].dst, errno);
+		free(pending_links[i].target);
+		free(pending_links[i].dst);
+	}
+	free(pending_links);
+
+	// Deepest first, so that setting a directory's times isn't undone by anything done inside it
+	for (size_t i = dir_count; i-- > 0; )
+	{
+		if (copyfile(dirs[i].src, dirs[i].dst, NULL, copy_flags()) < 0)
+			fail("copy metadata", dirs[i].src, errno);
+		finish_metadata(dirs[i].src, dirs[i].dst);
+		free(dirs[i].src);
+		free(dirs[i].dst);
+	}
+	free(dirs);
+
+	for (size_t i = 0; i < LINK_BUCKETS; i++)
+	{
+		for (struct hard_link *link = hard_links[i], *next; link; link = next)
+		{
+			next = link->next;
+			free(link->dst);
+			free(link);
+		}
+	}
+}
+
+//
+// Archives
+//
+
+static void archive_fail(struct archive* a, const char* path)
+{
+	fprintf(stderr, "ditto: %s: %s\n", path, archive_error_string(a) ? archive_error_string(a) : "archive error");
+	status = 1;
+}
+
+static bool write_entry_data(struct archive* a, struct archive_entry* entry, const char* path)
+{
+	static char buffer[ARCHIVE_BLOCK_SIZE];
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		fail("open", path, errno);
+		return false;
+	}
+
+	ssize_t length;
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+	{
+		if (archive_write_data(a, buffer, length) < 0)
+		{
+			archive_fail(a, path);
+			close(fd);
+			return false;
+		}
+	}
+	if (length < 0)
+		fail("read", path, errno);
+
+	close(fd);
+	return length == 0;
+}
+
+// CPIO and PKZip have no room for extended attributes, so (like on macOS) they travel
+// in an AppleDouble "._" file that follows the file they belong to
+static void write_apple_double(struct archive* a, struct archive_entry* entry)
+{
+	size_t size;
+	const void* metadata = archive_entry_mac_metadata(entry, &size);
+	if (!metadata || size == 0)
+		return;
+
+	char* name = strdup(archive_entry_pathname(entry));
+	char* slash = strrchr(name, '/');
+	char* apple_double_name;
+	if (slash)
+	{
+		*slash = '\0';
+		if (asprintf(&apple_double_name, "%s/._%s", name, slash + 1) < 0)
+			apple_double_name = NULL;
+	}
+	else if (asprintf(&apple_double_name, "._%s", name) < 0)
+		apple_double_name = NULL;
+	free(name);
+	if (!apple_double_name)
+		return;
+
+	struct archive_entry* apple_double = archive_entry_new();
+	archive_entry_set_pathname(apple_double, apple_double_name);
+	archive_entry_set_filetype(apple_double, AE_IFREG);
+	archive_entry_set_perm(apple_double, 0644);
+	archive_entry_set_size(apple_double, size);
+	archive_entry_set_mtime(apple_double, archive_entry_mtime(entry), 0);
+	archive_entry_set_uid(apple_double, archive_entry_uid(entry));
+	archive_entry_set_gid(apple_double, archive_entry_gid(entry));
+
+	if (archive_write_header(a, apple_double) < ARCHIVE_WARN || archive_write_data(a, metadata, size) < 0)
+		archive_fail(a, apple_double_name);
+
+	archive_entry_free(apple_double);
+	free(apple_double_name);
+}
+
+static void create_archive(const char* src, const char* dst)
+{
+	struct archive* a = archive_write_new();
+	struct archive* disk = archive_read_disk_new();
+
+	if (opts.zip)
+		archive_write_set_format_zip(a);
+	else
+		archive_write_set_format_cpio(a);
+
+	if (opts.compression == 'z')
+		archive_write_add_filter_gzip(a);
+	else if (opts.compression == 'j')
+		archive_write_add_filter_bzip2(a);
+
+	archive_write_set_bytes_per_block(a, ARCHIVE_BLOCK_SIZE);
+	if (archive_write_open_filename(a, strcmp(dst, "-") == 0 ? NULL : dst) != ARCHIVE_OK)
+	{
+		archive_fail(a, dst);
+		archive_write_free(a);
+		archive_read_free(disk);
+		return;
+	}
+
+	int behavior = 0;
+	if (opts.xdev)
+		behavior |= ARCHIVE_READDISK_NO_TRAVERSE_MOUNTS;
+	if (opts.rsrc)
+		behavior |= ARCHIVE_READDISK_MAC_COPYFILE;
+	else
+		behavior |= ARCHIVE_READDISK_NO_XATTR;
+	if (!opts.acl)
+		behavior |= ARCHIVE_READDISK_NO_ACL;
+	archive_read_disk_set_behavior(disk, behavior);
+	archive_read_disk_set_symlink_physical(disk);
+	archive_read_disk_set_standard_lookup(disk);
+
+	char* root = strip_trailing_slashes(src);
+	char* parent_name = strdup(basename(root));
+	size_t root_length = strlen(root);
+
+	if (opts.verbose)
+		fprintf(stderr, ">>> Copying %s\n", src);
+
+	if (archive_read_disk_open(disk, root) != ARCHIVE_OK)
+	{
+		archive_fail(disk, src);
+	}
+	else
+	{
+		struct archive_entry* entry = archive_entry_new();
+		int r;
+
+		while ((r = archive_read_next_header2(disk, entry)) != ARCHIVE_EOF)
+		{
+			if (r < ARCHIVE_WARN)
+			{
+				archive_fail(disk, src);
+				break;
+			}
+			if (r == ARCHIVE_WARN)
+				archive_fail(disk, archive_entry_sourcepath(entry));
+
+			archive_read_disk_descend(disk);
+
+			const char* source = archive_entry_sourcepath(entry);
+			const char* relative = source + (strcmp(root, "/") == 0 ? 1 : root_length);
+			while (*relative == '/')
+				relative++;
+
+			char* name;
+			if (opts.keep_parent)
+				name = *relative ? path_join(parent_name, relative) : strdup(parent_name);
+			else if (*relative)
+				name = strdup(relative);
+			else
+			{
+				// the source directory itself, which only exists in the archive under --keepParent
+				if (archive_entry_filetype(entry) == AE_IFDIR)
+					continue;
+				name = strdup(parent_name);
+			}
+
+			if (opts.very_verbose)
+				fprintf(stderr, "copying file %s ... %lld bytes\n", source, (long long) archive_entry_size(entry));
+
+			archive_entry_set_pathname(entry, name);
+			free(name);
+
+			if (archive_entry_filetype(entry) != AE_IFREG)
+				archive_entry_set_size(entry, 0);
+
+			r = archive_write_header(a, entry);
+			if (r < ARCHIVE_WARN)
+			{
+				archive_fail(a, source);
+				if (r == ARCHIVE_FATAL)
+					break;
+				continue;
+			}
+
+			if (archive_entry_filetype(entry) == AE_IFREG && archive_entry_size(entry) > 0)
+			{
+				if (!write_entry_data(a, entry, source))
+					continue;
+			}
+
+			if (opts.rsrc)
+				write_apple_double(a, entry);
+		}
+
+		archive_entry_free(entry);
+	}
+
+	free(parent_name);
+	free(root);
+	archive_read_close(disk);
+	archive_read_free(disk);
+
+	if (archive_write_close(a) != ARCHIVE_OK)
+		archive_fail(a, dst);
+	archive_write_free(a);
+}
+
+// The reader doesn't fold "._" entries back in like macOS does, so this unpacks
+// one onto the file before it and drops it. Returns false to keep it as a plain file.
+static bool apply_apple_double(const char* path)
+{
+	const char* slash = strrchr(path, '/');
+	const char* name = slash ? slash + 1 : path;
+	if (strncmp(name, "._", 2) != 0 || !name[2])
+		return false;
+
+	char* target = strdup(path);
+	strcpy(target + (name - path), name + 2);
+
+	struct stat st;
+	if (lstat(target, &st) < 0)
+	{
+		free(target);
+		return false;
+	}
+
+	copyfile_flags_t flags = COPYFILE_UNPACK | COPYFILE_NOFOLLOW | COPYFILE_XATTR;
+	if (opts.acl)
+		flags |= COPYFILE_ACL;
+	// anything that doesn't unpack is just a file that happens to be called ._something
+	bool unpacked = copyfile(path, target, NULL, flags) == 0;
+	if (unpacked)
+	{
+		if (!opts.qtn)
+			removexattr(target, QUARANTINE_XATTR, XATTR_NOFOLLOW);
+		unlink(path);
+	}
+
+	free(target);
+	return unpacked;
+}
+
+static void extract_archive(const char* src, const char* dst)
+{
+	struct archive* a = archive_read_new();
+	struct archive* disk = archive_write_disk_new();
+
+	if (opts.zip)
+		archive_read_support_format_zip(a);
+	else
+		archive_read_support_format_cpio(a);
+	archive_read_support_filter_all(a);
+
+	int flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_FFLAGS
+		| ARCHIVE_EXTRACT_SECURE_NODOTDOT | ARCHIVE_EXTRACT_SECURE_SYMLINKS
+		| ARCHIVE_EXTRACT_SECURE_NOABSOLUTEPATHS;
+	if (geteuid() == 0)
+		flags |= ARCHIVE_EXTRACT_OWNER;
+	if (opts.acl)
+		flags |= ARCHIVE_EXTRACT_ACL;
+	if (opts.rsrc)
+		flags |= ARCHIVE_EXTRACT_XATTR | ARCHIVE_EXTRACT_MAC_METADATA;
+	archive_write_disk_set_options(disk, flags);
+	archive_write_disk_set_standard_lookup(disk);
+
+	if (opts.verbose)
+		fprintf(stderr, ">>> Copying %s\n", src);
+
+	if (archive_read_open_filename(a, strcmp(src, "-") == 0 ? NULL : src, ARCHIVE_BLOCK_SIZE) != ARCHIVE_OK)
+	{
+		archive_fail(a, src);
+		archive_read_free(a);
+		archive_write_free(disk);
+		return;
+	}
+
+	// entries stay relative, so the secure flags only apply to what's in the archive
+	// and not to the destination the user asked for (like bsdtar -C)
+	make_parents(dst, true);
+	int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cwd < 0 || chdir(dst) < 0)
+	{
+		fail(cwd < 0 ? "open" : "chdir", cwd < 0 ? "." : dst, errno);
+		if (cwd >= 0)
+			close(cwd);
+		archive_read_free(a);
+		archive_write_free(disk);
+		return;
+	}
+
+	struct archive_entry* entry;
+	int r;
+	while ((r = archive_read_next_header(a, &entry)) != ARCHIVE_EOF)
+	{
+		if (r < ARCHIVE_WARN)
+		{
+			archive_fail(a, src);
+			break;
+		}
+
+		if (opts.very_verbose)
+		{
+			char* path = path_join(dst, archive_entry_pathname(entry));
+			fprintf(stderr, "copying file %s ... %lld bytes\n", path, (long long) archive_entry_size(entry));
+			free(path);
+		}
+
+		r = archive_write_header(disk, entry);
+		if (r < ARCHIVE_WARN)
+		{
+			archive_fail(disk, archive_entry_pathname(entry));
+			continue;
+		}
+
+		const void* buffer;
+		size_t size;
+		int64_t offset;
+		while ((r = archive_read_data_block(a, &buffer, &size, &offset)) == ARCHIVE_OK)
+		{
+			if (archive_write_data_block(disk, buffer, size, offset) < ARCHIVE_WARN)
+			{
+				archive_fail(disk, archive_entry_pathname(entry));
+				break;
+			}
+		}
+		if (r < ARCHIVE_WARN)
+			archive_fail(a, src);
+
+		if (archive_write_finish_entry(disk) < ARCHIVE_WARN)
+			archive_fail(disk, archive_entry_pathname(entry));
+
+		if (opts.rsrc && archive_entry_filetype(entry) == AE_IFREG && apply_apple_double(archive_entry_pathname(entry)))
+			continue;
+		if (!opts.qtn)
+			removexattr(archive_entry_pathname(entry), QUARANTINE_XATTR, XATTR_NOFOLLOW);
+	}
+
+	archive_read_free(a);
+	archive_write_close(disk);
+	archive_write_free(disk);
+
+	// the remaining sources may be relative to where we started
+	if (fchdir(cwd) < 0)
+	{
+		perror("fchdir");
+		exit(1);
+	}
+	close(cwd);
+}
+
+int main(int argc, char** argv)
+{
+	enum
+	{
+		OPT_RSRC = 256, OPT_NORSRC, OPT_EXTATTR, OPT_NOEXTATTR, OPT_ACL, OPT_NOACL,
+		OPT_QTN, OPT_NOQTN, OPT_KEEP_PARENT, OPT_IGNORED, OPT_ARCH,
+	};
+	static const struct option long_options[] = {
+		{ "rsrc", no_argument, NULL, OPT_RSRC },
+		{ "norsrc", no_argument, NULL, OPT_NORSRC },
+		{ "extattr", no_argument, NULL, OPT_EXTATTR },
+		{ "noextattr", no_argument, NULL, OPT_NOEXTATTR },
+		{ "acl", no_argument, NULL, OPT_ACL },
+		{ "noacl", no_argument, NULL, OPT_NOACL },
+		{ "qtn", no_argument, NULL, OPT_QTN },
+		{ "noqtn", no_argument, NULL, OPT_NOQTN },
+		{ "keepParent", no_argument, NULL, OPT_KEEP_PARENT },
+		{ "sequesterRsrc", no_argument, NULL, OPT_IGNORED },
+		{ "nocache", no_argument, NULL, OPT_IGNORED },
+		{ "hfsCompression", no_argument, NULL, OPT_IGNORED },
+		{ "nohfsCompression", no_argument, NULL, OPT_IGNORED },
+		{ "preserveHFSCompression", no_argument, NULL, OPT_IGNORED },
+		{ "nopreserveHFSCompression", no_argument, NULL, OPT_IGNORED },
+		{ "arch", required_argument, NULL, OPT_ARCH },
+		{ NULL, 0, NULL, 0 },
+	};
+	bool create = false, extract = false;
+	int opt;
+
+	// the old single-dash spellings are still in use (e.g. by xcodebuild)
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-rsrc") == 0)
+			argv[i] = "--rsrc";
+		else if (strcmp(argv[i], "-norsrc") == 0)
+			argv[i] = "--norsrc";
+	}
+
+	while ((opt = getopt_long(argc, argv, "hvVXcxzjk", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'v': opts.verbose = true; break;
+			case 'V': opts.verbose = opts.very_verbose = true; break;
+			case 'X': opts.xdev = true; break;
+			case 'c': create = true; break;
+			case 'x': extract = true; break;
+			case 'z': opts.compression = 'z'; break;
+			case 'j': opts.compression = 'j'; break;
+			case 'k': opts.zip = true; break;
+			case OPT_RSRC: opts.rsrc = true; break;
+			case OPT_NORSRC: opts.rsrc = false; break;
+			case OPT_EXTATTR: opts.extattr = true; break;
+			case OPT_NOEXTATTR: opts.extattr = false; break;
+			case OPT_ACL: opts.acl = true; break;
+			case OPT_NOACL: opts.acl = false; break;
+			case OPT_QTN: opts.qtn = true; break;
+			case OPT_NOQTN: opts.qtn = false; break;
+			case OPT_KEEP_PARENT: opts.keep_parent = true; break;
+			case OPT_IGNORED: break;
+			case OPT_ARCH:
+				fprintf(stderr, "ditto: --arch is not supported; copying all architectures\n");
+				break;
+			case 'h':
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 2 || (create && extract) || (create && argc != 2))
+	{
+		usage();
+		return 1;
+	}
+
+	const char* dst = argv[argc - 1];
+
+	if (create)
+	{
+		create_archive(argv[0], dst);
+	}
+	else if (extract)
+	{
+		for (int i = 0; i < argc - 1; i++)
+			extract_archive(argv[i], dst);
+	}
+	else
+	{
+		// several sources are all merged into the destination directory
+		if (argc > 2)
+			make_parents(dst, true);
+
+		pool_start();
+		for (int i = 0; i < argc - 1; i++)
+			copy_source(argv[i], dst);
+		copy_finish();
+	}
+
+	return status;
+}
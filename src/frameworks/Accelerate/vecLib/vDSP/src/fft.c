@@ -0,0 +1,179 @@
+/*
+ This file is part of Darling.
+
+ Copyright (C) 2026 Darling Team
+
+ Darling is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Darling is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <vDSP/vDSP.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+// enough for 2^64 in radix 4 passes, plus the odd radix 2, 3 and 5 ones
+#define FFT_MAX_STAGES 40
+#define FFT_MAX_LOG2N 30
+// below this many butterflies sharing a twiddle, passes run along the twiddles instead
+#define FFT_MIN_VECTOR_RUN 8
+
+enum dft_kind
+{
+	DFT_COMPLEX,
+	DFT_REAL,
+	DCT_II,
+	DCT_III,
+	DCT_IV,
+};
+
+// Splits n into the radices there are passes for, largest powers of two last.
+// Returns the number of passes, or -1 if n has any other prime factors.
+static int fft_factor(vDSP_Length n, unsigned radices[FFT_MAX_STAGES])
+{
+	static const unsigned order[] = { 3, 5, 4, 2 };
+	int count = 0;
+
+	if (n == 0)
+		return -1;
+
+	for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+	{
+		while (n % order[i] == 0)
+		{
+			if (count == FFT_MAX_STAGES)
+				return -1;
+			radices[count++] = order[i];
+			n /= order[i];
+		}
+	}
+
+	return n == 1 ? count : -1;
+}
+
+struct fft_scratch
+{
+	size_t size;
+	void* data;
+};
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_free(void* value)
+{
+	struct fft_scratch* scratch = value;
+	free(scratch->data);
+	free(scratch);
+}
+
+static void scratch_key_create(void)
+{
+	pthread_key_create(&scratch_key, scratch_free);
+}
+
+// Transforms need somewhere to put every other pass and to gather strided data. Setups are
+// read-only so they can be shared between threads like on macOS, which leaves this per thread.
+static void* fft_scratch(size_t size)
+{
+	pthread_once(&scratch_once, scratch_key_create);
+
+	struct fft_scratch* scratch = pthread_getspecific(scratch_key);
+	if (!scratch)
+	{
+		scratch = calloc(1, sizeof(*scratch));
+		if (!scratch)
+			return NULL;
+		pthread_setspecific(scratch_key, scratch);
+	}
+
+	if (scratch->size < size)
+	{
+		free(scratch->data);
+		scratch->size = 0;
+		if (posix_memalign(&scratch->data, 64, size) != 0)
+		{
+			scratch->data = NULL;
+			return NULL;
+		}
+		scratch->size = size;
+	}
+
+	return scratch->data;
+}
+
+#define REAL float
+#define FN(name) name##_f
+#define API(name) name
+#define SPLIT DSPSplitComplex
+#define SETUP FFTSetup
+#define SETUP_STRUCT OpaqueFFTSetup
+#define DFT_SETUP vDSP_DFT_Setup
+#define DFT_SETUP_STRUCT vDSP_DFT_SetupStruct
+#include "fft_impl.h"
+#undef REAL
+#undef FN
+#undef API
+#undef SPLIT
+#undef SETUP
+#undef SETUP_STRUCT
+#undef DFT_SETUP
+#undef DFT_SETUP_STRUCT
+
+#define REAL double
+#define FN(name) name##_d
+#define API(name) name##D
+#define SPLIT DSPDoubleSplitComplex
+#define SETUP FFTSetupD
+#define SETUP_STRUCT OpaqueFFTSetupD
+#define DFT_SETUP vDSP_DFT_SetupD
+#define DFT_SETUP_STRUCT vDSP_DFT_SetupStructD
+#include "fft_impl.h"
+#undef REAL
+#undef FN
+#undef API
+#undef SPLIT
+#undef SETUP
+#undef SETUP_STRUCT
+#undef DFT_SETUP
+#undef DFT_SETUP_STRUCT
+
+// These only come in single precision
+
+vDSP_DFT_Setup vDSP_DFT_CreateSetup(vDSP_DFT_Setup __Previous, vDSP_Length __Length)
+{
+	return dft_create_f(DFT_COMPLEX, __Length, 1);
+}
+
+void vDSP_DFT_zop(const struct vDSP_DFT_SetupStruct *__Setup, const float *__Ir, const float *__Ii, vDSP_Stride __Is, float *__Or, float *__Oi, vDSP_Stride __Os, vDSP_DFT_Direction __Direction)
+{
+	dft_execute_f(__Setup, direction_sign_f(__Direction), __Ir, __Ii, __Is, __Or, __Oi, __Os);
+}
+
+vDSP_DFT_Setup vDSP_DCT_CreateSetup(vDSP_DFT_Setup __Previous, vDSP_Length __Length, vDSP_DCT_Type __Type)
+{
+	switch (__Type)
+	{
+		case vDSP_DCT_II: return dft_create_f(DCT_II, __Length, 1);
+		case vDSP_DCT_III: return dft_create_f(DCT_III, __Length, 1);
+		case vDSP_DCT_IV: return dft_create_f(DCT_IV, __Length, 1);
+		default: return NULL;
+	}
+}
+
+void vDSP_DCT_Execute(const struct vDSP_DFT_SetupStruct *__Setup, const float *__Input, float *__Output)
+{
+	dft_execute_f(__Setup, 1, __Input, NULL, 1, __Output, NULL, 1);
+}
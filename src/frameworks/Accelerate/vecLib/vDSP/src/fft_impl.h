@@ -0,0 +1,1171 @@
+/*
+ This file is part of Darling.
+
+ Copyright (C) 2026 Darling Team
+
+ Darling is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Darling is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The FFT engine, included by fft.c once per precision with these defined:
+//   REAL              float or double
+//   FN(name)          internal name for that precision
+//   API(name)         public vDSP name for that precision
+//   SPLIT             DSPSplitComplex or DSPDoubleSplitComplex
+//   SETUP             FFTSetup or FFTSetupD
+//   SETUP_STRUCT      the struct behind SETUP
+//   DFT_SETUP         vDSP_DFT_Setup or vDSP_DFT_SetupD
+//   DFT_SETUP_STRUCT  the struct behind DFT_SETUP
+//
+// Transforms are done by a self-sorting (Stockham) mixed-radix FFT with radix 2, 3, 4 and 5
+// passes over split complex data. Each pass reads one buffer and writes the other, so no bit
+// reversal is ever needed and every pass has unit-stride inner loops the compiler can vectorize.
+// Real transforms of N elements are done as complex transforms of N/2 elements, with the usual
+// split step to separate the even and odd halves.
+
+struct FN(twiddles)
+{
+	unsigned radix;
+	vDSP_Length ls;
+	REAL* re;
+	REAL* im;
+};
+
+// Twiddles only depend on the radix of a pass and the length of the transforms it combines,
+// so all plans in a setup share them
+struct FN(twiddle_cache)
+{
+	struct FN(twiddles)* tables;
+	size_t count;
+	size_t capacity;
+};
+
+struct FN(stage)
+{
+	unsigned radix;
+	// length of the transforms this pass combines
+	vDSP_Length ls;
+	// W^(j*s) for s in [1, radix) and j in [0, ls), indexed by (s - 1) * ls + j
+	const REAL* twr;
+	const REAL* twi;
+};
+
+struct FN(plan)
+{
+	vDSP_Length n;
+	unsigned stage_count;
+	struct FN(stage) stages[FFT_MAX_STAGES];
+};
+
+struct SETUP_STRUCT
+{
+	vDSP_Length log2n;
+	// 3 or 5 for the setups used by vDSP_fft3_zop and vDSP_fft5_zop, otherwise 1
+	unsigned factor;
+	struct FN(twiddle_cache) cache;
+	// complex transforms of 2^k elements
+	struct FN(plan)* plans;
+	// complex transforms of factor * 2^k elements
+	struct FN(plan)* factor_plans;
+	// split step twiddles for real transforms of 2^k elements
+	REAL** real_re;
+	REAL** real_im;
+};
+
+struct DFT_SETUP_STRUCT
+{
+	enum dft_kind kind;
+	REAL sign;
+	vDSP_Length length;
+	struct FN(twiddle_cache) cache;
+	struct FN(plan) plan;
+	REAL* real_re;
+	REAL* real_im;
+	REAL* pre_re;
+	REAL* pre_im;
+	REAL* post_re;
+	REAL* post_im;
+};
+
+static inline REAL FN(direction_sign)(int direction)
+{
+	return direction == kFFTDirection_Inverse ? -1 : 1;
+}
+
+// Allocates a table of `count` complex values, both halves in one block that's freed through `re`
+static bool FN(table_alloc)(vDSP_Length count, REAL** re, REAL** im)
+{
+	*re = malloc(2 * count * sizeof(REAL));
+	*im = *re ? *re + count : NULL;
+	return *re != NULL;
+}
+
+// Fills a table with scale * e^(-i * pi * (mul * k + add) / div)
+static void FN(table_fill)(REAL* re, REAL* im, vDSP_Length count, double scale, double mul, double add, double div)
+{
+	for (vDSP_Length k = 0; k < count; k++)
+	{
+		const double angle = M_PI * (mul * k + add) / div;
+		re[k] = scale * cos(angle);
+		im[k] = -scale * sin(angle);
+	}
+}
+
+static const struct FN(twiddles)* FN(twiddles_get)(struct FN(twiddle_cache)* cache, unsigned radix, vDSP_Length ls)
+{
+	for (size_t i = 0; i < cache->count; i++)
+	{
+		if (cache->tables[i].radix == radix && cache->tables[i].ls == ls)
+			return &cache->tables[i];
+	}
+
+	if (cache->count == cache->capacity)
+	{
+		size_t capacity = cache->capacity ? cache->capacity * 2 : 16;
+		struct FN(twiddles)* tables = realloc(cache->tables, capacity * sizeof(*tables));
+		if (!tables)
+			return NULL;
+		cache->tables = tables;
+		cache->capacity = capacity;
+	}
+
+	struct FN(twiddles)* table = &cache->tables[cache->count];
+	const vDSP_Length length = radix * ls;
+
+	if (!FN(table_alloc)((radix - 1) * ls, &table->re, &table->im))
+		return NULL;
+
+	table->radix = radix;
+	table->ls = ls;
+
+	for (unsigned s = 1; s < radix; s++)
+	{
+		for (vDSP_Length j = 0; j < ls; j++)
+		{
+			// reduce first, so that large tables don't lose precision
+			const double angle = 2 * M_PI * ((j * s) % length) / length;
+			table->re[(s - 1) * ls + j] = cos(angle);
+			table->im[(s - 1) * ls + j] = -sin(angle);
+		}
+	}
+
+	cache->count++;
+	return table;
+}
+
+static void FN(twiddle_cache_free)(struct FN(twiddle_cache)* cache)
+{
+	for (size_t i = 0; i < cache->count; i++)
+		free(cache->tables[i].re);
+	free(cache->tables);
+}
+
+static bool FN(plan_init)(struct FN(plan)* plan, struct FN(twiddle_cache)* cache, vDSP_Length n)
+{
+	unsigned radices[FFT_MAX_STAGES];
+	const int count = fft_factor(n, radices);
+	vDSP_Length ls = 1;
+
+	if (count < 0)
+		return false;
+
+	plan->n = n;
+	plan->stage_count = count;
+
+	for (int i = 0; i < count; i++)
+	{
+		const struct FN(twiddles)* table = FN(twiddles_get)(cache, radices[i], ls);
+		if (!table)
+			return false;
+
+		plan->stages[i].radix = radices[i];
+		plan->stages[i].ls = ls;
+		plan->stages[i].twr = table->re;
+		plan->stages[i].twi = table->im;
+		ls *= radices[i];
+	}
+
+	return true;
+}
+
+// One radix `p` butterfly: twiddles the inputs, then does a p-point DFT of them
+static inline __attribute__((always_inline)) void FN(butterfly)(const unsigned p,
+	const REAL* restrict xr, const REAL* restrict xi, const vDSP_Length in_step,
+	REAL* restrict yr, REAL* restrict yi, const vDSP_Length out_step,
+	const REAL* wr, const REAL* wi, const REAL sign)
+{
+	REAL ar[5], ai[5];
+
+	ar[0] = xr[0];
+	ai[0] = xi[0];
+	for (unsigned s = 1; s < p; s++)
+	{
+		const REAL re = xr[s * in_step], im = xi[s * in_step];
+		ar[s] = re * wr[s] - im * wi[s];
+		ai[s] = re * wi[s] + im * wr[s];
+	}
+
+	// multiplying by -i * sign is what distinguishes the forward and inverse outputs below
+	switch (p)
+	{
+		case 2:
+		{
+			yr[0] = ar[0] + ar[1];
+			yi[0] = ai[0] + ai[1];
+			yr[out_step] = ar[0] - ar[1];
+			yi[out_step] = ai[0] - ai[1];
+			break;
+		}
+		case 3:
+		{
+			const REAL s3 = 0.86602540378443864676;
+			const REAL t1r = ar[1] + ar[2], t1i = ai[1] + ai[2];
+			const REAL t2r = ar[0] - 0.5 * t1r, t2i = ai[0] - 0.5 * t1i;
+			const REAL t3r = sign * s3 * (ar[1] - ar[2]), t3i = sign * s3 * (ai[1] - ai[2]);
+
+			yr[0] = ar[0] + t1r;
+			yi[0] = ai[0] + t1i;
+			yr[out_step] = t2r + t3i;
+			yi[out_step] = t2i - t3r;
+			yr[2 * out_step] = t2r - t3i;
+			yi[2 * out_step] = t2i + t3r;
+			break;
+		}
+		case 4:
+		{
+			const REAL pr = ar[0] + ar[2], pi = ai[0] + ai[2];
+			const REAL mr = ar[0] - ar[2], mi = ai[0] - ai[2];
+			const REAL qr = ar[1] + ar[3], qi = ai[1] + ai[3];
+			const REAL dr = sign * (ar[1] - ar[3]), di = sign * (ai[1] - ai[3]);
+
+			yr[0] = pr + qr;
+			yi[0] = pi + qi;
+			yr[out_step] = mr + di;
+			yi[out_step] = mi - dr;
+			yr[2 * out_step] = pr - qr;
+			yi[2 * out_step] = pi - qi;
+			yr[3 * out_step] = mr - di;
+			yi[3 * out_step] = mi + dr;
+			break;
+		}
+		case 5:
+		{
+			const REAL c1 = 0.30901699437494742410, c2 = -0.80901699437494742410;
+			const REAL s1 = 0.95105651629515357212, s2 = 0.58778525229247312917;
+			const REAL b1r = ar[1] + ar[4], b1i = ai[1] + ai[4];
+			const REAL b2r = ar[2] + ar[3], b2i = ai[2] + ai[3];
+			const REAL d1r = sign * (ar[1] - ar[4]), d1i = sign * (ai[1] - ai[4]);
+			const REAL d2r = sign * (ar[2] - ar[3]), d2i = sign * (ai[2] - ai[3]);
+			const REAL a1r = ar[0] + c1 * b1r + c2 * b2r, a1i = ai[0] + c1 * b1i + c2 * b2i;
+			const REAL a2r = ar[0] + c2 * b1r + c1 * b2r, a2i = ai[0] + c2 * b1i + c1 * b2i;
+			const REAL e1r = s1 * d1r + s2 * d2r, e1i = s1 * d1i + s2 * d2i;
+			const REAL e2r = s2 * d1r - s1 * d2r, e2i = s2 * d1i - s1 * d2i;
+
+			yr[0] = ar[0] + b1r + b2r;
+			yi[0] = ai[0] + b1i + b2i;
+			yr[out_step] = a1r + e1i;
+			yi[out_step] = a1i - e1r;
+			yr[2 * out_step] = a2r + e2i;
+			yi[2 * out_step] = a2i - e2r;
+			yr[3 * out_step] = a2r - e2i;
+			yi[3 * out_step] = a2i + e2r;
+			yr[4 * out_step] = a1r - e1i;
+			yi[4 * out_step] = a1i + e1r;
+			break;
+		}
+	}
+}
+
+// Combines `p` transforms of stage->ls elements into transforms of p * stage->ls elements.
+// There are r of them at each step: input j of sub-transform s for column k is at j * p * r + s * r + k,
+// and output j + q * ls goes to (j + q * ls) * r + k.
+static inline __attribute__((always_inline)) void FN(pass)(const unsigned p, const struct FN(stage)* stage,
+	const vDSP_Length r, const REAL sign,
+	const REAL* restrict xr, const REAL* restrict xi, REAL* restrict yr, REAL* restrict yi)
+{
+	const vDSP_Length ls = stage->ls;
+	const REAL* twr = stage->twr;
+	const REAL* twi = stage->twi;
+
+	if (r >= ls || r >= FFT_MIN_VECTOR_RUN)
+	{
+		// long runs of columns that share their twiddles
+		for (vDSP_Length j = 0; j < ls; j++)
+		{
+			REAL wr[5], wi[5];
+			for (unsigned s = 1; s < p; s++)
+			{
+				wr[s] = twr[(s - 1) * ls + j];
+				wi[s] = sign * twi[(s - 1) * ls + j];
+			}
+
+			const REAL* ar = xr + j * p * r;
+			const REAL* ai = xi + j * p * r;
+			REAL* br = yr + j * r;
+			REAL* bi = yi + j * r;
+
+			#pragma clang loop vectorize(enable)
+			for (vDSP_Length k = 0; k < r; k++)
+				FN(butterfly)(p, ar + k, ai + k, r, br + k, bi + k, ls * r, wr, wi, sign);
+		}
+	}
+	else
+	{
+		// the last passes have few columns, so go along the twiddles instead
+		for (vDSP_Length k = 0; k < r; k++)
+		{
+			#pragma clang loop vectorize(enable)
+			for (vDSP_Length j = 0; j < ls; j++)
+			{
+				REAL wr[5], wi[5];
+				for (unsigned s = 1; s < p; s++)
+				{
+					wr[s] = twr[(s - 1) * ls + j];
+					wi[s] = sign * twi[(s - 1) * ls + j];
+				}
+
+				FN(butterfly)(p, xr + j * p * r + k, xi + j * p * r + k, r,
+					yr + j * r + k, yi + j * r + k, ls * r, wr, wi, sign);
+			}
+		}
+	}
+}
+
+static void FN(pass2)(const struct FN(stage)* stage, vDSP_Length r, REAL sign,
+	const REAL* restrict xr, const REAL* restrict xi, REAL* restrict yr, REAL* restrict yi)
+{
+	FN(pass)(2, stage, r, sign, xr, xi, yr, yi);
+}
+
+static void FN(pass3)(const struct FN(stage)* stage, vDSP_Length r, REAL sign,
+	const REAL* restrict xr, const REAL* restrict xi, REAL* restrict yr, REAL* restrict yi)
+{
+	FN(pass)(3, stage, r, sign, xr, xi, yr, yi);
+}
+
+static void FN(pass4)(const struct FN(stage)* stage, vDSP_Length r, REAL sign,
+	const REAL* restrict xr, const REAL* restrict xi, REAL* restrict yr, REAL* restrict yi)
+{
+	FN(pass)(4, stage, r, sign, xr, xi, yr, yi);
+}
+
+static void FN(pass5)(const struct FN(stage)* stage, vDSP_Length r, REAL sign,
+	const REAL* restrict xr, const REAL* restrict xi, REAL* restrict yr, REAL* restrict yi)
+{
+	FN(pass)(5, stage, r, sign, xr, xi, yr, yi);
+}
+
+// Transforms contiguous data; `in` may be `out`, and `scratch` has room for plan->n complex elements
+static void FN(plan_execute)(const struct FN(plan)* plan, REAL sign,
+	const REAL* in_r, const REAL* in_i, REAL* out_r, REAL* out_i, REAL* scratch_r, REAL* scratch_i)
+{
+	const unsigned count = plan->stage_count;
+	const vDSP_Length n = plan->n;
+
+	if (count == 0)
+	{
+		if (in_r != out_r)
+		{
+			memcpy(out_r, in_r, n * sizeof(REAL));
+			memcpy(out_i, in_i, n * sizeof(REAL));
+		}
+		return;
+	}
+
+	// passes alternate between out and scratch, starting so that the last one lands in out
+	REAL* dst_r = (count % 2) ? out_r : scratch_r;
+	REAL* dst_i = (count % 2) ? out_i : scratch_i;
+	const REAL* src_r = in_r;
+	const REAL* src_i = in_i;
+
+	if (count % 2 && in_r == out_r)
+	{
+		memcpy(scratch_r, in_r, n * sizeof(REAL));
+		memcpy(scratch_i, in_i, n * sizeof(REAL));
+		src_r = scratch_r;
+		src_i = scratch_i;
+	}
+
+	vDSP_Length r = n;
+	for (unsigned i = 0; i < count; i++)
+	{
+		const struct FN(stage)* stage = &plan->stages[i];
+		r /= stage->radix;
+
+		switch (stage->radix)
+		{
+			case 2: FN(pass2)(stage, r, sign, src_r, src_i, dst_r, dst_i); break;
+			case 3: FN(pass3)(stage, r, sign, src_r, src_i, dst_r, dst_i); break;
+			case 4: FN(pass4)(stage, r, sign, src_r, src_i, dst_r, dst_i); break;
+			case 5: FN(pass5)(stage, r, sign, src_r, src_i, dst_r, dst_i); break;
+		}
+
+		src_r = dst_r;
+		src_i = dst_i;
+		dst_r = (dst_r == out_r) ? scratch_r : out_r;
+		dst_i = (dst_i == out_i) ? scratch_i : out_i;
+	}
+}
+
+static void FN(gather)(const REAL* ar, const REAL* ai, vDSP_Stride ia, REAL* cr, REAL* ci, vDSP_Length n)
+{
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 0; k < n; k++)
+	{
+		cr[k] = ar[k * ia];
+		ci[k] = ai[k * ia];
+	}
+}
+
+static void FN(scatter)(const REAL* ar, const REAL* ai, REAL* cr, REAL* ci, vDSP_Stride ic, vDSP_Length n)
+{
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 0; k < n; k++)
+	{
+		cr[k * ic] = ar[k];
+		ci[k * ic] = ai[k];
+	}
+}
+
+// Complex transform of strided data, going through contiguous copies where needed.
+// `scratch` has room for 4 * plan->n elements.
+static void FN(transform)(const struct FN(plan)* plan, REAL sign,
+	const REAL* ar, const REAL* ai, vDSP_Stride ia, REAL* cr, REAL* ci, vDSP_Stride ic, REAL* scratch)
+{
+	const vDSP_Length n = plan->n;
+	REAL* sr = scratch;
+	REAL* si = scratch + n;
+	REAL* tr = scratch + 2 * n;
+	REAL* ti = scratch + 3 * n;
+
+	if (ia != 1)
+	{
+		FN(gather)(ar, ai, ia, tr, ti, n);
+		ar = tr;
+		ai = ti;
+	}
+
+	if (ic == 1)
+	{
+		FN(plan_execute)(plan, sign, ar, ai, cr, ci, sr, si);
+	}
+	else
+	{
+		FN(plan_execute)(plan, sign, ar, ai, tr, ti, sr, si);
+		FN(scatter)(tr, ti, cr, ci, ic, n);
+	}
+}
+
+// Converts between the transform of z[k] = x[2k] + i * x[2k + 1] and the packed transform of the real x,
+// in place. The packed form has the DC term in the real part of element 0 and the Nyquist term in its
+// imaginary part, and the forward direction comes out scaled by 2 like on macOS.
+static void FN(real_split)(REAL* zr, REAL* zi, vDSP_Length m, const REAL* twr, const REAL* twi, REAL sign)
+{
+	const REAL r0 = zr[0], i0 = zi[0];
+	const REAL scale = sign > 0 ? 2 : 1;
+
+	zr[0] = scale * (r0 + i0);
+	zi[0] = scale * (r0 - i0);
+
+	// every step pairs up element k with element m - k
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 1; k < m - k; k++)
+	{
+		const REAL er = zr[k] + zr[m - k], ei = zi[k] - zi[m - k];
+		const REAL dr = zr[k] - zr[m - k], di = zi[k] + zi[m - k];
+		const REAL wr = twr[k], wi = sign * twi[k];
+		const REAL tr = sign * (dr * wr - di * wi), ti = sign * (dr * wi + di * wr);
+
+		zr[k] = er + ti;
+		zi[k] = ei - tr;
+		zr[m - k] = er - ti;
+		zi[m - k] = -ei - tr;
+	}
+
+	if (m % 2 == 0 && m > 1)
+	{
+		zr[m / 2] *= 2;
+		zi[m / 2] *= -2;
+	}
+}
+
+// Real transform of strided data, with plan->n complex elements holding twice as many reals.
+// `scratch` has room for 6 * plan->n elements.
+static void FN(real_transform)(const struct FN(plan)* plan, const REAL* twr, const REAL* twi, REAL sign,
+	const REAL* ar, const REAL* ai, vDSP_Stride ia, REAL* cr, REAL* ci, vDSP_Stride ic, REAL* scratch)
+{
+	const vDSP_Length m = plan->n;
+	REAL* tr = scratch + 4 * m;
+	REAL* ti = scratch + 5 * m;
+
+	if (sign > 0)
+	{
+		REAL* zr = (ic == 1) ? cr : tr;
+		REAL* zi = (ic == 1) ? ci : ti;
+
+		FN(transform)(plan, sign, ar, ai, ia, zr, zi, 1, scratch);
+		FN(real_split)(zr, zi, m, twr, twi, sign);
+		if (ic != 1)
+			FN(scatter)(tr, ti, cr, ci, ic, m);
+	}
+	else
+	{
+		REAL* zr = tr;
+		REAL* zi = ti;
+
+		if (ar == cr && ai == ci && ia == 1 && ic == 1)
+		{
+			zr = cr;
+			zi = ci;
+		}
+		else
+		{
+			FN(gather)(ar, ai, ia, tr, ti, m);
+		}
+
+		FN(real_split)(zr, zi, m, twr, twi, sign);
+		FN(transform)(plan, sign, zr, zi, 1, cr, ci, ic, scratch);
+	}
+}
+
+//
+// vDSP_create_fftsetup family
+//
+
+static void FN(setup_destroy)(SETUP setup)
+{
+	if (!setup)
+		return;
+
+	if (setup->real_re)
+	{
+		for (vDSP_Length k = 0; k <= setup->log2n; k++)
+			free(setup->real_re[k]);
+	}
+
+	free(setup->real_re);
+	free(setup->real_im);
+	free(setup->plans);
+	free(setup->factor_plans);
+	FN(twiddle_cache_free)(&setup->cache);
+	free(setup);
+}
+
+static SETUP FN(setup_create)(vDSP_Length log2n, FFTRadix radix)
+{
+	unsigned factor;
+
+	switch (radix)
+	{
+		case kFFTRadix2: factor = 1; break;
+		case kFFTRadix3: factor = 3; break;
+		case kFFTRadix5: factor = 5; break;
+		default: return NULL;
+	}
+
+	if (log2n > FFT_MAX_LOG2N)
+		return NULL;
+
+	SETUP setup = calloc(1, sizeof(*setup));
+	if (!setup)
+		return NULL;
+
+	setup->log2n = log2n;
+	setup->factor = factor;
+	setup->plans = calloc(log2n + 1, sizeof(*setup->plans));
+	setup->real_re = calloc(log2n + 1, sizeof(*setup->real_re));
+	setup->real_im = calloc(log2n + 1, sizeof(*setup->real_im));
+	if (factor != 1)
+		setup->factor_plans = calloc(log2n + 1, sizeof(*setup->factor_plans));
+
+	if (!setup->plans || !setup->real_re || !setup->real_im || (factor != 1 && !setup->factor_plans))
+		goto fail;
+
+	for (vDSP_Length k = 0; k <= log2n; k++)
+	{
+		const vDSP_Length n = (vDSP_Length) 1 << k;
+
+		if (!FN(plan_init)(&setup->plans[k], &setup->cache, n))
+			goto fail;
+		if (factor != 1 && !FN(plan_init)(&setup->factor_plans[k], &setup->cache, factor * n))
+			goto fail;
+
+		if (k > 0)
+		{
+			if (!FN(table_alloc)(n / 4 + 1, &setup->real_re[k], &setup->real_im[k]))
+				goto fail;
+			FN(table_fill)(setup->real_re[k], setup->real_im[k], n / 4 + 1, 1, 2, 0, n);
+		}
+	}
+
+	return setup;
+
+fail:
+	FN(setup_destroy)(setup);
+	return NULL;
+}
+
+static const struct FN(plan)* FN(setup_plan)(SETUP setup, vDSP_Length log2n, unsigned factor)
+{
+	if (!setup || log2n > setup->log2n)
+		return NULL;
+	if (factor == 1)
+		return &setup->plans[log2n];
+	if (factor != setup->factor)
+		return NULL;
+	return &setup->factor_plans[log2n];
+}
+
+static REAL* FN(setup_scratch)(vDSP_Length n)
+{
+	return fft_scratch(n * sizeof(REAL));
+}
+
+SETUP API(vDSP_create_fftsetup)(vDSP_Length __Log2n, FFTRadix __Radix)
+{
+	return FN(setup_create)(__Log2n, __Radix);
+}
+
+void API(vDSP_destroy_fftsetup)(SETUP __setup)
+{
+	FN(setup_destroy)(__setup);
+}
+
+// The *t variants take a temporary buffer, but don't say how big it is;
+// the per-thread scratch is used for all of them instead.
+
+static void FN(fftm_zop)(SETUP setup, unsigned factor, const SPLIT* a, vDSP_Stride ia, vDSP_Stride ima,
+	const SPLIT* c, vDSP_Stride ic, vDSP_Stride imc, vDSP_Length log2n, vDSP_Length count, FFTDirection direction)
+{
+	const struct FN(plan)* plan = FN(setup_plan)(setup, log2n, factor);
+	if (!plan)
+		return;
+
+	REAL* scratch = FN(setup_scratch)(4 * plan->n);
+	if (!scratch)
+		return;
+
+	for (vDSP_Length i = 0; i < count; i++)
+	{
+		FN(transform)(plan, FN(direction_sign)(direction),
+			a->realp + i * ima, a->imagp + i * ima, ia,
+			c->realp + i * imc, c->imagp + i * imc, ic, scratch);
+	}
+}
+
+static void FN(fftm_zrop)(SETUP setup, const SPLIT* a, vDSP_Stride ia, vDSP_Stride ima,
+	const SPLIT* c, vDSP_Stride ic, vDSP_Stride imc, vDSP_Length log2n, vDSP_Length count, FFTDirection direction)
+{
+	if (!setup || log2n == 0 || log2n > setup->log2n)
+		return;
+
+	const struct FN(plan)* plan = FN(setup_plan)(setup, log2n - 1, 1);
+	if (!plan)
+		return;
+
+	REAL* scratch = FN(setup_scratch)(6 * plan->n);
+	if (!scratch)
+		return;
+
+	for (vDSP_Length i = 0; i < count; i++)
+	{
+		FN(real_transform)(plan, setup->real_re[log2n], setup->real_im[log2n], FN(direction_sign)(direction),
+			a->realp + i * ima, a->imagp + i * ima, ia,
+			c->realp + i * imc, c->imagp + i * imc, ic, scratch);
+	}
+}
+
+void API(vDSP_fft_zip)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __C, __IC, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft_zipt)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, const SPLIT *__Buffer, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __C, __IC, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft_zop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __A, __IA, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft_zopt)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, const SPLIT *__C, vDSP_Stride __IC, const SPLIT *__Buffer, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __A, __IA, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft_zrip)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __C, __IC, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft_zript)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, const SPLIT *__Buffer, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __C, __IC, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft_zrop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __A, __IA, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft_zropt)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, const SPLIT *__C, vDSP_Stride __IC, const SPLIT *__Buffer, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __A, __IA, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft3_zop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 3, __A, __IA, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fft5_zop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Length __Log2N, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 5, __A, __IA, 0, __C, __IC, 0, __Log2N, 1, __Direction);
+}
+
+void API(vDSP_fftm_zip)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IM, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __C, __IC, __IM, __C, __IC, __IM, __Log2N, __M, __Direction);
+}
+
+void API(vDSP_fftm_zipt)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IM, const SPLIT *__Buffer, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __C, __IC, __IM, __C, __IC, __IM, __Log2N, __M, __Direction);
+}
+
+void API(vDSP_fftm_zop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, vDSP_Stride __IMA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IMC, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __A, __IA, __IMA, __C, __IC, __IMC, __Log2N, __M, __Direction);
+}
+
+void API(vDSP_fftm_zopt)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, vDSP_Stride __IMA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IMC, const SPLIT *__Buffer, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zop)(__Setup, 1, __A, __IA, __IMA, __C, __IC, __IMC, __Log2N, __M, __Direction);
+}
+
+void API(vDSP_fftm_zrip)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IM, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __C, __IC, __IM, __C, __IC, __IM, __Log2N, __M, __Direction);
+}
+
+void API(vDSP_fftm_zript)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IM, const SPLIT *__Buffer, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __C, __IC, __IM, __C, __IC, __IM, __Log2N, __M, __Direction);
+}
+
+void API(vDSP_fftm_zrop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, vDSP_Stride __IMA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IMC, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __A, __IA, __IMA, __C, __IC, __IMC, __Log2N, __M, __Direction);
+}
+
+void API(vDSP_fftm_zropt)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA, vDSP_Stride __IMA, const SPLIT *__C, vDSP_Stride __IC, vDSP_Stride __IMC, const SPLIT *__Buffer, vDSP_Length __Log2N, vDSP_Length __M, FFTDirection __Direction)
+{
+	FN(fftm_zrop)(__Setup, __A, __IA, __IMA, __C, __IC, __IMC, __Log2N, __M, __Direction);
+}
+
+//
+// 2D transforms
+//
+// Rows are N0 = 2^Log2N0 elements long and there are N1 = 2^Log2N1 of them.
+// A row stride of 0 means the rows are packed one after another.
+//
+
+static void FN(fft2d_zop)(SETUP setup, const SPLIT* a, vDSP_Stride ia0, vDSP_Stride ia1,
+	const SPLIT* c, vDSP_Stride ic0, vDSP_Stride ic1, vDSP_Length log2n0, vDSP_Length log2n1, FFTDirection direction)
+{
+	const struct FN(plan)* row_plan = FN(setup_plan)(setup, log2n0, 1);
+	const struct FN(plan)* column_plan = FN(setup_plan)(setup, log2n1, 1);
+	const REAL sign = FN(direction_sign)(direction);
+
+	if (!row_plan || !column_plan)
+		return;
+
+	const vDSP_Length n0 = row_plan->n, n1 = column_plan->n;
+	REAL* scratch = FN(setup_scratch)(4 * (n0 > n1 ? n0 : n1));
+	if (!scratch)
+		return;
+
+	if (ia1 == 0)
+		ia1 = ia0 * n0;
+	if (ic1 == 0)
+		ic1 = ic0 * n0;
+
+	for (vDSP_Length row = 0; row < n1; row++)
+	{
+		FN(transform)(row_plan, sign, a->realp + row * ia1, a->imagp + row * ia1, ia0,
+			c->realp + row * ic1, c->imagp + row * ic1, ic0, scratch);
+	}
+
+	for (vDSP_Length column = 0; column < n0; column++)
+	{
+		REAL* cr = c->realp + column * ic0;
+		REAL* ci = c->imagp + column * ic0;
+		FN(transform)(column_plan, sign, cr, ci, ic1, cr, ci, ic1, scratch);
+	}
+}
+
+// Real transform of a column of reals in place, treating it as interleaved complex numbers
+// (the same packing as a row), with the forward scaling of 2 taken back out so that the
+// column scales like the complex ones next to it
+static void FN(real_column)(const struct FN(plan)* plan, const REAL* twr, const REAL* twi, REAL sign,
+	REAL* x, vDSP_Stride stride, REAL* scratch)
+{
+	const vDSP_Length m = plan->n;
+	const REAL scale = sign > 0 ? 0.5 : 1;
+	REAL* zr = scratch + 6 * m;
+	REAL* zi = scratch + 7 * m;
+
+	FN(gather)(x, x + stride, 2 * stride, zr, zi, m);
+	FN(real_transform)(plan, twr, twi, sign, zr, zi, 1, zr, zi, 1, scratch);
+
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 0; k < m; k++)
+	{
+		x[2 * k * stride] = scale * zr[k];
+		x[(2 * k + 1) * stride] = scale * zi[k];
+	}
+}
+
+// Rows are real transforms packed like vDSP_fft_zrip. The first column then holds the DC terms of
+// every row in its real parts and the Nyquist terms in its imaginary parts, which are each transformed
+// as a real sequence; the other columns are ordinary complex transforms.
+static void FN(fft2d_zrop)(SETUP setup, const SPLIT* a, vDSP_Stride ia0, vDSP_Stride ia1,
+	const SPLIT* c, vDSP_Stride ic0, vDSP_Stride ic1, vDSP_Length log2n0, vDSP_Length log2n1, FFTDirection direction)
+{
+	if (!setup || log2n0 == 0 || log2n0 > setup->log2n || log2n1 > setup->log2n)
+		return;
+
+	const struct FN(plan)* row_plan = FN(setup_plan)(setup, log2n0 - 1, 1);
+	const struct FN(plan)* column_plan = FN(setup_plan)(setup, log2n1, 1);
+	const struct FN(plan)* real_column_plan = log2n1 ? FN(setup_plan)(setup, log2n1 - 1, 1) : NULL;
+	const REAL sign = FN(direction_sign)(direction);
+
+	if (!row_plan || !column_plan)
+		return;
+
+	const vDSP_Length m0 = row_plan->n, n1 = column_plan->n;
+	REAL* scratch = FN(setup_scratch)(6 * (m0 > n1 ? m0 : n1));
+	if (!scratch)
+		return;
+
+	if (ia1 == 0)
+		ia1 = ia0 * m0;
+	if (ic1 == 0)
+		ic1 = ic0 * m0;
+
+	if (sign > 0)
+	{
+		for (vDSP_Length row = 0; row < n1; row++)
+		{
+			FN(real_transform)(row_plan, setup->real_re[log2n0], setup->real_im[log2n0], sign,
+				a->realp + row * ia1, a->imagp + row * ia1, ia0,
+				c->realp + row * ic1, c->imagp + row * ic1, ic0, scratch);
+		}
+	}
+	else if (a->realp != c->realp || ia0 != ic0 || ia1 != ic1)
+	{
+		// the columns have to be done first, in the output
+		for (vDSP_Length row = 0; row < n1; row++)
+		{
+			for (vDSP_Length k = 0; k < m0; k++)
+			{
+				c->realp[row * ic1 + k * ic0] = a->realp[row * ia1 + k * ia0];
+				c->imagp[row * ic1 + k * ic0] = a->imagp[row * ia1 + k * ia0];
+			}
+		}
+	}
+
+	for (vDSP_Length column = 1; column < m0; column++)
+	{
+		REAL* cr = c->realp + column * ic0;
+		REAL* ci = c->imagp + column * ic0;
+		FN(transform)(column_plan, sign, cr, ci, ic1, cr, ci, ic1, scratch);
+	}
+
+	if (real_column_plan)
+	{
+		FN(real_column)(real_column_plan, setup->real_re[log2n1], setup->real_im[log2n1], sign, c->realp, ic1, scratch);
+		FN(real_column)(real_column_plan, setup->real_re[log2n1], setup->real_im[log2n1], sign, c->imagp, ic1, scratch);
+	}
+
+	if (sign < 0)
+	{
+		for (vDSP_Length row = 0; row < n1; row++)
+		{
+			REAL* cr = c->realp + row * ic1;
+			REAL* ci = c->imagp + row * ic1;
+			FN(real_transform)(row_plan, setup->real_re[log2n0], setup->real_im[log2n0], sign,
+				cr, ci, ic0, cr, ci, ic0, scratch);
+		}
+	}
+}
+
+void API(vDSP_fft2d_zip)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zop)(__Setup, __C, __IC0, __IC1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+void API(vDSP_fft2d_zipt)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, const SPLIT *__Buffer, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zop)(__Setup, __C, __IC0, __IC1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+void API(vDSP_fft2d_zop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA0, vDSP_Stride __IA1, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zop)(__Setup, __A, __IA0, __IA1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+void API(vDSP_fft2d_zopt)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA0, vDSP_Stride __IA1, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, const SPLIT *__Buffer, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zop)(__Setup, __A, __IA0, __IA1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+void API(vDSP_fft2d_zrip)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zrop)(__Setup, __C, __IC0, __IC1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+void API(vDSP_fft2d_zript)(SETUP __Setup, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, const SPLIT *__Buffer, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zrop)(__Setup, __C, __IC0, __IC1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+void API(vDSP_fft2d_zrop)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA0, vDSP_Stride __IA1, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zrop)(__Setup, __A, __IA0, __IA1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+void API(vDSP_fft2d_zropt)(SETUP __Setup, const SPLIT *__A, vDSP_Stride __IA0, vDSP_Stride __IA1, const SPLIT *__C, vDSP_Stride __IC0, vDSP_Stride __IC1, const SPLIT *__Buffer, vDSP_Length __Log2N0, vDSP_Length __Log2N1, FFTDirection __Direction)
+{
+	FN(fft2d_zrop)(__Setup, __A, __IA0, __IA1, __C, __IC0, __IC1, __Log2N0, __Log2N1, __Direction);
+}
+
+//
+// DFT and DCT setups
+//
+// These take any length that factors into 2, 3 and 5 (macOS only promises f * 2^n with f being
+// 1, 3, 5 or 15). The real transforms and all DCTs go through a complex transform of half the length.
+//
+
+static void FN(dft_destroy)(DFT_SETUP setup)
+{
+	if (!setup)
+		return;
+
+	FN(twiddle_cache_free)(&setup->cache);
+	free(setup->real_re);
+	free(setup->pre_re);
+	free(setup->post_re);
+	free(setup);
+}
+
+static DFT_SETUP FN(dft_create)(enum dft_kind kind, vDSP_Length length, REAL sign)
+{
+	const vDSP_Length m = length / 2;
+
+	if (length == 0 || (kind != DFT_COMPLEX && length % 2 != 0))
+		return NULL;
+
+	DFT_SETUP setup = calloc(1, sizeof(*setup));
+	if (!setup)
+		return NULL;
+
+	setup->kind = kind;
+	setup->sign = sign;
+	setup->length = length;
+
+	if (!FN(plan_init)(&setup->plan, &setup->cache, kind == DFT_COMPLEX ? length : m))
+		goto fail;
+
+	if (kind == DFT_REAL || kind == DCT_II || kind == DCT_III)
+	{
+		if (!FN(table_alloc)(m / 2 + 1, &setup->real_re, &setup->real_im))
+			goto fail;
+		FN(table_fill)(setup->real_re, setup->real_im, m / 2 + 1, 1, 2, 0, length);
+	}
+
+	switch (kind)
+	{
+		case DCT_II:
+			// 1/2 * e^(-i * pi * k / 2N), which also takes out the real transform's scaling
+			if (!FN(table_alloc)(m, &setup->post_re, &setup->post_im))
+				goto fail;
+			FN(table_fill)(setup->post_re, setup->post_im, m, 0.5, 1, 0, 2 * length);
+			break;
+		case DCT_III:
+			// 1/2 * e^(i * pi * k / 2N)
+			if (!FN(table_alloc)(m, &setup->pre_re, &setup->pre_im))
+				goto fail;
+			FN(table_fill)(setup->pre_re, setup->pre_im, m, 0.5, -1, 0, 2 * length);
+			break;
+		case DCT_IV:
+			// e^(-i * pi * (4k + 1) / 4N) before and e^(-i * pi * k / N) after
+			if (!FN(table_alloc)(m, &setup->pre_re, &setup->pre_im) || !FN(table_alloc)(m, &setup->post_re, &setup->post_im))
+				goto fail;
+			FN(table_fill)(setup->pre_re, setup->pre_im, m, 1, 4, 1, 4 * length);
+			FN(table_fill)(setup->post_re, setup->post_im, m, 1, 1, 0, length);
+			break;
+		default:
+			break;
+	}
+
+	return setup;
+
+fail:
+	FN(dft_destroy)(setup);
+	return NULL;
+}
+
+// Where element i of the DCT-II's reordered input comes from: the even elements
+// in order, followed by the odd ones backwards
+static inline vDSP_Length FN(dct2_index)(vDSP_Length i, vDSP_Length n)
+{
+	return i < n / 2 ? 2 * i : 2 * (n - 1 - i) + 1;
+}
+
+// DCT-II through a real transform of the reordered input (Makhoul's algorithm)
+static void FN(dct2)(const struct DFT_SETUP_STRUCT* setup, const REAL* x, REAL* y, REAL* scratch)
+{
+	const vDSP_Length n = setup->length, m = n / 2;
+	REAL* zr = scratch + 6 * m;
+	REAL* zi = scratch + 7 * m;
+
+	for (vDSP_Length k = 0; k < m; k++)
+	{
+		zr[k] = x[FN(dct2_index)(2 * k, n)];
+		zi[k] = x[FN(dct2_index)(2 * k + 1, n)];
+	}
+
+	FN(real_transform)(&setup->plan, setup->real_re, setup->real_im, 1, zr, zi, 1, zr, zi, 1, scratch);
+
+	y[0] = 0.5 * zr[0];
+	y[m] = 0.5 * M_SQRT1_2 * zi[0];
+
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 1; k < m; k++)
+	{
+		const REAL qr = zr[k] * setup->post_re[k] - zi[k] * setup->post_im[k];
+		const REAL qi = zr[k] * setup->post_im[k] + zi[k] * setup->post_re[k];
+		y[k] = qr;
+		y[n - k] = -qi;
+	}
+}
+
+// DCT-III by running the DCT-II steps backwards: rotate the input into the spectrum of the
+// reordered output, which is Hermitian, so an inverse real transform gets it back
+static void FN(dct3)(const struct DFT_SETUP_STRUCT* setup, const REAL* x, REAL* y, REAL* scratch)
+{
+	const vDSP_Length n = setup->length, m = n / 2;
+	REAL* zr = scratch + 6 * m;
+	REAL* zi = scratch + 7 * m;
+
+	zr[0] = 0.5 * x[0];
+	zi[0] = M_SQRT1_2 * x[m];
+
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 1; k < m; k++)
+	{
+		const REAL ar = x[k], ai = -x[n - k];
+		zr[k] = ar * setup->pre_re[k] - ai * setup->pre_im[k];
+		zi[k] = ar * setup->pre_im[k] + ai * setup->pre_re[k];
+	}
+
+	FN(real_transform)(&setup->plan, setup->real_re, setup->real_im, -1, zr, zi, 1, zr, zi, 1, scratch);
+
+	for (vDSP_Length k = 0; k < m; k++)
+	{
+		y[FN(dct2_index)(2 * k, n)] = zr[k];
+		y[FN(dct2_index)(2 * k + 1, n)] = zi[k];
+	}
+}
+
+// DCT-IV through a complex transform of half the length, twiddled on both sides
+static void FN(dct4)(const struct DFT_SETUP_STRUCT* setup, const REAL* x, REAL* y, REAL* scratch)
+{
+	const vDSP_Length n = setup->length, m = n / 2;
+	REAL* zr = scratch + 6 * m;
+	REAL* zi = scratch + 7 * m;
+
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 0; k < m; k++)
+	{
+		const REAL ar = x[2 * k], ai = x[n - 1 - 2 * k];
+		zr[k] = ar * setup->pre_re[k] - ai * setup->pre_im[k];
+		zi[k] = ar * setup->pre_im[k] + ai * setup->pre_re[k];
+	}
+
+	FN(transform)(&setup->plan, 1, zr, zi, 1, zr, zi, 1, scratch);
+
+	#pragma clang loop vectorize(enable)
+	for (vDSP_Length k = 0; k < m; k++)
+	{
+		const REAL vr = zr[k] * setup->post_re[k] - zi[k] * setup->post_im[k];
+		const REAL vi = zr[k] * setup->post_im[k] + zi[k] * setup->post_re[k];
+		y[2 * k] = vr;
+		y[n - 1 - 2 * k] = -vi;
+	}
+}
+
+// DCTs only use `ir` and `out_r`
+static void FN(dft_execute)(const struct DFT_SETUP_STRUCT* setup, REAL sign,
+	const REAL* ir, const REAL* ii, vDSP_Stride is, REAL* out_r, REAL* out_i, vDSP_Stride os)
+{
+	if (!setup)
+		return;
+
+	REAL* scratch = FN(setup_scratch)(4 * setup->length);
+	if (!scratch)
+		return;
+
+	switch (setup->kind)
+	{
+		case DFT_COMPLEX:
+			FN(transform)(&setup->plan, sign, ir, ii, is, out_r, out_i, os, scratch);
+			break;
+		case DFT_REAL:
+			FN(real_transform)(&setup->plan, setup->real_re, setup->real_im, sign, ir, ii, is, out_r, out_i, os, scratch);
+			break;
+		case DCT_II:
+			FN(dct2)(setup, ir, out_r, scratch);
+			break;
+		case DCT_III:
+			FN(dct3)(setup, ir, out_r, scratch);
+			break;
+		case DCT_IV:
+			FN(dct4)(setup, ir, out_r, scratch);
+			break;
+	}
+}
+
+DFT_SETUP API(vDSP_DFT_zop_CreateSetup)(DFT_SETUP __Previous, vDSP_Length __Length, vDSP_DFT_Direction __Direction)
+{
+	return FN(dft_create)(DFT_COMPLEX, __Length, FN(direction_sign)(__Direction));
+}
+
+DFT_SETUP API(vDSP_DFT_zrop_CreateSetup)(DFT_SETUP __Previous, vDSP_Length __Length, vDSP_DFT_Direction __Direction)
+{
+	return FN(dft_create)(DFT_REAL, __Length, FN(direction_sign)(__Direction));
+}
+
+void API(vDSP_DFT_DestroySetup)(DFT_SETUP __Setup)
+{
+	FN(dft_destroy)(__Setup);
+}
+
+void API(vDSP_DFT_Execute)(const struct DFT_SETUP_STRUCT *__Setup, const REAL *__Ir, const REAL *__Ii, REAL *__Or, REAL *__Oi)
+{
+	if (__Setup)
+		FN(dft_execute)(__Setup, __Setup->sign, __Ir, __Ii, 1, __Or, __Oi, 1);
+}
@@ -29,77 +29,101 @@ static void initme(void) {
     verbose = getenv("STUB_VERBOSE") != NULL;
 }
 
+/*
 void* vDSP_DCT_CreateSetup(void)
 {
     if (verbose) puts("STUB: vDSP_DCT_CreateSetup called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DCT_Execute(void)
 {
     if (verbose) puts("STUB: vDSP_DCT_Execute called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_CreateSetup(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_CreateSetup called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_DestroySetup(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_DestroySetup called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_DestroySetupD(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_DestroySetupD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_Execute(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_Execute called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_ExecuteD(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_ExecuteD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_zop(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_zop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_zop_CreateSetup(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_zop_CreateSetup called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_zop_CreateSetupD(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_zop_CreateSetupD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_zrop_CreateSetup(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_zrop_CreateSetup called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_DFT_zrop_CreateSetupD(void)
 {
     if (verbose) puts("STUB: vDSP_DFT_zrop_CreateSetupD called");
     return NULL;
 }
+*/
 
 void* vDSP_FFT16_copv(void)
 {
@@ -275,17 +299,21 @@ void* vDSP_convD(void)
     return NULL;
 }
 
+/*
 void* vDSP_create_fftsetup(void)
 {
     if (verbose) puts("STUB: vDSP_create_fftsetup called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_create_fftsetupD(void)
 {
     if (verbose) puts("STUB: vDSP_create_fftsetupD called");
     return NULL;
 }
+*/
 
 void* vDSP_ctoz(void)
 {
@@ -323,17 +351,21 @@ void* vDSP_desampD(void)
     return NULL;
 }
 
+/*
 void* vDSP_destroy_fftsetup(void)
 {
     if (verbose) puts("STUB: vDSP_destroy_fftsetup called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_destroy_fftsetupD(void)
 {
     if (verbose) puts("STUB: vDSP_destroy_fftsetupD called");
     return NULL;
 }
+*/
 
 void* vDSP_distancesq(void)
 {
@@ -419,317 +451,421 @@ void* vDSP_f5x5D(void)
     return NULL;
 }
 
+/*
 void* vDSP_fft2d_zip(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zip called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zipD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zipD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zipt(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zipt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_ziptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_ziptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zop(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zopD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zopD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zopt(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zopt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zoptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zoptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zrip(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zrip called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zripD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zripD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zript(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zript called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zriptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zriptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zrop(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zrop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zropD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zropD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zropt(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zropt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft2d_zroptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft2d_zroptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft3_zop(void)
 {
     if (verbose) puts("STUB: vDSP_fft3_zop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft3_zopD(void)
 {
     if (verbose) puts("STUB: vDSP_fft3_zopD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft5_zop(void)
 {
     if (verbose) puts("STUB: vDSP_fft5_zop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft5_zopD(void)
 {
     if (verbose) puts("STUB: vDSP_fft5_zopD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zip(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zip called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zipD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zipD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zipt(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zipt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_ziptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_ziptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zop(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zopD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zopD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zopt(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zopt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zoptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zoptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zrip(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zrip called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zripD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zripD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zript(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zript called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zriptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zriptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zrop(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zrop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zropD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zropD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zropt(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zropt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fft_zroptD(void)
 {
     if (verbose) puts("STUB: vDSP_fft_zroptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zip(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zip called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zipD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zipD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zipt(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zipt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_ziptD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_ziptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zop(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zopD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zopD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zopt(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zopt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zoptD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zoptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zrip(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zrip called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zripD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zripD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zript(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zript called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zriptD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zriptD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zrop(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zrop called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zropD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zropD called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zropt(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zropt called");
     return NULL;
 }
+*/
 
+/*
 void* vDSP_fftm_zroptD(void)
 {
     if (verbose) puts("STUB: vDSP_fftm_zroptD called");
     return NULL;
 }
+*/
 
 void* vDSP_hamm_window(void)
 {
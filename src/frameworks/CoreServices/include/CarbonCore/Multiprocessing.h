@@ -16,6 +16,16 @@ enum {
 typedef void* MPCriticalRegionID;
 typedef struct OpaqueMPSemaphoreID *MPSemaphoreID;
 typedef ItemCount MPSemaphoreCount;
+typedef struct OpaqueMPQueueID *MPQueueID;
+typedef struct OpaqueMPTaskID *MPTaskID;
+typedef OptionBits MPTaskOptions;
+typedef OSStatus (*TaskProc)(void* parameter);
+
+enum {
+	kMPCreateTaskTakesAllExceptionsMask = 0x00000002,
+	kMPCreateTaskNotDebuggableMask = 0x00000004,
+	kMPCreateTaskValidOptionsMask = kMPCreateTaskTakesAllExceptionsMask | kMPCreateTaskNotDebuggableMask
+};
 
 Boolean _MPIsFullyInitialized();
 OSStatus MPDelayUntil(AbsoluteTime* time);
@@ -29,6 +39,19 @@ OSStatus MPCreateSemaphore(MPSemaphoreCount maximumValue, MPSemaphoreCount initi
 OSStatus MPDeleteSemaphore(MPSemaphoreID semaphore);
 OSStatus MPSignalSemaphore(MPSemaphoreID semaphore);
 OSStatus MPWaitOnSemaphore(MPSemaphoreID semaphore, Duration timeout);
+
+OSStatus MPCreateQueue(MPQueueID* queue);
+OSStatus MPDeleteQueue(MPQueueID queue);
+OSStatus MPNotifyQueue(MPQueueID queue, void* param1, void* param2, void* param3);
+OSStatus MPWaitOnQueue(MPQueueID queue, void** param1, void** param2, void** param3, Duration timeout);
+OSStatus MPSetQueueReserve(MPQueueID queue, ItemCount count);
+
+OSStatus MPCreateTask(TaskProc entryPoint, void* parameter, ByteCount stackSize, MPQueueID notifyQueue,
+		void* terminationParameter1, void* terminationParameter2, MPTaskOptions options, MPTaskID* task);
+MPTaskID MPCurrentTaskID(void);
+void MPExitTask(OSStatus terminationStatus);
+void MPYield(void);
+Boolean MPTaskIsPreemptive(MPTaskID taskID);
 // other functions are missing...
 
 #ifdef __cplusplus
@@ -29,7 +29,87 @@ typedef UInt8* TextPtr;
 typedef const UInt8* ConstTextPtr;
 
 enum {
-	kTextEncodingUnicodeDefault = 0x100
+	kTextEncodingMacRoman = 0,
+	kTextEncodingMacJapanese = 1,
+	kTextEncodingMacChineseTrad = 2,
+	kTextEncodingMacKorean = 3,
+	kTextEncodingMacArabic = 4,
+	kTextEncodingMacHebrew = 5,
+	kTextEncodingMacGreek = 6,
+	kTextEncodingMacCyrillic = 7,
+	kTextEncodingMacDevanagari = 9,
+	kTextEncodingMacGurmukhi = 10,
+	kTextEncodingMacGujarati = 11,
+	kTextEncodingMacThai = 21,
+	kTextEncodingMacChineseSimp = 25,
+	kTextEncodingMacCentralEurRoman = 29,
+	kTextEncodingMacSymbol = 33,
+	kTextEncodingMacDingbats = 34,
+	kTextEncodingMacTurkish = 35,
+	kTextEncodingMacCroatian = 36,
+	kTextEncodingMacIcelandic = 37,
+	kTextEncodingMacRomanian = 38,
+	kTextEncodingMacCeltic = 39,
+	kTextEncodingMacGaelic = 40,
+	kTextEncodingMacFarsi = 0x8C,
+	kTextEncodingMacUkrainian = 0x98,
+	kTextEncodingMacInuit = 0xEC,
+
+	kTextEncodingUnicodeDefault = 0x100,
+	kTextEncodingUnicodeV2_0 = 0x103,
+	kTextEncodingUnicodeV3_0 = 0x104,
+
+	kTextEncodingISOLatin1 = 0x201,
+	kTextEncodingISOLatin2 = 0x202,
+	kTextEncodingISOLatin3 = 0x203,
+	kTextEncodingISOLatin4 = 0x204,
+	kTextEncodingISOLatinCyrillic = 0x205,
+	kTextEncodingISOLatinArabic = 0x206,
+	kTextEncodingISOLatinGreek = 0x207,
+	kTextEncodingISOLatinHebrew = 0x208,
+	kTextEncodingISOLatin5 = 0x209,
+	kTextEncodingISOLatin6 = 0x20A,
+	kTextEncodingISOLatin7 = 0x20D,
+	kTextEncodingISOLatin8 = 0x20E,
+	kTextEncodingISOLatin9 = 0x20F,
+	kTextEncodingISOLatin10 = 0x210,
+
+	kTextEncodingDOSLatinUS = 0x400,
+	kTextEncodingDOSGreek = 0x405,
+	kTextEncodingDOSBalticRim = 0x406,
+	kTextEncodingDOSLatin1 = 0x410,
+	kTextEncodingDOSLatin2 = 0x412,
+	kTextEncodingDOSCyrillic = 0x413,
+	kTextEncodingDOSRussian = 0x417,
+	kTextEncodingDOSThai = 0x41D,
+	kTextEncodingDOSJapanese = 0x420,
+	kTextEncodingDOSChineseSimplif = 0x421,
+	kTextEncodingDOSKorean = 0x422,
+	kTextEncodingDOSChineseTrad = 0x423,
+
+	kTextEncodingWindowsLatin1 = 0x500,
+	kTextEncodingWindowsLatin2 = 0x501,
+	kTextEncodingWindowsCyrillic = 0x502,
+	kTextEncodingWindowsGreek = 0x503,
+	kTextEncodingWindowsLatin5 = 0x504,
+	kTextEncodingWindowsHebrew = 0x505,
+	kTextEncodingWindowsArabic = 0x506,
+	kTextEncodingWindowsBalticRim = 0x507,
+	kTextEncodingWindowsVietnamese = 0x508,
+
+	kTextEncodingUS_ASCII = 0x600,
+	kTextEncodingGB_18030_2000 = 0x632,
+	kTextEncodingISO_2022_JP = 0x820,
+	kTextEncodingEUC_JP = 0x920,
+	kTextEncodingEUC_CN = 0x930,
+	kTextEncodingEUC_KR = 0x940,
+	kTextEncodingShiftJIS = 0xA01,
+	kTextEncodingKOI8_R = 0xA02,
+	kTextEncodingBig5 = 0xA03,
+	kTextEncodingKOI8_U = 0xA06,
+
+	kTextEncodingMultiRun = 0xFFF,
+	kTextEncodingUnknown = 0xFFFF
 };
 
 enum {
@@ -66,6 +146,9 @@ typedef UInt32 TextEncodingFormat;
 typedef UInt32 TextEncodingVariant;
 
 TextEncoding CreateTextEncoding(TextEncodingBase encodingBase, TextEncodingVariant encodingVariant, TextEncodingFormat encodingFormat);
+TextEncodingBase GetTextEncodingBase(TextEncoding encoding);
+TextEncodingVariant GetTextEncodingVariant(TextEncoding encoding);
+TextEncodingFormat GetTextEncodingFormat(TextEncoding encoding);
 
 #ifdef __cplusplus
 }
@@ -54,6 +54,10 @@ OSStatus UCCompareTextDefault(uint32_t options, const UniChar* text1, unsigned l
 
 OSStatus UCCompareTextNoLocale(uint32_t options, const UniChar* text1, unsigned long text1len, const UniChar* text2, unsigned long text2len, Boolean* equiv, int32_t* order);
 
+// Darling extension: sorts count strings by collation order, storing the resulting
+// permutation in outOrder. Each string's collation key is only generated once.
+OSStatus _UCSortText(CollatorRef collator, ItemCount count, const UniChar* const texts[], const unsigned long textlens[], ItemCount outOrder[]);
+
 typedef UInt16 UCKeyOutput;
 
 enum {
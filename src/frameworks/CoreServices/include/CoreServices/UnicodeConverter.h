@@ -11,6 +11,43 @@ extern "C" {
 
 typedef SInt32 UnicodeMapVersion;
 
+enum {
+    kUnicodeUseLatestMapping = -1,
+    kUnicodeUseHFSPlusMapping = 4
+};
+
+enum {
+    kUnicodeUseFallbacksBit = 0,
+    kUnicodeKeepInfoBit = 1,
+    kUnicodeDirectionalityBits = 2,
+    kUnicodeVerticalFormBit = 4,
+    kUnicodeLooseMappingsBit = 5,
+    kUnicodeStringUnterminatedBit = 6,
+    kUnicodeTextRunBit = 7,
+    kUnicodeKeepSameEncodingBit = 8,
+    kUnicodeForceASCIIRangeBit = 9,
+    kUnicodeNoHalfwidthCharsBit = 10,
+    kUnicodeTextRunHeuristicsBit = 11,
+    kUnicodeMapLineFeedToReturnBit = 12,
+    kUnicodeUseExternalEncodingFormBit = 13
+};
+
+enum {
+    kUnicodeUseFallbacksMask = 1L << kUnicodeUseFallbacksBit,
+    kUnicodeKeepInfoMask = 1L << kUnicodeKeepInfoBit,
+    kUnicodeDirectionalityMask = 3L << kUnicodeDirectionalityBits,
+    kUnicodeVerticalFormMask = 1L << kUnicodeVerticalFormBit,
+    kUnicodeLooseMappingsMask = 1L << kUnicodeLooseMappingsBit,
+    kUnicodeStringUnterminatedMask = 1L << kUnicodeStringUnterminatedBit,
+    kUnicodeTextRunMask = 1L << kUnicodeTextRunBit,
+    kUnicodeKeepSameEncodingMask = 1L << kUnicodeKeepSameEncodingBit,
+    kUnicodeForceASCIIRangeMask = 1L << kUnicodeForceASCIIRangeBit,
+    kUnicodeNoHalfwidthCharsMask = 1L << kUnicodeNoHalfwidthCharsBit,
+    kUnicodeTextRunHeuristicsMask = 1L << kUnicodeTextRunHeuristicsBit,
+    kUnicodeMapLineFeedToReturnMask = 1L << kUnicodeMapLineFeedToReturnBit,
+    kUnicodeUseExternalEncodingFormMask = 1L << kUnicodeUseExternalEncodingFormBit
+};
+
 struct UnicodeMapping {
     TextEncoding        unicodeEncoding;
     TextEncoding        otherEncoding;
@@ -28,8 +65,8 @@ typedef struct UnicodeMapping              UnicodeMapping;
 typedef UnicodeMapping*                    UnicodeMappingPtr;
 typedef const UnicodeMapping*              ConstUnicodeMappingPtr;
 
-extern OSStatus CreateUnicodeToTextInfo(ConstUnicodeMappingPtr iUnicodeMapping, UnicodeToTextInfo *oUnicodeToTextInfo);
-extern OSStatus CreateUnicodeToTextInfoByEncoding(TextEncoding iEncoding, UnicodeToTextInfo *oUnicodeToTextInfo);
+extern OSStatus CreateTextToUnicodeInfo(ConstUnicodeMappingPtr iUnicodeMapping, TextToUnicodeInfo *oTextToUnicodeInfo);
+extern OSStatus CreateTextToUnicodeInfoByEncoding(TextEncoding iEncoding, TextToUnicodeInfo *oTextToUnicodeInfo);
 extern OSStatus CreateUnicodeToTextInfo(ConstUnicodeMappingPtr iUnicodeMapping, UnicodeToTextInfo *oUnicodeToTextInfo);
 extern OSStatus CreateUnicodeToTextInfoByEncoding(TextEncoding iEncoding, UnicodeToTextInfo *oUnicodeToTextInfo);
 
@@ -20,14 +20,71 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <CarbonCore/Multiprocessing.h>
 #include <unistd.h>
 #include <ctime>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <CarbonCore/MacErrors.h>
 
-static int verbose = 0;
-__attribute__((constructor)) static void initme(void) {
-    verbose = getenv("STUB_VERBOSE") != NULL;
+// Private libsystem_kernel interface (see xnu's sys/ulock.h).
+// Under Darling, these are backed directly by Linux futexes.
+extern "C" int __ulock_wait(uint32_t operation, void* addr, uint64_t value, uint32_t timeout_us);
+extern "C" int __ulock_wake(uint32_t operation, void* addr, uint64_t wake_value);
+
+#define UL_COMPARE_AND_WAIT	1
+#define ULF_WAKE_ALL		0x00000100
+#define ULF_NO_ERRNO		0x01000000
+
+typedef std::chrono::steady_clock MPClock;
+
+// A deadline of time_point::max() means "wait forever".
+static MPClock::time_point DeadlineForDuration(Duration timeout)
+{
+	if (timeout == kDurationForever)
+		return MPClock::time_point::max();
+
+	if (timeout >= 0)
+		return MPClock::now() + std::chrono::milliseconds(timeout);
+	else
+		return MPClock::now() + std::chrono::microseconds(-int64_t(timeout));
+}
+
+// Blocks while *word == expected, until woken or until the deadline passes.
+// Returns false only if the deadline has passed; spurious wakeups return true
+// and callers are expected to re-check their condition.
+static bool FutexWait(std::atomic<uint32_t>* word, uint32_t expected, MPClock::time_point deadline)
+{
+	uint32_t timeout_us = 0; // 0 means no timeout for __ulock_wait
+
+	if (deadline != MPClock::time_point::max())
+	{
+		auto now = MPClock::now();
+		if (now >= deadline)
+			return false;
+
+		auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+		if (remaining < 1)
+			remaining = 1;
+		timeout_us = remaining > UINT32_MAX ? UINT32_MAX : uint32_t(remaining);
+	}
+
+	int rv = __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, word, expected, timeout_us);
+	if (rv == -ETIMEDOUT)
+		return MPClock::now() < deadline; // the timeout may have been clamped
+
+	return true;
+}
+
+static void FutexWake(std::atomic<uint32_t>* word, bool all)
+{
+	__ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO | (all ? ULF_WAKE_ALL : 0), word, 0);
 }
 
 Boolean _MPIsFullyInitialized()
@@ -47,96 +104,424 @@ unsigned long MPProcessors()
 	return sysconf(_SC_NPROCESSORS_ONLN);
 }
 
+// Recursive lock. state is 0 when unlocked, 1 when locked and 2 when locked
+// with (potential) waiters sleeping on the futex.
+struct MPCriticalRegion
+{
+	std::atomic<uint32_t> state { 0 };
+	std::atomic<pthread_t> owner { pthread_t() };
+	uint32_t recursion = 0;
+};
+
 OSStatus MPCreateCriticalRegion(MPCriticalRegionID* criticalRegion)
 {
-	pthread_mutex_t* pp = new pthread_mutex_t;
-	pthread_mutexattr_t attr;
+	if (!criticalRegion)
+		return paramErr;
 
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-	*criticalRegion = pp;
-	
-	pthread_mutex_init(pp, &attr);
+	*criticalRegion = new MPCriticalRegion;
 	return noErr;
 }
 
 OSStatus MPDeleteCriticalRegion(MPCriticalRegionID criticalRegion)
 {
-	pthread_mutex_t* pp = (pthread_mutex_t*) criticalRegion;
+	MPCriticalRegion* region = (MPCriticalRegion*) criticalRegion;
 	
-	if (pp != nullptr)
-	{
-		pthread_mutex_destroy(pp);
-		delete pp;
-	}
+	if (region != nullptr)
+		delete region;
 	
 	return noErr;
 }
 
 OSStatus MPEnterCriticalRegion(MPCriticalRegionID criticalRegion, Duration timeout)
 {
-	pthread_mutex_t* pp = (pthread_mutex_t*) criticalRegion;
+	MPCriticalRegion* region = (MPCriticalRegion*) criticalRegion;
+	pthread_t self = pthread_self();
 	
-	if (!pp)
+	if (!region)
 		return paramErr;
-	
-	if (timeout == kDurationForever)
+
+	if (region->owner.load(std::memory_order_relaxed) == self)
 	{
-		pthread_mutex_lock(pp);
+		region->recursion++;
 		return noErr;
 	}
-	else
+
+	uint32_t c = 0;
+	if (!region->state.compare_exchange_strong(c, 1, std::memory_order_acquire))
 	{
-		do
+		if (timeout == kDurationImmediate)
+			return kMPTimeoutErr;
+
+		MPClock::time_point deadline = DeadlineForDuration(timeout);
+
+		while (region->state.exchange(2, std::memory_order_acquire) != 0)
 		{
-			if (pthread_mutex_trylock(pp) == 0)
-				return noErr;
-			
-			if (timeout > 0)
-			{
-				usleep(10*1000);
-				timeout -= 10;
-			}
+			if (!FutexWait(&region->state, 2, deadline))
+				return kMPTimeoutErr;
 		}
-		while (timeout > 0);
-		
-		return kMPTimeoutErr;
 	}
+
+	region->owner.store(self, std::memory_order_relaxed);
+	return noErr;
 }
 
 OSStatus MPExitCriticalRegion(MPCriticalRegionID criticalRegion)
 {
-	pthread_mutex_t* pp = (pthread_mutex_t*) criticalRegion;
+	MPCriticalRegion* region = (MPCriticalRegion*) criticalRegion;
 	
-	if (pp != nullptr)
+	if (region == nullptr)
+		return paramErr;
+
+	if (region->owner.load(std::memory_order_relaxed) != pthread_self())
+		return kMPInsufficientResourcesErr;
+
+	if (region->recursion > 0)
 	{
-		pthread_mutex_unlock(pp);
+		region->recursion--;
 		return noErr;
 	}
-	else
-		return paramErr;
+
+	region->owner.store(pthread_t(), std::memory_order_relaxed);
+	if (region->state.exchange(0, std::memory_order_release) == 2)
+		FutexWake(&region->state, false);
+
+	return noErr;
+}
+
+// Set in value once the semaphore has been deleted, so that sleeping waiters
+// fail their futex compare and see it.
+#define MP_SEMAPHORE_DELETED	0x80000000u
+
+// Objects stay allocated until their creator has deleted them and every thread
+// blocked on them has left; references counts both.
+struct OpaqueMPSemaphoreID
+{
+	std::atomic<uint32_t> value;
+	std::atomic<uint32_t> waiters { 0 };
+	std::atomic<uint32_t> references { 1 };
+	uint32_t maximum;
+};
+
+template <typename T>
+static void MPRelease(T* object)
+{
+	if (object->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete object;
+}
+
+static void MPMarkSemaphoreDeleted(MPSemaphoreID semaphore)
+{
+	semaphore->value.fetch_or(MP_SEMAPHORE_DELETED);
+	if (semaphore->waiters.load() != 0)
+		FutexWake(&semaphore->value, true);
 }
 
 OSStatus MPCreateSemaphore(MPSemaphoreCount maximumValue, MPSemaphoreCount initialValue, MPSemaphoreID *semaphore)
 {
-    if (verbose) puts("STUB: MPCreateSemaphore called");
-    return noErr;
+	if (!semaphore || initialValue > maximumValue)
+		return paramErr;
+
+	if (maximumValue > MP_SEMAPHORE_DELETED - 1)
+		maximumValue = MP_SEMAPHORE_DELETED - 1;
+	if (initialValue > maximumValue)
+		initialValue = maximumValue;
+
+	MPSemaphoreID sem = new OpaqueMPSemaphoreID;
+	sem->value.store(uint32_t(initialValue), std::memory_order_relaxed);
+	sem->maximum = uint32_t(maximumValue);
+
+	*semaphore = sem;
+	return noErr;
 }
 
 OSStatus MPDeleteSemaphore(MPSemaphoreID semaphore)
 {
-    if (verbose) puts("STUB: MPDeleteSemaphore called");
-    return noErr;
+	if (!semaphore)
+		return kMPInvalidIDErr;
+
+	MPMarkSemaphoreDeleted(semaphore);
+	MPRelease(semaphore);
+	return noErr;
 }
 
 OSStatus MPSignalSemaphore(MPSemaphoreID semaphore)
 {
-    if (verbose) puts("STUB: MPSignalSemaphore called");
-    return noErr;
+	if (!semaphore)
+		return kMPInvalidIDErr;
+
+	uint32_t v = semaphore->value.load(std::memory_order_relaxed);
+	do
+	{
+		if (v & MP_SEMAPHORE_DELETED)
+			return kMPDeletedErr;
+		if (v >= semaphore->maximum)
+			return kMPInsufficientResourcesErr;
+	}
+	while (!semaphore->value.compare_exchange_weak(v, v + 1, std::memory_order_release));
+
+	if (semaphore->waiters.load() != 0)
+		FutexWake(&semaphore->value, false);
+
+	return noErr;
+}
+
+static bool MPTryWaitOnSemaphore(MPSemaphoreID semaphore)
+{
+	uint32_t v = semaphore->value.load(std::memory_order_relaxed);
+
+	while (v != 0 && !(v & MP_SEMAPHORE_DELETED))
+	{
+		if (semaphore->value.compare_exchange_weak(v, v - 1, std::memory_order_acquire))
+			return true;
+	}
+	return false;
+}
+
+// The caller must hold a reference on whatever object semaphore lives in.
+static OSStatus MPWaitOnSemaphoreReferenced(MPSemaphoreID semaphore, Duration timeout)
+{
+	if (MPTryWaitOnSemaphore(semaphore))
+		return noErr;
+	if (semaphore->value.load() & MP_SEMAPHORE_DELETED)
+		return kMPDeletedErr;
+	if (timeout == kDurationImmediate)
+		return kMPTimeoutErr;
+
+	MPClock::time_point deadline = DeadlineForDuration(timeout);
+	OSStatus status = noErr;
+
+	semaphore->waiters.fetch_add(1);
+	while (!MPTryWaitOnSemaphore(semaphore))
+	{
+		if (semaphore->value.load() & MP_SEMAPHORE_DELETED)
+		{
+			status = kMPDeletedErr;
+			break;
+		}
+		if (!FutexWait(&semaphore->value, 0, deadline))
+		{
+			status = kMPTimeoutErr;
+			break;
+		}
+	}
+	semaphore->waiters.fetch_sub(1);
+
+	return status;
 }
 
 OSStatus MPWaitOnSemaphore(MPSemaphoreID semaphore, Duration timeout)
 {
-    if (verbose) puts("STUB: MPWaitOnSemaphore called");
-    return noErr;
-}
\ No newline at end of file
+	if (!semaphore)
+		return kMPInvalidIDErr;
+
+	semaphore->references.fetch_add(1, std::memory_order_relaxed);
+	OSStatus status = MPWaitOnSemaphoreReferenced(semaphore, timeout);
+	MPRelease(semaphore);
+
+	return status;
+}
+
+struct MPQueueMessage
+{
+	void* param1;
+	void* param2;
+	void* param3;
+};
+
+struct OpaqueMPQueueID
+{
+	std::mutex lock;
+	std::deque<MPQueueMessage> messages;
+	OpaqueMPSemaphoreID available;
+	std::atomic<uint32_t> references { 1 };
+};
+
+OSStatus MPCreateQueue(MPQueueID* queue)
+{
+	if (!queue)
+		return paramErr;
+
+	MPQueueID q = new OpaqueMPQueueID;
+	q->available.value.store(0, std::memory_order_relaxed);
+	q->available.maximum = MP_SEMAPHORE_DELETED - 1;
+
+	*queue = q;
+	return noErr;
+}
+
+OSStatus MPDeleteQueue(MPQueueID queue)
+{
+	if (!queue)
+		return kMPInvalidIDErr;
+
+	MPMarkSemaphoreDeleted(&queue->available);
+	MPRelease(queue);
+	return noErr;
+}
+
+OSStatus MPNotifyQueue(MPQueueID queue, void* param1, void* param2, void* param3)
+{
+	if (!queue)
+		return kMPInvalidIDErr;
+	if (queue->available.value.load(std::memory_order_relaxed) & MP_SEMAPHORE_DELETED)
+		return kMPDeletedErr;
+
+	{
+		std::lock_guard<std::mutex> guard(queue->lock);
+		queue->messages.push_back(MPQueueMessage { param1, param2, param3 });
+	}
+
+	return MPSignalSemaphore(&queue->available);
+}
+
+OSStatus MPWaitOnQueue(MPQueueID queue, void** param1, void** param2, void** param3, Duration timeout)
+{
+	if (!queue)
+		return kMPInvalidIDErr;
+
+	queue->references.fetch_add(1, std::memory_order_relaxed);
+
+	OSStatus status = MPWaitOnSemaphoreReferenced(&queue->available, timeout);
+	if (status != noErr)
+	{
+		MPRelease(queue);
+		return status;
+	}
+
+	MPQueueMessage msg;
+	{
+		std::lock_guard<std::mutex> guard(queue->lock);
+		msg = queue->messages.front();
+		queue->messages.pop_front();
+	}
+	MPRelease(queue);
+
+	if (param1)
+		*param1 = msg.param1;
+	if (param2)
+		*param2 = msg.param2;
+	if (param3)
+		*param3 = msg.param3;
+
+	return noErr;
+}
+
+OSStatus MPSetQueueReserve(MPQueueID queue, ItemCount count)
+{
+	// Notifications are never dropped, so there is nothing to reserve.
+	if (!queue)
+		return kMPInvalidIDErr;
+	return noErr;
+}
+
+// The task's thread and MPCreateTask each hold a reference, so a task that
+// finishes straight away can't free the ID before its thread handle is stored.
+struct OpaqueMPTaskID
+{
+	std::atomic<uint32_t> references { 2 };
+	pthread_t thread;
+	TaskProc entryPoint;
+	void* parameter;
+	MPQueueID notifyQueue;
+	void* terminationParameter1;
+	void* terminationParameter2;
+};
+
+static thread_local MPTaskID currentTask = nullptr;
+static thread_local OpaqueMPTaskID foreignTask;
+
+static void MPTaskTerminated(MPTaskID task, OSStatus terminationStatus)
+{
+	if (task->notifyQueue)
+	{
+		MPNotifyQueue(task->notifyQueue, task->terminationParameter1, task->terminationParameter2,
+				(void*)(intptr_t) terminationStatus);
+	}
+	currentTask = nullptr;
+	MPRelease(task);
+}
+
+static void* MPTaskEntry(void* arg)
+{
+	MPTaskID task = (MPTaskID) arg;
+
+	currentTask = task;
+	MPTaskTerminated(task, task->entryPoint(task->parameter));
+
+	return nullptr;
+}
+
+OSStatus MPCreateTask(TaskProc entryPoint, void* parameter, ByteCount stackSize, MPQueueID notifyQueue,
+		void* terminationParameter1, void* terminationParameter2, MPTaskOptions options, MPTaskID* task)
+{
+	if (!entryPoint || !task || (options & ~kMPCreateTaskValidOptionsMask))
+		return paramErr;
+
+	MPTaskID t = new OpaqueMPTaskID;
+	t->entryPoint = entryPoint;
+	t->parameter = parameter;
+	t->notifyQueue = notifyQueue;
+	t->terminationParameter1 = terminationParameter1;
+	t->terminationParameter2 = terminationParameter2;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if (stackSize != 0)
+	{
+		long pageSize = sysconf(_SC_PAGESIZE);
+
+		if (stackSize < PTHREAD_STACK_MIN)
+			stackSize = PTHREAD_STACK_MIN;
+		stackSize = (stackSize + pageSize - 1) & ~(pageSize - 1);
+		pthread_attr_setstacksize(&attr, stackSize);
+	}
+
+	// The task may run (and finish) before pthread_create returns,
+	// so the ID is handed out before the thread exists.
+	*task = t;
+
+	pthread_t thread;
+	int err = pthread_create(&thread, &attr, MPTaskEntry, t);
+	pthread_attr_destroy(&attr);
+
+	if (err != 0)
+	{
+		delete t;
+		*task = nullptr;
+		return kMPInsufficientResourcesErr;
+	}
+
+	t->thread = thread;
+	MPRelease(t);
+	return noErr;
+}
+
+MPTaskID MPCurrentTaskID(void)
+{
+	if (currentTask != nullptr)
+		return currentTask;
+
+	foreignTask.thread = pthread_self();
+	return &foreignTask;
+}
+
+void MPExitTask(OSStatus terminationStatus)
+{
+	if (currentTask == nullptr)
+		return; // Not an MP task
+
+	MPTaskTerminated(currentTask, terminationStatus);
+	pthread_exit(nullptr);
+}
+
+void MPYield(void)
+{
+	sched_yield();
+}
+
+Boolean MPTaskIsPreemptive(MPTaskID taskID)
+{
+	return true;
+}
@@ -19,13 +19,31 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <CarbonCore/TextCommon.h>
 
+// Bits 0-15 hold the base, bits 16-25 the variant and bits 26-31 the format,
+// matching the layout Apple's constants (and CFStringEncodings) use.
+
 TextEncoding CreateTextEncoding(TextEncodingBase encodingBase, TextEncodingVariant encodingVariant, TextEncodingFormat encodingFormat)
 {
-	TextEncoding rv = encodingBase & 0xff;
-	rv |= (encodingVariant << 8) & 0xff00;
-	rv |= (encodingFormat << 16) & 0xff0000;
+	TextEncoding rv = encodingBase & 0xffff;
+	rv |= (encodingVariant << 16) & 0x3ff0000;
+	rv |= (encodingFormat << 26) & 0xfc000000;
 	return rv;
 }
 
+TextEncodingBase GetTextEncodingBase(TextEncoding encoding)
+{
+	return encoding & 0xffff;
+}
+
+TextEncodingVariant GetTextEncodingVariant(TextEncoding encoding)
+{
+	return (encoding >> 16) & 0x3ff;
+}
+
+TextEncodingFormat GetTextEncodingFormat(TextEncoding encoding)
+{
+	return (encoding >> 26) & 0x3f;
+}
+
 
 
@@ -21,100 +21,96 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <unicode/ucnv.h>
 #include <unicode/normalizer2.h>
 #include <CarbonCore/MacErrors.h>
+#include <memory>
+#include "TextEncodingTables.h"
 
 struct OpaqueTECObjectRef
 {
 	UConverter* inputConverter;
 	UConverter* outputConverter;
 	const UNormalizer2* normalizer;
-	UChar buffer[64];
-	size_t bufferUsed;
+	// Set when converting between two single-byte encodings: input byte -> output byte
+	std::unique_ptr<uint8_t[]> byteMap;
+	// ICU's pivot buffer for ucnv_convertEx(). It's kept across calls,
+	// so that data converted into it but not yet written out isn't lost.
+	UChar pivot[1024];
+	UChar* pivotSource;
+	UChar* pivotTarget;
 };
 
-static UConverter* createConverter(TextEncodingBase base, TextEncodingFormat format)
+// Direct byte-to-byte mapping for a pair of single-byte encodings.
+// Returns nullptr if some character would need more than a single lookup.
+static uint8_t* createByteMap(TextEncoding inputEncoding, TextEncoding outputEncoding, UConverter* outputConverter)
 {
-	switch (base)
+	const TextEncodingTable* in = TextEncodingTable::get(GetTextEncodingBase(inputEncoding));
+	const TextEncodingTable* out = TextEncodingTable::get(GetTextEncodingBase(outputEncoding));
+
+	if (!in || !out || in->isDoubleByte() || out->isDoubleByte())
+		return nullptr;
+
+	// Unmapped characters get the same substitution ICU would use
+	char subst[4];
+	int8_t substLength = sizeof(subst);
+	UErrorCode error = U_ZERO_ERROR;
+
+	ucnv_getSubstChars(outputConverter, subst, &substLength, &error);
+	if (U_FAILURE(error) || substLength != 1)
+		return nullptr;
+
+	std::unique_ptr<uint8_t[]> map(new uint8_t[256]);
+	for (int b = 0; b < 256; b++)
 	{
-		case kTextEncodingUnicodeDefault:
+		uint8_t byte = b;
+		UniChar ch;
+		size_t read, written;
+		TextEncodingTable::Status status = in->toUnicode(&byte, 1, &ch, 1, &read, &written);
+
+		if (status == TextEncodingTable::Complex)
+			return nullptr;
+		if (status != TextEncodingTable::Done)
 		{
-			const char* enc;
-			UErrorCode error = U_ZERO_ERROR;
+			map[b] = subst[0];
+			continue;
+		}
 
-			switch (format)
-			{
-				case kUnicodeUTF16Format:
-					enc = "UTF-16";
-					break;
-				case kUnicodeUTF7Format:
-					enc = "UTF-7";
-					break;
-			   	case kUnicodeUTF8Format:
-					enc = "UTF-8";
-					break;
-			   	case kUnicodeUTF32Format:
-					enc = "UTF-32";
-					break;
-				case kUnicodeUTF16BEFormat:
-					enc = "UTF-16BE";
-					break;
-			  	case kUnicodeUTF16LEFormat:
-					enc = "UTF-16LE";
-					break;
-				case kUnicodeUTF32BEFormat:
-					enc = "UTF-32BE";
-					break;
-				case kUnicodeUTF32LEFormat:
-					enc = "UTF-32LE";
-					break;
-				default:
-					return NULL;
-			}
+		uint8_t bytes[2];
+		status = out->fromUnicode(&ch, 1, bytes, sizeof(bytes), &read, &written);
 
-			return ucnv_open(enc, &error);
-		}
-		default:
-			return NULL;
+		if (status == TextEncodingTable::Complex)
+			return nullptr;
+		map[b] = (status == TextEncodingTable::Done) ? bytes[0] : subst[0];
 	}
+
+	return map.release();
 }
 
 OSStatus TECCreateConverter(TECObjectRef *newEncodingConverter, TextEncoding inputEncoding, TextEncoding outputEncoding)
 {
-	TextEncodingFormat format;
-	TextEncodingBase base;
-	TextEncodingVariant variant;
 	OpaqueTECObjectRef* obj = new OpaqueTECObjectRef;
 
 	obj->inputConverter = obj->outputConverter = NULL;
 	obj->normalizer = NULL;
-	obj->bufferUsed = 0;
+	obj->pivotSource = obj->pivotTarget = obj->pivot;
 
-	format = (inputEncoding >> 16) & 0xff;
-	base = (inputEncoding >> 0) & 0xff;
-	variant = (inputEncoding >> 8) & 0xff;
-
-	obj->inputConverter = createConverter(base, format);
+	obj->inputConverter = TextEncodingTable::openConverter(inputEncoding);
 	if (!obj->inputConverter)
 	{
 		TECDisposeConverter(obj);
 		*newEncodingConverter = NULL;
-		return unimpErr;
+		return kTECNoConversionPathErr;
 	}
 
-	format = (outputEncoding >> 16) & 0xff;
-	base = (outputEncoding >> 0) & 0xff;
-	variant = (outputEncoding >> 8) & 0xff;
-
-	obj->outputConverter = createConverter(base, format);
+	obj->outputConverter = TextEncodingTable::openConverter(outputEncoding);
 	if (!obj->outputConverter)
 	{
 		TECDisposeConverter(obj);
 		*newEncodingConverter = NULL;
-		return unimpErr;
+		return kTECNoConversionPathErr;
 	}
 
-	if (base == kTextEncodingUnicodeDefault)
+	if ((GetTextEncodingBase(outputEncoding) & 0xff00) == kTextEncodingUnicodeDefault)
 	{
-		switch (variant)
+		switch (GetTextEncodingVariant(outputEncoding))
 		{
 			case kUnicodeNoSubset:
 				break;
@@ -139,88 +135,86 @@ OSStatus TECCreateConverter(TECObjectRef *newEncodingConverter, TextEncoding inp
 			}
 		}
 	}
+	else
+		obj->byteMap.reset(createByteMap(inputEncoding, outputEncoding, obj->outputConverter));
 
 	*newEncodingConverter = obj;
 	return noErr;
 }
 
-OSStatus TECConvertText(TECObjectRef encodingConverter, ConstTextPtr inputBuffer,
+static OSStatus TECConvertTextInternal(TECObjectRef encodingConverter, ConstTextPtr inputBuffer,
 		ByteCount inputBufferLength, ByteCount *actualInputLength,
-		TextPtr outputBuffer, ByteCount outputBufferLength, ByteCount *actualOutputLength)
+		TextPtr outputBuffer, ByteCount outputBufferLength, ByteCount *actualOutputLength, bool flush)
 {
 	if (actualInputLength != NULL)
 		*actualInputLength = 0;
 	*actualOutputLength = 0;
 
-	while (outputBufferLength > 0)
+	if (encodingConverter->byteMap)
 	{
-		if (encodingConverter->bufferUsed > 0)
-		{
-			// flush buffer
-			UErrorCode error = U_ZERO_ERROR;
-			char* target = (char*) outputBuffer;
-			const UChar* source = encodingConverter->buffer;
-			ByteCount inputUsed;
-
+		const uint8_t* map = encodingConverter->byteMap.get();
+		ByteCount count = inputBufferLength < outputBufferLength ? inputBufferLength : outputBufferLength;
 
-			ucnv_fromUnicode(encodingConverter->outputConverter,
-					&target, target + outputBufferLength,
-					&source, source + encodingConverter->bufferUsed,
-					NULL, false, &error);
+		for (ByteCount i = 0; i < count; i++)
+			outputBuffer[i] = map[inputBuffer[i]];
 
-			if (error != U_ZERO_ERROR && error != U_BUFFER_OVERFLOW_ERROR)
-				return paramErr;
+		if (actualInputLength != NULL)
+			*actualInputLength = count;
+		*actualOutputLength = count;
 
-			*actualOutputLength = target - ((char*)outputBuffer);
+		return (count < inputBufferLength) ? kTECOutputBufferFullStatus : noErr;
+	}
 
-			inputUsed = source - encodingConverter->buffer;
-			if (inputUsed < encodingConverter->bufferUsed)
-			{
-				memmove(encodingConverter->buffer,
-						encodingConverter->buffer + inputUsed,
-						encodingConverter->bufferUsed - inputUsed);
-			}
-			encodingConverter->bufferUsed -= inputUsed;
-			outputBuffer += *actualOutputLength;
-			outputBufferLength -= *actualOutputLength;
+	// ICU converts straight from the input to the output encoding,
+	// only passing through the pivot buffer
+	UErrorCode error = U_ZERO_ERROR;
+	char* target = (char*) outputBuffer;
+	// ICU rejects a NULL source even when there's nothing to read
+	const char* source = inputBuffer ? (const char*) inputBuffer : "";
+	const char* sourceStart = source;
 
-			if (error == U_BUFFER_OVERFLOW_ERROR)
-				break;
-		}
+	ucnv_convertEx(encodingConverter->outputConverter, encodingConverter->inputConverter,
+			&target, target + outputBufferLength,
+			&source, source + inputBufferLength,
+			encodingConverter->pivot, &encodingConverter->pivotSource, &encodingConverter->pivotTarget,
+			encodingConverter->pivot + (sizeof(encodingConverter->pivot) / sizeof(encodingConverter->pivot[0])),
+			false, flush, &error);
 
-		if (inputBufferLength <= 0)
-			break;
+	// TODO: normalize
 
-		// Consume input
-		{
-			UChar* target = encodingConverter->buffer + encodingConverter->bufferUsed;
-			const char* source = (const char*) inputBuffer;
-			UErrorCode error = U_ZERO_ERROR;
-
-			ucnv_toUnicode(encodingConverter->inputConverter,
-					&target, encodingConverter->buffer + (sizeof(encodingConverter->buffer) / sizeof(encodingConverter->buffer[0])),
-					&source, source + inputBufferLength,
-					NULL, false, &error);
-
-			if (error != U_ZERO_ERROR && error != U_BUFFER_OVERFLOW_ERROR)
-				return paramErr;
-
-			encodingConverter->bufferUsed += target - (encodingConverter->buffer + encodingConverter->bufferUsed);
-			*actualInputLength += source - ((const char*)inputBuffer);
-			inputBufferLength -= source - ((const char*)inputBuffer);
-			inputBuffer = (ConstTextPtr) source;
-		}
+	if (actualInputLength != NULL)
+		*actualInputLength = source - sourceStart;
+	*actualOutputLength = target - ((char*) outputBuffer);
 
-		// TODO: normalize
-		// Normalization may cause the data to no longer fit into our internal buffer :-/
-	}
+	if (error == U_BUFFER_OVERFLOW_ERROR)
+		return kTECOutputBufferFullStatus;
+	if (U_FAILURE(error))
+		return paramErr;
 
 	return noErr;
 }
 
+OSStatus TECConvertText(TECObjectRef encodingConverter, ConstTextPtr inputBuffer,
+		ByteCount inputBufferLength, ByteCount *actualInputLength,
+		TextPtr outputBuffer, ByteCount outputBufferLength, ByteCount *actualOutputLength)
+{
+	return TECConvertTextInternal(encodingConverter, inputBuffer, inputBufferLength, actualInputLength,
+			outputBuffer, outputBufferLength, actualOutputLength, false);
+}
+
 OSStatus TECFlushText(TECObjectRef encodingConverter, TextPtr outputBuffer, ByteCount outputBufferLength, ByteCount *actualOutputLength)
 {
-	return TECConvertText(encodingConverter, NULL, 0, NULL, outputBuffer, outputBufferLength, actualOutputLength);
+	OSStatus status = TECConvertTextInternal(encodingConverter, NULL, 0, NULL,
+			outputBuffer, outputBufferLength, actualOutputLength, true);
+
+	// Start afresh after a complete flush
+	if (status == noErr)
+	{
+		ucnv_reset(encodingConverter->inputConverter);
+		ucnv_reset(encodingConverter->outputConverter);
+		encodingConverter->pivotSource = encodingConverter->pivotTarget = encodingConverter->pivot;
+	}
+	return status;
 }
 
 OSStatus TECDisposeConverter(TECObjectRef conv)
@@ -230,4 +224,3 @@ OSStatus TECDisposeConverter(TECObjectRef conv)
 	delete conv;
 	return noErr;
 }
-
@@ -0,0 +1,493 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "TextEncodingTables.h"
+#include <unicode/utf16.h>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#	include <arm_neon.h>
+#endif
+
+// ICU converter names to try for each base encoding, best match first.
+// Apple's ICU knows the x-mac-* names, stock ICU only some of them.
+static const struct
+{
+	TextEncodingBase base;
+	const char* names[3];
+} icuNames[] = {
+	{ kTextEncodingMacRoman, { "macos-0_2-10.2", "macintosh" } },
+	{ kTextEncodingMacJapanese, { "x-mac-japanese", "Shift_JIS" } },
+	{ kTextEncodingMacChineseTrad, { "x-mac-chinesetrad", "Big5" } },
+	{ kTextEncodingMacKorean, { "x-mac-korean", "EUC-KR" } },
+	{ kTextEncodingMacArabic, { "x-mac-arabic" } },
+	{ kTextEncodingMacHebrew, { "x-mac-hebrew" } },
+	{ kTextEncodingMacGreek, { "macos-6_2-10.4", "x-mac-greek" } },
+	{ kTextEncodingMacCyrillic, { "macos-7_3-10.2", "x-mac-cyrillic" } },
+	{ kTextEncodingMacThai, { "x-mac-thai" } },
+	{ kTextEncodingMacChineseSimp, { "x-mac-chinesesimp", "GB2312" } },
+	{ kTextEncodingMacCentralEurRoman, { "macos-29-10.2", "x-mac-centraleurroman" } },
+	{ kTextEncodingMacSymbol, { "x-mac-symbol" } },
+	{ kTextEncodingMacDingbats, { "x-mac-dingbats" } },
+	{ kTextEncodingMacTurkish, { "macos-35-10.2", "x-mac-turkish" } },
+	{ kTextEncodingMacCroatian, { "x-mac-croatian" } },
+	{ kTextEncodingMacIcelandic, { "x-mac-icelandic" } },
+	{ kTextEncodingMacRomanian, { "x-mac-romanian" } },
+	{ kTextEncodingMacCeltic, { "x-mac-celtic" } },
+	{ kTextEncodingMacGaelic, { "x-mac-gaelic" } },
+	{ kTextEncodingMacFarsi, { "x-mac-farsi" } },
+	{ kTextEncodingMacUkrainian, { "x-mac-ukrainian", "x-MacUkraine" } },
+	{ kTextEncodingMacInuit, { "x-mac-inuit" } },
+
+	{ kTextEncodingISOLatin1, { "ISO-8859-1" } },
+	{ kTextEncodingISOLatin2, { "ISO-8859-2" } },
+	{ kTextEncodingISOLatin3, { "ISO-8859-3" } },
+	{ kTextEncodingISOLatin4, { "ISO-8859-4" } },
+	{ kTextEncodingISOLatinCyrillic, { "ISO-8859-5" } },
+	{ kTextEncodingISOLatinArabic, { "ISO-8859-6" } },
+	{ kTextEncodingISOLatinGreek, { "ISO-8859-7" } },
+	{ kTextEncodingISOLatinHebrew, { "ISO-8859-8" } },
+	{ kTextEncodingISOLatin5, { "ISO-8859-9" } },
+	{ kTextEncodingISOLatin6, { "ISO-8859-10" } },
+	{ kTextEncodingISOLatin7, { "ISO-8859-13" } },
+	{ kTextEncodingISOLatin8, { "ISO-8859-14" } },
+	{ kTextEncodingISOLatin9, { "ISO-8859-15" } },
+	{ kTextEncodingISOLatin10, { "ISO-8859-16" } },
+
+	{ kTextEncodingDOSLatinUS, { "cp437" } },
+	{ kTextEncodingDOSGreek, { "cp737" } },
+	{ kTextEncodingDOSBalticRim, { "cp775" } },
+	{ kTextEncodingDOSLatin1, { "cp850" } },
+	{ kTextEncodingDOSLatin2, { "cp852" } },
+	{ kTextEncodingDOSCyrillic, { "cp855" } },
+	{ kTextEncodingDOSRussian, { "cp866" } },
+	{ kTextEncodingDOSThai, { "cp874" } },
+	{ kTextEncodingDOSJapanese, { "windows-31j", "cp932" } },
+	{ kTextEncodingDOSChineseSimplif, { "GBK", "cp936" } },
+	{ kTextEncodingDOSKorean, { "windows-949", "cp949" } },
+	{ kTextEncodingDOSChineseTrad, { "windows-950", "cp950" } },
+
+	{ kTextEncodingWindowsLatin1, { "windows-1252" } },
+	{ kTextEncodingWindowsLatin2, { "windows-1250" } },
+	{ kTextEncodingWindowsCyrillic, { "windows-1251" } },
+	{ kTextEncodingWindowsGreek, { "windows-1253" } },
+	{ kTextEncodingWindowsLatin5, { "windows-1254" } },
+	{ kTextEncodingWindowsHebrew, { "windows-1255" } },
+	{ kTextEncodingWindowsArabic, { "windows-1256" } },
+	{ kTextEncodingWindowsBalticRim, { "windows-1257" } },
+	{ kTextEncodingWindowsVietnamese, { "windows-1258" } },
+
+	{ kTextEncodingUS_ASCII, { "US-ASCII" } },
+	{ kTextEncodingGB_18030_2000, { "GB18030" } },
+	{ kTextEncodingISO_2022_JP, { "ISO-2022-JP" } },
+	{ kTextEncodingEUC_JP, { "EUC-JP" } },
+	{ kTextEncodingEUC_CN, { "GB2312" } },
+	{ kTextEncodingEUC_KR, { "EUC-KR" } },
+	{ kTextEncodingShiftJIS, { "Shift_JIS" } },
+	{ kTextEncodingKOI8_R, { "KOI8-R" } },
+	{ kTextEncodingBig5, { "Big5" } },
+	{ kTextEncodingKOI8_U, { "KOI8-U" } },
+};
+
+static const char* unicodeConverterName(TextEncodingFormat format)
+{
+	switch (format)
+	{
+		case kUnicodeUTF16Format:
+			return "UTF-16";
+		case kUnicodeUTF7Format:
+			return "UTF-7";
+		case kUnicodeUTF8Format:
+			return "UTF-8";
+		case kUnicodeUTF32Format:
+			return "UTF-32";
+		case kUnicodeUTF16BEFormat:
+			return "UTF-16BE";
+		case kUnicodeUTF16LEFormat:
+			return "UTF-16LE";
+		case kUnicodeUTF32BEFormat:
+			return "UTF-32BE";
+		case kUnicodeUTF32LEFormat:
+			return "UTF-32LE";
+		case kUnicodeSCSUFormat:
+			return "SCSU";
+		default:
+			return NULL;
+	}
+}
+
+UConverter* TextEncodingTable::openConverter(TextEncoding encoding)
+{
+	TextEncodingBase base = GetTextEncodingBase(encoding);
+
+	if ((base & 0xff00) == kTextEncodingUnicodeDefault)
+	{
+		const char* name = unicodeConverterName(GetTextEncodingFormat(encoding));
+		UErrorCode error = U_ZERO_ERROR;
+
+		if (!name)
+			return NULL;
+
+		UConverter* cnv = ucnv_open(name, &error);
+		return U_SUCCESS(error) ? cnv : NULL;
+	}
+
+	for (const auto& entry : icuNames)
+	{
+		if (entry.base != base)
+			continue;
+
+		for (const char* name : entry.names)
+		{
+			if (!name)
+				break;
+
+			UErrorCode error = U_ZERO_ERROR;
+			UConverter* cnv = ucnv_open(name, &error);
+
+			if (U_SUCCESS(error))
+				return cnv;
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+const TextEncodingTable* TextEncodingTable::get(TextEncodingBase base)
+{
+	static std::mutex mutex;
+	static std::unordered_map<TextEncodingBase, std::unique_ptr<TextEncodingTable>> tables;
+
+	if ((base & 0xff00) == kTextEncodingUnicodeDefault)
+		return nullptr;
+
+	std::lock_guard<std::mutex> guard(mutex);
+
+	auto it = tables.find(base);
+	if (it != tables.end())
+		return it->second.get();
+
+	// Failures are remembered as nullptr, so we only ask ICU once
+	std::unique_ptr<TextEncodingTable> table;
+	UConverter* cnv = openConverter(CreateTextEncoding(base, kTextEncodingDefaultVariant, kTextEncodingDefaultFormat));
+
+	if (cnv != NULL)
+	{
+		table.reset(new TextEncodingTable);
+		if (!table->build(cnv))
+			table.reset();
+		ucnv_close(cnv);
+	}
+
+	const TextEncodingTable* rv = table.get();
+	tables.emplace(base, std::move(table));
+	return rv;
+}
+
+// Decodes a complete byte sequence into a table entry
+static UniChar decodeEntry(UConverter* cnv, const char* bytes, int32_t length, bool* truncated)
+{
+	UChar out[4];
+	UErrorCode error = U_ZERO_ERROR;
+	int32_t count = ucnv_toUChars(cnv, out, 4, bytes, length, &error);
+
+	*truncated = error == U_TRUNCATED_CHAR_FOUND;
+	if (U_FAILURE(error) || count == 0)
+		return 0xFFFF;
+	if (count > 1 || U16_IS_SURROGATE(out[0]))
+		return 0xDFFF;
+	return out[0];
+}
+
+bool TextEncodingTable::build(UConverter* cnv)
+{
+	int8_t maxCharSize = ucnv_getMaxCharSize(cnv);
+	UErrorCode error = U_ZERO_ERROR;
+
+	if (maxCharSize > 2)
+		return false;
+
+	ucnv_setToUCallBack(cnv, UCNV_TO_U_CALLBACK_STOP, NULL, NULL, NULL, &error);
+	ucnv_setFromUCallBack(cnv, UCNV_FROM_U_CALLBACK_STOP, NULL, NULL, NULL, &error);
+	if (U_FAILURE(error))
+		return false;
+
+	for (int b = 0; b < 256; b++)
+	{
+		char byte = char(b);
+		bool truncated;
+
+		m_singleByte[b] = decodeEntry(cnv, &byte, 1, &truncated);
+		if (truncated && maxCharSize == 2)
+		{
+			m_singleByte[b] = kLeadByte;
+			if (!m_doubleByte)
+			{
+				m_doubleByte.reset(new UniChar[65536]);
+				std::fill_n(m_doubleByte.get(), 65536, kUnmapped);
+			}
+
+			for (int t = 0; t < 256; t++)
+			{
+				char pair[2] = { char(b), char(t) };
+				m_doubleByte[(b << 8) | t] = decodeEntry(cnv, pair, 2, &truncated);
+			}
+		}
+	}
+
+	m_asciiCompatible = true;
+	for (int b = 0; b < 0x80; b++)
+	{
+		if (m_singleByte[b] != b)
+		{
+			m_asciiCompatible = false;
+			break;
+		}
+	}
+
+	// The reverse table is the inverse of the forward one. When several byte sequences
+	// decode to the same character, ICU decides which one is the round-trip mapping.
+	m_fromUnicode.reset(new uint16_t[65536]);
+	std::fill_n(m_fromUnicode.get(), 65536, kNoBytes);
+
+	auto addReverse = [&](UniChar ch, uint16_t bytes)
+	{
+		if (ch == kUnmapped || ch == kLeadByte || ch == kComplex)
+			return;
+
+		if (m_fromUnicode[ch] == kNoBytes)
+		{
+			m_fromUnicode[ch] = bytes;
+			return;
+		}
+
+		char out[4];
+		UErrorCode error = U_ZERO_ERROR;
+		int32_t count = ucnv_fromUChars(cnv, out, sizeof(out), (const UChar*) &ch, 1, &error);
+
+		if (U_SUCCESS(error) && count == 1)
+			m_fromUnicode[ch] = uint8_t(out[0]);
+		else if (U_SUCCESS(error) && count == 2)
+			m_fromUnicode[ch] = (uint8_t(out[0]) << 8) | uint8_t(out[1]);
+	};
+
+	for (int b = 0; b < 256; b++)
+		addReverse(m_singleByte[b], b);
+	if (m_doubleByte)
+	{
+		for (int i = 0x100; i < 65536; i++)
+		{
+			if (m_singleByte[i >> 8] == kLeadByte)
+				addReverse(m_doubleByte[i], i);
+		}
+	}
+
+	return true;
+}
+
+size_t TextEncodingTable::asciiToUnicode(const uint8_t* src, UniChar* dst, size_t count)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+		if (_mm_movemask_epi8(v) != 0)
+			break;
+
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i*) (dst + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (; i + 16 <= count; i += 16)
+	{
+		uint8x16_t v = vld1q_u8(src + i);
+		if (vmaxvq_u8(v) & 0x80)
+			break;
+
+		vst1q_u16(dst + i, vmovl_u8(vget_low_u8(v)));
+		vst1q_u16(dst + i + 8, vmovl_high_u8(v));
+	}
+#endif
+
+	for (; i < count && src[i] < 0x80; i++)
+		dst[i] = src[i];
+
+	return i;
+}
+
+size_t TextEncodingTable::asciiFromUnicode(const UniChar* src, uint8_t* dst, size_t count)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i highMask = _mm_set1_epi16(short(0xff80));
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*) (src + i + 8));
+		__m128i high = _mm_and_si128(_mm_or_si128(a, b), highMask);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xffff)
+			break;
+
+		_mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(a, b));
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (; i + 8 <= count; i += 8)
+	{
+		uint16x8_t v = vld1q_u16(src + i);
+		if (vmaxvq_u16(v) >= 0x80)
+			break;
+
+		vst1_u8(dst + i, vmovn_u16(v));
+	}
+#endif
+
+	for (; i < count && src[i] < 0x80; i++)
+		dst[i] = uint8_t(src[i]);
+
+	return i;
+}
+
+TextEncodingTable::Status TextEncodingTable::toUnicode(const uint8_t* src, size_t srcLen, UniChar* dst, size_t dstLen,
+		size_t* read, size_t* written) const
+{
+	size_t in = 0, out = 0;
+	Status status = Done;
+
+	while (in < srcLen)
+	{
+		if (m_asciiCompatible)
+		{
+			size_t n = asciiToUnicode(src + in, dst + out, std::min(srcLen - in, dstLen - out));
+			in += n;
+			out += n;
+
+			if (in == srcLen)
+				break;
+		}
+
+		if (out == dstLen)
+		{
+			status = OutputFull;
+			break;
+		}
+
+		UniChar ch = m_singleByte[src[in]];
+		size_t length = 1;
+
+		if (ch == kLeadByte)
+		{
+			if (in + 1 == srcLen)
+			{
+				status = Partial;
+				break;
+			}
+			ch = m_doubleByte[(src[in] << 8) | src[in + 1]];
+			length = 2;
+		}
+
+		if (ch == kUnmapped)
+		{
+			status = Unmapped;
+			break;
+		}
+		if (ch == kComplex)
+		{
+			status = Complex;
+			break;
+		}
+
+		dst[out++] = ch;
+		in += length;
+	}
+
+	*read = in;
+	*written = out;
+	return status;
+}
+
+TextEncodingTable::Status TextEncodingTable::fromUnicode(const UniChar* src, size_t srcLen, uint8_t* dst, size_t dstLen,
+		size_t* read, size_t* written) const
+{
+	size_t in = 0, out = 0;
+	Status status = Done;
+
+	while (in < srcLen)
+	{
+		if (m_asciiCompatible)
+		{
+			size_t n = asciiFromUnicode(src + in, dst + out, std::min(srcLen - in, dstLen - out));
+			in += n;
+			out += n;
+
+			if (in == srcLen)
+				break;
+		}
+
+		if (U16_IS_SURROGATE(src[in]))
+		{
+			status = Complex;
+			break;
+		}
+
+		uint16_t bytes = m_fromUnicode[src[in]];
+		if (bytes == kNoBytes)
+		{
+			status = Unmapped;
+			break;
+		}
+
+		if (bytes > 0xff)
+		{
+			if (dstLen - out < 2)
+			{
+				status = OutputFull;
+				break;
+			}
+			dst[out++] = uint8_t(bytes >> 8);
+			dst[out++] = uint8_t(bytes);
+		}
+		else
+		{
+			if (out == dstLen)
+			{
+				status = OutputFull;
+				break;
+			}
+			dst[out++] = uint8_t(bytes);
+		}
+		in++;
+	}
+
+	*read = in;
+	*written = out;
+	return status;
+}
+
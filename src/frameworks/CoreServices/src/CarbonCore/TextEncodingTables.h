@@ -0,0 +1,88 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CS_TEXT_ENCODING_TABLES_H
+#define _CS_TEXT_ENCODING_TABLES_H
+#include <CarbonCore/TextCommon.h>
+#include <unicode/ucnv.h>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lookup tables for single-byte and double-byte (DBCS) legacy encodings.
+//
+// Tables are generated from ICU the first time an encoding is used and then
+// shared by all converters in the process, so that the per-call conversion
+// cost is a couple of array lookups per character instead of an ICU round trip.
+// Encodings that need more than two bytes per character (EUC-JP, GB 18030,
+// ISO-2022 and the Unicode forms) are not table-driven; use openConverter().
+class __attribute__((visibility("hidden"))) TextEncodingTable
+{
+public:
+	enum Status
+	{
+		Done,
+		OutputFull,
+		// Input ends in the middle of a double-byte character
+		Partial,
+		// No mapping exists for the character at the stop position
+		Unmapped,
+		// The character at the stop position maps to several code units;
+		// it must be converted by ICU
+		Complex,
+	};
+
+	// Returns nullptr if the encoding is not table-driven (or unknown).
+	static const TextEncodingTable* get(TextEncodingBase base);
+
+	// Opens an ICU converter for any encoding we support, including Unicode forms.
+	static UConverter* openConverter(TextEncoding encoding);
+
+	bool isDoubleByte() const { return m_doubleByte != nullptr; }
+	bool isLeadByte(uint8_t b) const { return m_singleByte[b] == kLeadByte; }
+
+	// Both functions stop at the first character they cannot handle themselves.
+	// *read and *written are in units of the respective buffer element type.
+	Status toUnicode(const uint8_t* src, size_t srcLen, UniChar* dst, size_t dstLen,
+			size_t* read, size_t* written) const;
+	Status fromUnicode(const UniChar* src, size_t srcLen, uint8_t* dst, size_t dstLen,
+			size_t* read, size_t* written) const;
+
+	// Converts ASCII characters until the first non-ASCII one. Returns the count converted.
+	static size_t asciiToUnicode(const uint8_t* src, UniChar* dst, size_t count);
+	static size_t asciiFromUnicode(const UniChar* src, uint8_t* dst, size_t count);
+private:
+	TextEncodingTable() = default;
+	bool build(UConverter* converter);
+
+	static constexpr UniChar kUnmapped = 0xFFFF;
+	static constexpr UniChar kLeadByte = 0xFFFE;
+	static constexpr UniChar kComplex = 0xDFFF;
+	static constexpr uint16_t kNoBytes = 0xFFFF;
+
+	UniChar m_singleByte[256];
+	// Indexed by (lead << 8) | trail
+	std::unique_ptr<UniChar[]> m_doubleByte;
+	// Indexed by UTF-16 code unit; values above 0xFF are (lead << 8) | trail
+	std::unique_ptr<uint16_t[]> m_fromUnicode;
+	bool m_asciiCompatible = false;
+};
+
+#endif
+
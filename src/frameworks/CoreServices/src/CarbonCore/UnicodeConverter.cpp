@@ -1,89 +1,389 @@
 #include <CoreServices/UnicodeConverter.h>
 #include <CarbonCore/TextCommon.h>
-#include <cstdio>
+#include <CarbonCore/MacErrors.h>
+#include <unicode/ucnv.h>
+#include <unicode/utf16.h>
+#include <cstring>
+#include <vector>
+#include "TextEncodingTables.h"
+
+struct OpaqueTextToUnicodeInfo
+{
+	UnicodeMapping mapping;
+	// nullptr if the encoding needs ICU for everything
+	const TextEncodingTable* table;
+	// Used when there is no table and for characters the table cannot express
+	UConverter* converter;
+	// Lead byte of a character split across kUnicodeStringUnterminatedMask calls, or -1
+	int pending;
+};
+
+struct OpaqueUnicodeToTextInfo
+{
+	UnicodeMapping mapping;
+	const TextEncodingTable* table;
+	UConverter* converter;
+	// High surrogate of a pair split across kUnicodeStringUnterminatedMask calls, or -1
+	int pending;
+};
+
+struct OpaqueUnicodeToTextRunInfo
+{
+	std::vector<UnicodeToTextInfo> infos;
+};
+
+template <typename Info>
+static OSStatus setupInfo(Info* info, ConstUnicodeMappingPtr mapping)
+{
+	if ((GetTextEncodingBase(mapping->unicodeEncoding) & 0xff00) != kTextEncodingUnicodeDefault)
+		return paramErr;
+
+	UConverter* cnv = TextEncodingTable::openConverter(mapping->otherEncoding);
+	if (!cnv)
+		return kTextUnsupportedEncodingErr;
+
+	UErrorCode error = U_ZERO_ERROR;
+	ucnv_setToUCallBack(cnv, UCNV_TO_U_CALLBACK_STOP, NULL, NULL, NULL, &error);
+	ucnv_setFromUCallBack(cnv, UCNV_FROM_U_CALLBACK_STOP, NULL, NULL, NULL, &error);
+
+	if (info->converter)
+		ucnv_close(info->converter);
+
+	info->mapping = *mapping;
+	info->table = TextEncodingTable::get(GetTextEncodingBase(mapping->otherEncoding));
+	info->converter = cnv;
+	info->pending = -1;
+
+	return noErr;
+}
+
+static UnicodeMapping mappingForEncoding(TextEncoding encoding)
+{
+	UnicodeMapping mapping;
+
+	mapping.unicodeEncoding = CreateTextEncoding(kTextEncodingUnicodeDefault, kTextEncodingDefaultVariant, kUnicode16BitFormat);
+	mapping.otherEncoding = encoding;
+	mapping.mappingVersion = kUnicodeUseLatestMapping;
+
+	return mapping;
+}
+
+static OSStatus statusFromICU(UErrorCode error, OSStatus undefinedStatus)
+{
+	switch (error)
+	{
+		case U_ZERO_ERROR:
+			return noErr;
+		case U_BUFFER_OVERFLOW_ERROR:
+			return kTECOutputBufferFullStatus;
+		case U_TRUNCATED_CHAR_FOUND:
+			return kTECPartialCharErr;
+		case U_INVALID_CHAR_FOUND:
+			return undefinedStatus;
+		case U_ILLEGAL_CHAR_FOUND:
+			return kTextMalformedInputErr;
+		default:
+			if (U_SUCCESS(error))
+				return noErr;
+			return paramErr;
+	}
+}
+
+// With the STOP callback, ICU consumes the offending sequence. Give it back
+// so that the caller sees where the conversion stopped.
+static size_t invalidLength(UConverter* cnv, bool toUnicode)
+{
+	UErrorCode error = U_ZERO_ERROR;
+
+	if (toUnicode)
+	{
+		char invalid[32];
+		int8_t length = sizeof(invalid);
+
+		ucnv_getInvalidChars(cnv, invalid, &length, &error);
+		return U_SUCCESS(error) ? length : 0;
+	}
+	else
+	{
+		UChar invalid[32];
+		int8_t length = sizeof(invalid) / sizeof(invalid[0]);
+
+		ucnv_getInvalidUChars(cnv, invalid, &length, &error);
+		return U_SUCCESS(error) ? length : 0;
+	}
+}
 
 OSStatus CreateTextToUnicodeInfo(ConstUnicodeMappingPtr iUnicodeMapping, TextToUnicodeInfo *oTextToUnicodeInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (!iUnicodeMapping || !oTextToUnicodeInfo)
+		return paramErr;
+
+	TextToUnicodeInfo info = new OpaqueTextToUnicodeInfo {};
+	OSStatus status = setupInfo(info, iUnicodeMapping);
+
+	if (status != noErr)
+	{
+		delete info;
+		info = nullptr;
+	}
+
+	*oTextToUnicodeInfo = info;
+	return status;
 }
 
 OSStatus CreateTextToUnicodeInfoByEncoding(TextEncoding iEncoding, TextToUnicodeInfo *oTextToUnicodeInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	UnicodeMapping mapping = mappingForEncoding(iEncoding);
+	return CreateTextToUnicodeInfo(&mapping, oTextToUnicodeInfo);
 }
 
 OSStatus CreateUnicodeToTextInfo(ConstUnicodeMappingPtr iUnicodeMapping, UnicodeToTextInfo *oUnicodeToTextInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
+	if (!iUnicodeMapping || !oUnicodeToTextInfo)
+		return paramErr;
+
+	UnicodeToTextInfo info = new OpaqueUnicodeToTextInfo {};
+	OSStatus status = setupInfo(info, iUnicodeMapping);
 
-    printf("Encoding: %02x, other encoding: %02x, version: %02x\n",
-            iUnicodeMapping->unicodeEncoding,
-            iUnicodeMapping->otherEncoding,
-            iUnicodeMapping->mappingVersion);
+	if (status != noErr)
+	{
+		delete info;
+		info = nullptr;
+	}
 
-    return 0;
+	*oUnicodeToTextInfo = info;
+	return status;
 }
 
 OSStatus CreateUnicodeToTextInfoByEncoding(TextEncoding iEncoding, UnicodeToTextInfo *oUnicodeToTextInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	UnicodeMapping mapping = mappingForEncoding(iEncoding);
+	return CreateUnicodeToTextInfo(&mapping, oUnicodeToTextInfo);
 }
 
 OSStatus CreateUnicodeToTextRunInfo(ItemCount iNumberOfMappings,
                                     const UnicodeMapping iUnicodeMappings[],
                                     UnicodeToTextRunInfo * oUnicodeToTextInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (!oUnicodeToTextInfo || (iNumberOfMappings && !iUnicodeMappings))
+		return paramErr;
+
+	UnicodeToTextRunInfo runInfo = new OpaqueUnicodeToTextRunInfo;
+
+	for (ItemCount i = 0; i < iNumberOfMappings; i++)
+	{
+		UnicodeToTextInfo info;
+		OSStatus status = CreateUnicodeToTextInfo(&iUnicodeMappings[i], &info);
+
+		if (status != noErr)
+		{
+			DisposeUnicodeToTextRunInfo(&runInfo);
+			*oUnicodeToTextInfo = nullptr;
+			return status;
+		}
+		runInfo->infos.push_back(info);
+	}
+
+	*oUnicodeToTextInfo = runInfo;
+	return noErr;
 }
 
 OSStatus CreateUnicodeToTextRunInfoByEncoding(ItemCount iNumberOfEncodings,
                                               const TextEncoding iEncodings[],
                                               UnicodeToTextRunInfo *oUnicodeToTextInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (iNumberOfEncodings && !iEncodings)
+		return paramErr;
+
+	std::vector<UnicodeMapping> mappings;
+	for (ItemCount i = 0; i < iNumberOfEncodings; i++)
+		mappings.push_back(mappingForEncoding(iEncodings[i]));
+
+	return CreateUnicodeToTextRunInfo(mappings.size(), mappings.data(), oUnicodeToTextInfo);
 }
 
 OSStatus CreateUnicodeToTextRunInfoByScriptCode(ItemCount iNumberOfScriptCodes,
                                                 const ScriptCode iScripts[],
                                                 UnicodeToTextRunInfo *oUnicodeToTextInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (iNumberOfScriptCodes && !iScripts)
+		return paramErr;
+
+	// Script codes double as the base of the corresponding Mac encoding
+	std::vector<UnicodeMapping> mappings;
+	for (ItemCount i = 0; i < iNumberOfScriptCodes; i++)
+		mappings.push_back(mappingForEncoding(CreateTextEncoding(iScripts[i], kTextEncodingDefaultVariant, kTextEncodingDefaultFormat)));
+
+	return CreateUnicodeToTextRunInfo(mappings.size(), mappings.data(), oUnicodeToTextInfo);
 }
 
 OSStatus ChangeTextToUnicodeInfo(TextToUnicodeInfo ioTextToUnicodeInfo, ConstUnicodeMappingPtr iUnicodeMapping)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (!ioTextToUnicodeInfo || !iUnicodeMapping)
+		return paramErr;
+	return setupInfo(ioTextToUnicodeInfo, iUnicodeMapping);
 }
 
 OSStatus ChangeUnicodeToTextInfo(UnicodeToTextInfo ioUnicodeToTextInfo, ConstUnicodeMappingPtr iUnicodeMapping)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (!ioUnicodeToTextInfo || !iUnicodeMapping)
+		return paramErr;
+	return setupInfo(ioUnicodeToTextInfo, iUnicodeMapping);
 }
 
 OSStatus DisposeTextToUnicodeInfo(TextToUnicodeInfo *ioTextToUnicodeInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (!ioTextToUnicodeInfo || !*ioTextToUnicodeInfo)
+		return paramErr;
+
+	ucnv_close((*ioTextToUnicodeInfo)->converter);
+	delete *ioTextToUnicodeInfo;
+	*ioTextToUnicodeInfo = nullptr;
+
+	return noErr;
 }
 
 OSStatus DisposeUnicodeToTextInfo(UnicodeToTextInfo *ioUnicodeToTextInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (!ioUnicodeToTextInfo || !*ioUnicodeToTextInfo)
+		return paramErr;
+
+	ucnv_close((*ioUnicodeToTextInfo)->converter);
+	delete *ioUnicodeToTextInfo;
+	*ioUnicodeToTextInfo = nullptr;
+
+	return noErr;
 }
 
 OSStatus DisposeUnicodeToTextRunInfo(UnicodeToTextRunInfo * ioUnicodeToTextRunInfo)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	if (!ioUnicodeToTextRunInfo || !*ioUnicodeToTextRunInfo)
+		return paramErr;
+
+	for (UnicodeToTextInfo info : (*ioUnicodeToTextRunInfo)->infos)
+		DisposeUnicodeToTextInfo(&info);
+
+	delete *ioUnicodeToTextRunInfo;
+	*ioUnicodeToTextRunInfo = nullptr;
+
+	return noErr;
+}
+
+// Table-driven conversion of src[0..len). Characters the table cannot handle
+// go through ICU one at a time.
+static OSStatus textToUnicodeRun(TextToUnicodeInfo info, const uint8_t* src, size_t len, bool fallbacks,
+		UniChar* dst, size_t dstLen, size_t* read, size_t* written, bool* usedFallbacks)
+{
+	size_t in = 0, out = 0;
+	OSStatus status = noErr;
+
+	while (in < len)
+	{
+		size_t r, w;
+		TextEncodingTable::Status st = info->table->toUnicode(src + in, len - in, dst + out, dstLen - out, &r, &w);
+
+		in += r;
+		out += w;
+
+		if (st == TextEncodingTable::Done)
+			break;
+		if (st == TextEncodingTable::OutputFull)
+		{
+			status = kTECOutputBufferFullStatus;
+			break;
+		}
+		if (st == TextEncodingTable::Partial)
+		{
+			status = kTECPartialCharErr;
+			break;
+		}
+
+		size_t charLen = info->table->isLeadByte(src[in]) ? 2 : 1;
+
+		if (st == TextEncodingTable::Complex)
+		{
+			UChar chars[8];
+			UErrorCode error = U_ZERO_ERROR;
+			int32_t count = ucnv_toUChars(info->converter, chars, 8, (const char*) (src + in), charLen, &error);
+
+			if (U_SUCCESS(error))
+			{
+				if (size_t(count) > dstLen - out)
+				{
+					status = kTECOutputBufferFullStatus;
+					break;
+				}
+
+				memcpy(dst + out, chars, count * sizeof(UniChar));
+				out += count;
+				in += charLen;
+				continue;
+			}
+		}
+
+		if (!fallbacks)
+		{
+			status = kTextUndefinedElementErr;
+			break;
+		}
+		if (out == dstLen)
+		{
+			status = kTECOutputBufferFullStatus;
+			break;
+		}
+
+		dst[out++] = 0xFFFD;
+		in += charLen;
+		*usedFallbacks = true;
+	}
+
+	*read = in;
+	*written = out;
+	return status;
+}
+
+static OSStatus icuToUnicode(TextToUnicodeInfo info, const uint8_t* src, size_t len, OptionBits flags,
+		ItemCount offsetCount, const ByteOffset offsetArray[], ItemCount* offsetsDone, ByteOffset oOffsetArray[],
+		UniChar* dst, size_t dstLen, size_t* read, size_t* written)
+{
+	UConverter* cnv = info->converter;
+	UErrorCode error = U_ZERO_ERROR;
+	std::vector<int32_t> offsets(offsetCount ? dstLen : 0);
+	const char* source = (const char*) src;
+	UChar* target = (UChar*) dst;
+	bool fallbacks = flags & kUnicodeUseFallbacksMask;
+
+	ucnv_setFallback(cnv, fallbacks);
+	if (fallbacks)
+		ucnv_setToUCallBack(cnv, UCNV_TO_U_CALLBACK_SUBSTITUTE, NULL, NULL, NULL, &error);
+	else
+		ucnv_setToUCallBack(cnv, UCNV_TO_U_CALLBACK_STOP, NULL, NULL, NULL, &error);
+
+	ucnv_toUnicode(cnv, &target, target + dstLen, &source, source + len,
+			offsetCount ? offsets.data() : NULL, !(flags & kUnicodeStringUnterminatedMask), &error);
+
+	*read = source - (const char*) src;
+	*written = target - (UChar*) dst;
+
+	if (error == U_INVALID_CHAR_FOUND || error == U_ILLEGAL_CHAR_FOUND || error == U_TRUNCATED_CHAR_FOUND)
+	{
+		size_t invalid = invalidLength(cnv, true);
+		*read -= invalid < *read ? invalid : *read;
+		ucnv_resetToUnicode(cnv);
+	}
+
+	// ICU tells us the source index each output unit came from
+	size_t j = 0;
+	while (*offsetsDone < offsetCount && offsetArray[*offsetsDone] <= *read)
+	{
+		while (j < *written && offsets[j] < int32_t(offsetArray[*offsetsDone]))
+			j++;
+		if (oOffsetArray)
+			oOffsetArray[*offsetsDone] = j * sizeof(UniChar);
+		(*offsetsDone)++;
+	}
+
+	return statusFromICU(error, kTextUndefinedElementErr);
 }
 
 OSStatus ConvertFromTextToUnicode(TextToUnicodeInfo iTextToUnicodeInfo,
@@ -99,8 +399,214 @@ OSStatus ConvertFromTextToUnicode(TextToUnicodeInfo iTextToUnicodeInfo,
                                   ByteCount *oUnicodeLen,
                                   UniChar oUnicodeStr[])
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	TextToUnicodeInfo info = iTextToUnicodeInfo;
+
+	if (!info || (iSourceLen && !iSourceStr) || (iOffsetCount && !iOffsetArray)
+			|| !oSourceRead || !oUnicodeLen || (iOutputBufLen && !oUnicodeStr))
+		return paramErr;
+
+	const uint8_t* src = (const uint8_t*) iSourceStr;
+	const size_t dstLen = iOutputBufLen / sizeof(UniChar);
+	const bool fallbacks = iControlFlags & kUnicodeUseFallbacksMask;
+	size_t in = 0, out = 0, r, w;
+	ItemCount offsetsDone = 0;
+	OSStatus status = noErr;
+	bool usedFallbacks = false;
+
+	if (!(iControlFlags & (kUnicodeKeepInfoMask | kUnicodeStringUnterminatedMask)))
+	{
+		info->pending = -1;
+		ucnv_resetToUnicode(info->converter);
+	}
+
+	if (!info->table)
+	{
+		status = icuToUnicode(info, src, iSourceLen, iControlFlags, iOffsetCount, iOffsetArray, &offsetsDone,
+				oOffsetArray, oUnicodeStr, dstLen, &in, &out);
+	}
+	else
+	{
+		if (info->pending >= 0 && iSourceLen > 0)
+		{
+			const uint8_t pair[2] = { uint8_t(info->pending), src[0] };
+
+			status = textToUnicodeRun(info, pair, 2, fallbacks, oUnicodeStr, dstLen, &r, &w, &usedFallbacks);
+			if (r == 2)
+			{
+				info->pending = -1;
+				in = 1;
+				out = w;
+			}
+		}
+
+		while (status == noErr)
+		{
+			while (offsetsDone < iOffsetCount && iOffsetArray[offsetsDone] <= in)
+			{
+				if (oOffsetArray)
+					oOffsetArray[offsetsDone] = out * sizeof(UniChar);
+				offsetsDone++;
+			}
+
+			if (in == iSourceLen)
+				break;
+
+			// Convert up to the next offset the caller is interested in
+			size_t end = iSourceLen;
+			if (offsetsDone < iOffsetCount && iOffsetArray[offsetsDone] < iSourceLen)
+				end = iOffsetArray[offsetsDone];
+
+			status = textToUnicodeRun(info, src + in, end - in, fallbacks, oUnicodeStr + out, dstLen - out,
+					&r, &w, &usedFallbacks);
+			in += r;
+			out += w;
+
+			if (status == kTECPartialCharErr && end < iSourceLen)
+			{
+				// The requested offset points into the middle of a character
+				status = textToUnicodeRun(info, src + in, 2, fallbacks, oUnicodeStr + out, dstLen - out,
+						&r, &w, &usedFallbacks);
+				in += r;
+				out += w;
+			}
+		}
+
+		if (status == kTECPartialCharErr && (iControlFlags & kUnicodeStringUnterminatedMask))
+		{
+			info->pending = src[in++];
+			status = noErr;
+		}
+	}
+
+	if (oOffsetCount)
+		*oOffsetCount = offsetsDone;
+	*oSourceRead = in;
+	*oUnicodeLen = out * sizeof(UniChar);
+
+	if (status == noErr && usedFallbacks)
+		status = kTECUsedFallbacksStatus;
+	return status;
+}
+
+static OSStatus unicodeToTextRun(UnicodeToTextInfo info, const UniChar* src, size_t len, bool fallbacks,
+		uint8_t* dst, size_t dstLen, size_t* read, size_t* written, bool* usedFallbacks)
+{
+	size_t in = 0, out = 0;
+	OSStatus status = noErr;
+
+	while (in < len)
+	{
+		size_t r, w;
+		TextEncodingTable::Status st = info->table->fromUnicode(src + in, len - in, dst + out, dstLen - out, &r, &w);
+
+		in += r;
+		out += w;
+
+		if (st == TextEncodingTable::Done)
+			break;
+		if (st == TextEncodingTable::OutputFull)
+		{
+			status = kTECOutputBufferFullStatus;
+			break;
+		}
+
+		size_t charLen = 1;
+		if (U16_IS_LEAD(src[in]))
+		{
+			if (in + 1 == len)
+			{
+				status = kTECPartialCharErr;
+				break;
+			}
+			if (U16_IS_TRAIL(src[in + 1]))
+				charLen = 2;
+		}
+
+		if (st == TextEncodingTable::Unmapped && !fallbacks)
+		{
+			status = kTECUnmappableElementErr;
+			break;
+		}
+
+		// Surrogate pairs and fallback mappings are left to ICU
+		char bytes[8];
+		UErrorCode error = U_ZERO_ERROR;
+		int32_t count;
+
+		ucnv_setFallback(info->converter, fallbacks);
+		count = ucnv_fromUChars(info->converter, bytes, sizeof(bytes), (const UChar*) (src + in), charLen, &error);
+
+		if (U_FAILURE(error) || count == 0)
+		{
+			if (!fallbacks)
+			{
+				status = kTECUnmappableElementErr;
+				break;
+			}
+			bytes[0] = '?';
+			count = 1;
+		}
+
+		if (size_t(count) > dstLen - out)
+		{
+			status = kTECOutputBufferFullStatus;
+			break;
+		}
+
+		if (st == TextEncodingTable::Unmapped)
+			*usedFallbacks = true;
+
+		memcpy(dst + out, bytes, count);
+		out += count;
+		in += charLen;
+	}
+
+	*read = in;
+	*written = out;
+	return status;
+}
+
+static OSStatus icuFromUnicode(UnicodeToTextInfo info, const UniChar* src, size_t len, OptionBits flags,
+		ItemCount offsetCount, const ByteOffset offsetArray[], ItemCount* offsetsDone, ByteOffset oOffsetArray[],
+		uint8_t* dst, size_t dstLen, size_t* read, size_t* written)
+{
+	UConverter* cnv = info->converter;
+	UErrorCode error = U_ZERO_ERROR;
+	std::vector<int32_t> offsets(offsetCount ? dstLen : 0);
+	const UChar* source = (const UChar*) src;
+	char* target = (char*) dst;
+	bool fallbacks = flags & kUnicodeUseFallbacksMask;
+
+	ucnv_setFallback(cnv, fallbacks);
+	if (fallbacks)
+		ucnv_setFromUCallBack(cnv, UCNV_FROM_U_CALLBACK_SUBSTITUTE, NULL, NULL, NULL, &error);
+	else
+		ucnv_setFromUCallBack(cnv, UCNV_FROM_U_CALLBACK_STOP, NULL, NULL, NULL, &error);
+
+	ucnv_fromUnicode(cnv, &target, target + dstLen, &source, source + len,
+			offsetCount ? offsets.data() : NULL, !(flags & kUnicodeStringUnterminatedMask), &error);
+
+	*read = source - (const UChar*) src;
+	*written = target - (char*) dst;
+
+	if (error == U_INVALID_CHAR_FOUND || error == U_ILLEGAL_CHAR_FOUND || error == U_TRUNCATED_CHAR_FOUND)
+	{
+		size_t invalid = invalidLength(cnv, false);
+		*read -= invalid < *read ? invalid : *read;
+		ucnv_resetFromUnicode(cnv);
+	}
+
+	size_t j = 0;
+	while (*offsetsDone < offsetCount && offsetArray[*offsetsDone] <= *read * sizeof(UniChar))
+	{
+		while (j < *written && offsets[j] < int32_t(offsetArray[*offsetsDone] / sizeof(UniChar)))
+			j++;
+		if (oOffsetArray)
+			oOffsetArray[*offsetsDone] = j;
+		(*offsetsDone)++;
+	}
+
+	return statusFromICU(error, kTECUnmappableElementErr);
 }
 
 OSStatus ConvertFromUnicodeToText(UnicodeToTextInfo iUnicodeToTextInfo,
@@ -116,6 +622,92 @@ OSStatus ConvertFromUnicodeToText(UnicodeToTextInfo iUnicodeToTextInfo,
                                   ByteCount *oOutputLen,
                                   LogicalAddress oOutputStr)
 {
-    printf("STUB %s\n", __PRETTY_FUNCTION__);
-    return 0;
+	UnicodeToTextInfo info = iUnicodeToTextInfo;
+
+	if (!info || (iUnicodeLen && !iUnicodeStr) || (iOffsetCount && !iOffsetArray)
+			|| !oInputRead || !oOutputLen || (iOutputBufLen && !oOutputStr))
+		return paramErr;
+
+	const size_t srcLen = iUnicodeLen / sizeof(UniChar);
+	uint8_t* dst = (uint8_t*) oOutputStr;
+	const bool fallbacks = iControlFlags & (kUnicodeUseFallbacksMask | kUnicodeLooseMappingsMask);
+	size_t in = 0, out = 0, r, w;
+	ItemCount offsetsDone = 0;
+	OSStatus status = noErr;
+	bool usedFallbacks = false;
+
+	if (!(iControlFlags & (kUnicodeKeepInfoMask | kUnicodeStringUnterminatedMask)))
+	{
+		info->pending = -1;
+		ucnv_resetFromUnicode(info->converter);
+	}
+
+	if (!info->table)
+	{
+		status = icuFromUnicode(info, iUnicodeStr, srcLen, iControlFlags, iOffsetCount, iOffsetArray, &offsetsDone,
+				oOffsetArray, dst, iOutputBufLen, &in, &out);
+	}
+	else
+	{
+		if (info->pending >= 0 && srcLen > 0)
+		{
+			const UniChar pair[2] = { UniChar(info->pending), iUnicodeStr[0] };
+
+			status = unicodeToTextRun(info, pair, 2, fallbacks, dst, iOutputBufLen, &r, &w, &usedFallbacks);
+			if (r == 2)
+			{
+				info->pending = -1;
+				in = 1;
+				out = w;
+			}
+		}
+
+		while (status == noErr)
+		{
+			while (offsetsDone < iOffsetCount && iOffsetArray[offsetsDone] <= in * sizeof(UniChar))
+			{
+				if (oOffsetArray)
+					oOffsetArray[offsetsDone] = out;
+				offsetsDone++;
+			}
+
+			if (in == srcLen)
+				break;
+
+			size_t end = srcLen;
+			if (offsetsDone < iOffsetCount && iOffsetArray[offsetsDone] / sizeof(UniChar) < srcLen)
+				end = iOffsetArray[offsetsDone] / sizeof(UniChar);
+			if (end <= in)
+				end = in + 1;
+
+			status = unicodeToTextRun(info, iUnicodeStr + in, end - in, fallbacks, dst + out, iOutputBufLen - out,
+					&r, &w, &usedFallbacks);
+			in += r;
+			out += w;
+
+			if (status == kTECPartialCharErr && end < srcLen)
+			{
+				// The requested offset splits a surrogate pair
+				status = unicodeToTextRun(info, iUnicodeStr + in, 2, fallbacks, dst + out, iOutputBufLen - out,
+						&r, &w, &usedFallbacks);
+				in += r;
+				out += w;
+			}
+		}
+
+		if (status == kTECPartialCharErr && (iControlFlags & kUnicodeStringUnterminatedMask))
+		{
+			info->pending = iUnicodeStr[in++];
+			status = noErr;
+		}
+	}
+
+	if (oOffsetCount)
+		*oOffsetCount = offsetsDone;
+	*oInputRead = in * sizeof(UniChar);
+	*oOutputLen = out;
+
+	if (status == noErr && usedFallbacks)
+		status = kTECUsedFallbacksStatus;
+	return status;
 }
@@ -20,10 +20,16 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <CarbonCore/UnicodeUtilities.h>
 #include <unicode/coll.h>
-#include <unicode/sortkey.h>
 #include <string>
 #include <cstring>
+#include <cstdlib>
 #include <iostream>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <CoreServices/UniChar.h>
 #include <CarbonCore/MacErrors.h>
 
@@ -50,19 +56,191 @@ static UColAttributeValue optsToColAttr(uint32_t options)
 	return strength;
 }
 
-OSStatus UCCreateCollator(LocaleRef locale, LocaleOperationVariant opVariant, uint32_t options, CollatorRef* collator)
+// Opening an ICU collator means loading and parsing the locale's tailoring,
+// which is far more expensive than a comparison. Configured collators are
+// therefore kept in a small LRU cache keyed by locale and options; users
+// get either the shared instance (for read-only use) or a cheap clone.
+namespace
+{
+	class CollatorCache
+	{
+	public:
+		static CollatorCache& instance()
+		{
+			static CollatorCache cache;
+			return cache;
+		}
+
+		// An empty locale name stands for the default locale
+		std::shared_ptr<const Collator> get(const std::string& locale, uint32_t options)
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			Key key { locale, options };
+
+			auto it = m_map.find(key);
+			if (it != m_map.end())
+			{
+				m_lru.splice(m_lru.begin(), m_lru, it->second);
+				return it->second->second;
+			}
+
+			UErrorCode code = U_ZERO_ERROR;
+			std::shared_ptr<Collator> c(locale.empty()
+				? Collator::createInstance(code)
+				: Collator::createInstance(Locale(locale.c_str()), code));
+
+			if (!c || U_FAILURE(code))
+				return nullptr;
+
+			code = U_ZERO_ERROR;
+			c->setAttribute(UCOL_STRENGTH, optsToColAttr(options), code);
+
+			m_lru.emplace_front(key, c);
+			m_map[key] = m_lru.begin();
+
+			if (m_lru.size() > kCapacity)
+			{
+				m_map.erase(m_lru.back().first);
+				m_lru.pop_back();
+			}
+
+			return c;
+		}
+	private:
+		typedef std::pair<std::string, uint32_t> Key;
+
+		struct KeyHash
+		{
+			size_t operator()(const Key& key) const
+			{
+				return std::hash<std::string>()(key.first) ^ (size_t(key.second) * 0x9e3779b97f4a7c15ull);
+			}
+		};
+
+		static constexpr size_t kCapacity = 16;
+
+		std::mutex m_mutex;
+		std::list<std::pair<Key, std::shared_ptr<const Collator>>> m_lru;
+		std::unordered_map<Key, decltype(m_lru)::iterator, KeyHash> m_map;
+	};
+
+	// What a CollatorRef points to
+	struct CollatorImpl
+	{
+		std::unique_ptr<Collator> collator;
+
+		// Sort keys of recently compared strings. Disabled unless
+		// UC_COLLATION_KEY_CACHE gives the number of entries to keep.
+		size_t keyCacheCapacity;
+		std::mutex keyCacheLock;
+		std::list<std::pair<std::u16string, std::vector<uint8_t>>> keyCacheLRU;
+		std::unordered_map<std::u16string, decltype(keyCacheLRU)::iterator> keyCache;
+	};
+}
+
+static size_t keyCacheCapacity()
+{
+	static size_t capacity = []() -> size_t
+	{
+		const char* value = getenv("UC_COLLATION_KEY_CACHE");
+		return value ? strtoul(value, nullptr, 10) : 0;
+	}();
+	return capacity;
+}
+
+static void getSortKey(const Collator* c, const UniChar* text, unsigned long textlen, std::vector<uint8_t>& key)
+{
+	if (key.size() < 64)
+		key.resize(64);
+
+	int32_t length = c->getSortKey((const UChar*) text, textlen, key.data(), key.size());
+	if (size_t(length) > key.size())
+	{
+		key.resize(length);
+		length = c->getSortKey((const UChar*) text, textlen, key.data(), key.size());
+	}
+	key.resize(length);
+}
+
+// Returns the cached sort key for text, computing it on a miss.
+// The returned reference is only valid while keyCacheLock is held.
+static const std::vector<uint8_t>& cachedSortKey(CollatorImpl* impl, const UniChar* text, unsigned long textlen)
+{
+	std::u16string str((const char16_t*) text, textlen);
+
+	auto it = impl->keyCache.find(str);
+	if (it != impl->keyCache.end())
+	{
+		impl->keyCacheLRU.splice(impl->keyCacheLRU.begin(), impl->keyCacheLRU, it->second);
+		return it->second->second;
+	}
+
+	if (impl->keyCacheLRU.size() >= impl->keyCacheCapacity)
+	{
+		impl->keyCache.erase(impl->keyCacheLRU.back().first);
+		impl->keyCacheLRU.pop_back();
+	}
+
+	impl->keyCacheLRU.emplace_front(str, std::vector<uint8_t>());
+	getSortKey(impl->collator.get(), text, textlen, impl->keyCacheLRU.front().second);
+	impl->keyCache[std::move(str)] = impl->keyCacheLRU.begin();
+
+	return impl->keyCacheLRU.front().second;
+}
+
+static int compareSortKeys(const uint8_t* key1, size_t key1len, const uint8_t* key2, size_t key2len)
+{
+	int rv = memcmp(key1, key2, std::min(key1len, key2len));
+	if (rv != 0)
+		return rv;
+	return (key1len < key2len) ? -1 : (key1len > key2len);
+}
+
+static void setResult(int cmp, Boolean* equiv, int32_t* order)
 {
+	if (equiv != nullptr)
+		*equiv = cmp == 0;
+	
+	if (order != nullptr)
+	{
+		if (cmp > 0)
+			*order = 1;
+		else if (cmp < 0)
+			*order = -1;
+		else
+			*order = 0;
+	}
+}
+
+static OSStatus compareWithCollator(const Collator* c, const UniChar* text1, unsigned long text1len, const UniChar* text2, unsigned long text2len, Boolean* equiv, int32_t* order)
+{
+	UCollationResult result;
 	UErrorCode code = U_ZERO_ERROR;
+	
+	result = c->compare((const UChar*) text1, text1len, (const UChar*) text2, text2len, code);
+	
+	if (code != U_ZERO_ERROR)
+		return -1;
+	
+	setResult(result, equiv, order);
+	return noErr;
+}
+
+OSStatus UCCreateCollator(LocaleRef locale, LocaleOperationVariant opVariant, uint32_t options, CollatorRef* collator)
+{
 	const char* localeStr = Darling::getLocaleString(locale);
-	Collator* c = Collator::createInstance(localeStr, code);
+	std::shared_ptr<const Collator> proto = CollatorCache::instance().get(localeStr, options);
 	
-	*collator = c;
+	*collator = nullptr;
 	
-	if (!c)
+	if (!proto)
 		return paramErr;
 	
-	code = U_ZERO_ERROR;
-	c->setAttribute(UCOL_STRENGTH, optsToColAttr(options), code);
+	CollatorImpl* impl = new CollatorImpl;
+	impl->collator.reset(proto->clone());
+	impl->keyCacheCapacity = keyCacheCapacity();
+	
+	*collator = impl;
 	return noErr;
 }
 
@@ -71,26 +249,20 @@ OSStatus UCGetCollationKey(CollatorRef collator, const UniChar* text, unsigned l
 	if (!text || !actualKeySize || !collationKey || !collator)
 		return paramErr;
 	
-	UnicodeString str1((const char*) text, textlen*2, UNICHAR_ENCODING);
-	Collator* c = static_cast<Collator*>(collator);
-	CollationKey key;
-	UErrorCode code = U_ZERO_ERROR;
-	int32_t count;
-	const uint8_t* data;
+	CollatorImpl* impl = static_cast<CollatorImpl*>(collator);
+	std::vector<uint8_t> key;
 	
 	*actualKeySize = 0;
-	c->getCollationKey(str1, key, code);
+	getSortKey(impl->collator.get(), text, textlen, key);
 	
-	if (code != U_ZERO_ERROR)
+	if (key.empty())
 		return -1;
-	
-	data = key.getByteArray(count);
-	if (count > sizeof(uint32_t)*maxKeySize)
+	if (key.size() > sizeof(uint32_t)*maxKeySize)
 		return kUCOutputBufferTooSmall;
 	
-	*actualKeySize = (count + sizeof(uint32_t) - 1) / sizeof(uint32_t);
-	memset(collationKey, 0, *actualKeySize);
-	memcpy(collationKey, data, count);
+	*actualKeySize = (key.size() + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+	memset(collationKey, 0, *actualKeySize * sizeof(uint32_t));
+	memcpy(collationKey, key.data(), key.size());
 	
 	return noErr;
 }
@@ -99,29 +271,13 @@ OSStatus UCCompareCollationKeys(const uint32_t* key1, unsigned long key1len, con
 {
 	if (!equiv && !order)
 		return paramErr;
+	if ((!key1 && key1len) || (!key2 && key2len))
+		return paramErr;
 	
-	CollationKey ckey1((const uint8_t*)key1, key1len);
-	CollationKey ckey2((const uint8_t*)key2, key2len);
-	UCollationResult result;
-	UErrorCode code = U_ZERO_ERROR;
-	
-	result = ckey1.compareTo(ckey2, code);
-	
-	if (code != U_ZERO_ERROR)
-		return -1;
-	
-	if (equiv != nullptr)
-		*equiv = result == UCOL_EQUAL;
-	
-	if (order != nullptr)
-	{
-		if (result == UCOL_GREATER)
-			*order = 1;
-		else if (result == UCOL_LESS)
-			*order = -1;
-		else
-			*order = 0;
-	}
+	// ICU sort keys are NUL-terminated byte strings and UCGetCollationKey
+	// zero-pads them, so a plain byte comparison gives the collation order
+	setResult(compareSortKeys((const uint8_t*) key1, key1len * sizeof(uint32_t),
+			(const uint8_t*) key2, key2len * sizeof(uint32_t)), equiv, order);
 	
 	return noErr;
 }
@@ -133,66 +289,78 @@ OSStatus UCCompareText(CollatorRef collator, const UniChar* text1, unsigned long
 	if (!text1 || !text2 || !collator)
 		return paramErr;
 	
-	UnicodeString str1((const char*) text1, text1len*2, UNICHAR_ENCODING);
-	UnicodeString str2((const char*) text2, text2len*2, UNICHAR_ENCODING);
-	Collator* c = static_cast<Collator*>(collator);
-	UCollationResult result;
-	UErrorCode code = U_ZERO_ERROR;
-	
-	result = c->compare(str1, str2, code);
-	
-	if (code != U_ZERO_ERROR)
-		return -1;
-	
-	if (equiv != nullptr)
-		*equiv = (result == UCOL_EQUAL);
+	CollatorImpl* impl = static_cast<CollatorImpl*>(collator);
 	
-	if (order != nullptr)
+	if (impl->keyCacheCapacity > 0)
 	{
-		if (result == UCOL_GREATER)
-			*order = 1;
-		else if (result == UCOL_LESS)
-			*order = -1;
-		else
-			*order = 0;
+		std::lock_guard<std::mutex> guard(impl->keyCacheLock);
+		// Copy the first key, computing the second one may evict it
+		std::vector<uint8_t> key1 = cachedSortKey(impl, text1, text1len);
+		const std::vector<uint8_t>& key2 = cachedSortKey(impl, text2, text2len);
+		
+		setResult(compareSortKeys(key1.data(), key1.size(), key2.data(), key2.size()), equiv, order);
+		return noErr;
 	}
 	
-	return noErr;
+	return compareWithCollator(impl->collator.get(), text1, text1len, text2, text2len, equiv, order);
 }
 
 OSStatus UCDisposeCollator(CollatorRef* collator)
 {
-	delete static_cast<Collator*>(*collator);
+	delete static_cast<CollatorImpl*>(*collator);
 	*collator = nullptr;
 	return noErr;
 }
 
 OSStatus UCCompareTextDefault(uint32_t options, const UniChar* text1, unsigned long text1len, const UniChar* text2, unsigned long text2len, Boolean* equiv, int32_t* order)
 {
-	UErrorCode code = U_ZERO_ERROR;
-	Collator* col = Collator::createInstance(code);
-	OSStatus rv;
+	if (!equiv && !order)
+		return paramErr;
+	if (!text1 || !text2)
+		return paramErr;
 	
-	code = U_ZERO_ERROR;
-	col->setAttribute(UCOL_STRENGTH, optsToColAttr(options), code);
-	rv = UCCompareText(col, text1, text1len, text2, text2len, equiv, order);
+	std::shared_ptr<const Collator> col = CollatorCache::instance().get("", options);
+	if (!col)
+		return -1;
 	
-	delete col;
-	return rv;
+	return compareWithCollator(col.get(), text1, text1len, text2, text2len, equiv, order);
 }
 
 OSStatus UCCompareTextNoLocale(uint32_t options, const UniChar* text1, unsigned long text1len, const UniChar* text2, unsigned long text2len, Boolean* equiv, int32_t* order)
 {
-	UErrorCode code = U_ZERO_ERROR;
-	Collator* col = Collator::createInstance(Locale::getRoot(), code); // is getRoot correct?
-	OSStatus rv;
+	if (!equiv && !order)
+		return paramErr;
+	if (!text1 || !text2)
+		return paramErr;
+	
+	std::shared_ptr<const Collator> col = CollatorCache::instance().get("root", options); // is root correct?
+	if (!col)
+		return -1;
 	
-	code = U_ZERO_ERROR;
-	col->setAttribute(UCOL_STRENGTH, optsToColAttr(options), code);
-	rv = UCCompareText(col, text1, text1len, text2, text2len,  equiv, order);
+	return compareWithCollator(col.get(), text1, text1len, text2, text2len, equiv, order);
+}
+
+OSStatus _UCSortText(CollatorRef collator, ItemCount count, const UniChar* const texts[], const unsigned long textlens[], ItemCount outOrder[])
+{
+	if (!collator || (count && (!texts || !textlens || !outOrder)))
+		return paramErr;
 	
-	delete col;
-	return rv;
+	CollatorImpl* impl = static_cast<CollatorImpl*>(collator);
+	std::vector<std::vector<uint8_t>> keys(count);
+	
+	// One sort key per string, then compare the keys bytewise
+	for (ItemCount i = 0; i < count; i++)
+	{
+		getSortKey(impl->collator.get(), texts[i], textlens[i], keys[i]);
+		outOrder[i] = i;
+	}
+	
+	std::stable_sort(outOrder, outOrder + count, [&](ItemCount a, ItemCount b)
+	{
+		return compareSortKeys(keys[a].data(), keys[a].size(), keys[b].data(), keys[b].size()) < 0;
+	});
+	
+	return noErr;
 }
 
 #define shiftKeyBit 9
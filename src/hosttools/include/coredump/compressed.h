@@ -0,0 +1,70 @@
+#ifndef _DARLING_COREDUMP_COMPRESSED_H_
+#define _DARLING_COREDUMP_COMPRESSED_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// compressed cores are a Mach-O core split into fixed-size chunks that are zstd-compressed independently,
+// so they can be compressed in parallel and any part of the core can be read back without decompressing the rest.
+//
+// layout:
+//   struct compressed_core_header
+//   chunk data, in order
+//   struct compressed_core_chunk[chunk_count] (at index_offset)
+//
+// every chunk but the last one holds exactly chunk_size bytes of the core.
+
+#define COMPRESSED_CORE_MAGIC "DARLCORZ"
+#define COMPRESSED_CORE_VERSION 1
+
+#define COMPRESSED_CORE_DEFAULT_CHUNK_SIZE (4 * 1024 * 1024)
+
+struct compressed_core_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t chunk_size;
+	uint64_t uncompressed_size;
+	uint64_t chunk_count;
+	uint64_t index_offset;
+};
+
+enum compressed_core_chunk_type {
+	// zstd frame
+	COMPRESSED_CORE_CHUNK_ZSTD = 0,
+	// stored as-is because it didn't compress
+	COMPRESSED_CORE_CHUNK_RAW = 1,
+	// all zeros; nothing is stored
+	COMPRESSED_CORE_CHUNK_ZERO = 2,
+};
+
+struct compressed_core_chunk {
+	uint64_t offset;
+	uint32_t stored_size;
+	uint32_t type;
+};
+
+struct compressed_writer;
+struct compressed_reader;
+
+// the writer takes ownership of nothing; `fd` must be positioned at the start of an empty file
+struct compressed_writer* compressed_writer_create(int fd, uint32_t chunk_size, unsigned int thread_count, int level);
+bool compressed_writer_write(struct compressed_writer* writer, const void* buffer, size_t size);
+bool compressed_writer_write_zeros(struct compressed_writer* writer, size_t size);
+uint64_t compressed_writer_offset(const struct compressed_writer* writer);
+// writes out the remaining chunks and the index and frees the writer, whether it succeeds or not
+bool compressed_writer_finish(struct compressed_writer* writer);
+
+struct compressed_reader* compressed_reader_open(int fd);
+void compressed_reader_close(struct compressed_reader* reader);
+uint64_t compressed_reader_size(const struct compressed_reader* reader);
+uint32_t compressed_reader_chunk_size(const struct compressed_reader* reader);
+uint64_t compressed_reader_chunk_count(const struct compressed_reader* reader);
+// decompresses a whole chunk into `buffer` (which must hold chunk_size bytes) and returns its length.
+// `is_zero` is set for chunks that were stored as zeros, in which case `buffer` is left untouched.
+ssize_t compressed_reader_read_chunk(struct compressed_reader* reader, uint64_t index, void* buffer, bool* is_zero);
+// reads from the uncompressed core like pread would; safe to call from multiple threads
+ssize_t compressed_reader_pread(struct compressed_reader* reader, void* buffer, size_t size, uint64_t offset);
+
+#endif // _DARLING_COREDUMP_COMPRESSED_H_
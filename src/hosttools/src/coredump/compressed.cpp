@@ -0,0 +1,545 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <zstd.h>
+
+#include <coredump/compressed.h>
+
+// how many chunks each worker thread may have queued or finished-but-unwritten at once
+#define CHUNKS_PER_THREAD 2
+
+struct pending_chunk {
+	char* data;
+	size_t length;
+	char* compressed;
+	size_t compressed_length;
+	uint32_t type;
+	bool done;
+};
+
+struct compressed_writer {
+	int fd;
+	uint32_t chunk_size;
+	size_t compressed_capacity;
+	int level;
+	size_t max_in_flight;
+
+	// uncompressed bytes received so far
+	uint64_t offset;
+	// where the next chunk goes in the file
+	uint64_t file_offset;
+	std::vector<struct compressed_core_chunk> index;
+
+	struct pending_chunk* current;
+	std::vector<struct pending_chunk*> free_chunks;
+	size_t allocated_chunks;
+
+	std::mutex lock;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+	// waiting for a worker
+	std::deque<struct pending_chunk*> queue;
+	// everything that hasn't been written yet, in file order
+	std::deque<struct pending_chunk*> in_flight;
+	bool stopping;
+	bool failed;
+
+	std::vector<std::thread> workers;
+};
+
+static bool write_all(int fd, const void* buffer, size_t size, uint64_t offset) {
+	while (size > 0) {
+		ssize_t written = pwrite(fd, buffer, size, offset);
+		if (written < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			} else {
+				return false;
+			}
+		}
+		size -= written;
+		offset += written;
+		buffer = (const char*)buffer + written;
+	}
+	return true;
+};
+
+static bool read_all(int fd, void* buffer, size_t size, uint64_t offset) {
+	while (size > 0) {
+		ssize_t result = pread(fd, buffer, size, offset);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		} else if (result == 0) {
+			// truncated file
+			errno = EIO;
+			return false;
+		}
+		size -= result;
+		offset += result;
+		buffer = (char*)buffer + result;
+	}
+	return true;
+};
+
+static bool is_all_zeros(const char* data, size_t length) {
+	return length == 0 || (data[0] == 0 && memcmp(data, data + 1, length - 1) == 0);
+};
+
+static void compress_chunk(struct compressed_writer* writer, ZSTD_CCtx* context, struct pending_chunk* chunk) {
+	if (is_all_zeros(chunk->data, chunk->length)) {
+		chunk->type = COMPRESSED_CORE_CHUNK_ZERO;
+		chunk->compressed_length = 0;
+		return;
+	}
+
+	size_t result = ZSTD_compressCCtx(context, chunk->compressed, writer->compressed_capacity, chunk->data, chunk->length, writer->level);
+	if (ZSTD_isError(result) || result >= chunk->length) {
+		// incompressible (or zstd failed, which storing it raw also takes care of)
+		chunk->type = COMPRESSED_CORE_CHUNK_RAW;
+		chunk->compressed_length = chunk->length;
+	} else {
+		chunk->type = COMPRESSED_CORE_CHUNK_ZSTD;
+		chunk->compressed_length = result;
+	}
+};
+
+static void worker_main(struct compressed_writer* writer) {
+	ZSTD_CCtx* context = ZSTD_createCCtx();
+	std::unique_lock<std::mutex> guard(writer->lock);
+
+	while (true) {
+		writer->work_available.wait(guard, [writer] { return writer->stopping || !writer->queue.empty(); });
+		if (writer->queue.empty())
+			break;
+
+		struct pending_chunk* chunk = writer->queue.front();
+		writer->queue.pop_front();
+
+		guard.unlock();
+		if (context) {
+			compress_chunk(writer, context, chunk);
+		} else {
+			chunk->type = is_all_zeros(chunk->data, chunk->length) ? COMPRESSED_CORE_CHUNK_ZERO : COMPRESSED_CORE_CHUNK_RAW;
+			chunk->compressed_length = (chunk->type == COMPRESSED_CORE_CHUNK_RAW) ? chunk->length : 0;
+		}
+		guard.lock();
+
+		chunk->done = true;
+		writer->work_done.notify_all();
+	}
+
+	ZSTD_freeCCtx(context);
+};
+
+// called without the lock held; only the thread feeding the writer ever writes to the file
+static bool write_chunk(struct compressed_writer* writer, struct pending_chunk* chunk) {
+	struct compressed_core_chunk entry;
+
+	entry.offset = writer->file_offset;
+	entry.stored_size = chunk->compressed_length;
+	entry.type = chunk->type;
+
+	if (chunk->type != COMPRESSED_CORE_CHUNK_ZERO) {
+		const char* source = (chunk->type == COMPRESSED_CORE_CHUNK_RAW) ? chunk->data : chunk->compressed;
+		if (!write_all(writer->fd, source, chunk->compressed_length, writer->file_offset)) {
+			perror("write");
+			return false;
+		}
+		writer->file_offset += chunk->compressed_length;
+	}
+
+	writer->index.push_back(entry);
+	return true;
+};
+
+// writes out finished chunks in order, waiting for unfinished ones until no more than `keep` chunks are left in flight
+static bool drain_chunks(struct compressed_writer* writer, size_t keep) {
+	std::unique_lock<std::mutex> guard(writer->lock);
+
+	if (writer->failed)
+		return false;
+
+	while (!writer->in_flight.empty()) {
+		struct pending_chunk* chunk = writer->in_flight.front();
+
+		if (!chunk->done) {
+			if (writer->in_flight.size() <= keep)
+				break;
+			writer->work_done.wait(guard, [chunk] { return chunk->done; });
+		}
+
+		writer->in_flight.pop_front();
+		guard.unlock();
+		bool ok = write_chunk(writer, chunk);
+		guard.lock();
+
+		writer->free_chunks.push_back(chunk);
+		if (!ok) {
+			writer->failed = true;
+			return false;
+		}
+	}
+
+	return true;
+};
+
+static struct pending_chunk* get_chunk(struct compressed_writer* writer) {
+	std::unique_lock<std::mutex> guard(writer->lock);
+
+	// one more than can be in flight, for the one being filled
+	if (writer->free_chunks.empty() && writer->allocated_chunks <= writer->max_in_flight) {
+		struct pending_chunk* chunk = (struct pending_chunk*)calloc(1, sizeof(*chunk));
+		if (chunk) {
+			chunk->data = (char*)malloc(writer->chunk_size);
+			chunk->compressed = (char*)malloc(writer->compressed_capacity);
+			if (!chunk->data || !chunk->compressed) {
+				free(chunk->data);
+				free(chunk->compressed);
+				free(chunk);
+			} else {
+				++writer->allocated_chunks;
+				writer->free_chunks.push_back(chunk);
+			}
+		}
+	}
+
+	while (writer->free_chunks.empty()) {
+		if (writer->in_flight.empty()) {
+			fprintf(stderr, "Failed to allocate compression buffers\n");
+			return NULL;
+		}
+
+		// wait for the oldest chunk to be written out
+		size_t keep = writer->in_flight.size() - 1;
+		guard.unlock();
+		if (!drain_chunks(writer, keep))
+			return NULL;
+		guard.lock();
+	}
+
+	struct pending_chunk* chunk = writer->free_chunks.back();
+	writer->free_chunks.pop_back();
+	chunk->length = 0;
+	chunk->compressed_length = 0;
+	chunk->done = false;
+	return chunk;
+};
+
+static bool submit_chunk(struct compressed_writer* writer, struct pending_chunk* chunk, bool compress) {
+	{
+		std::lock_guard<std::mutex> guard(writer->lock);
+		writer->in_flight.push_back(chunk);
+		if (compress) {
+			writer->queue.push_back(chunk);
+			writer->work_available.notify_one();
+		} else {
+			chunk->done = true;
+		}
+	}
+	return drain_chunks(writer, writer->max_in_flight - 1);
+};
+
+struct compressed_writer* compressed_writer_create(int fd, uint32_t chunk_size, unsigned int thread_count, int level) {
+	if (thread_count == 0) {
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	struct compressed_writer* writer = new struct compressed_writer();
+	writer->fd = fd;
+	writer->chunk_size = chunk_size;
+	writer->compressed_capacity = ZSTD_compressBound(chunk_size);
+	writer->level = level;
+	writer->max_in_flight = thread_count * CHUNKS_PER_THREAD;
+	writer->offset = 0;
+	writer->file_offset = sizeof(struct compressed_core_header);
+	writer->current = NULL;
+	writer->allocated_chunks = 0;
+	writer->stopping = false;
+	writer->failed = false;
+
+	for (unsigned int i = 0; i < thread_count; ++i) {
+		writer->workers.emplace_back(worker_main, writer);
+	}
+
+	return writer;
+};
+
+bool compressed_writer_write(struct compressed_writer* writer, const void* buffer, size_t size) {
+	while (size > 0) {
+		if (!writer->current) {
+			writer->current = get_chunk(writer);
+			if (!writer->current)
+				return false;
+		}
+
+		struct pending_chunk* chunk = writer->current;
+		size_t length = std::min(size, (size_t)writer->chunk_size - chunk->length);
+
+		if (buffer) {
+			memcpy(chunk->data + chunk->length, buffer, length);
+			buffer = (const char*)buffer + length;
+		} else {
+			memset(chunk->data + chunk->length, 0, length);
+		}
+		chunk->length += length;
+		writer->offset += length;
+		size -= length;
+
+		if (chunk->length == writer->chunk_size) {
+			writer->current = NULL;
+			if (!submit_chunk(writer, chunk, true))
+				return false;
+		}
+	}
+	return true;
+};
+
+bool compressed_writer_write_zeros(struct compressed_writer* writer, size_t size) {
+	// top off the current chunk first
+	if (writer->current) {
+		size_t length = std::min(size, (size_t)writer->chunk_size - writer->current->length);
+		if (!compressed_writer_write(writer, NULL, length))
+			return false;
+		size -= length;
+	}
+
+	// whole chunks of zeros don't need to go through the workers
+	while (size >= writer->chunk_size) {
+		struct pending_chunk* chunk = get_chunk(writer);
+		if (!chunk)
+			return false;
+		chunk->length = writer->chunk_size;
+		chunk->type = COMPRESSED_CORE_CHUNK_ZERO;
+		writer->offset += writer->chunk_size;
+		size -= writer->chunk_size;
+		if (!submit_chunk(writer, chunk, false))
+			return false;
+	}
+
+	return compressed_writer_write(writer, NULL, size);
+};
+
+uint64_t compressed_writer_offset(const struct compressed_writer* writer) {
+	return writer->offset;
+};
+
+bool compressed_writer_finish(struct compressed_writer* writer) {
+	bool ok = !writer->failed;
+
+	if (ok && writer->current) {
+		ok = submit_chunk(writer, writer->current, true);
+		writer->current = NULL;
+	}
+
+	if (ok) {
+		ok = drain_chunks(writer, 0);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(writer->lock);
+		writer->stopping = true;
+		writer->work_available.notify_all();
+	}
+	for (std::thread& worker : writer->workers) {
+		worker.join();
+	}
+
+	if (ok) {
+		struct compressed_core_header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, COMPRESSED_CORE_MAGIC, sizeof(header.magic));
+		header.version = COMPRESSED_CORE_VERSION;
+		header.chunk_size = writer->chunk_size;
+		header.uncompressed_size = writer->offset;
+		header.chunk_count = writer->index.size();
+		header.index_offset = writer->file_offset;
+
+		if (
+			!write_all(writer->fd, writer->index.data(), writer->index.size() * sizeof(struct compressed_core_chunk), header.index_offset) ||
+			!write_all(writer->fd, &header, sizeof(header), 0) ||
+			ftruncate(writer->fd, header.index_offset + writer->index.size() * sizeof(struct compressed_core_chunk)) < 0
+		) {
+			perror("write");
+			ok = false;
+		}
+	}
+
+	if (writer->current) {
+		writer->free_chunks.push_back(writer->current);
+	}
+	// left over after a failure; the workers are gone, so nothing else refers to them
+	for (struct pending_chunk* chunk : writer->in_flight) {
+		writer->free_chunks.push_back(chunk);
+	}
+	for (struct pending_chunk* chunk : writer->free_chunks) {
+		free(chunk->data);
+		free(chunk->compressed);
+		free(chunk);
+	}
+
+	delete writer;
+	return ok;
+};
+
+struct compressed_reader {
+	int fd;
+	struct compressed_core_header header;
+	std::vector<struct compressed_core_chunk> index;
+};
+
+// per-thread scratch space, so that reads from several threads don't need a lock
+struct reader_scratch {
+	ZSTD_DCtx* context = NULL;
+	std::vector<char> compressed;
+	std::vector<char> chunk;
+
+	~reader_scratch() {
+		ZSTD_freeDCtx(context);
+	};
+};
+
+static thread_local struct reader_scratch scratch;
+
+struct compressed_reader* compressed_reader_open(int fd) {
+	struct compressed_core_header header;
+
+	if (!read_all(fd, &header, sizeof(header), 0))
+		return NULL;
+
+	if (memcmp(header.magic, COMPRESSED_CORE_MAGIC, sizeof(header.magic)) != 0 || header.version != COMPRESSED_CORE_VERSION || header.chunk_size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (header.chunk_count != (header.uncompressed_size + header.chunk_size - 1) / header.chunk_size || header.chunk_count > SIZE_MAX / sizeof(struct compressed_core_chunk)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct compressed_reader* reader = new struct compressed_reader();
+	reader->fd = fd;
+	reader->header = header;
+	reader->index.resize(header.chunk_count);
+
+	if (!read_all(fd, reader->index.data(), header.chunk_count * sizeof(struct compressed_core_chunk), header.index_offset)) {
+		delete reader;
+		return NULL;
+	}
+
+	return reader;
+};
+
+void compressed_reader_close(struct compressed_reader* reader) {
+	delete reader;
+};
+
+uint64_t compressed_reader_size(const struct compressed_reader* reader) {
+	return reader->header.uncompressed_size;
+};
+
+uint32_t compressed_reader_chunk_size(const struct compressed_reader* reader) {
+	return reader->header.chunk_size;
+};
+
+uint64_t compressed_reader_chunk_count(const struct compressed_reader* reader) {
+	return reader->header.chunk_count;
+};
+
+ssize_t compressed_reader_read_chunk(struct compressed_reader* reader, uint64_t index, void* buffer, bool* is_zero) {
+	if (index >= reader->header.chunk_count) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const struct compressed_core_chunk* entry = &reader->index[index];
+	size_t length = std::min<uint64_t>(reader->header.chunk_size, reader->header.uncompressed_size - index * reader->header.chunk_size);
+
+	*is_zero = false;
+
+	switch (entry->type) {
+		case COMPRESSED_CORE_CHUNK_ZERO:
+			*is_zero = true;
+			return length;
+
+		case COMPRESSED_CORE_CHUNK_RAW:
+			if (entry->stored_size != length) {
+				errno = EIO;
+				return -1;
+			}
+			if (!read_all(reader->fd, buffer, length, entry->offset))
+				return -1;
+			return length;
+
+		case COMPRESSED_CORE_CHUNK_ZSTD: {
+			if (!scratch.context) {
+				scratch.context = ZSTD_createDCtx();
+				if (!scratch.context) {
+					errno = ENOMEM;
+					return -1;
+				}
+			}
+			scratch.compressed.resize(entry->stored_size);
+			if (!read_all(reader->fd, scratch.compressed.data(), entry->stored_size, entry->offset))
+				return -1;
+			size_t result = ZSTD_decompressDCtx(scratch.context, buffer, reader->header.chunk_size, scratch.compressed.data(), entry->stored_size);
+			if (ZSTD_isError(result) || result != length) {
+				errno = EIO;
+				return -1;
+			}
+			return length;
+		}
+
+		default:
+			errno = EIO;
+			return -1;
+	}
+};
+
+ssize_t compressed_reader_pread(struct compressed_reader* reader, void* buffer, size_t size, uint64_t offset) {
+	const uint32_t chunk_size = reader->header.chunk_size;
+	size_t done = 0;
+
+	if (offset >= reader->header.uncompressed_size)
+		return 0;
+	size = std::min<uint64_t>(size, reader->header.uncompressed_size - offset);
+
+	while (done < size) {
+		uint64_t index = offset / chunk_size;
+		size_t chunk_offset = offset % chunk_size;
+		size_t length = std::min<uint64_t>(size - done, chunk_size - chunk_offset);
+		char* destination = (char*)buffer + done;
+		bool is_zero;
+
+		if (chunk_offset == 0 && length == chunk_size) {
+			// the whole chunk is wanted, so decompress it in place
+			if (compressed_reader_read_chunk(reader, index, destination, &is_zero) < 0)
+				return -1;
+		} else {
+			scratch.chunk.resize(chunk_size);
+			if (compressed_reader_read_chunk(reader, index, scratch.chunk.data(), &is_zero) < 0)
+				return -1;
+			if (!is_zero)
+				memcpy(destination, scratch.chunk.data() + chunk_offset, length);
+		}
+
+		if (is_zero)
+			memset(destination, 0, length);
+
+		done += length;
+		offset += length;
+	}
+
+	return done;
+};
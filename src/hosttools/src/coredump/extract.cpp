@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <coredump/compressed.h>
+
+// turns a compressed core written by `darling-coredump --compress` back into a plain Mach-O core that LLDB can load
+
+static void print_usage(const char* program) {
+	fprintf(stderr, "Usage: %s [--sparse] [--threads N] <compressed-coredump> <output-coredump>\n", program);
+	fprintf(stderr, "  -s, --sparse       leave zero-filled chunks as holes in the output\n");
+	fprintf(stderr, "  -j, --threads N    decompress with N threads (default: one per CPU)\n");
+};
+
+struct extract_params {
+	struct compressed_reader* reader;
+	int output;
+	bool sparse;
+	const char* zeros;
+	std::atomic<uint64_t> next_chunk;
+	std::atomic<bool> failed;
+};
+
+static bool write_all(int fd, const void* buffer, size_t size, uint64_t offset) {
+	while (size > 0) {
+		ssize_t written = pwrite(fd, buffer, size, offset);
+		if (written < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+				continue;
+			} else {
+				return false;
+			}
+		}
+		size -= written;
+		offset += written;
+		buffer = (const char*)buffer + written;
+	}
+	return true;
+};
+
+// chunks are independent, so each thread just takes the next one and writes it where it belongs
+static void extract_chunks(struct extract_params* params) {
+	const uint32_t chunk_size = compressed_reader_chunk_size(params->reader);
+	const uint64_t chunk_count = compressed_reader_chunk_count(params->reader);
+	std::vector<char> buffer(chunk_size);
+
+	while (!params->failed) {
+		uint64_t index = params->next_chunk++;
+		if (index >= chunk_count)
+			break;
+
+		bool is_zero;
+		ssize_t length = compressed_reader_read_chunk(params->reader, index, buffer.data(), &is_zero);
+		if (length < 0) {
+			fprintf(stderr, "Failed to read chunk %lu: %s\n", index, strerror(errno));
+			params->failed = true;
+			break;
+		}
+
+		if (is_zero && params->sparse)
+			continue;
+
+		if (!write_all(params->output, is_zero ? params->zeros : buffer.data(), length, index * chunk_size)) {
+			perror("write");
+			params->failed = true;
+			break;
+		}
+	}
+};
+
+int main(int argc, char** argv) {
+	static const struct option long_options[] = {
+		{ "sparse", no_argument, NULL, 's' },
+		{ "threads", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 },
+	};
+	const char* program = (argc > 0 ? argv[0] : "darling-coredump-extract");
+	bool sparse = false;
+	unsigned int thread_count = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "sj:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 's':
+				sparse = true;
+				break;
+			case 'j':
+				thread_count = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				print_usage(program);
+				return 1;
+		}
+	}
+
+	if (argc - optind != 2) {
+		print_usage(program);
+		return 1;
+	}
+
+	int input = open(argv[optind], O_RDONLY);
+	if (input < 0) {
+		perror("open input");
+		return 1;
+	}
+
+	struct compressed_reader* reader = compressed_reader_open(input);
+	if (!reader) {
+		if (errno == EINVAL) {
+			fprintf(stderr, "Input file is not a compressed corefile\n");
+		} else {
+			perror("read input");
+		}
+		return 1;
+	}
+
+	int output = open(argv[optind + 1], O_WRONLY | O_TRUNC | O_CREAT, 0644);
+	if (output < 0) {
+		perror("open output");
+		return 1;
+	}
+
+	if (thread_count == 0) {
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+	thread_count = std::min<uint64_t>(thread_count, std::max<uint64_t>(1, compressed_reader_chunk_count(reader)));
+
+	struct extract_params params;
+	params.reader = reader;
+	params.output = output;
+	params.sparse = sparse;
+	params.next_chunk = 0;
+	params.failed = false;
+
+	char* zeros = NULL;
+	if (!sparse) {
+		zeros = (char*)calloc(1, compressed_reader_chunk_size(reader));
+		if (!zeros) {
+			perror("calloc");
+			return 1;
+		}
+	}
+	params.zeros = zeros;
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < thread_count; ++i) {
+		workers.emplace_back(extract_chunks, &params);
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	if (params.failed)
+		return 1;
+
+	// trailing zero chunks are never written in sparse mode
+	if (ftruncate(output, compressed_reader_size(reader)) < 0) {
+		perror("ftruncate");
+		return 1;
+	}
+
+	free(zeros);
+	compressed_reader_close(reader);
+	close(output);
+	close(input);
+
+	return 0;
+};
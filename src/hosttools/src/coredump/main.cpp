@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <filesystem>
 
 #include <stdio.h>
@@ -11,6 +12,7 @@
 #include <sys/stat.h>
 #include <pwd.h>
 #include <libgen.h>
+#include <getopt.h>
 
 #include <mach-o/loader.h>
 #include <elf.h>
@@ -18,6 +20,9 @@
 #include <linux/time_types.h>
 
 #include <coredump/x86_64.h>
+#if DARLING_COREDUMP_COMPRESSION
+	#include <coredump/compressed.h>
+#endif
 
 #include <darling-config.h>
 
@@ -33,6 +38,12 @@
 	#define INVALIDATE_DEVICES 0
 #endif
 
+#ifndef DARLING_COREDUMP_COMPRESSION
+	#define DARLING_COREDUMP_COMPRESSION 0
+#endif
+
+#define DEFAULT_COMPRESSION_LEVEL 3
+
 // interestingly enough, there are no existing tools that can perform this conversion (ELF coredump to Mach-O coredump).
 // neither objcopy nor llvm-objcopy support Mach-O conversion like that, nor does objconv (it considers coredumps to be executables and refuses to operate on them).
 // porting our existing code from the LKM is simple enough, so that's what we do here.
@@ -198,6 +209,12 @@ struct coredump_params {
 	const char* main_executable_path;
 	size_t main_executable_path_length;
 	bool is_64_bit;
+	// leave holes in the output instead of writing out zeros
+	bool sparse;
+#if DARLING_COREDUMP_COMPRESSION
+	// if set, everything goes through here instead of straight to output_corefile
+	struct compressed_writer* compressed;
+#endif
 };
 
 static char default_output_name[4096];
@@ -207,10 +224,6 @@ static uint64_t round_up_pow2(uint64_t number, uint64_t multiple) {
 	return (number + (multiple - 1)) & -multiple;
 };
 
-static uint64_t round_down_pow2(uint64_t number, uint64_t multiple) {
-	return (number) & -multiple;
-};
-
 static const char* note_name(const struct coredump_params* cprm, const union Elf_Nhdr* note) {
 	return (const char*)note + (cprm->is_64_bit ? sizeof(note->elf64) : sizeof(note->elf64));
 };
@@ -274,14 +287,66 @@ static int open_file(struct coredump_params* cprm, const char* filename, size_t
 
 void macho_coredump(struct coredump_params* cprm);
 
+static void print_usage(const char* program) {
+	fprintf(stderr, "Usage: %s [--sparse] [--compress[=LEVEL]] [--threads N] <input-coredump> [output-coredump]\n", program);
+	fprintf(stderr, "  -s, --sparse            leave zero-filled ranges as holes in the output (smaller and faster, but some LLDB versions mishandle them)\n");
+#if DARLING_COREDUMP_COMPRESSION
+	fprintf(stderr, "  -z, --compress[=LEVEL]  write a chunked zstd-compressed core (level %d by default); use darling-coredump-extract to get a plain core back\n", DEFAULT_COMPRESSION_LEVEL);
+	fprintf(stderr, "  -j, --threads N         compress with N threads (default: one per CPU)\n");
+#endif
+};
+
 int main(int argc, char** argv) {
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s <input-coredump> [output-coredump]\n", (argc > 0 ? argv[0] : "darling-coredump"));
+	static const struct option long_options[] = {
+		{ "sparse", no_argument, NULL, 's' },
+		{ "compress", optional_argument, NULL, 'z' },
+		{ "threads", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct coredump_params cprm = {0};
+	bool compress = false;
+	int compression_level = DEFAULT_COMPRESSION_LEVEL;
+	unsigned int thread_count = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "sz::j:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 's':
+				cprm.sparse = true;
+				break;
+			case 'z':
+				compress = true;
+				if (optarg)
+					compression_level = atoi(optarg);
+				break;
+			case 'j':
+				thread_count = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				print_usage(argc > 0 ? argv[0] : "darling-coredump");
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		print_usage(argc > 0 ? argv[0] : "darling-coredump");
 		return 1;
 	}
 
-	char *tmp_output_dirname = strdup(argv[1]);
-	char *tmp_output_basename = strdup(argv[1]);
+#if !DARLING_COREDUMP_COMPRESSION
+	if (compress) {
+		fprintf(stderr, "darling-coredump was built without compression support (libzstd was not found)\n");
+		return 1;
+	}
+	(void)compression_level;
+	(void)thread_count;
+#endif
+
+	const char* input_path = argv[optind];
+	const char* output_path = (optind + 1 < argc) ? argv[optind + 1] : default_output_name;
+
+	char *tmp_output_dirname = strdup(input_path);
+	char *tmp_output_basename = strdup(input_path);
 	if (snprintf(default_output_name, sizeof(default_output_name), "%s/darlingcore-%s", dirname(tmp_output_dirname), basename(tmp_output_basename)) < 0) {
 		perror("snprintf");
 		return 1;
@@ -303,8 +368,6 @@ int main(int argc, char** argv) {
 		return 1;
 	}
 
-	struct coredump_params cprm = {0};
-
 	cprm.prefix = getenv("DPREFIX");
 
 	if (!cprm.prefix) {
@@ -313,7 +376,7 @@ int main(int argc, char** argv) {
 
 	cprm.prefix_length = strlen(cprm.prefix);
 
-	cprm.input_corefile = open(argv[1], O_RDONLY);
+	cprm.input_corefile = open(input_path, O_RDONLY);
 	if (cprm.input_corefile < 0) {
 		perror("open input");
 		return 1;
@@ -327,12 +390,18 @@ int main(int argc, char** argv) {
 	cprm.input_corefile_size = input_corefile_stats.st_size;
 	cprm.input_corefile_mapping = mmap(NULL, cprm.input_corefile_size, PROT_READ, MAP_PRIVATE, cprm.input_corefile, 0);
 
-	cprm.output_corefile = open((argc > 2 ? argv[2] : default_output_name), O_WRONLY | O_TRUNC | O_CREAT, 0644);
+	cprm.output_corefile = open(output_path, O_WRONLY | O_TRUNC | O_CREAT, 0644);
 	if (cprm.output_corefile < 0) {
 		perror("open output");
 		return 1;
 	}
 
+#if DARLING_COREDUMP_COMPRESSION
+	if (compress) {
+		cprm.compressed = compressed_writer_create(cprm.output_corefile, COMPRESSED_CORE_DEFAULT_CHUNK_SIZE, thread_count, compression_level);
+	}
+#endif
+
 	cprm.universal_header = (const struct elf_universal_header*)cprm.input_corefile_mapping;
 
 	if (
@@ -638,6 +707,11 @@ int main(int argc, char** argv) {
 };
 
 static bool dump_emit(struct coredump_params* cprm, const void* buffer, size_t buffer_size) {
+#if DARLING_COREDUMP_COMPRESSION
+	if (cprm->compressed)
+		return compressed_writer_write(cprm->compressed, buffer, buffer_size);
+#endif
+
 	while (buffer_size > 0) {
 		ssize_t written = write(cprm->output_corefile, buffer, buffer_size);
 		if (written < 0) {
@@ -654,15 +728,37 @@ static bool dump_emit(struct coredump_params* cprm, const void* buffer, size_t b
 	return true;
 };
 
+// the output is only ever appended to, so everything past the current offset is past the end of the file
 static bool dump_skip(struct coredump_params* cprm, size_t size) {
-	// leaving holes seems to confuse LLDB
-#if 0
-	if (lseek(cprm->output_corefile, size, SEEK_CUR) < 0) {
-		perror("lseek");
-		return false;
+	if (size == 0)
+		return true;
+
+#if DARLING_COREDUMP_COMPRESSION
+	if (cprm->compressed)
+		return compressed_writer_write_zeros(cprm->compressed, size);
+#endif
+
+	if (cprm->sparse) {
+		// the hole is filled in by the next write or by the final `dump_finish`
+		if (lseek(cprm->output_corefile, size, SEEK_CUR) < 0) {
+			perror("lseek");
+			return false;
+		}
+		return true;
 	}
-#else
-	static char zeros[4096];
+
+	// leaving holes seems to confuse LLDB, so allocate zeroed blocks instead of writing zeros ourselves
+	off_t offset = lseek(cprm->output_corefile, 0, SEEK_CUR);
+	if (offset >= 0 && fallocate(cprm->output_corefile, 0, offset, size) == 0) {
+		if (lseek(cprm->output_corefile, size, SEEK_CUR) < 0) {
+			perror("lseek");
+			return false;
+		}
+		return true;
+	}
+
+	// not every filesystem supports fallocate
+	static char zeros[1024 * 1024];
 	while (sizeof(zeros) < size) {
 		if (!dump_emit(cprm, zeros, sizeof(zeros)))
 			return false;
@@ -670,11 +766,112 @@ static bool dump_skip(struct coredump_params* cprm, size_t size) {
 	}
 	if (!dump_emit(cprm, zeros, size))
 		return false;
+	return true;
+};
+
+// copies data from `fd` to the output; returns how much was copied, which is less than `size` only at the end of the input
+static ssize_t dump_copy_range(struct coredump_params* cprm, int fd, off_t offset, size_t size) {
+	static char buffer[1024 * 1024];
+	static bool copy_file_range_unsupported = false;
+	bool use_copy_file_range = !copy_file_range_unsupported;
+	size_t copied = 0;
+
+#if DARLING_COREDUMP_COMPRESSION
+	// the data has to pass through the compressor anyways
+	if (cprm->compressed)
+		use_copy_file_range = false;
 #endif
+
+	while (copied < size && use_copy_file_range) {
+		ssize_t result = copy_file_range(fd, &offset, cprm->output_corefile, NULL, size - copied, 0);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+				// older kernels can't copy across filesystems, and some filesystems can't do it at all
+				copy_file_range_unsupported = true;
+				break;
+			} else {
+				perror("copy_file_range");
+				return -1;
+			}
+		} else if (result == 0) {
+			return copied;
+		}
+		copied += result;
+	}
+
+	while (copied < size) {
+		ssize_t result = pread(fd, buffer, std::min(size - copied, sizeof(buffer)), offset);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pread");
+			return -1;
+		} else if (result == 0) {
+			break;
+		}
+		if (!dump_emit(cprm, buffer, result))
+			return -1;
+		offset += result;
+		copied += result;
+	}
+
+	return copied;
+};
+
+// copies `size` bytes at `offset` in `fd` to the output, zero-filling anything past the end of the input.
+// in sparse mode, holes in the input (the kernel leaves them for untouched pages) stay holes in the output.
+// compressed output does the same, because zeros cost nothing there.
+static bool dump_copy(struct coredump_params* cprm, int fd, off_t offset, size_t size) {
+	bool skip_holes = cprm->sparse;
+
+#if DARLING_COREDUMP_COMPRESSION
+	skip_holes = skip_holes || cprm->compressed;
+#endif
+
+	while (size > 0) {
+		size_t chunk = size;
+
+		if (skip_holes) {
+			off_t data = lseek(fd, offset, SEEK_DATA);
+			if (data < 0 && errno == ENXIO) {
+				// nothing but holes up to the end of the input
+				return dump_skip(cprm, size);
+			} else if (data >= 0) {
+				if ((uint64_t)(data - offset) >= size)
+					return dump_skip(cprm, size);
+				if (!dump_skip(cprm, data - offset))
+					return false;
+				size -= data - offset;
+				offset = data;
+
+				off_t hole = lseek(fd, offset, SEEK_HOLE);
+				if (hole > offset && (uint64_t)(hole - offset) < size)
+					chunk = hole - offset;
+				else
+					chunk = size;
+			}
+			// if SEEK_DATA isn't supported, just copy everything
+		}
+
+		ssize_t copied = dump_copy_range(cprm, fd, offset, chunk);
+		if (copied < 0)
+			return false;
+		if ((size_t)copied < chunk)
+			return dump_skip(cprm, size - copied);
+
+		offset += copied;
+		size -= copied;
+	}
 	return true;
 };
 
 static uint64_t dump_offset_get(struct coredump_params* cprm) {
+#if DARLING_COREDUMP_COMPRESSION
+	if (cprm->compressed)
+		return compressed_writer_offset(cprm->compressed);
+#endif
 	return lseek(cprm->output_corefile, 0, SEEK_CUR);
 };
 
@@ -684,6 +881,23 @@ static bool dump_align(struct coredump_params* cprm, size_t alignment) {
 	return dump_skip(cprm, aligned - offset);
 };
 
+// a hole at the very end only exists once the file is extended over it
+static bool dump_finish(struct coredump_params* cprm) {
+#if DARLING_COREDUMP_COMPRESSION
+	if (cprm->compressed) {
+		bool ok = compressed_writer_finish(cprm->compressed);
+		cprm->compressed = NULL;
+		return ok;
+	}
+#endif
+
+	if (ftruncate(cprm->output_corefile, dump_offset_get(cprm)) < 0) {
+		perror("ftruncate");
+		return false;
+	}
+	return true;
+};
+
 // the following coredump code has been imported from the LKM and adapted for use in userspace
 
 struct thread_flavor
@@ -1072,6 +1286,9 @@ void macho_coredump(struct coredump_params* cprm)
 	if (!dump_align(cprm, align_page_size))
 		exit(EXIT_FAILURE);
 
+	const char* cached_filename = NULL;
+	int cached_fd = -1;
+
 	// Inspired by elf_core_dump()
 	for (size_t i = 0; i < cprm->vm_area_count; ++i) {
 		const struct vm_area* vma = &cprm->vm_areas[i];
@@ -1106,37 +1323,28 @@ void macho_coredump(struct coredump_params* cprm)
 				continue;
 			}
 
-			int fd = open_file(cprm, vma->filename, vma->filename_length);
-			if (fd < 0) {
-				fprintf(stderr, "Warning: failed to open %s: %d (%s)\n", vma->filename, errno, strerror(errno));
+			// consecutive regions usually come from the same file, so keep it open between them
+			if (!cached_filename || strcmp(cached_filename, vma->filename) != 0) {
+				if (cached_fd >= 0)
+					close(cached_fd);
+				cached_filename = vma->filename;
+				cached_fd = open_file(cprm, vma->filename, vma->filename_length);
+				if (cached_fd < 0) {
+					fprintf(stderr, "Warning: failed to open %s: %d (%s)\n", vma->filename, errno, strerror(errno));
+				}
+			}
+
+			if (cached_fd < 0) {
 				//exit(EXIT_FAILURE);
 				// just zero it out
 				if (!dump_skip(cprm, vma->file_size)) {
 					exit(EXIT_FAILURE);
 				}
-				continue;
-			}
-
-			uintptr_t aligned_offset = round_down_pow2(vma->file_offset, sysconf(_SC_PAGESIZE));
-			size_t aligned_size = round_up_pow2(vma->file_size + (vma->file_offset - aligned_offset), sysconf(_SC_PAGESIZE));
-			void* mapping = mmap(NULL, aligned_size, PROT_READ, MAP_PRIVATE, fd, aligned_offset);
-			if (mapping == MAP_FAILED) {
-				perror("mmap");
+			} else if (!dump_copy(cprm, cached_fd, vma->file_offset, vma->file_size)) {
 				exit(EXIT_FAILURE);
 			}
-			const void* start = (const char*)mapping + (vma->file_offset - aligned_offset);
-
-			if (!dump_emit(cprm, start, vma->file_size))
-				exit(EXIT_FAILURE);
-
-			if (munmap(mapping, aligned_size) < 0) {
-				perror("munmap");
-				exit(EXIT_FAILURE);
-			}
-
-			close(fd);
 		} else {
-			if (!dump_emit(cprm, (const char*)cprm->input_corefile_mapping + vma->file_offset, vma->file_size))
+			if (!dump_copy(cprm, cprm->input_corefile, vma->file_offset, vma->file_size))
 				exit(EXIT_FAILURE);
 		}
 
@@ -1150,4 +1358,10 @@ void macho_coredump(struct coredump_params* cprm)
 		if (!dump_align(cprm, align_page_size))
 			exit(EXIT_FAILURE);
 	}
+
+	if (cached_fd >= 0)
+		close(cached_fd);
+
+	if (!dump_finish(cprm))
+		exit(EXIT_FAILURE);
 }
@@ -20,42 +20,79 @@
 #ifndef _CACHE_CACHE_H_
 #define _CACHE_CACHE_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void* cache_create(void);
-void* cache_destroy(void);
+typedef struct cache_s cache_t;
+
+typedef uintptr_t (*cache_key_hash_cb_t)(void* key, void* user_data);
+typedef bool (*cache_key_is_equal_cb_t)(void* key1, void* key2, void* user_data);
+typedef void (*cache_key_retain_cb_t)(void* key_in, void** key_out, void* user_data);
+typedef void (*cache_release_cb_t)(void* key_or_value, void* user_data);
+typedef void (*cache_value_retain_cb_t)(void* value, void* user_data);
+typedef bool (*cache_value_make_nonpurgeable_cb_t)(void* value, void* user_data);
+typedef void (*cache_value_make_purgeable_cb_t)(void* value, void* user_data);
+
+#define CACHE_ATTRIBUTES_VERSION_1 1
+#define CACHE_ATTRIBUTES_VERSION_2 2
+
+typedef struct cache_attributes_s {
+	uint32_t version;
+	cache_key_hash_cb_t key_hash_cb;
+	cache_key_is_equal_cb_t key_is_equal_cb;
+	cache_key_retain_cb_t key_retain_cb;
+	cache_release_cb_t key_release_cb;
+	cache_release_cb_t value_release_cb;
+	cache_value_make_nonpurgeable_cb_t value_make_nonpurgeable_cb;
+	cache_value_make_purgeable_cb_t value_make_purgeable_cb;
+	void* user_data;
+
+	// CACHE_ATTRIBUTES_VERSION_2
+	cache_value_retain_cb_t value_retain_cb;
+} cache_attributes_t;
+
+int cache_create(const char* name, cache_attributes_t* attrs, cache_t** cache_out);
+int cache_destroy(cache_t* cache);
+int cache_set_and_retain(cache_t* cache, void* key, void* value, size_t cost);
+int cache_get_and_retain(cache_t* cache, void* key, void** value_out);
+int cache_release_value(cache_t* cache, void* value);
+int cache_remove(cache_t* cache, void* key);
+int cache_remove_all(cache_t* cache);
+
+void cache_set_cost_hint(cache_t* cache, size_t cost);
+size_t cache_get_cost_hint(cache_t* cache);
+void cache_set_count_hint(cache_t* cache, size_t count);
+size_t cache_get_count_hint(cache_t* cache);
+void cache_set_minimum_values_hint(cache_t* cache, size_t count);
+size_t cache_get_minimum_values_hint(cache_t* cache);
+const char* cache_get_name(cache_t* cache);
+
+uintptr_t cache_hash_byte_string(const char* data, size_t bytes);
+uintptr_t cache_key_hash_cb_cstring(void* key, void* unused);
+uintptr_t cache_key_hash_cb_integer(void* key, void* unused);
+bool cache_key_is_equal_cb_cstring(void* key1, void* key2, void* unused);
+bool cache_key_is_equal_cb_integer(void* key1, void* key2, void* unused);
+void cache_release_cb_free(void* key_or_value, void* unused);
+bool cache_value_make_nonpurgeable_cb(void* value, void* unused);
+void cache_value_make_purgeable_cb(void* value, void* unused);
+
+// Takes a DISPATCH_MEMORYPRESSURE_* level
+void cache_simulate_memory_warning_event(uint64_t memory_warning_type);
+
 void* cache_get(void);
-void* cache_get_and_retain(void);
-void* cache_get_cost_hint(void);
-void* cache_get_count_hint(void);
 void* cache_get_info(void);
 void* cache_get_info_for_key(void);
 void* cache_get_info_for_keys(void);
-void* cache_get_minimum_values_hint(void);
-void* cache_get_name(void);
-void* cache_hash_byte_string(void);
 void* cache_invoke(void);
-void* cache_key_hash_cb_cstring(void);
-void* cache_key_hash_cb_integer(void);
-void* cache_key_is_equal_cb_cstring(void);
-void* cache_key_is_equal_cb_integer(void);
 void* cache_print(void);
 void* cache_print_stats(void);
-void* cache_release_cb_free(void);
-void* cache_release_value(void);
-void* cache_remove(void);
-void* cache_remove_all(void);
 void* cache_remove_with_block(void);
-void* cache_set_and_retain(void);
-void* cache_set_cost_hint(void);
-void* cache_set_count_hint(void);
-void* cache_set_minimum_values_hint(void);
 void* cache_set_name(void);
-void* cache_simulate_memory_warning_event(void);
-void* cache_value_make_nonpurgeable_cb(void);
-void* cache_value_make_purgeable_cb(void);
 
 #ifdef __cplusplus
 };
@@ -18,8 +18,93 @@
  */
 
 #include <cache/cache.h>
+#include <dispatch/dispatch.h>
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <os/lock.h>
+#include <mach/mach.h>
+#include "cache_internal.h"
+
+// Keys are spread over independently locked shards, so that threads working
+// on different keys rarely contend. Values are indexed separately, as
+// cache_release_value() only gets the value.
+//
+// Lock order: a shard lock, then a value index lock.
+#define CACHE_SHARD_COUNT 16
+#define CACHE_INITIAL_BUCKETS 8
+
+// Eviction compares this many of the least recently used entries of every shard
+#define CACHE_EVICTION_CANDIDATES 4
+
+struct cache_entry
+{
+	// Chains in the shard's key table and in the value index
+	struct cache_entry* key_next;
+	struct cache_entry* value_next;
+
+	// Only entries that nobody retains are on the LRU list, so they can all be evicted
+	struct cache_entry* lru_prev;
+	struct cache_entry* lru_next;
+
+	void* key;
+	void* value;
+	uintptr_t hash;
+	size_t cost;
+	uint64_t last_used;
+	uint32_t retain_count;
+	uint8_t shard;
+
+	// Replaced or removed while retained; freed on the last cache_release_value()
+	bool removed;
+};
+
+struct cache_table
+{
+	struct cache_entry** buckets;
+	size_t bucket_count;
+	size_t count;
+};
+
+struct cache_shard
+{
+	os_unfair_lock lock;
+	struct cache_table keys;
+	size_t cost;
+
+	// Most recently used first
+	struct cache_entry* lru_head;
+	struct cache_entry* lru_tail;
+};
+
+struct cache_value_index
+{
+	os_unfair_lock lock;
+	struct cache_table values;
+};
+
+struct cache_s
+{
+	char* name;
+	cache_attributes_t attrs;
+
+	_Atomic size_t cost_limit;
+	_Atomic size_t count_limit;
+	_Atomic size_t minimum_count;
+
+	// Sums over all entries still reachable by key
+	_Atomic size_t total_cost;
+	_Atomic size_t total_count;
+	_Atomic uint64_t clock;
+
+	// One for the owner, plus one for every memory pressure notification working on the cache
+	_Atomic uint32_t references;
+
+	struct cache_shard shards[CACHE_SHARD_COUNT];
+	struct cache_value_index value_indexes[CACHE_SHARD_COUNT];
+};
 
 static int verbose = 0;
 
@@ -33,226 +118,807 @@ static void initme(void) {
 	}
 }
 
-void* cache_create(void)
+// Callers' hashes are often plain pointers or small integers
+static uintptr_t mix_hash(uintptr_t h)
 {
-	initme();
-	if (verbose) puts("STUB: cache_create called");
-	return NULL;
+	uint64_t x = h;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (uintptr_t)x;
 }
 
-void* cache_destroy(void)
+static struct cache_value_index* value_index_for(cache_t* cache, void* value)
 {
-	initme();
-	if (verbose) puts("STUB: cache_destroy called");
-	return NULL;
+	return &cache->value_indexes[mix_hash((uintptr_t)value) % CACHE_SHARD_COUNT];
 }
 
-void* cache_get(void)
+static size_t bucket_of(const struct cache_table* table, uintptr_t hash)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get called");
-	return NULL;
+	// The low bits choose the shard
+	return (hash / CACHE_SHARD_COUNT) & (table->bucket_count - 1);
 }
 
-void* cache_get_and_retain(void)
+static struct cache_entry** key_chain_next(struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_and_retain called");
-	return NULL;
+	return &e->key_next;
 }
 
-void* cache_get_cost_hint(void)
+static struct cache_entry** value_chain_next(struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_cost_hint called");
-	return NULL;
+	return &e->value_next;
 }
 
-void* cache_get_count_hint(void)
+// Doubles the bucket array of a table once it holds more entries than buckets.
+// Running out of memory here only makes the chains longer.
+static void table_grow(struct cache_table* table, struct cache_entry** (*next)(struct cache_entry*),
+		uintptr_t (*hash_of)(struct cache_entry*))
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_count_hint called");
-	return NULL;
+	size_t new_count = table->bucket_count ? table->bucket_count * 2 : CACHE_INITIAL_BUCKETS;
+	struct cache_entry** buckets;
+
+	if (table->count < table->bucket_count)
+		return;
+
+	buckets = calloc(new_count, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	for (size_t i = 0; i < table->bucket_count; i++)
+	{
+		struct cache_entry* e = table->buckets[i];
+		while (e)
+		{
+			struct cache_entry* following = *next(e);
+			size_t b = (hash_of(e) / CACHE_SHARD_COUNT) & (new_count - 1);
+
+			*next(e) = buckets[b];
+			buckets[b] = e;
+			e = following;
+		}
+	}
+
+	free(table->buckets);
+	table->buckets = buckets;
+	table->bucket_count = new_count;
 }
 
-void* cache_get_info(void)
+static uintptr_t entry_key_hash(struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_info called");
-	return NULL;
+	return e->hash;
 }
 
-void* cache_get_info_for_key(void)
+static uintptr_t entry_value_hash(struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_info_for_key called");
-	return NULL;
+	return mix_hash((uintptr_t)e->value);
 }
 
-void* cache_get_info_for_keys(void)
+static struct cache_entry* key_find(cache_t* cache, struct cache_shard* shard, void* key, uintptr_t hash)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_info_for_keys called");
+	struct cache_entry* e;
+
+	if (!shard->keys.bucket_count)
+		return NULL;
+
+	for (e = shard->keys.buckets[bucket_of(&shard->keys, hash)]; e; e = e->key_next)
+	{
+		if (e->hash == hash && cache->attrs.key_is_equal_cb(e->key, key, cache->attrs.user_data))
+			return e;
+	}
 	return NULL;
 }
 
-void* cache_get_minimum_values_hint(void)
+static void key_insert(struct cache_shard* shard, struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_minimum_values_hint called");
-	return NULL;
+	struct cache_entry** bucket;
+
+	table_grow(&shard->keys, key_chain_next, entry_key_hash);
+	bucket = &shard->keys.buckets[bucket_of(&shard->keys, e->hash)];
+	e->key_next = *bucket;
+	*bucket = e;
+	shard->keys.count++;
 }
 
-void* cache_get_name(void)
+static void key_unlink(struct cache_shard* shard, struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_get_name called");
-	return NULL;
+	struct cache_entry** p = &shard->keys.buckets[bucket_of(&shard->keys, e->hash)];
+
+	while (*p != e)
+		p = &(*p)->key_next;
+	*p = e->key_next;
+	// key_next doubles as the link of the list of entries to finalize
+	e->key_next = NULL;
+	shard->keys.count--;
 }
 
-void* cache_hash_byte_string(void)
+// Finds a retained entry holding the value, in the given shard unless that is negative
+static struct cache_entry* value_find(struct cache_value_index* index, void* value, int shard)
 {
-	initme();
-	if (verbose) puts("STUB: cache_hash_byte_string called");
+	struct cache_entry* e;
+
+	if (!index->values.bucket_count)
+		return NULL;
+
+	for (e = index->values.buckets[bucket_of(&index->values, mix_hash((uintptr_t)value))]; e; e = e->value_next)
+	{
+		if (e->value == value && e->retain_count > 0 && (shard < 0 || e->shard == shard))
+			return e;
+	}
 	return NULL;
 }
 
-void* cache_invoke(void)
+static void value_insert(struct cache_value_index* index, struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_invoke called");
-	return NULL;
+	struct cache_entry** bucket;
+
+	table_grow(&index->values, value_chain_next, entry_value_hash);
+	bucket = &index->values.buckets[bucket_of(&index->values, entry_value_hash(e))];
+	e->value_next = *bucket;
+	*bucket = e;
+	index->values.count++;
 }
 
-void* cache_key_hash_cb_cstring(void)
+static void value_unlink(struct cache_value_index* index, struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_key_hash_cb_cstring called");
-	return NULL;
+	struct cache_entry** p = &index->values.buckets[bucket_of(&index->values, entry_value_hash(e))];
+
+	while (*p != e)
+		p = &(*p)->value_next;
+	*p = e->value_next;
+	index->values.count--;
 }
 
-void* cache_key_hash_cb_integer(void)
+static void lru_push(struct cache_shard* shard, struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_key_hash_cb_integer called");
-	return NULL;
+	e->lru_prev = NULL;
+	e->lru_next = shard->lru_head;
+	if (shard->lru_head)
+		shard->lru_head->lru_prev = e;
+	else
+		shard->lru_tail = e;
+	shard->lru_head = e;
 }
 
-void* cache_key_is_equal_cb_cstring(void)
+static void lru_unlink(struct cache_shard* shard, struct cache_entry* e)
 {
-	initme();
-	if (verbose) puts("STUB: cache_key_is_equal_cb_cstring called");
-	return NULL;
+	if (e->lru_prev)
+		e->lru_prev->lru_next = e->lru_next;
+	else
+		shard->lru_head = e->lru_next;
+	if (e->lru_next)
+		e->lru_next->lru_prev = e->lru_prev;
+	else
+		shard->lru_tail = e->lru_prev;
+	e->lru_prev = e->lru_next = NULL;
 }
 
-void* cache_key_is_equal_cb_integer(void)
+// Makes the entry unreachable by key. Unless somebody still holds its value, it also leaves
+// the value index and goes on the list of entries to finalize once the locks are dropped.
+static void entry_detach(cache_t* cache, struct cache_shard* shard, struct cache_entry* e, struct cache_entry** dead)
 {
-	initme();
-	if (verbose) puts("STUB: cache_key_is_equal_cb_integer called");
-	return NULL;
+	key_unlink(shard, e);
+	if (e->retain_count == 0)
+		lru_unlink(shard, e);
+
+	shard->cost -= e->cost;
+	atomic_fetch_sub_explicit(&cache->total_cost, e->cost, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&cache->total_count, 1, memory_order_relaxed);
+
+	if (e->retain_count == 0)
+	{
+		struct cache_value_index* index = value_index_for(cache, e->value);
+
+		os_unfair_lock_lock(&index->lock);
+		value_unlink(index, e);
+		os_unfair_lock_unlock(&index->lock);
+
+		e->key_next = *dead;
+		*dead = e;
+	}
+	else
+	{
+		e->removed = true;
+	}
 }
 
-void* cache_print(void)
+// Release callbacks may free memory or call back into the cache, so they run without locks held
+static void entries_finalize(cache_t* cache, struct cache_entry* dead)
 {
-	initme();
-	if (verbose) puts("STUB: cache_print called");
-	return NULL;
+	while (dead)
+	{
+		struct cache_entry* next = dead->key_next;
+
+		if (cache->attrs.key_release_cb)
+			cache->attrs.key_release_cb(dead->key, cache->attrs.user_data);
+		if (cache->attrs.value_release_cb)
+			cache->attrs.value_release_cb(dead->value, cache->attrs.user_data);
+		free(dead);
+		dead = next;
+	}
 }
 
-void* cache_print_stats(void)
+static bool over_limit(cache_t* cache, size_t cost_limit, size_t count_limit)
 {
-	initme();
-	if (verbose) puts("STUB: cache_print_stats called");
-	return NULL;
+	size_t count = atomic_load_explicit(&cache->total_count, memory_order_relaxed);
+
+	if (count <= atomic_load_explicit(&cache->minimum_count, memory_order_relaxed))
+		return false;
+	return atomic_load_explicit(&cache->total_cost, memory_order_relaxed) > cost_limit || count > count_limit;
 }
 
-void* cache_release_cb_free(void)
+// Among the least recently used unretained entries of a shard, the one whose eviction
+// buys the most: old entries go first, and of equally old ones the costliest
+static struct cache_entry* eviction_candidate(struct cache_shard* shard, uint64_t now, double* score_out)
 {
-	initme();
-	if (verbose) puts("STUB: cache_release_cb_free called");
-	return NULL;
+	struct cache_entry* best = NULL;
+	double best_score = -1;
+	struct cache_entry* e = shard->lru_tail;
+
+	for (int i = 0; e && i < CACHE_EVICTION_CANDIDATES; i++, e = e->lru_prev)
+	{
+		// Entries used after the caller read the clock count as brand new
+		uint64_t age = now > e->last_used ? now - e->last_used : 0;
+		double score = (double)(age + 1) * (double)(e->cost + 1);
+		if (score > best_score)
+		{
+			best = e;
+			best_score = score;
+		}
+	}
+
+	*score_out = best_score;
+	return best;
+}
+
+// How much of the excess a shard holding `part` of `total` gives up
+static size_t shard_share(size_t excess, size_t part, size_t total)
+{
+	if (!excess || !part)
+		return 0;
+	if (excess >= total)
+		return part;
+	// rounded up, so that the shares add up to at least the excess
+	return (size_t)((double)excess * part / total) + 1;
+}
+
+// Evicts entries until the cache is within the given limits, the minimum
+// number of values is reached, or everything left is retained.
+//
+// Every shard gives up its share of the excess, so each pass only takes every shard
+// lock once. Shards that fall short because of retained entries are made up for
+// by another pass over the others.
+static void cache_trim(cache_t* cache, size_t cost_limit, size_t count_limit)
+{
+	while (over_limit(cache, cost_limit, count_limit))
+	{
+		size_t total_cost = atomic_load_explicit(&cache->total_cost, memory_order_relaxed);
+		size_t total_count = atomic_load_explicit(&cache->total_count, memory_order_relaxed);
+		size_t cost_excess = total_cost > cost_limit ? total_cost - cost_limit : 0;
+		size_t count_excess = total_count > count_limit ? total_count - count_limit : 0;
+		uint64_t now = atomic_load_explicit(&cache->clock, memory_order_relaxed);
+		bool evicted = false;
+
+		for (int i = 0; i < CACHE_SHARD_COUNT; i++)
+		{
+			struct cache_shard* shard = &cache->shards[i];
+			struct cache_entry* dead = NULL;
+			struct cache_entry* e;
+			size_t cost_share, count_share;
+			double score;
+
+			os_unfair_lock_lock(&shard->lock);
+
+			cost_share = shard_share(cost_excess, shard->cost, total_cost);
+			count_share = shard_share(count_excess, shard->keys.count, total_count);
+
+			while ((cost_share || count_share) && over_limit(cache, cost_limit, count_limit)
+					&& (e = eviction_candidate(shard, now, &score)))
+			{
+				cost_share = cost_share > e->cost ? cost_share - e->cost : 0;
+				count_share = count_share ? count_share - 1 : 0;
+				entry_detach(cache, shard, e, &dead);
+				evicted = true;
+			}
+
+			os_unfair_lock_unlock(&shard->lock);
+
+			entries_finalize(cache, dead);
+		}
+
+		if (!evicted)
+			break;
+	}
 }
 
-void* cache_release_value(void)
+// A hint of zero means no limit
+static void cache_trim_to_hints(cache_t* cache)
 {
-	initme();
-	if (verbose) puts("STUB: cache_release_value called");
-	return NULL;
+	size_t cost_limit = atomic_load_explicit(&cache->cost_limit, memory_order_relaxed);
+	size_t count_limit = atomic_load_explicit(&cache->count_limit, memory_order_relaxed);
+
+	if (cost_limit || count_limit)
+		cache_trim(cache, cost_limit ? cost_limit : SIZE_MAX, count_limit ? count_limit : SIZE_MAX);
 }
 
-void* cache_remove(void)
+// Under warning pressure the cache gives up half of its cost, under critical
+// pressure everything nobody holds on to
+void cache_handle_memory_pressure(cache_t* cache, unsigned long level)
 {
-	initme();
-	if (verbose) puts("STUB: cache_remove called");
-	return NULL;
+	if (level & DISPATCH_MEMORYPRESSURE_CRITICAL)
+		cache_trim(cache, 0, 0);
+	else if (level & DISPATCH_MEMORYPRESSURE_WARN)
+		cache_trim(cache, atomic_load_explicit(&cache->total_cost, memory_order_relaxed) / 2, SIZE_MAX);
 }
 
-void* cache_remove_all(void)
+int cache_create(const char* name, cache_attributes_t* attrs, cache_t** cache_out)
 {
-	initme();
-	if (verbose) puts("STUB: cache_remove_all called");
-	return NULL;
+	cache_t* cache;
+
+	if (!name || !attrs || !cache_out || !attrs->key_hash_cb || !attrs->key_is_equal_cb)
+		return EINVAL;
+	if (attrs->version != CACHE_ATTRIBUTES_VERSION_1 && attrs->version != CACHE_ATTRIBUTES_VERSION_2)
+		return EINVAL;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return ENOMEM;
+
+	cache->name = strdup(name);
+	if (!cache->name)
+	{
+		free(cache);
+		return ENOMEM;
+	}
+
+	// Version 1 callers don't have the fields added later
+	if (attrs->version == CACHE_ATTRIBUTES_VERSION_1)
+		memcpy(&cache->attrs, attrs, offsetof(cache_attributes_t, value_retain_cb));
+	else
+		cache->attrs = *attrs;
+
+	for (int i = 0; i < CACHE_SHARD_COUNT; i++)
+	{
+		cache->shards[i].lock = OS_UNFAIR_LOCK_INIT;
+		cache->value_indexes[i].lock = OS_UNFAIR_LOCK_INIT;
+	}
+
+	atomic_init(&cache->references, 1);
+	cache_pressure_register(cache);
+
+	*cache_out = cache;
+	return 0;
 }
 
-void* cache_remove_with_block(void)
+static void cache_dispose(cache_t* cache)
+{
+	struct cache_entry* dead = NULL;
+
+	cache_remove_all(cache);
+
+	// Values that were still retained go as well
+	for (int i = 0; i < CACHE_SHARD_COUNT; i++)
+	{
+		struct cache_table* values = &cache->value_indexes[i].values;
+
+		for (size_t b = 0; b < values->bucket_count; b++)
+		{
+			struct cache_entry* e = values->buckets[b];
+			while (e)
+			{
+				struct cache_entry* next = e->value_next;
+				e->key_next = dead;
+				dead = e;
+				e = next;
+			}
+		}
+
+		free(values->buckets);
+		free(cache->shards[i].keys.buckets);
+	}
+
+	entries_finalize(cache, dead);
+	free(cache->name);
+	free(cache);
+}
+
+void cache_reference(cache_t* cache)
+{
+	atomic_fetch_add_explicit(&cache->references, 1, memory_order_relaxed);
+}
+
+void cache_unreference(cache_t* cache)
+{
+	if (atomic_fetch_sub_explicit(&cache->references, 1, memory_order_acq_rel) == 1)
+		cache_dispose(cache);
+}
+
+// A memory pressure notification that is still evicting from the cache gets to
+// finish first; the last one out tears the cache down
+int cache_destroy(cache_t* cache)
+{
+	if (!cache)
+		return EINVAL;
+
+	cache_pressure_unregister(cache);
+	cache_unreference(cache);
+	return 0;
+}
+
+int cache_set_and_retain(cache_t* cache, void* key, void* value, size_t cost)
+{
+	struct cache_entry* dead = NULL;
+	struct cache_entry* e;
+	struct cache_entry* old;
+	struct cache_shard* shard;
+	struct cache_value_index* index;
+
+	if (!cache)
+		return EINVAL;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return ENOMEM;
+
+	e->key = key;
+	if (cache->attrs.key_retain_cb)
+		cache->attrs.key_retain_cb(key, &e->key, cache->attrs.user_data);
+	if (cache->attrs.value_retain_cb)
+		cache->attrs.value_retain_cb(value, cache->attrs.user_data);
+
+	e->value = value;
+	e->cost = cost;
+	e->hash = mix_hash(cache->attrs.key_hash_cb(key, cache->attrs.user_data));
+	e->shard = e->hash % CACHE_SHARD_COUNT;
+	e->retain_count = 1;
+	e->last_used = atomic_fetch_add_explicit(&cache->clock, 1, memory_order_relaxed);
+
+	shard = &cache->shards[e->shard];
+	index = value_index_for(cache, value);
+
+	os_unfair_lock_lock(&shard->lock);
+
+	// The previous value stays valid for whoever retained it
+	old = key_find(cache, shard, key, e->hash);
+	if (old)
+		entry_detach(cache, shard, old, &dead);
+
+	key_insert(shard, e);
+	os_unfair_lock_lock(&index->lock);
+	value_insert(index, e);
+	os_unfair_lock_unlock(&index->lock);
+
+	shard->cost += cost;
+	atomic_fetch_add_explicit(&cache->total_cost, cost, memory_order_relaxed);
+	atomic_fetch_add_explicit(&cache->total_count, 1, memory_order_relaxed);
+
+	os_unfair_lock_unlock(&shard->lock);
+
+	entries_finalize(cache, dead);
+	cache_trim_to_hints(cache);
+	return 0;
+}
+
+int cache_get_and_retain(cache_t* cache, void* key, void** value_out)
+{
+	struct cache_entry* dead = NULL;
+	struct cache_entry* e;
+	struct cache_shard* shard;
+	uintptr_t hash;
+	int ret = 0;
+
+	if (!cache || !value_out)
+		return EINVAL;
+
+	hash = mix_hash(cache->attrs.key_hash_cb(key, cache->attrs.user_data));
+	shard = &cache->shards[hash % CACHE_SHARD_COUNT];
+
+	os_unfair_lock_lock(&shard->lock);
+
+	e = key_find(cache, shard, key, hash);
+	if (!e)
+	{
+		ret = ENOENT;
+	}
+	else if (e->retain_count == 0 && cache->attrs.value_make_nonpurgeable_cb
+			&& !cache->attrs.value_make_nonpurgeable_cb(e->value, cache->attrs.user_data))
+	{
+		// The system reclaimed the memory behind the value while it was purgeable
+		entry_detach(cache, shard, e, &dead);
+		ret = ENOENT;
+	}
+	else
+	{
+		if (e->retain_count++ == 0)
+			lru_unlink(shard, e);
+		e->last_used = atomic_fetch_add_explicit(&cache->clock, 1, memory_order_relaxed);
+		*value_out = e->value;
+	}
+
+	os_unfair_lock_unlock(&shard->lock);
+
+	entries_finalize(cache, dead);
+	return ret;
+}
+
+int cache_release_value(cache_t* cache, void* value)
+{
+	struct cache_value_index* index;
+	struct cache_entry* dead = NULL;
+	struct cache_entry* e;
+	bool now_evictable = false;
+	int shard_index;
+
+	if (!cache)
+		return EINVAL;
+
+	index = value_index_for(cache, value);
+
+	os_unfair_lock_lock(&index->lock);
+	e = value_find(index, value, -1);
+	shard_index = e ? e->shard : -1;
+	os_unfair_lock_unlock(&index->lock);
+
+	// The shard lock comes first, so look the value up again once it is held
+	while (shard_index >= 0)
+	{
+		struct cache_shard* shard = &cache->shards[shard_index];
+
+		os_unfair_lock_lock(&shard->lock);
+		os_unfair_lock_lock(&index->lock);
+
+		e = value_find(index, value, shard_index);
+		if (e)
+		{
+			if (--e->retain_count == 0)
+			{
+				if (e->removed)
+				{
+					value_unlink(index, e);
+					e->key_next = NULL;
+					dead = e;
+				}
+				else
+				{
+					lru_push(shard, e);
+					if (cache->attrs.value_make_purgeable_cb)
+						cache->attrs.value_make_purgeable_cb(e->value, cache->attrs.user_data);
+					now_evictable = true;
+				}
+			}
+
+			os_unfair_lock_unlock(&index->lock);
+			os_unfair_lock_unlock(&shard->lock);
+			break;
+		}
+
+		e = value_find(index, value, -1);
+		shard_index = e ? e->shard : -1;
+
+		os_unfair_lock_unlock(&index->lock);
+		os_unfair_lock_unlock(&shard->lock);
+	}
+
+	if (!e)
+		return ENOENT;
+
+	entries_finalize(cache, dead);
+	if (now_evictable)
+		cache_trim_to_hints(cache);
+	return 0;
+}
+
+int cache_remove(cache_t* cache, void* key)
+{
+	struct cache_entry* dead = NULL;
+	struct cache_entry* e;
+	struct cache_shard* shard;
+	uintptr_t hash;
+
+	if (!cache)
+		return EINVAL;
+
+	hash = mix_hash(cache->attrs.key_hash_cb(key, cache->attrs.user_data));
+	shard = &cache->shards[hash % CACHE_SHARD_COUNT];
+
+	os_unfair_lock_lock(&shard->lock);
+	e = key_find(cache, shard, key, hash);
+	if (e)
+		entry_detach(cache, shard, e, &dead);
+	os_unfair_lock_unlock(&shard->lock);
+
+	entries_finalize(cache, dead);
+	return e ? 0 : ENOENT;
+}
+
+int cache_remove_all(cache_t* cache)
+{
+	if (!cache)
+		return EINVAL;
+
+	for (int i = 0; i < CACHE_SHARD_COUNT; i++)
+	{
+		struct cache_shard* shard = &cache->shards[i];
+		struct cache_entry* dead = NULL;
+
+		os_unfair_lock_lock(&shard->lock);
+		for (size_t b = 0; b < shard->keys.bucket_count; b++)
+		{
+			while (shard->keys.buckets[b])
+				entry_detach(cache, shard, shard->keys.buckets[b], &dead);
+		}
+		os_unfair_lock_unlock(&shard->lock);
+
+		entries_finalize(cache, dead);
+	}
+
+	return 0;
+}
+
+void cache_set_cost_hint(cache_t* cache, size_t cost)
+{
+	atomic_store_explicit(&cache->cost_limit, cost, memory_order_relaxed);
+	cache_trim_to_hints(cache);
+}
+
+size_t cache_get_cost_hint(cache_t* cache)
+{
+	return atomic_load_explicit(&cache->cost_limit, memory_order_relaxed);
+}
+
+void cache_set_count_hint(cache_t* cache, size_t count)
+{
+	atomic_store_explicit(&cache->count_limit, count, memory_order_relaxed);
+	cache_trim_to_hints(cache);
+}
+
+size_t cache_get_count_hint(cache_t* cache)
+{
+	return atomic_load_explicit(&cache->count_limit, memory_order_relaxed);
+}
+
+void cache_set_minimum_values_hint(cache_t* cache, size_t count)
+{
+	atomic_store_explicit(&cache->minimum_count, count, memory_order_relaxed);
+}
+
+size_t cache_get_minimum_values_hint(cache_t* cache)
+{
+	return atomic_load_explicit(&cache->minimum_count, memory_order_relaxed);
+}
+
+const char* cache_get_name(cache_t* cache)
+{
+	return cache->name;
+}
+
+// 32 or 64-bit FNV-1a
+uintptr_t cache_hash_byte_string(const char* data, size_t bytes)
+{
+#if UINTPTR_MAX > 0xffffffff
+	uintptr_t hash = 0xcbf29ce484222325ULL;
+	const uintptr_t prime = 0x100000001b3ULL;
+#else
+	uintptr_t hash = 0x811c9dc5;
+	const uintptr_t prime = 0x01000193;
+#endif
+
+	for (size_t i = 0; i < bytes; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= prime;
+	}
+	return hash;
+}
+
+uintptr_t cache_key_hash_cb_cstring(void* key, void* unused)
+{
+	return cache_hash_byte_string(key, strlen(key));
+}
+
+uintptr_t cache_key_hash_cb_integer(void* key, void* unused)
+{
+	return (uintptr_t)key;
+}
+
+bool cache_key_is_equal_cb_cstring(void* key1, void* key2, void* unused)
+{
+	return strcmp(key1, key2) == 0;
+}
+
+bool cache_key_is_equal_cb_integer(void* key1, void* key2, void* unused)
+{
+	return key1 == key2;
+}
+
+void cache_release_cb_free(void* key_or_value, void* unused)
+{
+	free(key_or_value);
+}
+
+// For values allocated as purgeable VM regions
+void cache_value_make_purgeable_cb(void* value, void* unused)
+{
+	int state = VM_PURGABLE_VOLATILE;
+	vm_purgable_control(mach_task_self(), (vm_address_t)value, VM_PURGABLE_SET_STATE, &state);
+}
+
+bool cache_value_make_nonpurgeable_cb(void* value, void* unused)
+{
+	int state = VM_PURGABLE_NONVOLATILE;
+
+	// Where purgeable memory isn't supported, the contents were never at risk
+	if (vm_purgable_control(mach_task_self(), (vm_address_t)value, VM_PURGABLE_SET_STATE, &state) != KERN_SUCCESS)
+		return true;
+	return state != VM_PURGABLE_EMPTY;
+}
+
+void* cache_get(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_remove_with_block called");
+	if (verbose) puts("STUB: cache_get called");
 	return NULL;
 }
 
-void* cache_set_and_retain(void)
+void* cache_get_info(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_set_and_retain called");
+	if (verbose) puts("STUB: cache_get_info called");
 	return NULL;
 }
 
-void* cache_set_cost_hint(void)
+void* cache_get_info_for_key(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_set_cost_hint called");
+	if (verbose) puts("STUB: cache_get_info_for_key called");
 	return NULL;
 }
 
-void* cache_set_count_hint(void)
+void* cache_get_info_for_keys(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_set_count_hint called");
+	if (verbose) puts("STUB: cache_get_info_for_keys called");
 	return NULL;
 }
 
-void* cache_set_minimum_values_hint(void)
+void* cache_invoke(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_set_minimum_values_hint called");
+	if (verbose) puts("STUB: cache_invoke called");
 	return NULL;
 }
 
-void* cache_set_name(void)
+void* cache_print(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_set_name called");
+	if (verbose) puts("STUB: cache_print called");
 	return NULL;
 }
 
-void* cache_simulate_memory_warning_event(void)
+void* cache_print_stats(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_simulate_memory_warning_event called");
+	if (verbose) puts("STUB: cache_print_stats called");
 	return NULL;
 }
 
-void* cache_value_make_nonpurgeable_cb(void)
+void* cache_remove_with_block(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_value_make_nonpurgeable_cb called");
+	if (verbose) puts("STUB: cache_remove_with_block called");
 	return NULL;
 }
 
-void* cache_value_make_purgeable_cb(void)
+void* cache_set_name(void)
 {
 	initme();
-	if (verbose) puts("STUB: cache_value_make_purgeable_cb called");
+	if (verbose) puts("STUB: cache_set_name called");
 	return NULL;
 }
+
+void cache_simulate_memory_warning_event(uint64_t memory_warning_type)
+{
+	cache_pressure_notify((unsigned long)memory_warning_type);
+}
@@ -0,0 +1,48 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2026 Darling Team
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBCACHE_CACHE_INTERNAL_H_
+#define _LIBCACHE_CACHE_INTERNAL_H_
+
+#include <cache/cache.h>
+
+// Evicts from one cache according to a DISPATCH_MEMORYPRESSURE_* level
+__attribute__((visibility("hidden")))
+void cache_handle_memory_pressure(cache_t* cache, unsigned long level);
+
+// Keep a cache alive while it is used outside of the registry lock. cache_destroy()
+// drops the owner's reference, and whoever drops the last one tears the cache down.
+__attribute__((visibility("hidden")))
+void cache_reference(cache_t* cache);
+
+__attribute__((visibility("hidden")))
+void cache_unreference(cache_t* cache);
+
+// Caches are registered with the memory pressure monitor for their whole lifetime
+__attribute__((visibility("hidden")))
+void cache_pressure_register(cache_t* cache);
+
+__attribute__((visibility("hidden")))
+void cache_pressure_unregister(cache_t* cache);
+
+// Passes a memory pressure level on to every cache
+__attribute__((visibility("hidden")))
+void cache_pressure_notify(unsigned long level);
+
+#endif // _LIBCACHE_CACHE_INTERNAL_H_
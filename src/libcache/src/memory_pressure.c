@@ -0,0 +1,419 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2026 Darling Team
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// only for the DISPATCH_MEMORYPRESSURE_* levels
+#include <dispatch/dispatch.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <os/lock.h>
+#include "cache_internal.h"
+
+// Caches learn about memory pressure from what the Linux host reports: a pressure stall
+// information (PSI) trigger, which fires when tasks stall on memory, and inside a container
+// the cgroup's memory.events, which changes when the cgroup runs into its limits.
+// For as long as any cache exists a thread sleeps in poll() on both. It only wakes up
+// periodically while the pressure lasts, so that the caches are kept small until it is over.
+#define PRESSURE_RECHECK_INTERVAL_MS 2000
+
+// Fire once tasks stalled on memory for 10% of a 2 second window
+// (unprivileged triggers need a window that is a multiple of 2 seconds)
+#define PSI_TRIGGER "some 200000 2000000"
+
+// Percentage of the last 10 seconds in which some or all tasks stalled on memory
+#define PSI_SOME_WARN 10.0
+#define PSI_SOME_CRITICAL 40.0
+#define PSI_FULL_CRITICAL 10.0
+
+// Percentage of the cgroup memory limit in use
+#define CGROUP_USAGE_WARN 85
+#define CGROUP_USAGE_CRITICAL 95
+
+// Darwin processes see the Linux root here if it is not their own
+static const char* const host_roots[] = { "", "/Volumes/SystemRoot" };
+
+static os_unfair_lock registry_lock = OS_UNFAIR_LOCK_INIT;
+static cache_t** registry;
+static size_t registry_count;
+static size_t registry_capacity;
+
+// Owned by its thread, which frees it once told to stop through the wake pipe
+struct monitor
+{
+	int wake[2];
+	int psi;
+	int events;
+	unsigned long long max_events;
+	unsigned long long high_events;
+};
+
+static struct monitor* monitor;
+
+static int open_host_file(const char* path, int flags)
+{
+	for (size_t i = 0; i < sizeof(host_roots) / sizeof(host_roots[0]); i++)
+	{
+		char full_path[256];
+		int fd;
+
+		snprintf(full_path, sizeof(full_path), "%s%s", host_roots[i], path);
+		fd = open(full_path, flags | O_CLOEXEC);
+		if (fd >= 0)
+			return fd;
+	}
+	return -1;
+}
+
+static ssize_t read_fd(int fd, char* buf, size_t size)
+{
+	ssize_t len = pread(fd, buf, size - 1, 0);
+
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+	return len;
+}
+
+static ssize_t read_host_file(const char* path, char* buf, size_t size)
+{
+	int fd = open_host_file(path, O_RDONLY);
+	ssize_t len;
+
+	if (fd < 0)
+		return -1;
+	len = read_fd(fd, buf, size);
+	close(fd);
+	return len;
+}
+
+// Parses "avg10=" out of the "some" or "full" line of a PSI file
+static double psi_avg10(const char* text, const char* kind)
+{
+	const char* line = strstr(text, kind);
+	const char* avg;
+
+	if (!line)
+		return 0;
+	avg = strstr(line, "avg10=");
+	if (!avg)
+		return 0;
+	return strtod(avg + 6, NULL);
+}
+
+static unsigned long psi_level(void)
+{
+	char buf[512];
+	double some, full;
+
+	// The cgroup's own figures, if there is one, otherwise the whole host's
+	if (read_host_file("/sys/fs/cgroup/memory.pressure", buf, sizeof(buf)) < 0
+			&& read_host_file("/proc/pressure/memory", buf, sizeof(buf)) < 0)
+		return DISPATCH_MEMORYPRESSURE_NORMAL;
+
+	some = psi_avg10(buf, "some");
+	full = psi_avg10(buf, "full");
+
+	if (some >= PSI_SOME_CRITICAL || full >= PSI_FULL_CRITICAL)
+		return DISPATCH_MEMORYPRESSURE_CRITICAL;
+	if (some >= PSI_SOME_WARN)
+		return DISPATCH_MEMORYPRESSURE_WARN;
+	return DISPATCH_MEMORYPRESSURE_NORMAL;
+}
+
+// Each PSI file takes triggers, the cgroup's only covers the container
+static int psi_trigger_open(void)
+{
+	static const char* const paths[] = { "/sys/fs/cgroup/memory.pressure", "/proc/pressure/memory" };
+
+	for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+	{
+		int fd = open_host_file(paths[i], O_RDWR | O_NONBLOCK);
+		if (fd < 0)
+			continue;
+		if (write(fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) >= 0)
+			return fd;
+		close(fd);
+	}
+	return -1;
+}
+
+static unsigned long long cgroup_event_count(const char* events, const char* name)
+{
+	size_t len = strlen(name);
+	const char* line = events;
+
+	while (line)
+	{
+		if (strncmp(line, name, len) == 0 && line[len] == ' ')
+			return strtoull(line + len + 1, NULL, 10);
+
+		line = strchr(line, '\n');
+		if (line)
+			line++;
+	}
+	return 0;
+}
+
+static unsigned long cgroup_level(struct monitor* m)
+{
+	unsigned long level = DISPATCH_MEMORYPRESSURE_NORMAL;
+	char buf[512];
+
+	// Hitting memory.max (reclaim failed to stay under it) or memory.high (throttled)
+	// since the last look. Reading the file through the polled descriptor also rearms it.
+	if (m->events >= 0 && read_fd(m->events, buf, sizeof(buf)) >= 0)
+	{
+		unsigned long long max_events = cgroup_event_count(buf, "max") + cgroup_event_count(buf, "oom");
+		unsigned long long high_events = cgroup_event_count(buf, "high");
+
+		if (max_events != m->max_events)
+			level = DISPATCH_MEMORYPRESSURE_CRITICAL;
+		else if (high_events != m->high_events)
+			level = DISPATCH_MEMORYPRESSURE_WARN;
+
+		m->max_events = max_events;
+		m->high_events = high_events;
+	}
+
+	if (level == DISPATCH_MEMORYPRESSURE_NORMAL && read_host_file("/sys/fs/cgroup/memory.max", buf, sizeof(buf)) >= 0
+			&& strncmp(buf, "max", 3) != 0)
+	{
+		unsigned long long limit = strtoull(buf, NULL, 10);
+		unsigned long long usage;
+
+		if (limit > 0 && read_host_file("/sys/fs/cgroup/memory.current", buf, sizeof(buf)) >= 0)
+		{
+			usage = strtoull(buf, NULL, 10);
+			if (usage * 100 >= limit * CGROUP_USAGE_CRITICAL)
+				level = DISPATCH_MEMORYPRESSURE_CRITICAL;
+			else if (usage * 100 >= limit * CGROUP_USAGE_WARN)
+				level = DISPATCH_MEMORYPRESSURE_WARN;
+		}
+	}
+
+	return level;
+}
+
+static void monitor_free(struct monitor* m)
+{
+	close(m->wake[0]);
+	close(m->wake[1]);
+	if (m->psi >= 0)
+		close(m->psi);
+	if (m->events >= 0)
+		close(m->events);
+	free(m);
+}
+
+static void* monitor_thread(void* arg)
+{
+	struct monitor* m = arg;
+	unsigned long level = DISPATCH_MEMORYPRESSURE_NORMAL;
+
+	for (;;)
+	{
+		// poll() skips the negative descriptors of whatever isn't available
+		struct pollfd fds[] = {
+			{ .fd = m->wake[0], .events = POLLIN },
+			{ .fd = m->psi, .events = POLLPRI },
+			{ .fd = m->events, .events = POLLPRI },
+		};
+		unsigned long psi, cgroup;
+
+		if (poll(fds, 3, level == DISPATCH_MEMORYPRESSURE_NORMAL ? -1 : PRESSURE_RECHECK_INTERVAL_MS) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[0].revents)
+		{
+			char stop;
+			read(m->wake[0], &stop, 1);
+			break;
+		}
+
+		// The trigger goes away with its cgroup
+		if (fds[1].revents & (POLLERR | POLLNVAL))
+		{
+			close(m->psi);
+			m->psi = -1;
+		}
+
+		psi = psi_level();
+		if ((fds[1].revents & POLLPRI) && psi == DISPATCH_MEMORYPRESSURE_NORMAL)
+			psi = DISPATCH_MEMORYPRESSURE_WARN;
+		cgroup = cgroup_level(m);
+		level = cgroup > psi ? cgroup : psi;
+
+		// Caches hear about the pressure for as long as it lasts, or they'd just grow back
+		if (level != DISPATCH_MEMORYPRESSURE_NORMAL)
+			cache_pressure_notify(level);
+	}
+
+	monitor_free(m);
+	return NULL;
+}
+
+static void monitor_start(void)
+{
+	struct monitor* m = calloc(1, sizeof(*m));
+	pthread_attr_t attr;
+	pthread_t thread;
+	char buf[512];
+	int err;
+
+	if (!m)
+		return;
+
+	m->psi = psi_trigger_open();
+	m->events = open_host_file("/sys/fs/cgroup/memory.events", O_RDONLY);
+
+	// What happened before any cache existed doesn't count
+	if (m->events >= 0 && read_fd(m->events, buf, sizeof(buf)) >= 0)
+	{
+		m->max_events = cgroup_event_count(buf, "max") + cgroup_event_count(buf, "oom");
+		m->high_events = cgroup_event_count(buf, "high");
+	}
+
+	// Nothing to wait for; caches still hear about cache_simulate_memory_warning_event()
+	if ((m->psi < 0 && m->events < 0) || pipe(m->wake) < 0)
+	{
+		if (m->psi >= 0)
+			close(m->psi);
+		if (m->events >= 0)
+			close(m->events);
+		free(m);
+		return;
+	}
+	fcntl(m->wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(m->wake[1], F_SETFD, FD_CLOEXEC);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&thread, &attr, monitor_thread, m);
+	pthread_attr_destroy(&attr);
+
+	if (err != 0)
+	{
+		monitor_free(m);
+		return;
+	}
+	monitor = m;
+}
+
+// The thread may be busy notifying, which needs the registry lock we're holding,
+// so it is left to clean up after itself
+static void monitor_stop(void)
+{
+	if (monitor)
+	{
+		write(monitor->wake[1], "", 1);
+		monitor = NULL;
+	}
+}
+
+void cache_pressure_register(cache_t* cache)
+{
+	os_unfair_lock_lock(&registry_lock);
+
+	if (registry_count == registry_capacity)
+	{
+		size_t capacity = registry_capacity ? registry_capacity * 2 : 8;
+		cache_t** grown = realloc(registry, capacity * sizeof(*grown));
+
+		// Such a cache just doesn't react to memory pressure
+		if (!grown)
+		{
+			os_unfair_lock_unlock(&registry_lock);
+			return;
+		}
+		registry = grown;
+		registry_capacity = capacity;
+	}
+
+	registry[registry_count++] = cache;
+	if (registry_count == 1)
+		monitor_start();
+
+	os_unfair_lock_unlock(&registry_lock);
+}
+
+void cache_pressure_unregister(cache_t* cache)
+{
+	os_unfair_lock_lock(&registry_lock);
+
+	for (size_t i = 0; i < registry_count; i++)
+	{
+		if (registry[i] == cache)
+		{
+			registry[i] = registry[--registry_count];
+			if (registry_count == 0)
+				monitor_stop();
+			break;
+		}
+	}
+
+	os_unfair_lock_unlock(&registry_lock);
+}
+
+// Release callbacks run while the caches evict and may create or destroy caches
+// themselves, so the caches are evicted from outside of the registry lock
+void cache_pressure_notify(unsigned long level)
+{
+	cache_t* small_snapshot[16];
+	cache_t** snapshot = small_snapshot;
+	size_t count;
+
+	os_unfair_lock_lock(&registry_lock);
+
+	count = registry_count;
+	if (count > sizeof(small_snapshot) / sizeof(small_snapshot[0]))
+	{
+		snapshot = malloc(count * sizeof(*snapshot));
+		if (!snapshot)
+		{
+			os_unfair_lock_unlock(&registry_lock);
+			return;
+		}
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		snapshot[i] = registry[i];
+		cache_reference(snapshot[i]);
+	}
+
+	os_unfair_lock_unlock(&registry_lock);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		cache_handle_memory_pressure(snapshot[i], level);
+		cache_unreference(snapshot[i]);
+	}
+
+	if (snapshot != small_snapshot)
+		free(snapshot);
+}
@@ -0,0 +1,202 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Regression tests for entries that leave the cache (removed, replaced or evicted)
+// while their value is still retained.
+// Exits with a non-zero status if any check fails.
+
+#include <cache/cache.h>
+#include <dispatch/dispatch.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static int failures;
+static int released;
+
+static void value_release(void* value, void* user_data)
+{
+	released++;
+	free(value);
+}
+
+static cache_t* create_cache(void)
+{
+	cache_attributes_t attrs = {
+		.version = CACHE_ATTRIBUTES_VERSION_2,
+		.key_hash_cb = cache_key_hash_cb_integer,
+		.key_is_equal_cb = cache_key_is_equal_cb_integer,
+		.value_release_cb = value_release,
+	};
+	cache_t* cache = NULL;
+
+	if (cache_create("org.darlinghq.cache_test", &attrs, &cache) != 0)
+	{
+		fprintf(stderr, "cache_create failed\n");
+		exit(1);
+	}
+	return cache;
+}
+
+// Fills the cache with entries that share the key chains of the ones under test
+static void fill(cache_t* cache, uintptr_t first, uintptr_t last)
+{
+	for (uintptr_t key = first; key < last; key++)
+	{
+		void* value = malloc(16);
+
+		CHECK(cache_set_and_retain(cache, (void*)key, value, 1) == 0);
+		CHECK(cache_release_value(cache, value) == 0);
+	}
+}
+
+static void test_release_after_remove(void)
+{
+	cache_t* cache = create_cache();
+
+	released = 0;
+	fill(cache, 1000, 1500);
+
+	for (uintptr_t key = 1; key < 200; key++)
+	{
+		void* value = malloc(16);
+
+		CHECK(cache_set_and_retain(cache, (void*)key, value, 1) == 0);
+		CHECK(cache_remove(cache, (void*)key) == 0);
+		CHECK(released == key - 1);
+		CHECK(cache_release_value(cache, value) == 0);
+		CHECK(released == key);
+		CHECK(cache_release_value(cache, value) == ENOENT);
+	}
+
+	// the entries that were still in the cache must all be intact
+	for (uintptr_t key = 1000; key < 1500; key++)
+	{
+		void* value;
+
+		CHECK(cache_get_and_retain(cache, (void*)key, &value) == 0);
+		CHECK(cache_release_value(cache, value) == 0);
+	}
+	fill(cache, 1500, 3000);
+
+	CHECK(cache_destroy(cache) == 0);
+	CHECK(released == 199 + 2000);
+}
+
+static void test_release_after_replace(void)
+{
+	cache_t* cache = create_cache();
+
+	released = 0;
+	fill(cache, 1000, 1500);
+
+	for (uintptr_t key = 1; key < 200; key++)
+	{
+		void* old_value = malloc(16);
+		void* new_value = malloc(16);
+
+		CHECK(cache_set_and_retain(cache, (void*)key, old_value, 1) == 0);
+		CHECK(cache_set_and_retain(cache, (void*)key, new_value, 1) == 0);
+		CHECK(cache_release_value(cache, new_value) == 0);
+		CHECK(released == key - 1);
+		CHECK(cache_release_value(cache, old_value) == 0);
+		CHECK(released == key);
+	}
+
+	fill(cache, 1500, 3000);
+
+	CHECK(cache_destroy(cache) == 0);
+	CHECK(released == 199 * 2 + 2000);
+}
+
+static void test_release_after_remove_all(void)
+{
+	cache_t* cache = create_cache();
+	void* value = malloc(16);
+
+	released = 0;
+	fill(cache, 1000, 1500);
+
+	CHECK(cache_set_and_retain(cache, (void*)1, value, 1) == 0);
+	CHECK(cache_remove_all(cache) == 0);
+	CHECK(released == 500);
+	CHECK(cache_release_value(cache, value) == 0);
+	CHECK(released == 501);
+
+	fill(cache, 1, 1000);
+
+	CHECK(cache_destroy(cache) == 0);
+	CHECK(released == 501 + 999);
+}
+
+static void test_trim(void)
+{
+	cache_t* cache = create_cache();
+	void* retained = malloc(16);
+	void* value;
+
+	released = 0;
+	CHECK(cache_set_and_retain(cache, (void*)1, retained, 1) == 0);
+	fill(cache, 2, 1001);
+
+	// trimming stops right at the limit
+	cache_set_count_hint(cache, 100);
+	CHECK(released == 900);
+	cache_set_count_hint(cache, 0);
+
+	cache_set_cost_hint(cache, 50);
+	CHECK(released == 950);
+	cache_set_cost_hint(cache, 0);
+
+	// everything but the retained value goes under critical pressure
+	cache_simulate_memory_warning_event(DISPATCH_MEMORYPRESSURE_CRITICAL);
+	CHECK(released == 999);
+	CHECK(cache_get_and_retain(cache, (void*)1, &value) == 0 && value == retained);
+	CHECK(cache_release_value(cache, value) == 0);
+	CHECK(cache_release_value(cache, retained) == 0);
+
+	CHECK(cache_destroy(cache) == 0);
+	CHECK(released == 1000);
+}
+
+int main(int argc, const char** argv)
+{
+	test_release_after_remove();
+	test_release_after_replace();
+	test_release_after_remove_all();
+	test_trim();
+
+	if (failures)
+	{
+		fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	printf("All tests passed\n");
+	return 0;
+}
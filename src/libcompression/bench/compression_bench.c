@@ -0,0 +1,632 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measures libcompression throughput, compression ratio and peak memory use
+// for every algorithm, over synthetic corpora of several sizes, through the
+// one-shot, streaming and parallel entry points.
+//
+// Encoding and decoding each run in a forked child, so the peak resident size
+// reported is what that one operation needed on top of its input and output
+// buffers, undisturbed by earlier runs. Memory that the parent already freed
+// but kept mapped gets reused without counting, so small figures read low.
+
+#include <compression.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Chunk size used on both sides of compression_stream_process() in stream mode
+#define STREAM_CHUNK_SIZE (64 << 10)
+
+// Each measurement repeats until it has run for at least this long, and the best run counts
+#define MIN_RUN_TIME 0.25
+#define MAX_RUNS 50
+
+enum mode {
+    MODE_BUFFER,
+    MODE_STREAM,
+    MODE_PARALLEL,
+    MODE_COUNT
+};
+
+struct named_value {
+    const char* name;
+    int value;
+};
+
+static const struct named_value algorithms[] = {
+    { "lz4", COMPRESSION_LZ4 },
+    { "lz4_raw", COMPRESSION_LZ4_RAW },
+    { "lzfse", COMPRESSION_LZFSE },
+    { "zlib", COMPRESSION_ZLIB },
+    { "lzma", COMPRESSION_LZMA },
+};
+#define ALGORITHM_COUNT (sizeof(algorithms) / sizeof(algorithms[0]))
+
+static const char* const mode_names[MODE_COUNT] = { "buffer", "stream", "parallel" };
+
+enum corpus {
+    CORPUS_TEXT,
+    CORPUS_BINARY,
+    CORPUS_COMPRESSED,
+    CORPUS_FILE,
+    CORPUS_COUNT
+};
+
+static const char* const corpus_names[CORPUS_COUNT] = { "text", "binary", "compressed", "file" };
+
+static const size_t default_sizes[] = { 64 << 10, 1 << 20, 16 << 20 };
+#define DEFAULT_SIZE_COUNT (sizeof(default_sizes) / sizeof(default_sizes[0]))
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long peak_rss(void) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024L;
+#endif
+}
+
+// xorshift64*, so that every run sees the same corpora
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+// English-like text: words drawn with a skewed distribution, so that common
+// words repeat often and rare ones seldom, as in real prose
+static void generate_text(uint8_t* dst, size_t size) {
+    static const char* const words[] = {
+        "the", "of", "and", "to", "a", "in", "is", "it", "that", "for", "was", "on", "with",
+        "as", "be", "at", "by", "this", "from", "or", "have", "an", "which", "not", "are",
+        "but", "they", "file", "system", "kernel", "process", "memory", "compression",
+        "buffer", "stream", "darling", "library", "framework", "binary", "directory",
+        "implementation", "performance", "throughput", "application", "interface",
+        "configuration", "allocation", "synchronization", "environment", "documentation",
+    };
+    const size_t count = sizeof(words) / sizeof(words[0]);
+    size_t pos = 0, line = 0;
+
+    while (pos < size) {
+        uint64_t r = rng_next();
+        // The product of two uniform picks favours the first entries
+        size_t index = ((r & 0xffff) * ((r >> 16) & 0xffff) >> 16) * count >> 16;
+        const char* word = words[index];
+        size_t len = strlen(word);
+        char sep = ' ';
+
+        if ((r >> 40) % 17 == 0)
+            sep = ',';
+        if (line + len > 72) {
+            sep = (r >> 48) % 5 == 0 ? '.' : '\n';
+            line = 0;
+        }
+
+        for (size_t i = 0; i < len && pos < size; i++)
+            dst[pos++] = word[i];
+        if (pos < size)
+            dst[pos++] = sep;
+        line += len + 1;
+    }
+}
+
+// Binary data resembling in-memory tables: fixed-size records of counters,
+// small integers, pointers into a few regions, floats and padding
+static void generate_binary(uint8_t* dst, size_t size) {
+    uint64_t counter = 0;
+    size_t pos = 0;
+
+    while (pos < size) {
+        struct {
+            uint64_t id;
+            uint64_t pointer;
+            uint32_t flags;
+            int32_t value;
+            float weight;
+            uint32_t padding;
+        } record;
+        uint64_t r = rng_next();
+        size_t n = sizeof(record) < size - pos ? sizeof(record) : size - pos;
+
+        counter += 1 + (r & 3);
+        record.id = counter;
+        record.pointer = 0x00007fff00000000ULL + ((r >> 8) & 3) * 0x10000000ULL + ((r >> 16) & 0xfff) * 16;
+        record.flags = 1u << ((r >> 28) & 7);
+        record.value = (int32_t)((r >> 32) & 0x3ff) - 512;
+        record.weight = (float)((r >> 42) & 0xff) / 16.0f;
+        record.padding = 0;
+
+        memcpy(dst + pos, &record, n);
+        pos += n;
+    }
+}
+
+// Data that has already been compressed, as found in zip archives and PNG images
+static bool generate_compressed(uint8_t* dst, size_t size) {
+    size_t text_size = 4 << 20;
+    uint8_t* text = malloc(text_size);
+    uint8_t* packed = malloc(text_size);
+    size_t pos = 0;
+    bool ok = text && packed;
+
+    while (ok && pos < size) {
+        size_t n;
+
+        generate_text(text, text_size);
+        n = compression_encode_buffer(packed, text_size, text, text_size, NULL, COMPRESSION_ZLIB);
+        if (n == 0) {
+            ok = false;
+            break;
+        }
+        if (n > size - pos)
+            n = size - pos;
+        memcpy(dst + pos, packed, n);
+        pos += n;
+    }
+
+    free(text);
+    free(packed);
+    return ok;
+}
+
+static uint8_t* load_file(const char* path, size_t size) {
+    uint8_t* data = malloc(size ? size : 1);
+    size_t pos = 0;
+    FILE* f = fopen(path, "rb");
+
+    if (!f || !data) {
+        fprintf(stderr, "compression_bench: %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    // Files shorter than the requested size repeat
+    while (pos < size) {
+        size_t n = fread(data + pos, 1, size - pos, f);
+        if (n == 0) {
+            if (pos == 0 || ferror(f)) {
+                fprintf(stderr, "compression_bench: %s: cannot read\n", path);
+                goto fail;
+            }
+            rewind(f);
+        }
+        pos += n;
+    }
+
+    fclose(f);
+    return data;
+
+fail:
+    if (f)
+        fclose(f);
+    free(data);
+    return NULL;
+}
+
+static uint8_t* make_corpus(enum corpus corpus, const char* path, size_t size) {
+    uint8_t* data;
+
+    if (corpus == CORPUS_FILE)
+        return load_file(path, size);
+
+    data = malloc(size ? size : 1);
+    if (!data)
+        return NULL;
+
+    rng_state = 0x9e3779b97f4a7c15ULL;
+    switch (corpus) {
+        case CORPUS_TEXT:
+            generate_text(data, size);
+            break;
+        case CORPUS_BINARY:
+            generate_binary(data, size);
+            break;
+        case CORPUS_COMPRESSED:
+            if (!generate_compressed(data, size)) {
+                free(data);
+                return NULL;
+            }
+            break;
+        default:
+            break;
+    }
+    return data;
+}
+
+static size_t stream_run(compression_stream_operation operation, compression_algorithm algorithm,
+                         uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size) {
+    compression_stream stream;
+    compression_status status = COMPRESSION_STATUS_OK;
+    size_t src_pos = 0, dst_pos = 0;
+
+    if (compression_stream_init(&stream, operation, algorithm) != COMPRESSION_STATUS_OK)
+        return 0;
+
+    // Feed and drain at most one chunk at a time, as a pipe would
+    stream.src_size = 0;
+    while (status == COMPRESSION_STATUS_OK) {
+        size_t in_chunk, out_chunk;
+        int flags = 0;
+
+        if (stream.src_size == 0) {
+            in_chunk = src_size - src_pos < STREAM_CHUNK_SIZE ? src_size - src_pos : STREAM_CHUNK_SIZE;
+            stream.src_ptr = src + src_pos;
+            stream.src_size = in_chunk;
+            src_pos += in_chunk;
+        }
+        if (src_pos == src_size)
+            flags = COMPRESSION_STREAM_FINALIZE;
+
+        out_chunk = dst_size - dst_pos < STREAM_CHUNK_SIZE ? dst_size - dst_pos : STREAM_CHUNK_SIZE;
+        if (out_chunk == 0)
+            break;
+        stream.dst_ptr = dst + dst_pos;
+        stream.dst_size = out_chunk;
+
+        status = compression_stream_process(&stream, flags);
+        dst_pos += out_chunk - stream.dst_size;
+    }
+
+    compression_stream_destroy(&stream);
+    return status == COMPRESSION_STATUS_END ? dst_pos : 0;
+}
+
+static size_t encode(enum mode mode, compression_algorithm algorithm, uint8_t* dst, size_t dst_size,
+                     const uint8_t* src, size_t src_size, void* scratch) {
+    switch (mode) {
+        case MODE_BUFFER:
+            return compression_encode_buffer(dst, dst_size, src, src_size, scratch, algorithm);
+        case MODE_STREAM:
+            return stream_run(COMPRESSION_STREAM_ENCODE, algorithm, dst, dst_size, src, src_size);
+        case MODE_PARALLEL:
+            return compression_encode_buffer_parallel(dst, dst_size, src, src_size, 0, algorithm);
+        default:
+            return 0;
+    }
+}
+
+static size_t decode(enum mode mode, compression_algorithm algorithm, uint8_t* dst, size_t dst_size,
+                     const uint8_t* src, size_t src_size, void* scratch) {
+    switch (mode) {
+        case MODE_BUFFER:
+            return compression_decode_buffer(dst, dst_size, src, src_size, scratch, algorithm);
+        case MODE_STREAM:
+            return stream_run(COMPRESSION_STREAM_DECODE, algorithm, dst, dst_size, src, src_size);
+        case MODE_PARALLEL:
+            return compression_decode_buffer_parallel(dst, dst_size, src, src_size, algorithm);
+        default:
+            return 0;
+    }
+}
+
+struct job {
+    enum mode mode;
+    compression_algorithm algorithm;
+    const uint8_t* src;
+    size_t src_size;
+    // For decoding, the output of the same mode's encoder
+    const uint8_t* packed;
+    size_t packed_size;
+};
+
+struct measurement {
+    bool ok;
+    size_t size;
+    double time;
+    long peak;
+};
+
+// Worst case growth of incompressible input, which raw LZ4 and stored LZFSE blocks come closest to
+static size_t packed_capacity(size_t size) {
+    return size + size / 16 + (64 << 10);
+}
+
+// Runs the operation until it has taken MIN_RUN_TIME overall and keeps the fastest run
+static void time_runs(const struct job* job, bool encoding, uint8_t* dst, size_t dst_size, void* scratch,
+                      struct measurement* m) {
+    m->time = 1e30;
+
+    for (int runs = 1; runs <= MAX_RUNS; runs++) {
+        double start = now(), elapsed;
+
+        if (encoding)
+            m->size = encode(job->mode, job->algorithm, dst, dst_size, job->src, job->src_size, scratch);
+        else
+            m->size = decode(job->mode, job->algorithm, dst, dst_size, job->packed, job->packed_size, scratch);
+        elapsed = now() - start;
+
+        if (encoding ? (m->size == 0 && job->src_size > 0)
+                     : (m->size != job->src_size || memcmp(dst, job->src, job->src_size) != 0))
+            return;
+
+        if (elapsed < m->time)
+            m->time = elapsed;
+        if (runs * m->time >= MIN_RUN_TIME)
+            break;
+    }
+    m->ok = true;
+}
+
+// Runs in a child process, whose peak resident size only covers this one operation
+static struct measurement measure(const struct job* job, bool encoding) {
+    struct measurement m = { 0 };
+    // Decoding gets one spare byte to show whether it would write past the original size
+    size_t dst_size = encoding ? packed_capacity(job->src_size) : job->src_size + 1;
+    size_t scratch_size = encoding ? compression_encode_scratch_buffer_size(job->algorithm)
+                                   : compression_decode_scratch_buffer_size(job->algorithm);
+    uint8_t* dst = malloc(dst_size);
+    void* scratch = NULL;
+    long baseline;
+
+    if (!dst)
+        return m;
+    memset(dst, 0, dst_size);
+    baseline = peak_rss();
+
+    // The caller provides the scratch buffer in buffer mode, so it counts as the codec's memory
+    if (job->mode == MODE_BUFFER && scratch_size > 0) {
+        scratch = malloc(scratch_size);
+        if (!scratch) {
+            free(dst);
+            return m;
+        }
+        memset(scratch, 0, scratch_size);
+    }
+
+    time_runs(job, encoding, dst, dst_size, scratch, &m);
+    m.peak = peak_rss() - baseline;
+
+    free(scratch);
+    free(dst);
+    return m;
+}
+
+static bool run_isolated(const struct job* job, bool encoding, struct measurement* m) {
+    int fds[2];
+    pid_t pid;
+    int status;
+    ssize_t n;
+
+    if (pipe(fds) != 0)
+        return false;
+
+    pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        struct measurement result;
+
+        close(fds[0]);
+        result = measure(job, encoding);
+        n = write(fds[1], &result, sizeof(result));
+        _exit(n == sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    n = read(fds[0], m, sizeof(*m));
+    close(fds[0]);
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    return n == sizeof(*m) && WIFEXITED(status) && WEXITSTATUS(status) == 0 && m->ok;
+}
+
+static bool benchmark(struct job* job, struct measurement* enc, struct measurement* dec) {
+    size_t capacity = packed_capacity(job->src_size);
+    uint8_t* packed = malloc(capacity);
+    bool ok;
+
+    if (!packed)
+        return false;
+
+    // The decoders get their input from here, not from the child that timed the encoder
+    job->packed = packed;
+    job->packed_size = encode(job->mode, job->algorithm, packed, capacity, job->src, job->src_size, NULL);
+
+    ok = (job->packed_size > 0 || job->src_size == 0) && run_isolated(job, true, enc) && run_isolated(job, false, dec);
+
+    job->packed = NULL;
+    free(packed);
+    return ok;
+}
+
+static size_t parse_size(const char* arg) {
+    char* end;
+    unsigned long long value = strtoull(arg, &end, 0);
+
+    switch (*end) {
+        case 'k': case 'K':
+            value <<= 10;
+            end++;
+            break;
+        case 'm': case 'M':
+            value <<= 20;
+            end++;
+            break;
+        case 'g': case 'G':
+            value <<= 30;
+            end++;
+            break;
+    }
+    return *end == '\0' ? (size_t)value : 0;
+}
+
+static int lookup(const char* name, const char* const* names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: compression_bench [-a algorithm] [-c corpus] [-m mode] [-s size] [-f file]\n"
+        "  -a  lz4, lz4_raw, lzfse, zlib or lzma (repeatable, default all)\n"
+        "  -c  text, binary or compressed (repeatable, default all)\n"
+        "  -m  buffer, stream or parallel (repeatable, default all)\n"
+        "  -s  input size, with an optional k, m or g suffix (repeatable, default 64k, 1m, 16m)\n"
+        "  -f  also benchmark the contents of a file, repeated up to each size\n");
+}
+
+int main(int argc, char** argv) {
+    bool algorithm_set[ALGORITHM_COUNT] = { false };
+    bool corpus_set[CORPUS_COUNT] = { false };
+    bool mode_set[MODE_COUNT] = { false };
+    bool any_algorithm = false, any_corpus = false, any_mode = false;
+    size_t sizes[16];
+    size_t size_count = 0;
+    const char* path = NULL;
+    int failures = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "a:c:m:s:f:h")) != -1) {
+        int i;
+
+        switch (c) {
+            case 'a':
+                for (i = 0; i < (int)ALGORITHM_COUNT && strcmp(optarg, algorithms[i].name) != 0; i++)
+                    ;
+                if (i == (int)ALGORITHM_COUNT) {
+                    usage();
+                    return 1;
+                }
+                algorithm_set[i] = any_algorithm = true;
+                break;
+            case 'c':
+                i = lookup(optarg, corpus_names, CORPUS_FILE);
+                if (i < 0) {
+                    usage();
+                    return 1;
+                }
+                corpus_set[i] = any_corpus = true;
+                break;
+            case 'm':
+                i = lookup(optarg, mode_names, MODE_COUNT);
+                if (i < 0) {
+                    usage();
+                    return 1;
+                }
+                mode_set[i] = any_mode = true;
+                break;
+            case 's':
+                if (size_count == sizeof(sizes) / sizeof(sizes[0]) || (sizes[size_count++] = parse_size(optarg)) == 0) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'f':
+                path = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (!any_algorithm)
+        memset(algorithm_set, true, sizeof(algorithm_set));
+    if (!any_corpus)
+        memset(corpus_set, true, sizeof(corpus_set));
+    if (!any_mode)
+        memset(mode_set, true, sizeof(mode_set));
+    if (size_count == 0) {
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+        size_count = DEFAULT_SIZE_COUNT;
+    }
+    corpus_set[CORPUS_FILE] = path != NULL;
+    if (path && !any_corpus) {
+        // A file on its own replaces the synthetic corpora
+        memset(corpus_set, false, sizeof(corpus_set));
+        corpus_set[CORPUS_FILE] = true;
+    }
+
+    printf("%-8s %-10s %9s %-8s %7s %10s %10s %10s %10s\n",
+           "algo", "corpus", "size", "mode", "ratio", "enc MB/s", "dec MB/s", "enc KiB", "dec KiB");
+
+    for (int corpus = 0; corpus < CORPUS_COUNT; corpus++) {
+        if (!corpus_set[corpus])
+            continue;
+
+        for (size_t s = 0; s < size_count; s++) {
+            size_t size = sizes[s];
+            uint8_t* src = make_corpus(corpus, path, size);
+
+            if (!src) {
+                fprintf(stderr, "compression_bench: cannot build the %s corpus\n", corpus_names[corpus]);
+                return 1;
+            }
+
+            for (size_t a = 0; a < ALGORITHM_COUNT; a++) {
+                if (!algorithm_set[a])
+                    continue;
+
+                for (int mode = 0; mode < MODE_COUNT; mode++) {
+                    struct job job = { mode, algorithms[a].value, src, size, NULL, 0 };
+                    struct measurement enc, dec;
+
+                    if (!mode_set[mode])
+                        continue;
+
+                    if (!benchmark(&job, &enc, &dec)) {
+                        printf("%-8s %-10s %9zu %-8s FAILED\n", algorithms[a].name, corpus_names[corpus], size, mode_names[mode]);
+                        failures++;
+                        continue;
+                    }
+
+                    printf("%-8s %-10s %9zu %-8s %7.3f %10.1f %10.1f %10ld %10ld\n",
+                           algorithms[a].name, corpus_names[corpus], size, mode_names[mode],
+                           (double)enc.size / (size ? size : 1),
+                           size / 1e6 / enc.time, size / 1e6 / dec.time,
+                           enc.peak >> 10, dec.peak >> 10);
+                    fflush(stdout);
+                }
+            }
+
+            free(src);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
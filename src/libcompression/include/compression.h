@@ -90,6 +90,26 @@ __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
 extern compression_status
 compression_stream_destroy(compression_stream * stream)
 __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+/*
+ * Darling extension: multithreaded block mode.
+ *
+ * The source is split into blocks of block_size bytes (0 picks a default for the
+ * algorithm) that are compressed independently and in parallel. The output is a
+ * regular stream of the algorithm, which compression_decode_buffer() and the stream
+ * API read as usual. compression_decode_buffer_parallel() decodes such output in
+ * parallel again; anything else it decodes like compression_decode_buffer().
+ * COMPRESSION_LZ4_RAW has no framing to split and is always processed serially.
+ */
+extern size_t
+compression_encode_buffer_parallel(uint8_t * __restrict dst_buffer, size_t dst_size,
+                                   const uint8_t * __restrict src_buffer, size_t src_size,
+                                   size_t block_size, compression_algorithm algorithm);
+
+extern size_t
+compression_decode_buffer_parallel(uint8_t * __restrict dst_buffer, size_t dst_size,
+                                   const uint8_t * __restrict src_buffer, size_t src_size,
+                                   compression_algorithm algorithm);
   
 #if __has_feature(assume_nonnull)
   _Pragma("clang assume_nonnull end")
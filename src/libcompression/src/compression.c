@@ -1,8 +1,24 @@
 #include <compression.h>
+#include <stdlib.h>
+#include "compression_private.h"
+#include "lz4.h"
 
 size_t
 compression_encode_scratch_buffer_size(compression_algorithm algorithm) {
-    return 0;
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+        case COMPRESSION_LZ4_RAW:
+            return LZ4_HASH_SIZE * sizeof(uint32_t);
+        case COMPRESSION_ZLIB:
+            return compression_zlib_encode_scratch_size();
+        case COMPRESSION_LZFSE:
+            return compression_lzfse_encode_scratch_size();
+        case COMPRESSION_LZMA:
+            // liblzma allocates its own memory
+            return 1;
+        default:
+            return 0;
+    }
 }
 
 size_t
@@ -10,12 +26,50 @@ compression_encode_buffer(uint8_t * __restrict dst_buffer, size_t dst_size,
                           const uint8_t * __restrict src_buffer, size_t src_size,
                           void * __restrict __nullable scratch_buffer,
                           compression_algorithm algorithm) {
-    return 0;
+    void* scratch = scratch_buffer;
+    size_t written;
+
+    if (algorithm == COMPRESSION_LZ4 || algorithm == COMPRESSION_LZ4_RAW) {
+        if (!scratch && !(scratch = malloc(LZ4_HASH_SIZE * sizeof(uint32_t))))
+            return 0;
+
+        if (algorithm == COMPRESSION_LZ4)
+            written = lz4_encode_frame(dst_buffer, dst_size, src_buffer, src_size, scratch);
+        else
+            written = lz4_encode_raw(dst_buffer, dst_size, src_buffer, src_size, scratch);
+
+        if (scratch != scratch_buffer)
+            free(scratch);
+        return written;
+    }
+
+    switch (algorithm) {
+        case COMPRESSION_ZLIB:
+            return compression_zlib_encode_buffer(dst_buffer, dst_size, src_buffer, src_size, scratch_buffer);
+        case COMPRESSION_LZMA:
+            return compression_lzma_encode_buffer(dst_buffer, dst_size, src_buffer, src_size);
+        case COMPRESSION_LZFSE:
+            return compression_lzfse_encode_buffer(dst_buffer, dst_size, src_buffer, src_size, scratch_buffer);
+        default:
+            return 0;
+    }
 }
 
 size_t
 compression_decode_scratch_buffer_size(compression_algorithm algorithm) {
-    return 0;
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+        case COMPRESSION_LZ4_RAW:
+        case COMPRESSION_LZMA:
+            // Nothing needed, but callers may treat 0 as an unsupported algorithm
+            return 1;
+        case COMPRESSION_ZLIB:
+            return compression_zlib_decode_scratch_size();
+        case COMPRESSION_LZFSE:
+            return compression_lzfse_decode_scratch_size();
+        default:
+            return 0;
+    }
 }
 
 size_t
@@ -23,24 +77,58 @@ compression_decode_buffer(uint8_t * __restrict dst_buffer, size_t dst_size,
                           const uint8_t * __restrict src_buffer, size_t src_size,
                           void * __restrict __nullable scratch_buffer,
                           compression_algorithm algorithm) {
-    return 0;
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+            return lz4_decode_frame(dst_buffer, dst_size, src_buffer, src_size);
+        case COMPRESSION_LZ4_RAW:
+            return lz4_decode_raw(dst_buffer, dst_size, src_buffer, src_size);
+        case COMPRESSION_ZLIB:
+            return compression_zlib_decode_buffer(dst_buffer, dst_size, src_buffer, src_size, scratch_buffer);
+        case COMPRESSION_LZMA:
+            return compression_lzma_decode_buffer(dst_buffer, dst_size, src_buffer, src_size);
+        case COMPRESSION_LZFSE:
+            return compression_lzfse_decode_buffer(dst_buffer, dst_size, src_buffer, src_size, scratch_buffer);
+        default:
+            return 0;
+    }
 }
 
 compression_status
 compression_stream_init(compression_stream * stream,
                         compression_stream_operation operation,
                         compression_algorithm algorithm) {
-    return COMPRESSION_STATUS_ERROR;
+    stream->state = NULL;
+
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+            return compression_lz4_stream_init(stream, operation, false);
+        case COMPRESSION_LZ4_RAW:
+            return compression_lz4_stream_init(stream, operation, true);
+        case COMPRESSION_ZLIB:
+            return compression_zlib_stream_init(stream, operation);
+        case COMPRESSION_LZMA:
+            return compression_lzma_stream_init(stream, operation);
+        case COMPRESSION_LZFSE:
+            return compression_lzfse_stream_init(stream, operation);
+        default:
+            return COMPRESSION_STATUS_ERROR;
+    }
 }
 
 compression_status
 compression_stream_process(compression_stream * stream,
                            int flags) {
-    return COMPRESSION_STATUS_ERROR;
+    if (!stream->state)
+        return COMPRESSION_STATUS_ERROR;
+    return stream_state(stream)->process(stream, flags);
 }
 
 compression_status
 compression_stream_destroy(compression_stream * stream) {
-    return COMPRESSION_STATUS_ERROR;
-}
+    if (!stream->state)
+        return COMPRESSION_STATUS_ERROR;
 
+    stream_state(stream)->destroy(stream_state(stream));
+    stream->state = NULL;
+    return COMPRESSION_STATUS_OK;
+}
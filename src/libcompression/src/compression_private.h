@@ -0,0 +1,162 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _COMPRESSION_PRIVATE_H
+#define _COMPRESSION_PRIVATE_H
+
+#include <compression.h>
+#include <stdbool.h>
+
+// Every codec keeps its stream state in a structure starting with this header,
+// which compression_stream_init() stores in stream->state
+struct stream_state {
+    compression_status (*process)(compression_stream* stream, int flags);
+    void (*destroy)(struct stream_state* state);
+};
+
+static inline struct stream_state* stream_state(compression_stream* stream) {
+    return (struct stream_state*)stream->state;
+}
+
+// Growable byte buffer holding input that has been taken from the caller but not yet consumed
+struct stage {
+    uint8_t* data;
+    size_t pos, len, capacity;
+};
+
+// Appends as much caller input as fits after making room for `reserve` more bytes
+__attribute__((visibility("hidden")))
+bool stage_fill(struct stage* stage, compression_stream* stream, size_t reserve);
+__attribute__((visibility("hidden")))
+void stage_free(struct stage* stage);
+
+// Output buffer that keeps the last `history` bytes of decoded data around for back references.
+// [drain, end) has been decoded but not yet handed to the caller.
+struct window {
+    uint8_t* data;
+    size_t drain, end, capacity, history;
+};
+
+__attribute__((visibility("hidden")))
+bool window_init(struct window* window, size_t history, size_t capacity);
+// Makes at least `size` bytes available after `end`, keeping the history. May move the data.
+__attribute__((visibility("hidden")))
+bool window_reserve(struct window* window, size_t size);
+// Copies pending output to the caller, returns true if all of it went out
+__attribute__((visibility("hidden")))
+bool window_drain(struct window* window, compression_stream* stream);
+__attribute__((visibility("hidden")))
+void window_free(struct window* window);
+
+// Stream encoder for framed formats made of independently encoded blocks followed by an
+// end-of-stream marker. `encode` writes one block for [src, src + size) and returns its
+// size, which never exceeds `max_block_size`, or 0 on failure.
+typedef size_t (*block_encoder)(uint8_t* dst, const uint8_t* src, size_t size, void* scratch);
+
+__attribute__((visibility("hidden")))
+compression_status block_stream_init(compression_stream* stream, size_t block_size, size_t max_block_size,
+                                     size_t scratch_size, block_encoder encode, uint32_t end_magic);
+
+// Part of a compressed buffer that decodes independently of the rest
+struct segment {
+    const uint8_t* src;
+    size_t src_size;
+    // Where the decoded bytes go in the output
+    size_t offset, size;
+};
+
+struct segment_list {
+    struct segment* items;
+    size_t count, capacity;
+    // Codec specific information shared by all segments
+    uint32_t param;
+};
+
+__attribute__((visibility("hidden")))
+bool segment_list_add(struct segment_list* list, const uint8_t* src, size_t src_size, size_t offset, size_t size);
+
+// Codecs. Buffer functions follow compression_encode_buffer() and compression_decode_buffer()
+// semantics; stream functions set up stream->state.
+__attribute__((visibility("hidden")))
+compression_status compression_lz4_stream_init(compression_stream* stream, compression_stream_operation operation, bool raw);
+__attribute__((visibility("hidden")))
+size_t compression_lz4_encode_block(uint8_t* dst, const uint8_t* src, size_t size, void* scratch);
+__attribute__((visibility("hidden")))
+bool compression_lz4_split(const uint8_t* src, size_t src_size, struct segment_list* segments);
+__attribute__((visibility("hidden")))
+bool compression_lz4_decode_segment(uint8_t* dst, const struct segment* segment, uint32_t param);
+
+__attribute__((visibility("hidden")))
+size_t compression_zlib_encode_scratch_size(void);
+__attribute__((visibility("hidden")))
+size_t compression_zlib_decode_scratch_size(void);
+__attribute__((visibility("hidden")))
+size_t compression_zlib_encode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch);
+__attribute__((visibility("hidden")))
+size_t compression_zlib_decode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch);
+__attribute__((visibility("hidden")))
+compression_status compression_zlib_stream_init(compression_stream* stream, compression_stream_operation operation);
+__attribute__((visibility("hidden")))
+size_t compression_zlib_block_bound(size_t size);
+// Encodes one piece of a DEFLATE stream, primed with the `dictionary_size` bytes that precede `src`.
+// Every piece but the last ends on a byte boundary so that the pieces can be concatenated.
+__attribute__((visibility("hidden")))
+size_t compression_zlib_encode_block(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t size,
+                                     size_t dictionary_size, bool last);
+
+__attribute__((visibility("hidden")))
+size_t compression_lzma_encode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size);
+__attribute__((visibility("hidden")))
+size_t compression_lzma_decode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size);
+__attribute__((visibility("hidden")))
+compression_status compression_lzma_stream_init(compression_stream* stream, compression_stream_operation operation);
+__attribute__((visibility("hidden")))
+size_t compression_lzma_block_bound(size_t size);
+// Encodes one .xz block and reports the size the index records for it
+__attribute__((visibility("hidden")))
+size_t compression_lzma_encode_block(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t size, uint64_t* unpadded_size);
+// Writes the .xz stream header, or the index and stream footer for the given blocks
+__attribute__((visibility("hidden")))
+size_t compression_lzma_encode_header(uint8_t* dst, size_t dst_size);
+__attribute__((visibility("hidden")))
+size_t compression_lzma_encode_index(uint8_t* dst, size_t dst_size, const uint64_t* unpadded_sizes,
+                                     const uint64_t* uncompressed_sizes, size_t count);
+__attribute__((visibility("hidden")))
+bool compression_lzma_split(const uint8_t* src, size_t src_size, struct segment_list* segments);
+__attribute__((visibility("hidden")))
+bool compression_lzma_decode_segment(uint8_t* dst, const struct segment* segment, uint32_t param);
+
+__attribute__((visibility("hidden")))
+size_t compression_lzfse_encode_scratch_size(void);
+__attribute__((visibility("hidden")))
+size_t compression_lzfse_decode_scratch_size(void);
+__attribute__((visibility("hidden")))
+size_t compression_lzfse_encode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch);
+__attribute__((visibility("hidden")))
+size_t compression_lzfse_decode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch);
+__attribute__((visibility("hidden")))
+compression_status compression_lzfse_stream_init(compression_stream* stream, compression_stream_operation operation);
+__attribute__((visibility("hidden")))
+size_t compression_lzfse_encode_block(uint8_t* dst, const uint8_t* src, size_t size, void* scratch);
+__attribute__((visibility("hidden")))
+bool compression_lzfse_split(const uint8_t* src, size_t src_size, struct segment_list* segments);
+__attribute__((visibility("hidden")))
+bool compression_lzfse_decode_segment(uint8_t* dst, const struct segment* segment, uint32_t param);
+
+#endif
@@ -0,0 +1,479 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lz4.h"
+#include <string.h>
+
+// LZ4 block format: a sequence is a token (literal length << 4 | match length - 4),
+// optional literal length bytes, the literals, a 16-bit little endian offset and
+// optional match length bytes. The last sequence of a block has literals only.
+#define MINMATCH 4
+#define LASTLITERALS 5 // the last 5 bytes are always literals
+#define MFLIMIT 12 // the last match starts at least 12 bytes before the end
+#define SKIP_TRIGGER 6 // search faster through incompressible data
+
+// Positions are kept as 32-bit offsets in the hash table
+#define MAX_INPUT_SIZE 0x7e000000
+
+static inline uint64_t load64(const void* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline size_t count_match(const uint8_t* ip, const uint8_t* match, const uint8_t* limit) {
+    const uint8_t* start = ip;
+
+    while (limit - ip >= 8) {
+        uint64_t diff = load64(ip) ^ load64(match);
+        if (diff)
+            return ip - start + (__builtin_ctzll(diff) >> 3);
+        ip += 8;
+        match += 8;
+    }
+    while (ip < limit && *ip == *match) {
+        ip++;
+        match++;
+    }
+    return ip - start;
+}
+
+static inline uint8_t* write_length(uint8_t* op, size_t length) {
+    for (; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static inline bool read_length(const uint8_t** ip, const uint8_t* end, size_t* length) {
+    unsigned byte;
+
+    do {
+        if (*ip >= end)
+            return false;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+bool lz4_encode(uint8_t** dst, uint8_t* dst_end, const uint8_t** src, const uint8_t* src_end, bool final, uint32_t* table) {
+    const uint8_t* base = *src;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    const uint8_t* mflimit;
+    const uint8_t* matchlimit;
+    uint8_t* op = *dst;
+    size_t literals;
+
+    if ((size_t)(src_end - base) > MAX_INPUT_SIZE) {
+        src_end = base + MAX_INPUT_SIZE;
+        final = false;
+    }
+    if (src_end - base < MFLIMIT + 1)
+        goto last_literals;
+
+    mflimit = src_end - MFLIMIT;
+    matchlimit = src_end - LASTLITERALS;
+
+    for (;;) {
+        const uint8_t* forward = ip;
+        const uint8_t* match;
+        unsigned attempts = 1 << SKIP_TRIGGER;
+        uint8_t* token;
+        size_t length;
+
+        // The table is never cleared: every candidate is checked to lie before
+        // `ip`, within the window and to actually match
+        for (;;) {
+            uint32_t sequence, position, candidate;
+            uint32_t* entry;
+
+            ip = forward;
+            if (ip > mflimit)
+                goto last_literals;
+            forward += attempts++ >> SKIP_TRIGGER;
+
+            sequence = lz4_load32(ip);
+            position = (uint32_t)(ip - base);
+            entry = &table[hash32(sequence)];
+            candidate = *entry;
+            *entry = position;
+
+            if (candidate < position && position - candidate <= LZ4_MAX_DISTANCE && lz4_load32(base + candidate) == sequence) {
+                match = base + candidate;
+                break;
+            }
+        }
+
+        while (ip > anchor && match > base && ip[-1] == match[-1]) {
+            ip--;
+            match--;
+        }
+
+        literals = ip - anchor;
+        if ((size_t)(dst_end - op) < 1 + literals / 255 + 1 + literals + 2)
+            return false;
+
+        token = op++;
+        if (literals >= 15) {
+            *token = 15 << 4;
+            op = write_length(op, literals - 15);
+        } else {
+            *token = (uint8_t)(literals << 4);
+        }
+        memcpy(op, anchor, literals);
+        op += literals;
+
+        op[0] = (uint8_t)(ip - match);
+        op[1] = (uint8_t)((ip - match) >> 8);
+        op += 2;
+
+        length = count_match(ip + MINMATCH, match + MINMATCH, matchlimit);
+        ip += MINMATCH + length;
+
+        if (length >= 15) {
+            if ((size_t)(dst_end - op) < length / 255 + 1)
+                return false;
+            *token |= 15;
+            op = write_length(op, length - 15);
+        } else {
+            *token |= (uint8_t)length;
+        }
+
+        anchor = ip;
+        if (ip > mflimit)
+            break;
+
+        table[hash32(lz4_load32(ip - 2))] = (uint32_t)(ip - 2 - base);
+    }
+
+last_literals:
+    if (!final) {
+        *src = anchor;
+        *dst = op;
+        return true;
+    }
+
+    literals = src_end - anchor;
+    if ((size_t)(dst_end - op) < 1 + literals / 255 + 1 + literals)
+        return false;
+
+    if (literals >= 15) {
+        *op++ = 15 << 4;
+        op = write_length(op, literals - 15);
+    } else {
+        *op++ = (uint8_t)(literals << 4);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    *src = src_end;
+    *dst = op;
+    return true;
+}
+
+static inline void copy_match(uint8_t* op, const uint8_t* match, size_t length, const uint8_t* dst_end) {
+    uint8_t* end = op + length;
+    size_t offset = op - match;
+
+    if (offset < 8) {
+        // Repeat the pattern byte by byte until it can be copied from at least 8 bytes back
+        size_t distance = offset;
+        size_t head;
+
+        while (distance < 8)
+            distance += offset;
+        head = distance - offset;
+        if (head > length)
+            head = length;
+
+        for (size_t i = 0; i < head; i++)
+            op[i] = match[i];
+        op += head;
+        match = op - distance;
+        offset = distance;
+    }
+
+    if ((size_t)(dst_end - end) >= 16) {
+        if (offset >= 16) {
+            do {
+                memcpy(op, match, 16);
+                op += 16;
+                match += 16;
+            } while (op < end);
+        } else {
+            do {
+                memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            } while (op < end);
+        }
+    } else {
+        while (op < end)
+            *op++ = *match++;
+    }
+}
+
+int lz4_decode(const uint8_t** src, const uint8_t* src_end, uint8_t* dst_begin, uint8_t** dst, uint8_t* dst_end, bool final, bool partial) {
+    const uint8_t* ip = *src;
+    uint8_t* op = *dst;
+    int status;
+
+    for (;;) {
+        const uint8_t* sequence = ip;
+        const uint8_t* literals;
+        size_t literal_length, match_length, offset;
+        unsigned token;
+
+        if (ip == src_end) {
+            status = final ? LZ4_STATUS_OK : LZ4_STATUS_SRC_EMPTY;
+            break;
+        }
+
+        token = *ip++;
+        literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(&ip, src_end, &literal_length))
+            goto truncated;
+        if ((size_t)(src_end - ip) < literal_length)
+            goto truncated;
+        literals = ip;
+        ip += literal_length;
+
+        if (ip == src_end) {
+            if (!final)
+                goto truncated;
+
+            // Last sequence
+            if ((size_t)(dst_end - op) < literal_length) {
+                if (partial) {
+                    memcpy(op, literals, dst_end - op);
+                    op = dst_end;
+                }
+                ip = sequence;
+                status = LZ4_STATUS_DST_FULL;
+                break;
+            }
+
+            memcpy(op, literals, literal_length);
+            op += literal_length;
+            status = LZ4_STATUS_OK;
+            break;
+        }
+
+        if (src_end - ip < 2)
+            goto truncated;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        match_length = token & 15;
+        if (match_length == 15 && !read_length(&ip, src_end, &match_length))
+            goto truncated;
+        match_length += MINMATCH;
+
+        if (offset == 0 || offset > (size_t)(op - dst_begin) + literal_length) {
+            ip = sequence;
+            status = LZ4_STATUS_ERROR;
+            break;
+        }
+
+        if ((size_t)(dst_end - op) < literal_length || (size_t)(dst_end - op) - literal_length < match_length) {
+            if (partial) {
+                size_t n = (size_t)(dst_end - op) < literal_length ? (size_t)(dst_end - op) : literal_length;
+                const uint8_t* match;
+
+                memcpy(op, literals, n);
+                op += n;
+                match = op - offset;
+                while (op < dst_end)
+                    *op++ = *match++;
+            }
+            ip = sequence;
+            status = LZ4_STATUS_DST_FULL;
+            break;
+        }
+
+        if (literal_length <= 16 && src_end - literals >= 16 && dst_end - op >= 16)
+            memcpy(op, literals, 16);
+        else
+            memcpy(op, literals, literal_length);
+        op += literal_length;
+
+        copy_match(op, op - offset, match_length, dst_end);
+        op += match_length;
+        continue;
+
+truncated:
+        ip = sequence;
+        status = final ? LZ4_STATUS_ERROR : LZ4_STATUS_SRC_EMPTY;
+        break;
+    }
+
+    *src = ip;
+    *dst = op;
+    return status;
+}
+
+bool lz4_encode_frame_block(uint8_t** dst, uint8_t* dst_end, const uint8_t* src, size_t size, uint32_t* table) {
+    uint8_t* op = *dst;
+    size_t room = dst_end - op;
+
+    if (room > LZ4_COMPRESSED_BLOCK_HEADER_SIZE && size > 1) {
+        uint8_t* payload = op + LZ4_COMPRESSED_BLOCK_HEADER_SIZE;
+        uint8_t* payload_end = payload;
+        const uint8_t* ip = src;
+        size_t limit = room - LZ4_COMPRESSED_BLOCK_HEADER_SIZE;
+
+        // Only keep the compressed form if it is smaller
+        if (limit > size - 1)
+            limit = size - 1;
+
+        if (lz4_encode(&payload_end, payload + limit, &ip, src + size, true, table)) {
+            lz4_store32(op, LZ4_COMPRESSED_BLOCK_MAGIC);
+            lz4_store32(op + 4, (uint32_t)size);
+            lz4_store32(op + 8, (uint32_t)(payload_end - payload));
+            *dst = payload_end;
+            return true;
+        }
+    }
+
+    if (room < LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE || room - LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE < size)
+        return false;
+
+    lz4_store32(op, LZ4_UNCOMPRESSED_BLOCK_MAGIC);
+    lz4_store32(op + 4, (uint32_t)size);
+    memcpy(op + LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE, src, size);
+    *dst = op + LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE + size;
+    return true;
+}
+
+size_t lz4_encode_frame(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, uint32_t* table) {
+    uint8_t* op = dst;
+    uint8_t* dst_end = dst + dst_size;
+
+    for (size_t pos = 0; pos < src_size; ) {
+        size_t size = src_size - pos < LZ4_BLOCK_SIZE ? src_size - pos : LZ4_BLOCK_SIZE;
+
+        if (!lz4_encode_frame_block(&op, dst_end, src + pos, size, table))
+            return 0;
+        pos += size;
+    }
+
+    if (dst_end - op < 4)
+        return 0;
+    lz4_store32(op, LZ4_ENDOFSTREAM_BLOCK_MAGIC);
+    op += 4;
+
+    return op - dst;
+}
+
+size_t lz4_decode_frame(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size) {
+    const uint8_t* ip = src;
+    const uint8_t* src_end = src + src_size;
+    uint8_t* op = dst;
+    uint8_t* dst_end = dst + dst_size;
+
+    for (;;) {
+        uint32_t magic, raw_size;
+
+        // Tolerate a missing end-of-stream marker at a block boundary
+        if (ip == src_end)
+            return op - dst;
+        if (src_end - ip < 4)
+            return 0;
+
+        magic = lz4_load32(ip);
+        if (magic == LZ4_ENDOFSTREAM_BLOCK_MAGIC)
+            return op - dst;
+
+        if (magic == LZ4_UNCOMPRESSED_BLOCK_MAGIC) {
+            if (src_end - ip < LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE)
+                return 0;
+            raw_size = lz4_load32(ip + 4);
+            ip += LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE;
+            if ((size_t)(src_end - ip) < raw_size)
+                return 0;
+
+            if ((size_t)(dst_end - op) < raw_size) {
+                memcpy(op, ip, dst_end - op);
+                return dst_size;
+            }
+            memcpy(op, ip, raw_size);
+            ip += raw_size;
+            op += raw_size;
+        } else if (magic == LZ4_COMPRESSED_BLOCK_MAGIC) {
+            const uint8_t* payload_end;
+            uint8_t* block_end;
+            uint32_t payload_size;
+            int status;
+
+            if (src_end - ip < LZ4_COMPRESSED_BLOCK_HEADER_SIZE)
+                return 0;
+            raw_size = lz4_load32(ip + 4);
+            payload_size = lz4_load32(ip + 8);
+            ip += LZ4_COMPRESSED_BLOCK_HEADER_SIZE;
+            if ((size_t)(src_end - ip) < payload_size)
+                return 0;
+            payload_end = ip + payload_size;
+
+            // Decoding is bounded by the block size so that a corrupt block can't overrun it
+            block_end = (size_t)(dst_end - op) > raw_size ? op + raw_size : dst_end;
+            status = lz4_decode(&ip, payload_end, dst, &op, block_end, true, true);
+
+            if (status == LZ4_STATUS_DST_FULL && block_end == dst_end)
+                return dst_size;
+            if (status != LZ4_STATUS_OK || op != block_end)
+                return 0;
+        } else {
+            return 0;
+        }
+    }
+}
+
+size_t lz4_encode_raw(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, uint32_t* table) {
+    const uint8_t* ip = src;
+    uint8_t* op = dst;
+
+    // lz4_encode() stops early on inputs too large for its table, so keep going from where it left off
+    do {
+        if (!lz4_encode(&op, dst + dst_size, &ip, src + src_size, true, table))
+            return 0;
+    } while (ip != src + src_size);
+
+    return op - dst;
+}
+
+size_t lz4_decode_raw(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size) {
+    const uint8_t* ip = src;
+    uint8_t* op = dst;
+    int status;
+
+    status = lz4_decode(&ip, src + src_size, dst, &op, dst + dst_size, true, true);
+    if (status == LZ4_STATUS_DST_FULL)
+        return dst_size;
+    if (status != LZ4_STATUS_OK)
+        return 0;
+
+    return op - dst;
+}
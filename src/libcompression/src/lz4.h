@@ -0,0 +1,99 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _COMPRESSION_LZ4_H
+#define _COMPRESSION_LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define LZ4_HASH_LOG 14
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_LOG)
+#define LZ4_MAX_DISTANCE 65535
+
+// Raw bytes per block in COMPRESSION_LZ4 output; every block is encoded
+// independently of the others, but the decoder accepts references into earlier
+// blocks as Apple's encoder may produce them.
+#define LZ4_BLOCK_SIZE (1 << 20)
+
+// COMPRESSION_LZ4 framing
+#define LZ4_COMPRESSED_BLOCK_MAGIC 0x31347662 // "bv41": n_raw_bytes, n_payload_bytes, payload
+#define LZ4_UNCOMPRESSED_BLOCK_MAGIC 0x2d347662 // "bv4-": n_raw_bytes, raw bytes
+#define LZ4_ENDOFSTREAM_BLOCK_MAGIC 0x24347662 // "bv4$"
+
+#define LZ4_COMPRESSED_BLOCK_HEADER_SIZE 12
+#define LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE 8
+
+enum {
+    LZ4_STATUS_OK = 0,
+    LZ4_STATUS_SRC_EMPTY = -1,
+    LZ4_STATUS_DST_FULL = -2,
+    LZ4_STATUS_ERROR = -3,
+};
+
+// Worst-case size of the LZ4 sequences for `size` input bytes.
+#define LZ4_ENCODE_BOUND(size) ((size) + (size) / 255 + 16)
+
+// Encodes [*src, src_end) as LZ4 sequences into [*dst, dst_end), advancing both pointers.
+// `table` holds LZ4_HASH_SIZE entries and need not be initialized.
+// If `final` is false, the trailing literals are left for the next call, which
+// must present them again at the start of its input.
+// Returns false if the output does not fit.
+__attribute__((visibility("hidden")))
+bool lz4_encode(uint8_t** dst, uint8_t* dst_end, const uint8_t** src, const uint8_t* src_end, bool final, uint32_t* table);
+
+// Decodes LZ4 sequences from [*src, src_end) into [*dst, dst_end), advancing both pointers.
+// Matches may reach back to `dst_begin`.
+// A sequence that is not complete in the input ends decoding with SRC_EMPTY, unless `final`
+// is set, in which case the input must end with a literal-only sequence and OK is returned.
+// A sequence that does not fit in the output ends decoding with DST_FULL; if `partial` is set,
+// as much of it as fits is written first.
+__attribute__((visibility("hidden")))
+int lz4_decode(const uint8_t** src, const uint8_t* src_end, uint8_t* dst_begin, uint8_t** dst, uint8_t* dst_end, bool final, bool partial);
+
+// Appends one framed block holding [src, src + size), falling back to an uncompressed
+// block if LZ4 does not make it smaller. Returns false if the output does not fit.
+__attribute__((visibility("hidden")))
+bool lz4_encode_frame_block(uint8_t** dst, uint8_t* dst_end, const uint8_t* src, size_t size, uint32_t* table);
+
+// Whole-buffer COMPRESSION_LZ4 codec, following compression_encode_buffer() and
+// compression_decode_buffer() semantics.
+__attribute__((visibility("hidden")))
+size_t lz4_encode_frame(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, uint32_t* table);
+__attribute__((visibility("hidden")))
+size_t lz4_decode_frame(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size);
+
+// Whole-buffer COMPRESSION_LZ4_RAW codec: bare LZ4 sequences without any framing.
+__attribute__((visibility("hidden")))
+size_t lz4_encode_raw(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, uint32_t* table);
+__attribute__((visibility("hidden")))
+size_t lz4_decode_raw(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size);
+
+static inline uint32_t lz4_load32(const void* p) {
+    uint32_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void lz4_store32(void* p, uint32_t v) {
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
+#endif
@@ -0,0 +1,371 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression_private.h"
+#include "lz4.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Input bytes per lz4_encode() call and initial output room per lz4_decode() call in raw streams
+#define LZ4_RAW_CHUNK_SIZE (256 << 10)
+#define LZ4_HISTORY_SIZE (LZ4_MAX_DISTANCE + 1)
+
+size_t compression_lz4_encode_block(uint8_t* dst, const uint8_t* src, size_t size, void* scratch) {
+    uint8_t* op = dst;
+
+    if (!lz4_encode_frame_block(&op, dst + LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE + size, src, size, scratch))
+        return 0;
+    return op - dst;
+}
+
+// Blocks after an empty uncompressed block never refer back past it. The parallel encoder
+// puts one between its blocks so that they can be decoded in parallel too.
+bool compression_lz4_split(const uint8_t* src, size_t src_size, struct segment_list* segments) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + src_size;
+    const uint8_t* start = src;
+    size_t offset = 0, size = 0;
+
+    while (ip < end) {
+        uint32_t magic, raw_size;
+        size_t block_size;
+
+        if (end - ip < 4)
+            return false;
+
+        magic = lz4_load32(ip);
+        if (magic == LZ4_ENDOFSTREAM_BLOCK_MAGIC)
+            break;
+
+        if (magic == LZ4_COMPRESSED_BLOCK_MAGIC) {
+            if (end - ip < LZ4_COMPRESSED_BLOCK_HEADER_SIZE)
+                return false;
+            raw_size = lz4_load32(ip + 4);
+            block_size = LZ4_COMPRESSED_BLOCK_HEADER_SIZE + (size_t)lz4_load32(ip + 8);
+        } else if (magic == LZ4_UNCOMPRESSED_BLOCK_MAGIC) {
+            if (end - ip < LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE)
+                return false;
+            raw_size = lz4_load32(ip + 4);
+            block_size = LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE + (size_t)raw_size;
+
+            if (raw_size == 0) {
+                if (size > 0 && !segment_list_add(segments, start, ip - start, offset, size))
+                    return false;
+                ip += LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE;
+                start = ip;
+                offset += size;
+                size = 0;
+                continue;
+            }
+        } else {
+            return false;
+        }
+
+        if ((size_t)(end - ip) < block_size)
+            return false;
+        ip += block_size;
+        size += raw_size;
+    }
+
+    return size == 0 || segment_list_add(segments, start, ip - start, offset, size);
+}
+
+bool compression_lz4_decode_segment(uint8_t* dst, const struct segment* segment, uint32_t param) {
+    return lz4_decode_frame(dst + segment->offset, segment->size, segment->src, segment->src_size) == segment->size;
+}
+
+// COMPRESSION_LZ4_RAW has no blocks: the trailing literals of every chunk are carried over into
+// the next one, since only the very last sequence of the stream may lack a match
+struct lz4_raw_encoder {
+    struct stream_state header;
+    uint32_t table[LZ4_HASH_SIZE];
+    bool finished;
+
+    uint8_t* in;
+    size_t in_len, in_capacity, carry;
+
+    uint8_t* out;
+    size_t out_pos, out_len, out_capacity;
+};
+
+static compression_status raw_encode_process(compression_stream* stream, int flags) {
+    struct lz4_raw_encoder* state = (struct lz4_raw_encoder*)stream->state;
+
+    for (;;) {
+        const uint8_t* ip;
+        uint8_t* op;
+        size_t want, n, bound;
+        bool final;
+
+        if (state->out_pos < state->out_len) {
+            n = state->out_len - state->out_pos;
+            if (n > stream->dst_size)
+                n = stream->dst_size;
+            memcpy(stream->dst_ptr, state->out + state->out_pos, n);
+            state->out_pos += n;
+            stream->dst_ptr += n;
+            stream->dst_size -= n;
+            if (state->out_pos < state->out_len)
+                return COMPRESSION_STATUS_OK;
+        }
+
+        if (state->finished)
+            return COMPRESSION_STATUS_END;
+
+        // Without matches, the carried literals grow into one long literal-only run that can't be
+        // written out before the next match (or the end of the stream). Take in at least as much new
+        // input as is carried over, so that rescanning, moving and growing it stays linear overall.
+        want = state->carry + (state->carry > LZ4_RAW_CHUNK_SIZE ? state->carry : LZ4_RAW_CHUNK_SIZE);
+        if (state->in_capacity < want) {
+            uint8_t* in = realloc(state->in, want);
+            if (!in)
+                return COMPRESSION_STATUS_ERROR;
+            state->in = in;
+            state->in_capacity = want;
+        }
+
+        n = want - state->in_len;
+        if (n > stream->src_size)
+            n = stream->src_size;
+        memcpy(state->in + state->in_len, stream->src_ptr, n);
+        state->in_len += n;
+        stream->src_ptr += n;
+        stream->src_size -= n;
+
+        final = (flags & COMPRESSION_STREAM_FINALIZE) && stream->src_size == 0;
+        if (!final && state->in_len < want)
+            return COMPRESSION_STATUS_OK;
+
+        bound = LZ4_ENCODE_BOUND(state->in_len);
+        if (state->out_capacity < bound) {
+            free(state->out);
+            state->out = malloc(bound);
+            state->out_capacity = state->out ? bound : 0;
+            if (!state->out)
+                return COMPRESSION_STATUS_ERROR;
+        }
+
+        ip = state->in;
+        op = state->out;
+        if (!lz4_encode(&op, state->out + bound, &ip, state->in + state->in_len, final, state->table))
+            return COMPRESSION_STATUS_ERROR;
+
+        state->carry = state->in + state->in_len - ip;
+        if (ip != state->in)
+            memmove(state->in, ip, state->carry);
+        state->in_len = state->carry;
+        state->out_pos = 0;
+        state->out_len = op - state->out;
+        state->finished = final && state->carry == 0;
+    }
+}
+
+static void raw_encode_destroy(struct stream_state* header) {
+    struct lz4_raw_encoder* state = (struct lz4_raw_encoder*)header;
+
+    free(state->in);
+    free(state->out);
+    free(state);
+}
+
+struct lz4_decoder {
+    struct stream_state header;
+    bool finished;
+    struct stage in;
+    struct window out;
+    // Free output room asked for before every lz4_decode() call in raw streams
+    size_t reserve;
+};
+
+// Consumes `size` bytes from the staged input if there is any, from the caller's buffer otherwise
+static void consume(struct lz4_decoder* state, compression_stream* stream, bool staged, size_t size) {
+    if (staged) {
+        state->in.pos += size;
+    } else {
+        stream->src_ptr += size;
+        stream->src_size -= size;
+    }
+}
+
+static compression_status decode_process(compression_stream* stream, int flags) {
+    struct lz4_decoder* state = (struct lz4_decoder*)stream->state;
+
+    for (;;) {
+        bool staged = state->in.pos < state->in.len;
+        const uint8_t* ip = staged ? state->in.data + state->in.pos : stream->src_ptr;
+        size_t available = staged ? state->in.len - state->in.pos : stream->src_size;
+        size_t header_size, raw_size, payload_size, needed;
+        uint32_t magic;
+
+        if (!window_drain(&state->out, stream))
+            return COMPRESSION_STATUS_OK;
+        if (state->finished)
+            return COMPRESSION_STATUS_END;
+
+        // Blocks are decoded only once they are complete in the input
+        needed = 4;
+        if (available < needed)
+            goto need_input;
+
+        magic = lz4_load32(ip);
+        if (magic == LZ4_ENDOFSTREAM_BLOCK_MAGIC) {
+            consume(state, stream, staged, 4);
+            state->finished = true;
+            continue;
+        } else if (magic == LZ4_COMPRESSED_BLOCK_MAGIC) {
+            header_size = LZ4_COMPRESSED_BLOCK_HEADER_SIZE;
+        } else if (magic == LZ4_UNCOMPRESSED_BLOCK_MAGIC) {
+            header_size = LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE;
+        } else {
+            return COMPRESSION_STATUS_ERROR;
+        }
+
+        needed = header_size;
+        if (available < needed)
+            goto need_input;
+
+        raw_size = lz4_load32(ip + 4);
+        payload_size = magic == LZ4_COMPRESSED_BLOCK_MAGIC ? lz4_load32(ip + 8) : raw_size;
+        needed = header_size + payload_size;
+        if (available < needed)
+            goto need_input;
+
+        if (!window_reserve(&state->out, raw_size))
+            return COMPRESSION_STATUS_ERROR;
+
+        if (magic == LZ4_UNCOMPRESSED_BLOCK_MAGIC) {
+            memcpy(state->out.data + state->out.end, ip + header_size, raw_size);
+        } else {
+            const uint8_t* payload = ip + header_size;
+            uint8_t* block = state->out.data + state->out.end;
+            uint8_t* op = block;
+            int status;
+
+            status = lz4_decode(&payload, payload + payload_size, state->out.data, &op, block + raw_size, true, false);
+            if (status != LZ4_STATUS_OK || op != block + raw_size)
+                return COMPRESSION_STATUS_ERROR;
+        }
+
+        state->out.end += raw_size;
+        consume(state, stream, staged, needed);
+        continue;
+
+need_input:
+        // Like lz4_decode_frame(), tolerate a missing end-of-stream marker at a block boundary
+        if (available == 0 && stream->src_size == 0 && (flags & COMPRESSION_STREAM_FINALIZE)) {
+            state->finished = true;
+            continue;
+        }
+        if (stream->src_size == 0)
+            return (flags & COMPRESSION_STREAM_FINALIZE) ? COMPRESSION_STATUS_ERROR : COMPRESSION_STATUS_OK;
+        if (!stage_fill(&state->in, stream, needed - (staged ? available : 0)))
+            return COMPRESSION_STATUS_ERROR;
+    }
+}
+
+static compression_status raw_decode_process(compression_stream* stream, int flags) {
+    struct lz4_decoder* state = (struct lz4_decoder*)stream->state;
+
+    for (;;) {
+        bool staged = state->in.pos < state->in.len;
+        const uint8_t* src = staged ? state->in.data + state->in.pos : stream->src_ptr;
+        size_t available = staged ? state->in.len - state->in.pos : stream->src_size;
+        bool final = (flags & COMPRESSION_STREAM_FINALIZE) && (!staged || stream->src_size == 0);
+        const uint8_t* ip = src;
+        uint8_t* begin;
+        uint8_t* op;
+        int status;
+
+        if (!window_drain(&state->out, stream))
+            return COMPRESSION_STATUS_OK;
+        if (state->finished)
+            return COMPRESSION_STATUS_END;
+
+        if (!window_reserve(&state->out, state->reserve))
+            return COMPRESSION_STATUS_ERROR;
+
+        begin = op = state->out.data + state->out.end;
+        status = lz4_decode(&ip, src + available, state->out.data, &op, state->out.data + state->out.capacity, final, false);
+        consume(state, stream, staged, ip - src);
+        state->out.end += op - begin;
+
+        switch (status) {
+            case LZ4_STATUS_OK:
+                state->finished = true;
+                break;
+            case LZ4_STATUS_DST_FULL:
+                // A single sequence needs more room than there is
+                if (op == begin)
+                    state->reserve *= 2;
+                break;
+            case LZ4_STATUS_SRC_EMPTY:
+                // Keep the incomplete sequence around until the rest of it arrives
+                if (stream->src_size == 0) {
+                    if (op == begin)
+                        return COMPRESSION_STATUS_OK;
+                    break;
+                }
+                if (!stage_fill(&state->in, stream, LZ4_RAW_CHUNK_SIZE))
+                    return COMPRESSION_STATUS_ERROR;
+                break;
+            default:
+                return COMPRESSION_STATUS_ERROR;
+        }
+    }
+}
+
+static void decode_destroy(struct stream_state* header) {
+    struct lz4_decoder* state = (struct lz4_decoder*)header;
+
+    stage_free(&state->in);
+    window_free(&state->out);
+    free(state);
+}
+
+compression_status compression_lz4_stream_init(compression_stream* stream, compression_stream_operation operation, bool raw) {
+    if (operation == COMPRESSION_STREAM_ENCODE && !raw) {
+        return block_stream_init(stream, LZ4_BLOCK_SIZE, LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE + LZ4_BLOCK_SIZE,
+                                 LZ4_HASH_SIZE * sizeof(uint32_t), compression_lz4_encode_block, LZ4_ENDOFSTREAM_BLOCK_MAGIC);
+    } else if (operation == COMPRESSION_STREAM_ENCODE) {
+        struct lz4_raw_encoder* state = calloc(1, sizeof(*state));
+
+        if (!state)
+            return COMPRESSION_STATUS_ERROR;
+        state->header.process = raw_encode_process;
+        state->header.destroy = raw_encode_destroy;
+        stream->state = state;
+        return COMPRESSION_STATUS_OK;
+    } else if (operation == COMPRESSION_STREAM_DECODE) {
+        struct lz4_decoder* state = calloc(1, sizeof(*state));
+
+        if (!state)
+            return COMPRESSION_STATUS_ERROR;
+        if (!window_init(&state->out, LZ4_HISTORY_SIZE, LZ4_HISTORY_SIZE + (raw ? LZ4_RAW_CHUNK_SIZE : LZ4_BLOCK_SIZE))) {
+            free(state);
+            return COMPRESSION_STATUS_ERROR;
+        }
+        state->header.process = raw ? raw_decode_process : decode_process;
+        state->header.destroy = decode_destroy;
+        state->reserve = LZ4_RAW_CHUNK_SIZE;
+        stream->state = state;
+        return COMPRESSION_STATUS_OK;
+    }
+
+    return COMPRESSION_STATUS_ERROR;
+}
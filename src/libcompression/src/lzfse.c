@@ -0,0 +1,260 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression_private.h"
+#include <lzfse.h>
+#include <lzfse_internal.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Raw bytes per independently encoded chunk in streams. Every chunk is a complete
+// LZFSE stream with its end-of-stream block dropped.
+#define LZFSE_STREAM_BLOCK_SIZE (1 << 20)
+
+// bvx- block: magic, n_raw_bytes, raw bytes
+#define LZFSE_RAW_BLOCK_HEADER_SIZE 8
+
+// Matches reach back at most LZFSE_ENCODE_MAX_D_VALUE bytes (LZVN ones even less)
+#define LZFSE_HISTORY_SIZE (512 << 10)
+#define LZFSE_OUTPUT_CHUNK_SIZE (2 << 20)
+#define LZFSE_INPUT_CHUNK_SIZE (256 << 10)
+
+size_t compression_lzfse_encode_scratch_size(void) {
+    return lzfse_encode_scratch_size();
+}
+
+size_t compression_lzfse_decode_scratch_size(void) {
+    return lzfse_decode_scratch_size();
+}
+
+size_t compression_lzfse_encode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch) {
+    return lzfse_encode_buffer(dst, dst_size, src, src_size, scratch);
+}
+
+size_t compression_lzfse_decode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch) {
+    return lzfse_decode_buffer(dst, dst_size, src, src_size, scratch);
+}
+
+size_t compression_lzfse_encode_block(uint8_t* dst, const uint8_t* src, size_t size, void* scratch) {
+    uint32_t magic = LZFSE_UNCOMPRESSED_BLOCK_MAGIC;
+    uint32_t raw_size = (uint32_t)size;
+    size_t n;
+
+    // Keep the encoded blocks, minus the end-of-stream marker, if they fit where a raw block would
+    n = lzfse_encode_buffer(dst, LZFSE_RAW_BLOCK_HEADER_SIZE + size, src, size, scratch);
+    if (n > 4)
+        return n - 4;
+
+    memcpy(dst, &magic, 4);
+    memcpy(dst + 4, &raw_size, 4);
+    memcpy(dst + LZFSE_RAW_BLOCK_HEADER_SIZE, src, size);
+    return LZFSE_RAW_BLOCK_HEADER_SIZE + size;
+}
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Like with COMPRESSION_LZ4, an empty raw block separates blocks that don't refer to each other
+bool compression_lzfse_split(const uint8_t* src, size_t src_size, struct segment_list* segments) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + src_size;
+    const uint8_t* start = src;
+    size_t offset = 0, size = 0;
+
+    for (;;) {
+        uint32_t magic, raw_size;
+        size_t block_size;
+
+        if (end - ip < 4)
+            return false;
+
+        magic = load32(ip);
+        if (magic == LZFSE_ENDOFSTREAM_BLOCK_MAGIC)
+            break;
+
+        if (magic == LZFSE_UNCOMPRESSED_BLOCK_MAGIC) {
+            if (end - ip < LZFSE_RAW_BLOCK_HEADER_SIZE)
+                return false;
+            raw_size = load32(ip + 4);
+            block_size = LZFSE_RAW_BLOCK_HEADER_SIZE + (size_t)raw_size;
+
+            if (raw_size == 0) {
+                if (size > 0 && !segment_list_add(segments, start, ip - start, offset, size))
+                    return false;
+                ip += LZFSE_RAW_BLOCK_HEADER_SIZE;
+                start = ip;
+                offset += size;
+                size = 0;
+                continue;
+            }
+        } else if (magic == LZFSE_COMPRESSEDLZVN_BLOCK_MAGIC) {
+            // magic, n_raw_bytes, n_payload_bytes
+            if (end - ip < 12)
+                return false;
+            raw_size = load32(ip + 4);
+            block_size = 12 + (size_t)load32(ip + 8);
+        } else if (magic == LZFSE_COMPRESSEDV2_BLOCK_MAGIC) {
+            // magic, n_raw_bytes, then three packed words holding among others the size of the
+            // header and of the literal and LMD payloads
+            uint64_t literal_fields, lmd_fields, header_fields;
+
+            if (end - ip < 32)
+                return false;
+            raw_size = load32(ip + 4);
+            literal_fields = load64(ip + 8);
+            lmd_fields = load64(ip + 16);
+            header_fields = load64(ip + 24);
+            block_size = (header_fields & 0xffffffff) + ((literal_fields >> 20) & 0xfffff) + ((lmd_fields >> 40) & 0xfffff);
+        } else {
+            // Including v1 blocks, which only old encoders produce
+            return false;
+        }
+
+        if ((size_t)(end - ip) < block_size)
+            return false;
+        ip += block_size;
+        size += raw_size;
+    }
+
+    return size == 0 || segment_list_add(segments, start, ip - start, offset, size);
+}
+
+bool compression_lzfse_decode_segment(uint8_t* dst, const struct segment* segment, uint32_t param) {
+    lzfse_decoder_state* s = calloc(1, sizeof(*s));
+    bool ok;
+    int status;
+
+    if (!s)
+        return false;
+
+    // The segment has no end-of-stream block, so running out of input right after its last block is success
+    s->src = s->src_begin = segment->src;
+    s->src_end = segment->src + segment->src_size;
+    s->dst = s->dst_begin = dst + segment->offset;
+    s->dst_end = s->dst + segment->size;
+
+    status = lzfse_decode(s);
+    ok = (status == LZFSE_STATUS_SRC_EMPTY || status == LZFSE_STATUS_DST_FULL)
+        && s->src == s->src_end && s->dst == s->dst_end && s->block_magic == LZFSE_NO_BLOCK_MAGIC;
+
+    free(s);
+    return ok;
+}
+
+struct lzfse_decoder {
+    struct stream_state header;
+    bool finished;
+    struct stage in;
+    struct window out;
+    lzfse_decoder_state s;
+};
+
+static compression_status decode_process(compression_stream* stream, int flags) {
+    struct lzfse_decoder* state = (struct lzfse_decoder*)stream->state;
+    lzfse_decoder_state* s = &state->s;
+
+    for (;;) {
+        int status;
+
+        if (!window_drain(&state->out, stream))
+            return COMPRESSION_STATUS_OK;
+        if (state->finished)
+            return COMPRESSION_STATUS_END;
+
+        if (!window_reserve(&state->out, LZFSE_OUTPUT_CHUNK_SIZE))
+            return COMPRESSION_STATUS_ERROR;
+
+        // A compressed block refers to its payload by offset from src_begin while it is being
+        // decoded. The decoder wants whole compressed blocks in the input, so the staged input
+        // only moves between blocks or within raw and LZVN blocks, which keep no such offsets.
+        s->src_begin = state->in.data;
+        s->src = state->in.data + state->in.pos;
+        s->src_end = state->in.data + state->in.len;
+        s->dst_begin = state->out.data;
+        s->dst = state->out.data + state->out.end;
+        s->dst_end = state->out.data + state->out.capacity;
+
+        status = lzfse_decode(s);
+
+        state->in.pos = s->src - state->in.data;
+        state->out.end = s->dst - state->out.data;
+
+        switch (status) {
+            case LZFSE_STATUS_OK:
+                state->finished = true;
+                break;
+            case LZFSE_STATUS_DST_FULL:
+                break;
+            case LZFSE_STATUS_SRC_EMPTY:
+                if (stream->src_size == 0) {
+                    if (flags & COMPRESSION_STREAM_FINALIZE)
+                        return COMPRESSION_STATUS_ERROR;
+                    window_drain(&state->out, stream);
+                    return COMPRESSION_STATUS_OK;
+                }
+                if (!stage_fill(&state->in, stream, LZFSE_INPUT_CHUNK_SIZE))
+                    return COMPRESSION_STATUS_ERROR;
+                break;
+            default:
+                return COMPRESSION_STATUS_ERROR;
+        }
+    }
+}
+
+static void decode_destroy(struct stream_state* header) {
+    struct lzfse_decoder* state = (struct lzfse_decoder*)header;
+
+    stage_free(&state->in);
+    window_free(&state->out);
+    free(state);
+}
+
+compression_status compression_lzfse_stream_init(compression_stream* stream, compression_stream_operation operation) {
+    struct lzfse_decoder* state;
+
+    if (operation == COMPRESSION_STREAM_ENCODE) {
+        return block_stream_init(stream, LZFSE_STREAM_BLOCK_SIZE, LZFSE_RAW_BLOCK_HEADER_SIZE + LZFSE_STREAM_BLOCK_SIZE,
+                                 lzfse_encode_scratch_size(), compression_lzfse_encode_block, LZFSE_ENDOFSTREAM_BLOCK_MAGIC);
+    } else if (operation != COMPRESSION_STREAM_DECODE) {
+        return COMPRESSION_STATUS_ERROR;
+    }
+
+    // The decoder state is all zeroes before the first block, as in lzfse_decode_buffer()
+    state = calloc(1, sizeof(*state));
+    if (!state)
+        return COMPRESSION_STATUS_ERROR;
+    if (!window_init(&state->out, LZFSE_HISTORY_SIZE, LZFSE_HISTORY_SIZE + LZFSE_OUTPUT_CHUNK_SIZE)) {
+        free(state);
+        return COMPRESSION_STATUS_ERROR;
+    }
+
+    state->header.process = decode_process;
+    state->header.destroy = decode_destroy;
+    stream->state = state;
+    return COMPRESSION_STATUS_OK;
+}
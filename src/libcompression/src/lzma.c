@@ -0,0 +1,273 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression_private.h"
+#include <lzma.h>
+#include <stdlib.h>
+
+// COMPRESSION_LZMA is an .xz container holding LZMA2 data produced at preset 6
+#define XZ_PRESET 6
+#define XZ_CHECK LZMA_CHECK_CRC32
+
+size_t compression_lzma_encode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size) {
+    size_t written = 0;
+
+    if (lzma_easy_buffer_encode(XZ_PRESET, XZ_CHECK, NULL, src, src_size, dst, &written, dst_size) != LZMA_OK)
+        return 0;
+    return written;
+}
+
+size_t compression_lzma_decode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size) {
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_ret status;
+
+    // lzma_stream_buffer_decode() fails outright when the output does not fit,
+    // but a destination that is too small must get truncated output instead
+    if (lzma_stream_decoder(&strm, UINT64_MAX, 0) != LZMA_OK)
+        return 0;
+
+    strm.next_in = src;
+    strm.avail_in = src_size;
+    strm.next_out = dst;
+    strm.avail_out = dst_size;
+
+    do {
+        status = lzma_code(&strm, LZMA_FINISH);
+    } while (status == LZMA_OK && strm.avail_out > 0);
+
+    lzma_end(&strm);
+
+    if (status == LZMA_STREAM_END || strm.avail_out == 0)
+        return dst_size - strm.avail_out;
+    return 0;
+}
+
+struct lzma_codec_stream {
+    struct stream_state header;
+    lzma_stream strm;
+    bool encode;
+};
+
+static compression_status lzma_process(compression_stream* stream, int flags) {
+    struct lzma_codec_stream* state = (struct lzma_codec_stream*)stream->state;
+    lzma_stream* strm = &state->strm;
+    lzma_action action = LZMA_RUN;
+    lzma_ret status;
+
+    if (state->encode && (flags & COMPRESSION_STREAM_FINALIZE))
+        action = LZMA_FINISH;
+
+    strm->next_in = stream->src_ptr;
+    strm->avail_in = stream->src_size;
+    strm->next_out = stream->dst_ptr;
+    strm->avail_out = stream->dst_size;
+
+    status = lzma_code(strm, action);
+
+    stream->src_ptr = strm->next_in;
+    stream->src_size = strm->avail_in;
+    stream->dst_ptr = strm->next_out;
+    stream->dst_size = strm->avail_out;
+
+    switch (status) {
+        case LZMA_STREAM_END:
+            return COMPRESSION_STATUS_END;
+        case LZMA_OK:
+            return COMPRESSION_STATUS_OK;
+        case LZMA_BUF_ERROR:
+            // No progress was possible
+            if (!state->encode && (flags & COMPRESSION_STREAM_FINALIZE) && stream->src_size == 0 && stream->dst_size > 0)
+                return COMPRESSION_STATUS_ERROR;
+            return COMPRESSION_STATUS_OK;
+        default:
+            return COMPRESSION_STATUS_ERROR;
+    }
+}
+
+static void lzma_destroy(struct stream_state* header) {
+    struct lzma_codec_stream* state = (struct lzma_codec_stream*)header;
+
+    lzma_end(&state->strm);
+    free(state);
+}
+
+compression_status compression_lzma_stream_init(compression_stream* stream, compression_stream_operation operation) {
+    struct lzma_codec_stream* state = calloc(1, sizeof(*state));
+    lzma_stream init = LZMA_STREAM_INIT;
+    lzma_ret status;
+
+    if (!state)
+        return COMPRESSION_STATUS_ERROR;
+
+    state->header.process = lzma_process;
+    state->header.destroy = lzma_destroy;
+    state->strm = init;
+    state->encode = operation == COMPRESSION_STREAM_ENCODE;
+
+    if (operation == COMPRESSION_STREAM_ENCODE)
+        status = lzma_easy_encoder(&state->strm, XZ_PRESET, XZ_CHECK);
+    else if (operation == COMPRESSION_STREAM_DECODE)
+        status = lzma_stream_decoder(&state->strm, UINT64_MAX, 0);
+    else
+        status = LZMA_PROG_ERROR;
+
+    if (status != LZMA_OK) {
+        free(state);
+        return COMPRESSION_STATUS_ERROR;
+    }
+
+    stream->state = state;
+    return COMPRESSION_STATUS_OK;
+}
+
+// The parallel encoder writes one .xz stream holding several blocks, with the same filters and
+// check as the one-shot encoder
+static bool preset_filters(lzma_filter* filters, lzma_options_lzma* options) {
+    if (lzma_lzma_preset(options, XZ_PRESET))
+        return false;
+
+    filters[0].id = LZMA_FILTER_LZMA2;
+    filters[0].options = options;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    filters[1].options = NULL;
+    return true;
+}
+
+size_t compression_lzma_block_bound(size_t size) {
+    return lzma_block_buffer_bound(size);
+}
+
+size_t compression_lzma_encode_block(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t size, uint64_t* unpadded_size) {
+    lzma_filter filters[2];
+    lzma_options_lzma options;
+    lzma_block block = { 0 };
+    size_t written = 0;
+
+    if (!preset_filters(filters, &options))
+        return 0;
+
+    block.version = 0;
+    block.check = XZ_CHECK;
+    block.filters = filters;
+
+    if (lzma_block_buffer_encode(&block, NULL, src, size, dst, &written, dst_size) != LZMA_OK)
+        return 0;
+
+    *unpadded_size = lzma_block_unpadded_size(&block);
+    return written;
+}
+
+size_t compression_lzma_encode_header(uint8_t* dst, size_t dst_size) {
+    lzma_stream_flags flags = { 0 };
+
+    flags.version = 0;
+    flags.check = XZ_CHECK;
+
+    if (dst_size < LZMA_STREAM_HEADER_SIZE || lzma_stream_header_encode(&flags, dst) != LZMA_OK)
+        return 0;
+    return LZMA_STREAM_HEADER_SIZE;
+}
+
+size_t compression_lzma_encode_index(uint8_t* dst, size_t dst_size, const uint64_t* unpadded_sizes,
+                                     const uint64_t* uncompressed_sizes, size_t count) {
+    lzma_stream_flags flags = { 0 };
+    lzma_index* index = lzma_index_init(NULL);
+    size_t written = 0;
+    bool ok = index != NULL;
+
+    for (size_t i = 0; ok && i < count; i++)
+        ok = lzma_index_append(index, NULL, unpadded_sizes[i], uncompressed_sizes[i]) == LZMA_OK;
+
+    ok = ok && lzma_index_buffer_encode(index, dst, &written, dst_size) == LZMA_OK;
+
+    if (ok) {
+        flags.version = 0;
+        flags.check = XZ_CHECK;
+        flags.backward_size = lzma_index_size(index);
+        ok = dst_size - written >= LZMA_STREAM_HEADER_SIZE && lzma_stream_footer_encode(&flags, dst + written) == LZMA_OK;
+        written += LZMA_STREAM_HEADER_SIZE;
+    }
+
+    lzma_index_end(index, NULL);
+    return ok ? written : 0;
+}
+
+// Every block of a single-stream .xz file decodes on its own; the index at the end
+// says where they are
+bool compression_lzma_split(const uint8_t* src, size_t src_size, struct segment_list* segments) {
+    lzma_stream_flags header_flags, footer_flags;
+    lzma_index* index = NULL;
+    lzma_index_iter iter;
+    uint64_t memlimit = UINT64_MAX;
+    const uint8_t* footer;
+    size_t index_pos;
+    bool ok;
+
+    if (src_size < 2 * LZMA_STREAM_HEADER_SIZE)
+        return false;
+
+    footer = src + src_size - LZMA_STREAM_HEADER_SIZE;
+    if (lzma_stream_header_decode(&header_flags, src) != LZMA_OK || lzma_stream_footer_decode(&footer_flags, footer) != LZMA_OK)
+        return false;
+    if (lzma_stream_flags_compare(&header_flags, &footer_flags) != LZMA_OK)
+        return false;
+    if (footer_flags.backward_size > src_size - 2 * LZMA_STREAM_HEADER_SIZE)
+        return false;
+
+    index_pos = footer - src - footer_flags.backward_size;
+    if (lzma_index_buffer_decode(&index, &memlimit, NULL, src, &index_pos, footer - src) != LZMA_OK)
+        return false;
+
+    // Anything else in front of the stream, like another concatenated stream, is left to the serial decoder
+    ok = lzma_index_file_size(index) == src_size;
+
+    lzma_index_iter_init(&iter, index);
+    while (ok && !lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)) {
+        ok = segment_list_add(segments, src + iter.block.compressed_file_offset, iter.block.total_size,
+                              iter.block.uncompressed_file_offset, iter.block.uncompressed_size);
+    }
+
+    segments->param = footer_flags.check;
+    lzma_index_end(index, NULL);
+    return ok;
+}
+
+bool compression_lzma_decode_segment(uint8_t* dst, const struct segment* segment, uint32_t param) {
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    lzma_block block = { 0 };
+    size_t in_pos, out_pos = 0;
+    bool ok;
+
+    block.version = 0;
+    block.check = (lzma_check)param;
+    block.filters = filters;
+    block.header_size = lzma_block_header_size_decode(segment->src[0]);
+
+    if (block.header_size > segment->src_size || lzma_block_header_decode(&block, NULL, segment->src) != LZMA_OK)
+        return false;
+
+    in_pos = block.header_size;
+    ok = lzma_block_buffer_decode(&block, NULL, segment->src, &in_pos, segment->src_size,
+                                  dst + segment->offset, &out_pos, segment->size) == LZMA_OK
+        && out_pos == segment->size;
+
+    for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+        free(filters[i].options);
+    return ok;
+}
@@ -0,0 +1,348 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression_private.h"
+#include "lz4.h"
+#include <dispatch/dispatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PARALLEL_LZ4_BLOCK_SIZE LZ4_BLOCK_SIZE
+#define PARALLEL_LZFSE_BLOCK_SIZE (1 << 20)
+#define PARALLEL_ZLIB_BLOCK_SIZE (1 << 20)
+// Three times the preset 6 dictionary, like xz --threads
+#define PARALLEL_LZMA_BLOCK_SIZE (24 << 20)
+// Block headers store sizes in 32 bits
+#define PARALLEL_MAX_BLOCK_SIZE (1 << 30)
+
+// Every DEFLATE piece is primed with the input preceding it, as far back as the window reaches
+#define ZLIB_DICTIONARY_SIZE (32 << 10)
+
+// Header of an empty raw block, which separates independent blocks in LZ4 and LZFSE output
+#define SYNC_MARKER_SIZE 8
+
+#define LZFSE_UNCOMPRESSED_BLOCK_MAGIC 0x2d787662 // "bvx-"
+#define LZFSE_ENDOFSTREAM_BLOCK_MAGIC 0x24787662 // "bvx$"
+
+struct encode_slot {
+    uint8_t* out;
+    size_t out_size;
+    void* scratch;
+    uint64_t unpadded_size;
+};
+
+struct encode_job {
+    compression_algorithm algorithm;
+    const uint8_t* src;
+    size_t src_size, block_size, block_count;
+    // First block of the batch being encoded
+    size_t first_block;
+    size_t bound;
+    struct encode_slot* slots;
+};
+
+struct decode_job {
+    compression_algorithm algorithm;
+    uint8_t* dst;
+    struct segment_list* segments;
+    bool failed;
+};
+
+bool segment_list_add(struct segment_list* list, const uint8_t* src, size_t src_size, size_t offset, size_t size) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        struct segment* items = realloc(list->items, capacity * sizeof(*items));
+
+        if (!items)
+            return false;
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    list->items[list->count++] = (struct segment) {
+        .src = src,
+        .src_size = src_size,
+        .offset = offset,
+        .size = size,
+    };
+    return true;
+}
+
+static size_t default_block_size(compression_algorithm algorithm) {
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+            return PARALLEL_LZ4_BLOCK_SIZE;
+        case COMPRESSION_LZFSE:
+            return PARALLEL_LZFSE_BLOCK_SIZE;
+        case COMPRESSION_ZLIB:
+            return PARALLEL_ZLIB_BLOCK_SIZE;
+        case COMPRESSION_LZMA:
+            return PARALLEL_LZMA_BLOCK_SIZE;
+        default:
+            return 0;
+    }
+}
+
+static size_t block_bound(compression_algorithm algorithm, size_t block_size) {
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+            return LZ4_UNCOMPRESSED_BLOCK_HEADER_SIZE + block_size;
+        case COMPRESSION_LZFSE:
+            // Raw block header
+            return 8 + block_size;
+        case COMPRESSION_ZLIB:
+            return compression_zlib_block_bound(block_size);
+        case COMPRESSION_LZMA:
+            return compression_lzma_block_bound(block_size);
+        default:
+            return 0;
+    }
+}
+
+static size_t block_scratch_size(compression_algorithm algorithm) {
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+            return LZ4_HASH_SIZE * sizeof(uint32_t);
+        case COMPRESSION_LZFSE:
+            return compression_lzfse_encode_scratch_size();
+        default:
+            return 0;
+    }
+}
+
+static size_t cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
+
+static void encode_block(void* context, size_t i) {
+    struct encode_job* job = context;
+    struct encode_slot* slot = &job->slots[i];
+    size_t block = job->first_block + i;
+    size_t pos = block * job->block_size;
+    size_t size = job->src_size - pos < job->block_size ? job->src_size - pos : job->block_size;
+    const uint8_t* src = job->src + pos;
+
+    switch (job->algorithm) {
+        case COMPRESSION_LZ4:
+            slot->out_size = compression_lz4_encode_block(slot->out, src, size, slot->scratch);
+            break;
+        case COMPRESSION_LZFSE:
+            slot->out_size = compression_lzfse_encode_block(slot->out, src, size, slot->scratch);
+            break;
+        case COMPRESSION_ZLIB:
+            slot->out_size = compression_zlib_encode_block(slot->out, job->bound, src, size,
+                                                           pos < ZLIB_DICTIONARY_SIZE ? pos : ZLIB_DICTIONARY_SIZE,
+                                                           block == job->block_count - 1);
+            break;
+        case COMPRESSION_LZMA:
+            slot->out_size = compression_lzma_encode_block(slot->out, job->bound, src, size, &slot->unpadded_size);
+            break;
+        default:
+            slot->out_size = 0;
+            break;
+    }
+}
+
+static inline bool append(uint8_t** op, uint8_t* dst_end, const void* data, size_t size) {
+    if ((size_t)(dst_end - *op) < size)
+        return false;
+    memcpy(*op, data, size);
+    *op += size;
+    return true;
+}
+
+static bool append_marker(uint8_t** op, uint8_t* dst_end, uint32_t magic, uint32_t size) {
+    uint32_t header[2] = { magic, size };
+    return append(op, dst_end, header, sizeof(header));
+}
+
+size_t
+compression_encode_buffer_parallel(uint8_t * __restrict dst_buffer, size_t dst_size,
+                                   const uint8_t * __restrict src_buffer, size_t src_size,
+                                   size_t block_size, compression_algorithm algorithm) {
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    struct encode_job job = { 0 };
+    uint64_t* unpadded_sizes = NULL;
+    uint64_t* uncompressed_sizes = NULL;
+    uint8_t* op = dst_buffer;
+    uint8_t* dst_end = dst_buffer + dst_size;
+    size_t slot_count, scratch_size;
+    bool ok = true;
+
+    if (block_size == 0)
+        block_size = default_block_size(algorithm);
+    if (block_size > PARALLEL_MAX_BLOCK_SIZE)
+        block_size = PARALLEL_MAX_BLOCK_SIZE;
+
+    // A single block comes out the same either way
+    if (block_size == 0 || algorithm == COMPRESSION_LZ4_RAW || src_size <= block_size)
+        return compression_encode_buffer(dst_buffer, dst_size, src_buffer, src_size, NULL, algorithm);
+
+    job.algorithm = algorithm;
+    job.src = src_buffer;
+    job.src_size = src_size;
+    job.block_size = block_size;
+    job.block_count = (src_size + block_size - 1) / block_size;
+    job.bound = block_bound(algorithm, block_size);
+
+    // Blocks are encoded in batches of one per CPU, each into its own buffer, and then appended in order
+    slot_count = cpu_count();
+    if (slot_count > job.block_count)
+        slot_count = job.block_count;
+    scratch_size = block_scratch_size(algorithm);
+
+    job.slots = calloc(slot_count, sizeof(*job.slots));
+    ok = job.slots != NULL;
+    for (size_t i = 0; ok && i < slot_count; i++) {
+        job.slots[i].out = malloc(job.bound);
+        job.slots[i].scratch = scratch_size ? malloc(scratch_size) : NULL;
+        ok = job.slots[i].out && (!scratch_size || job.slots[i].scratch);
+    }
+
+    if (ok && algorithm == COMPRESSION_LZMA) {
+        size_t n = compression_lzma_encode_header(op, dst_end - op);
+
+        unpadded_sizes = malloc(job.block_count * sizeof(*unpadded_sizes));
+        uncompressed_sizes = malloc(job.block_count * sizeof(*uncompressed_sizes));
+        ok = n > 0 && unpadded_sizes && uncompressed_sizes;
+        op += n;
+    }
+
+    for (job.first_block = 0; ok && job.first_block < job.block_count; job.first_block += slot_count) {
+        size_t count = job.block_count - job.first_block < slot_count ? job.block_count - job.first_block : slot_count;
+
+        dispatch_apply_f(count, queue, &job, encode_block);
+
+        for (size_t i = 0; ok && i < count; i++) {
+            struct encode_slot* slot = &job.slots[i];
+            size_t block = job.first_block + i;
+
+            ok = slot->out_size > 0;
+            if (ok && block > 0 && algorithm == COMPRESSION_LZ4)
+                ok = append_marker(&op, dst_end, LZ4_UNCOMPRESSED_BLOCK_MAGIC, 0);
+            if (ok && block > 0 && algorithm == COMPRESSION_LZFSE)
+                ok = append_marker(&op, dst_end, LZFSE_UNCOMPRESSED_BLOCK_MAGIC, 0);
+            ok = ok && append(&op, dst_end, slot->out, slot->out_size);
+
+            if (algorithm == COMPRESSION_LZMA) {
+                unpadded_sizes[block] = slot->unpadded_size;
+                uncompressed_sizes[block] = block == job.block_count - 1 ? src_size - block * block_size : block_size;
+            }
+        }
+    }
+
+    if (ok && algorithm == COMPRESSION_LZ4) {
+        uint32_t magic = LZ4_ENDOFSTREAM_BLOCK_MAGIC;
+        ok = append(&op, dst_end, &magic, sizeof(magic));
+    } else if (ok && algorithm == COMPRESSION_LZFSE) {
+        uint32_t magic = LZFSE_ENDOFSTREAM_BLOCK_MAGIC;
+        ok = append(&op, dst_end, &magic, sizeof(magic));
+    } else if (ok && algorithm == COMPRESSION_LZMA) {
+        size_t n = compression_lzma_encode_index(op, dst_end - op, unpadded_sizes, uncompressed_sizes, job.block_count);
+        ok = n > 0;
+        op += n;
+    }
+
+    if (job.slots) {
+        for (size_t i = 0; i < slot_count; i++) {
+            free(job.slots[i].out);
+            free(job.slots[i].scratch);
+        }
+        free(job.slots);
+    }
+    free(unpadded_sizes);
+    free(uncompressed_sizes);
+
+    return ok ? op - dst_buffer : 0;
+}
+
+static void decode_segment(void* context, size_t i) {
+    struct decode_job* job = context;
+    const struct segment* segment = &job->segments->items[i];
+    bool ok;
+
+    switch (job->algorithm) {
+        case COMPRESSION_LZ4:
+            ok = compression_lz4_decode_segment(job->dst, segment, job->segments->param);
+            break;
+        case COMPRESSION_LZFSE:
+            ok = compression_lzfse_decode_segment(job->dst, segment, job->segments->param);
+            break;
+        case COMPRESSION_LZMA:
+            ok = compression_lzma_decode_segment(job->dst, segment, job->segments->param);
+            break;
+        default:
+            ok = false;
+            break;
+    }
+
+    if (!ok)
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+}
+
+size_t
+compression_decode_buffer_parallel(uint8_t * __restrict dst_buffer, size_t dst_size,
+                                   const uint8_t * __restrict src_buffer, size_t src_size,
+                                   compression_algorithm algorithm) {
+    struct segment_list segments = { 0 };
+    struct decode_job job = { 0 };
+    size_t total = 0;
+    bool split;
+
+    switch (algorithm) {
+        case COMPRESSION_LZ4:
+            split = compression_lz4_split(src_buffer, src_size, &segments);
+            break;
+        case COMPRESSION_LZFSE:
+            split = compression_lzfse_split(src_buffer, src_size, &segments);
+            break;
+        case COMPRESSION_LZMA:
+            split = compression_lzma_split(src_buffer, src_size, &segments);
+            break;
+        default:
+            // DEFLATE pieces can't be found without decoding everything before them
+            split = false;
+            break;
+    }
+
+    if (split && segments.count > 1) {
+        const struct segment* last = &segments.items[segments.count - 1];
+        total = last->offset + last->size;
+
+        // Output that doesn't fit gets truncated, which is left to the serial decoder
+        if (total <= dst_size) {
+            job.algorithm = algorithm;
+            job.dst = dst_buffer;
+            job.segments = &segments;
+            dispatch_apply_f(segments.count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), &job, decode_segment);
+        } else {
+            split = false;
+        }
+    } else {
+        split = false;
+    }
+
+    free(segments.items);
+
+    if (split && !job.failed)
+        return total;
+    return compression_decode_buffer(dst_buffer, dst_size, src_buffer, src_size, NULL, algorithm);
+}
@@ -0,0 +1,238 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression_private.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline size_t min_size(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+bool stage_fill(struct stage* stage, compression_stream* stream, size_t reserve) {
+    size_t pending = stage->len - stage->pos;
+    size_t n;
+
+    if (stage->pos > 0) {
+        memmove(stage->data, stage->data + stage->pos, pending);
+        stage->pos = 0;
+        stage->len = pending;
+    }
+
+    if (stage->capacity - stage->len < reserve) {
+        size_t capacity = stage->capacity * 2;
+        uint8_t* data;
+
+        if (capacity < stage->len + reserve)
+            capacity = stage->len + reserve;
+        data = realloc(stage->data, capacity);
+        if (!data)
+            return false;
+        stage->data = data;
+        stage->capacity = capacity;
+    }
+
+    n = min_size(stage->capacity - stage->len, stream->src_size);
+    memcpy(stage->data + stage->len, stream->src_ptr, n);
+    stage->len += n;
+    stream->src_ptr += n;
+    stream->src_size -= n;
+    return true;
+}
+
+void stage_free(struct stage* stage) {
+    free(stage->data);
+    stage->data = NULL;
+}
+
+bool window_init(struct window* window, size_t history, size_t capacity) {
+    window->data = malloc(capacity);
+    window->drain = window->end = 0;
+    window->capacity = capacity;
+    window->history = history;
+    return window->data != NULL;
+}
+
+bool window_reserve(struct window* window, size_t size) {
+    size_t keep_from;
+
+    if (window->capacity - window->end >= size)
+        return true;
+
+    // Drop everything that is neither history nor pending output
+    keep_from = window->end > window->history ? window->end - window->history : 0;
+    if (keep_from > window->drain)
+        keep_from = window->drain;
+    if (keep_from > 0) {
+        memmove(window->data, window->data + keep_from, window->end - keep_from);
+        window->drain -= keep_from;
+        window->end -= keep_from;
+    }
+
+    if (window->capacity - window->end < size) {
+        size_t capacity = window->capacity * 2;
+        uint8_t* data;
+
+        if (capacity < window->end + size)
+            capacity = window->end + size;
+        data = realloc(window->data, capacity);
+        if (!data)
+            return false;
+        window->data = data;
+        window->capacity = capacity;
+    }
+
+    return true;
+}
+
+bool window_drain(struct window* window, compression_stream* stream) {
+    size_t n = min_size(window->end - window->drain, stream->dst_size);
+
+    memcpy(stream->dst_ptr, window->data + window->drain, n);
+    window->drain += n;
+    stream->dst_ptr += n;
+    stream->dst_size -= n;
+    return window->drain == window->end;
+}
+
+void window_free(struct window* window) {
+    free(window->data);
+    window->data = NULL;
+}
+
+struct block_stream {
+    struct stream_state header;
+
+    block_encoder encode;
+    void* scratch;
+    uint32_t end_magic;
+    bool finished;
+
+    // Input collected until a whole block is available
+    uint8_t* in;
+    size_t in_len, block_size;
+
+    // Encoded data not yet handed to the caller
+    uint8_t* out;
+    size_t out_pos, out_len, max_block_size;
+};
+
+static compression_status block_stream_process(compression_stream* stream, int flags) {
+    struct block_stream* state = (struct block_stream*)stream->state;
+
+    for (;;) {
+        size_t size;
+
+        if (state->out_pos < state->out_len) {
+            size_t n = min_size(state->out_len - state->out_pos, stream->dst_size);
+
+            memcpy(stream->dst_ptr, state->out + state->out_pos, n);
+            state->out_pos += n;
+            stream->dst_ptr += n;
+            stream->dst_size -= n;
+            if (state->out_pos < state->out_len)
+                return COMPRESSION_STATUS_OK;
+        }
+
+        if (state->finished)
+            return COMPRESSION_STATUS_END;
+
+        // Whole blocks are encoded straight from the caller's buffer, and into it if there is room
+        if (state->in_len == 0 && stream->src_size >= state->block_size) {
+            if (stream->dst_size >= state->max_block_size) {
+                size = state->encode(stream->dst_ptr, stream->src_ptr, state->block_size, state->scratch);
+                if (size == 0)
+                    return COMPRESSION_STATUS_ERROR;
+                stream->dst_ptr += size;
+                stream->dst_size -= size;
+            } else {
+                size = state->encode(state->out, stream->src_ptr, state->block_size, state->scratch);
+                if (size == 0)
+                    return COMPRESSION_STATUS_ERROR;
+                state->out_pos = 0;
+                state->out_len = size;
+            }
+            stream->src_ptr += state->block_size;
+            stream->src_size -= state->block_size;
+            continue;
+        }
+
+        size = min_size(state->block_size - state->in_len, stream->src_size);
+        memcpy(state->in + state->in_len, stream->src_ptr, size);
+        state->in_len += size;
+        stream->src_ptr += size;
+        stream->src_size -= size;
+
+        if (state->in_len < state->block_size && !(flags & COMPRESSION_STREAM_FINALIZE))
+            return COMPRESSION_STATUS_OK;
+
+        size = 0;
+        if (state->in_len > 0) {
+            size = state->encode(state->out, state->in, state->in_len, state->scratch);
+            if (size == 0)
+                return COMPRESSION_STATUS_ERROR;
+        }
+
+        if (state->in_len < state->block_size) {
+            memcpy(state->out + size, &state->end_magic, sizeof(state->end_magic));
+            size += sizeof(state->end_magic);
+            state->finished = true;
+        }
+
+        state->in_len = 0;
+        state->out_pos = 0;
+        state->out_len = size;
+    }
+}
+
+static void block_stream_destroy(struct stream_state* header) {
+    struct block_stream* state = (struct block_stream*)header;
+
+    free(state->scratch);
+    free(state->in);
+    free(state->out);
+    free(state);
+}
+
+compression_status block_stream_init(compression_stream* stream, size_t block_size, size_t max_block_size,
+                                     size_t scratch_size, block_encoder encode, uint32_t end_magic) {
+    struct block_stream* state = calloc(1, sizeof(*state));
+
+    if (!state)
+        return COMPRESSION_STATUS_ERROR;
+
+    state->header.process = block_stream_process;
+    state->header.destroy = block_stream_destroy;
+    state->encode = encode;
+    state->end_magic = end_magic;
+    state->block_size = block_size;
+    state->max_block_size = max_block_size;
+
+    state->scratch = scratch_size ? malloc(scratch_size) : NULL;
+    state->in = malloc(block_size);
+    state->out = malloc(max_block_size + sizeof(end_magic));
+
+    if ((scratch_size && !state->scratch) || !state->in || !state->out) {
+        block_stream_destroy(&state->header);
+        return COMPRESSION_STATUS_ERROR;
+    }
+
+    stream->state = state;
+    return COMPRESSION_STATUS_OK;
+}
@@ -0,0 +1,273 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression_private.h"
+#include <zlib.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// COMPRESSION_ZLIB is a raw DEFLATE stream (RFC 1951) without the zlib header and checksum,
+// produced at level 5
+#define ZLIB_LEVEL 5
+#define ZLIB_WINDOW_BITS (-15)
+#define ZLIB_MEM_LEVEL 8
+
+// Sizes of what deflate and inflate allocate through zalloc with the parameters above,
+// plus alignment slack
+#define ZLIB_ENCODE_SCRATCH_SIZE ((1 << 18) + (16 << 10))
+#define ZLIB_DECODE_SCRATCH_SIZE ((32 << 10) + (16 << 10))
+
+// Bump allocator handing out the caller's scratch buffer, falling back to malloc() once it runs out
+struct scratch_arena {
+    uint8_t* base;
+    size_t used, size;
+};
+
+static voidpf arena_alloc(voidpf opaque, uInt items, uInt size) {
+    struct scratch_arena* arena = opaque;
+    size_t bytes = ((size_t)items * size + 15) & ~(size_t)15;
+
+    if (arena->size - arena->used >= bytes) {
+        voidpf p = arena->base + arena->used;
+        arena->used += bytes;
+        return p;
+    }
+    return malloc((size_t)items * size);
+}
+
+static void arena_free(voidpf opaque, voidpf address) {
+    struct scratch_arena* arena = opaque;
+
+    if ((uint8_t*)address < arena->base || (uint8_t*)address >= arena->base + arena->size)
+        free(address);
+}
+
+static void arena_setup(z_stream* z, struct scratch_arena* arena, void* scratch, size_t size) {
+    memset(z, 0, sizeof(*z));
+    if (!scratch)
+        return;
+
+    // Align the start so that zlib's structures are naturally aligned
+    arena->base = (uint8_t*)(((uintptr_t)scratch + 15) & ~(uintptr_t)15);
+    arena->size = size - (arena->base - (uint8_t*)scratch);
+    arena->used = 0;
+    z->zalloc = arena_alloc;
+    z->zfree = arena_free;
+    z->opaque = arena;
+}
+
+size_t compression_zlib_encode_scratch_size(void) {
+    return ZLIB_ENCODE_SCRATCH_SIZE;
+}
+
+size_t compression_zlib_decode_scratch_size(void) {
+    return ZLIB_DECODE_SCRATCH_SIZE;
+}
+
+size_t compression_zlib_encode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch) {
+    struct scratch_arena arena;
+    z_stream z;
+    size_t written = 0;
+    int status;
+
+    arena_setup(&z, &arena, scratch, ZLIB_ENCODE_SCRATCH_SIZE);
+    if (deflateInit2(&z, ZLIB_LEVEL, Z_DEFLATED, ZLIB_WINDOW_BITS, ZLIB_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+
+    z.next_in = (Bytef*)src;
+    z.next_out = dst;
+
+    // avail_in and avail_out are 32-bit, so feed larger buffers piecewise
+    do {
+        uInt in_chunk = src_size > UINT_MAX ? UINT_MAX : (uInt)src_size;
+        uInt out_chunk = dst_size > UINT_MAX ? UINT_MAX : (uInt)dst_size;
+
+        z.avail_in = in_chunk;
+        z.avail_out = out_chunk;
+        status = deflate(&z, src_size == in_chunk ? Z_FINISH : Z_NO_FLUSH);
+        src_size -= in_chunk - z.avail_in;
+        dst_size -= out_chunk - z.avail_out;
+    } while (status == Z_OK && dst_size > 0);
+
+    if (status == Z_STREAM_END)
+        written = z.total_out;
+    deflateEnd(&z);
+    return written;
+}
+
+size_t compression_zlib_decode_buffer(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size, void* scratch) {
+    struct scratch_arena arena;
+    z_stream z;
+    uint8_t* op;
+    int status;
+
+    arena_setup(&z, &arena, scratch, ZLIB_DECODE_SCRATCH_SIZE);
+    if (inflateInit2(&z, ZLIB_WINDOW_BITS) != Z_OK)
+        return 0;
+
+    z.next_in = (Bytef*)src;
+    z.next_out = dst;
+
+    do {
+        uInt in_chunk = src_size > UINT_MAX ? UINT_MAX : (uInt)src_size;
+        uInt out_chunk = dst_size > UINT_MAX ? UINT_MAX : (uInt)dst_size;
+
+        z.avail_in = in_chunk;
+        z.avail_out = out_chunk;
+        status = inflate(&z, Z_NO_FLUSH);
+        src_size -= in_chunk - z.avail_in;
+        dst_size -= out_chunk - z.avail_out;
+    } while (status == Z_OK && dst_size > 0 && src_size > 0);
+
+    op = z.next_out;
+    inflateEnd(&z);
+
+    // A destination that fills up before the end of the stream gets truncated output
+    if (status == Z_STREAM_END || dst_size == 0)
+        return op - dst;
+    return 0;
+}
+
+struct zlib_stream {
+    struct stream_state header;
+    z_stream z;
+    bool encode;
+};
+
+static compression_status zlib_process(compression_stream* stream, int flags) {
+    struct zlib_stream* state = (struct zlib_stream*)stream->state;
+    z_stream* z = &state->z;
+
+    for (;;) {
+        uInt in_chunk = stream->src_size > UINT_MAX ? UINT_MAX : (uInt)stream->src_size;
+        uInt out_chunk = stream->dst_size > UINT_MAX ? UINT_MAX : (uInt)stream->dst_size;
+        bool last_chunk = stream->src_size == in_chunk;
+        size_t consumed, produced;
+        int status;
+
+        z->next_in = (Bytef*)stream->src_ptr;
+        z->avail_in = in_chunk;
+        z->next_out = stream->dst_ptr;
+        z->avail_out = out_chunk;
+
+        if (state->encode)
+            status = deflate(z, (flags & COMPRESSION_STREAM_FINALIZE) && last_chunk ? Z_FINISH : Z_NO_FLUSH);
+        else
+            status = inflate(z, Z_NO_FLUSH);
+
+        consumed = in_chunk - z->avail_in;
+        produced = out_chunk - z->avail_out;
+        stream->src_ptr += consumed;
+        stream->src_size -= consumed;
+        stream->dst_ptr += produced;
+        stream->dst_size -= produced;
+
+        switch (status) {
+            case Z_STREAM_END:
+                return COMPRESSION_STATUS_END;
+            case Z_OK:
+                // Only go around again when a 32-bit limit cut the call short
+                if ((z->avail_in == 0 && !last_chunk) || (z->avail_out == 0 && stream->dst_size > 0))
+                    continue;
+                return COMPRESSION_STATUS_OK;
+            case Z_BUF_ERROR:
+                // No progress was possible
+                if (!state->encode && (flags & COMPRESSION_STREAM_FINALIZE) && stream->src_size == 0 && stream->dst_size > 0)
+                    return COMPRESSION_STATUS_ERROR;
+                return COMPRESSION_STATUS_OK;
+            default:
+                return COMPRESSION_STATUS_ERROR;
+        }
+    }
+}
+
+static void zlib_destroy(struct stream_state* header) {
+    struct zlib_stream* state = (struct zlib_stream*)header;
+
+    if (state->encode)
+        deflateEnd(&state->z);
+    else
+        inflateEnd(&state->z);
+    free(state);
+}
+
+compression_status compression_zlib_stream_init(compression_stream* stream, compression_stream_operation operation) {
+    struct zlib_stream* state = calloc(1, sizeof(*state));
+    int status;
+
+    if (!state)
+        return COMPRESSION_STATUS_ERROR;
+
+    state->header.process = zlib_process;
+    state->header.destroy = zlib_destroy;
+    state->encode = operation == COMPRESSION_STREAM_ENCODE;
+
+    if (operation == COMPRESSION_STREAM_ENCODE)
+        status = deflateInit2(&state->z, ZLIB_LEVEL, Z_DEFLATED, ZLIB_WINDOW_BITS, ZLIB_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    else if (operation == COMPRESSION_STREAM_DECODE)
+        status = inflateInit2(&state->z, ZLIB_WINDOW_BITS);
+    else
+        status = Z_STREAM_ERROR;
+
+    if (status != Z_OK) {
+        free(state);
+        return COMPRESSION_STATUS_ERROR;
+    }
+
+    stream->state = state;
+    return COMPRESSION_STATUS_OK;
+}
+
+size_t compression_zlib_block_bound(size_t size) {
+    // compressBound() plus the empty stored block a full flush ends with
+    return compressBound(size) + 16;
+}
+
+size_t compression_zlib_encode_block(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t size,
+                                     size_t dictionary_size, bool last) {
+    z_stream z;
+    size_t written = 0;
+    int status;
+
+    memset(&z, 0, sizeof(z));
+    if (size > UINT_MAX || dst_size > UINT_MAX)
+        return 0;
+    if (deflateInit2(&z, ZLIB_LEVEL, Z_DEFLATED, ZLIB_WINDOW_BITS, ZLIB_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+
+    if (dictionary_size > 0 && deflateSetDictionary(&z, src - dictionary_size, (uInt)dictionary_size) != Z_OK) {
+        deflateEnd(&z);
+        return 0;
+    }
+
+    z.next_in = (Bytef*)src;
+    z.avail_in = (uInt)size;
+    z.next_out = dst;
+    z.avail_out = (uInt)dst_size;
+
+    // A full flush leaves no bits pending and marks no block as final, so the next piece
+    // can start right after it
+    status = deflate(&z, last ? Z_FINISH : Z_FULL_FLUSH);
+    if ((last && status == Z_STREAM_END) || (!last && status == Z_OK && z.avail_in == 0 && z.avail_out > 0))
+        written = z.total_out;
+
+    deflateEnd(&z);
+    return written;
+}
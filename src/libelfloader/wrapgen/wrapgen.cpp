@@ -2,6 +2,7 @@
 #include <string>
 #include <iostream>
 #include <set>
+#include <map>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -24,20 +25,33 @@
 // TODO: use wrapgen32 to generate 32-bit wrappers.
 
 void parse_elf(const char* elf, std::string& soname_out, std::set<std::string>& functions_out, std::set<std::string>& vars_out);
-void generate_wrapper(std::ofstream& output, const char* soname, const std::set<std::string>& symbols);
-void generate_var_wrappers(std::ofstream& output, std::ofstream& outputHeader, const std::set<std::string>& vars);
+void generate_wrapper(std::ofstream& output, const char* soname, const std::set<std::string>& symbols,
+		const std::set<std::string>& vars, bool lazy, std::map<std::string, size_t>& indices_out);
+void generate_var_wrappers(std::ofstream& output, std::ofstream& outputHeader, const std::set<std::string>& vars,
+		const std::map<std::string, size_t>& indices);
 Elf64_Off vaddr_to_offset(const Elf64_Ehdr* ehdr, Elf64_Addr vaddr);
 
 int main(int argc, const char** argv)
 {
 	std::string elfLibrary;
 	std::set<std::string> functions, vars;
+	std::map<std::string, size_t> indices;
 	std::string soname;
 	std::ofstream output;
+	bool lazy = false;
+
+	// With --lazy, the ELF library is only loaded once the first symbol is resolved
+	// instead of in the wrapper's constructor.
+	if (argc > 1 && strcmp(argv[1], "--lazy") == 0)
+	{
+		lazy = true;
+		argc--;
+		argv++;
+	}
 
 	if (argc != 4)
 	{
-		std::cerr << "Usage: " << argv[0] << " <library-name> <output-file> <var-access-header>\n";
+		std::cerr << "Usage: " << argv[0] << " [--lazy] <library-name> <output-file> <var-access-header>\n";
 		return 1;
 	}
 
@@ -79,7 +93,7 @@ int main(int argc, const char** argv)
 		}
 
 		parse_elf(elfLibrary.c_str(), soname, functions, vars);
-		generate_wrapper(output, soname.c_str(), functions);
+		generate_wrapper(output, soname.c_str(), functions, vars, lazy, indices);
 
 		if (!vars.empty())
 		{
@@ -87,7 +101,7 @@ int main(int argc, const char** argv)
 			if (!outputHeader.is_open())
 				throw std::runtime_error("Cannot open output macro header file");
 
-			generate_var_wrappers(output, outputHeader, vars);
+			generate_var_wrappers(output, outputHeader, vars, indices);
 		}
 	}
 	catch (const std::exception& e)
@@ -251,26 +265,80 @@ end_dyn:
 	munmap((void*) ehdr, length);
 }
 
-void generate_wrapper(std::ofstream& output, const char* soname, const std::set<std::string>& symbols)
+void generate_wrapper(std::ofstream& output, const char* soname, const std::set<std::string>& symbols,
+		const std::set<std::string>& vars, bool lazy, std::map<std::string, size_t>& indices)
 {
+	// All symbols are resolved in a single pass over the ELF's symbol table the first time
+	// any of them is needed. dlsym_bulk() requires the names to be sorted.
+	std::set<std::string> all_symbols(symbols);
+	all_symbols.insert(vars.begin(), vars.end());
+
 	output << "#include <elfcalls.h>\n"
-		"extern struct elf_calls* _elfcalls;\n\n"
+		"#include <pthread.h>\n";
+	output << "extern struct elf_calls* _elfcalls;\n\n"
 		"extern const char __elfname[];\n\n";
 
-	output << "static void* lib_handle;\n"
-		"__attribute__((constructor)) static void initializer() {\n"
-		"\tlib_handle = _elfcalls->dlopen_fatal(__elfname);\n"
+	output << "static void* lib_handle;\n";
+
+	if (lazy)
+	{
+		output << "static pthread_once_t lib_once = PTHREAD_ONCE_INIT;\n\n"
+			"static void lib_open() {\n"
+			"\tlib_handle = _elfcalls->dlopen_fatal(__elfname);\n"
+			"}\n\n";
+
+		output << "static void* get_lib_handle() {\n"
+			"\tpthread_once(&lib_once, lib_open);\n"
+			"\treturn lib_handle;\n"
+			"}\n\n";
+
+		output << "__attribute__((destructor)) static void destructor() {\n"
+			"\tif (lib_handle != NULL)\n"
+			"\t\t_elfcalls->dlclose_fatal(lib_handle);\n"
+			"}\n\n";
+	}
+	else
+	{
+		output << "__attribute__((constructor)) static void initializer() {\n"
+			"\tlib_handle = _elfcalls->dlopen_fatal(__elfname);\n"
+			"}\n\n";
+
+		output << "static void* get_lib_handle() {\n"
+			"\treturn lib_handle;\n"
+			"}\n\n";
+
+		output << "__attribute__((destructor)) static void destructor() {\n"
+			"\t_elfcalls->dlclose_fatal(lib_handle);\n"
+			"}\n\n";
+	}
+	
+	output << "static const char* const symbol_names[" << all_symbols.size() << "] = {\n";
+	for (const std::string& sym : all_symbols)
+	{
+		size_t index = indices.size();
+		indices[sym] = index;
+		output << "\t\"" << sym << "\",\n";
+	}
+	output << "};\n\n";
+
+	output << "static void* symbol_table[" << all_symbols.size() << "];\n"
+		"static pthread_once_t symbol_table_once = PTHREAD_ONCE_INIT;\n\n"
+		"static void resolve_symbols() {\n"
+		"\t_elfcalls->dlsym_bulk(get_lib_handle(), symbol_names, symbol_table, " << all_symbols.size() << ");\n"
 		"}\n\n";
 
-	output << "__attribute__((destructor)) static void destructor() {\n"
-		"\t_elfcalls->dlclose_fatal(lib_handle);\n"
+	output << "static void* get_symbol(unsigned long index) {\n"
+		"\tpthread_once(&symbol_table_once, resolve_symbols);\n"
+		"\tif (symbol_table[index] == NULL)\n"
+		"\t\treturn _elfcalls->dlsym_fatal(get_lib_handle(), symbol_names[index]);\n"
+		"\treturn symbol_table[index];\n"
 		"}\n\n";
-	
+
 	for (const std::string& sym : symbols)
 	{
 		output << "void* " << sym << "() {\n"
 			"\t__asm__(\".symbol_resolver _" << sym << "\");\n"
-			"\treturn _elfcalls->dlsym_fatal(lib_handle, \"" << sym << "\");\n"
+			"\treturn get_symbol(" << indices[sym] << ");\n"
 			"}\n\n";
 	}
 	output << "asm(\".section __TEXT,__elfname\\n"
@@ -278,7 +346,8 @@ void generate_wrapper(std::ofstream& output, const char* soname, const std::set<
 		"___elfname: .asciz \\\"" << soname << "\\\"\");\n";
 }
 
-void generate_var_wrappers(std::ofstream& output, std::ofstream& outputHeader, const std::set<std::string>& vars)
+void generate_var_wrappers(std::ofstream& output, std::ofstream& outputHeader, const std::set<std::string>& vars,
+		const std::map<std::string, size_t>& indices)
 {
 	outputHeader << "#pragma once\n\n";
 	outputHeader << "#ifdef __cplusplus\n"
@@ -288,7 +357,7 @@ void generate_var_wrappers(std::ofstream& output, std::ofstream& outputHeader, c
 	for (const std::string& sym : vars)
 	{
 		output << "void* __elf_get_" << sym << "(void) {\n"
-			"\treturn _elfcalls->dlsym_fatal(lib_handle, \"" << sym << "\");\n"
+			"\treturn get_symbol(" << indices.at(sym) << ");\n"
 			"}\n\n";
 		
 		outputHeader << "extern __typeof(" << sym << ")* __elf_get_" << sym << "(void);\n"
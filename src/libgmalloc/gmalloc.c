@@ -1,10 +1,16 @@
 #include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/cdefs.h>
 #include <sys/mman.h>
 #include <mach/vm_page_size.h>
+#include <malloc/malloc.h>
+#include <os/lock.h>
 #include <os/overflow.h>
 
 #ifdef __LP64__
@@ -27,6 +33,95 @@ static int gmalloc_allow_reads;
 static int gmalloc_strict_size;
 static int gmalloc_check_header = 1;
 
+// Sampling mode (MALLOC_SAMPLE_RATE=N): only about one in N allocations is
+// guarded, in a slot from a pool reserved up front, and everything else goes
+// to the default zone. That is cheap enough to leave on under real load.
+#define GMALLOC_DEFAULT_SAMPLE_SLOTS 256
+
+static size_t gmalloc_sample_rate;
+static size_t gmalloc_sample_slots = GMALLOC_DEFAULT_SAMPLE_SLOTS;
+
+// Full protection mode carves allocations of up to GMALLOC_SLAB_MAX_PAGES from
+// regions of one virtual arena reserved up front. A region holds slots of a
+// single size class, each slot between two guard pages, and freed slots sit in
+// a quarantine (MALLOC_QUARANTINE_SLOTS) before they can be handed out again.
+// That catches the same overruns and use-after-free as a dedicated mapping per
+// allocation, without an mmap() and munmap() each time and a VMA per allocation.
+#define GMALLOC_SLAB_CLASSES 7
+#define GMALLOC_SLAB_MAX_PAGES (1 << (GMALLOC_SLAB_CLASSES - 1))
+#define GMALLOC_REGION_SIZE ((size_t) 4 << 20)
+#ifdef __LP64__
+#define GMALLOC_ARENA_SIZE ((size_t) 64 << 30)
+#else
+#define GMALLOC_ARENA_SIZE ((size_t) 512 << 20)
+#endif
+#define GMALLOC_DEFAULT_QUARANTINE_SLOTS 4096
+// Freed slots of at least this many pages give their memory back right away
+#define GMALLOC_SLAB_MADVISE_PAGES 4
+
+static size_t gmalloc_quarantine_slots = GMALLOC_DEFAULT_QUARANTINE_SLOTS;
+
+struct gmalloc_slot {
+    void *payload;
+    size_t size;
+    bool in_use;
+    bool ever_used;
+};
+
+// One page per slot, each followed by a guard page, and a guard page in front:
+// [guard][slot 0][guard][slot 1][guard]...
+static struct {
+    char *base;
+    size_t size;
+    size_t stride;
+    struct gmalloc_slot *slots;
+    // Free slot indices, the one freed longest ago first, so that freed
+    // memory stays inaccessible for as long as possible
+    uint32_t *free_queue;
+    size_t free_head;
+    size_t free_count;
+    os_unfair_lock lock;
+} sample_pool = { .lock = OS_UNFAIR_LOCK_INIT };
+
+static _Atomic long sample_countdown;
+static _Atomic uint64_t sample_random;
+static malloc_zone_t *system_zone;
+static struct sigaction old_segv_action;
+static struct sigaction old_bus_action;
+
+struct gmalloc_region {
+    char *slots;
+    size_t slot_size;
+    size_t stride;
+    size_t slot_count;
+    size_t free_count;
+    // Next region of the same class with free slots
+    struct gmalloc_region *next_free;
+    // A set bit marks a free slot
+    uint64_t *free_bitmap;
+    struct gmalloc_slot *slot_info;
+};
+
+struct gmalloc_quarantined {
+    uint32_t region;
+    uint32_t slot;
+};
+
+static struct {
+    char *base;
+    size_t region_count;
+    struct gmalloc_region **regions;
+    struct gmalloc_region *free_regions[GMALLOC_SLAB_CLASSES];
+    // Ring of freed slots, oldest first
+    struct gmalloc_quarantined *quarantine;
+    size_t quarantine_head;
+    size_t quarantine_count;
+    bool unavailable;
+    os_unfair_lock lock;
+} slab_arena = { .lock = OS_UNFAIR_LOCK_INIT };
+
+static void sample_pool_init(void);
+
 void __malloc_init(const char *apple[]) {
     (void) apple;
 
@@ -39,6 +134,22 @@ void __malloc_init(const char *apple[]) {
     if (check_header && (!strcmp(check_header, "0") || !strcmp(check_header, "NO"))) {
         gmalloc_check_header = 0;
     }
+
+    const char *sample_slots = getenv("MALLOC_SAMPLE_SLOTS");
+    if (sample_slots && strtoul(sample_slots, NULL, 0) > 0) {
+        gmalloc_sample_slots = strtoul(sample_slots, NULL, 0);
+    }
+
+    const char *quarantine_slots = getenv("MALLOC_QUARANTINE_SLOTS");
+    if (quarantine_slots) {
+        gmalloc_quarantine_slots = strtoul(quarantine_slots, NULL, 0);
+    }
+
+    const char *sample_rate = getenv("MALLOC_SAMPLE_RATE");
+    if (sample_rate && strtoul(sample_rate, NULL, 0) > 0) {
+        gmalloc_sample_rate = strtoul(sample_rate, NULL, 0);
+        sample_pool_init();
+    }
 }
 
 static inline size_t round_up(size_t size, size_t increment) {
@@ -57,6 +168,426 @@ static struct gmalloc_header *header_for_ptr(void *ptr) {
     return (struct gmalloc_header *) ((char *) ptr - sizeof(struct gmalloc_header));
 }
 
+static inline bool sample_pool_contains(const void *ptr) {
+    return sample_pool.base != NULL
+        && (const char *) ptr >= sample_pool.base
+        && (const char *) ptr < sample_pool.base + sample_pool.size;
+}
+
+static inline char *sample_slot_address(size_t index) {
+    return sample_pool.base + vm_page_size + index * sample_pool.stride;
+}
+
+// Sampled intervals vary around the rate, so that allocation patterns
+// that repeat with some period don't always escape sampling
+static long next_sample_interval(void) {
+    uint64_t x = atomic_load_explicit(&sample_random, memory_order_relaxed);
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    atomic_store_explicit(&sample_random, x, memory_order_relaxed);
+
+    return 1 + (long) (x % (2 * gmalloc_sample_rate - 1));
+}
+
+static bool should_sample(void) {
+    // Threads racing past zero only sample a few extra allocations
+    if (atomic_fetch_sub_explicit(&sample_countdown, 1, memory_order_relaxed) > 1) {
+        return false;
+    }
+    atomic_store_explicit(&sample_countdown, next_sample_interval(), memory_order_relaxed);
+    return true;
+}
+
+// Returns NULL when the allocation is not sampled, so it should go to the default zone
+static void *sample_alloc(size_t payload_size, size_t align) {
+    if (sample_pool.base == NULL || payload_size > vm_page_size || align > vm_page_size || !should_sample()) {
+        return NULL;
+    }
+
+    os_unfair_lock_lock(&sample_pool.lock);
+    if (sample_pool.free_count == 0) {
+        os_unfair_lock_unlock(&sample_pool.lock);
+        return NULL;
+    }
+    size_t index = sample_pool.free_queue[sample_pool.free_head];
+    sample_pool.free_head = (sample_pool.free_head + 1) % gmalloc_sample_slots;
+    sample_pool.free_count--;
+    os_unfair_lock_unlock(&sample_pool.lock);
+
+    char *slot = sample_slot_address(index);
+    if (mprotect(slot, vm_page_size, PROT_READ | PROT_WRITE) < 0) {
+        os_unfair_lock_lock(&sample_pool.lock);
+        sample_pool.free_queue[(sample_pool.free_head + sample_pool.free_count++) % gmalloc_sample_slots] = index;
+        os_unfair_lock_unlock(&sample_pool.lock);
+        return NULL;
+    }
+
+    // Right against the guard page behind the slot, or the one in front of it
+    void *payload = gmalloc_protect_before ? slot : round_down(slot + vm_page_size - payload_size, align);
+
+    if (gmalloc_fill_space) {
+        memset(slot, 0x55, vm_page_size);
+    }
+
+    struct gmalloc_slot *meta = &sample_pool.slots[index];
+    meta->payload = payload;
+    meta->size = payload_size;
+    meta->in_use = meta->ever_used = true;
+    return payload;
+}
+
+static void sample_free(void *ptr) {
+    size_t index = ((char *) ptr - sample_pool.base - vm_page_size) / sample_pool.stride;
+    struct gmalloc_slot *meta = &sample_pool.slots[index];
+
+    // A double free, or a pointer into the middle of an allocation
+    if ((char *) ptr < sample_pool.base + vm_page_size || !meta->in_use || meta->payload != ptr) {
+        abort();
+    }
+
+    meta->in_use = false;
+    mprotect(sample_slot_address(index), vm_page_size, gmalloc_allow_reads ? PROT_READ : PROT_NONE);
+
+    os_unfair_lock_lock(&sample_pool.lock);
+    sample_pool.free_queue[(sample_pool.free_head + sample_pool.free_count++) % gmalloc_sample_slots] = index;
+    os_unfair_lock_unlock(&sample_pool.lock);
+}
+
+static size_t format_hex(char *buf, uintptr_t value) {
+    char digits[2 * sizeof(value)];
+    size_t count = 0, len = 0;
+
+    do {
+        digits[count++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value);
+
+    buf[len++] = '0';
+    buf[len++] = 'x';
+    while (count) {
+        buf[len++] = digits[--count];
+    }
+    return len;
+}
+
+static size_t format_decimal(char *buf, size_t value) {
+    char digits[3 * sizeof(value)];
+    size_t count = 0, len = 0;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (count) {
+        buf[len++] = digits[--count];
+    }
+    return len;
+}
+
+static void write_fault_report(const char *what, const char *where, const struct gmalloc_slot *meta) {
+    char buf[256];
+    size_t len = 0;
+
+#define APPEND(str) do { size_t n = strlen(str); memcpy(buf + len, str, n); len += n; } while (0)
+    APPEND("GuardMalloc: ");
+    APPEND(what);
+    APPEND(where);
+    len += format_decimal(buf + len, meta->size);
+    APPEND("-byte allocation at ");
+    len += format_hex(buf + len, (uintptr_t) meta->payload);
+    APPEND("\n");
+#undef APPEND
+
+    write(2, buf, len);
+}
+
+// Explains a fault inside the pool, then lets it happen again the way it
+// would have without this handler
+static void sample_fault_handler(int sig, siginfo_t *info, void *context) {
+    (void) context;
+    char *addr = info->si_addr;
+
+    if (sample_pool_contains(addr) && addr >= sample_pool.base + vm_page_size) {
+        size_t offset = addr - sample_pool.base - vm_page_size;
+        size_t index = offset / sample_pool.stride;
+        bool in_slot = offset % sample_pool.stride < vm_page_size;
+
+        if (in_slot && sample_pool.slots[index].ever_used && !sample_pool.slots[index].in_use) {
+            write_fault_report("use after free", " of a ", &sample_pool.slots[index]);
+        } else if (!in_slot && sample_pool.slots[index].in_use) {
+            write_fault_report("buffer overflow", " past the end of a ", &sample_pool.slots[index]);
+        } else if (!in_slot && index + 1 < gmalloc_sample_slots && sample_pool.slots[index + 1].in_use) {
+            write_fault_report("buffer underflow", " before the start of a ", &sample_pool.slots[index + 1]);
+        }
+    } else if (sample_pool_contains(addr) && sample_pool.slots[0].in_use) {
+        write_fault_report("buffer underflow", " before the start of a ", &sample_pool.slots[0]);
+    }
+
+    sigaction(sig, sig == SIGBUS ? &old_bus_action : &old_segv_action, NULL);
+}
+
+static void sample_pool_init(void) {
+    size_t count = gmalloc_sample_slots;
+    size_t meta_size = round_up(count * (sizeof(struct gmalloc_slot) + sizeof(uint32_t)), vm_page_size);
+
+    system_zone = malloc_default_zone();
+    sample_pool.stride = 2 * vm_page_size;
+    sample_pool.size = vm_page_size + count * sample_pool.stride;
+
+    // Nothing is accessible until it is handed out
+    void *base = mmap(NULL, sample_pool.size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    void *meta = mmap(NULL, meta_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (base == MAP_FAILED || meta == MAP_FAILED) {
+        if (base != MAP_FAILED) munmap(base, sample_pool.size);
+        if (meta != MAP_FAILED) munmap(meta, meta_size);
+        // Without a pool, everything just passes through
+        return;
+    }
+
+    sample_pool.slots = meta;
+    sample_pool.free_queue = (uint32_t *) (sample_pool.slots + count);
+    for (size_t i = 0; i < count; i++) {
+        sample_pool.free_queue[i] = (uint32_t) i;
+    }
+    sample_pool.free_count = count;
+
+    atomic_store(&sample_random, (uint64_t) getpid() * 0x9e3779b97f4a7c15ULL ^ (uintptr_t) base);
+    atomic_store(&sample_countdown, next_sample_interval());
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = sample_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &old_segv_action);
+    sigaction(SIGBUS, &action, &old_bus_action);
+
+    sample_pool.base = base;
+}
+
+static inline bool slab_arena_contains(const void *ptr) {
+    return slab_arena.base != NULL
+        && (const char *) ptr >= slab_arena.base
+        && (const char *) ptr < slab_arena.base + GMALLOC_ARENA_SIZE;
+}
+
+static void *map_metadata(size_t size) {
+    void *ptr = mmap(NULL, round_up(size, vm_page_size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Called with the arena locked
+static bool slab_arena_init(void) {
+    size_t max_regions = GMALLOC_ARENA_SIZE / GMALLOC_REGION_SIZE;
+
+    if (slab_arena.unavailable) {
+        return false;
+    }
+
+    // Only address space: the pages get committed as slots are handed out
+    void *base = mmap(NULL, GMALLOC_ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    slab_arena.regions = map_metadata(max_regions * sizeof(*slab_arena.regions));
+    if (gmalloc_quarantine_slots) {
+        slab_arena.quarantine = map_metadata(gmalloc_quarantine_slots * sizeof(*slab_arena.quarantine));
+    }
+
+    if (base == MAP_FAILED || slab_arena.regions == NULL || (gmalloc_quarantine_slots && slab_arena.quarantine == NULL)) {
+        // Every allocation gets its own mapping then, as before
+        if (base != MAP_FAILED) munmap(base, GMALLOC_ARENA_SIZE);
+        slab_arena.unavailable = true;
+        return false;
+    }
+
+    slab_arena.base = base;
+    return true;
+}
+
+// Called with the arena locked
+static struct gmalloc_region *slab_region_create(int size_class) {
+    if (slab_arena.base == NULL && !slab_arena_init()) {
+        return NULL;
+    }
+    if (slab_arena.region_count == GMALLOC_ARENA_SIZE / GMALLOC_REGION_SIZE) {
+        return NULL;
+    }
+
+    size_t slot_size = vm_page_size << size_class;
+    size_t stride = slot_size + vm_page_size;
+    // A guard page in front, then every slot followed by its guard page
+    size_t slot_count = (GMALLOC_REGION_SIZE - vm_page_size) / stride;
+    size_t bitmap_words = (slot_count + 63) / 64;
+
+    size_t metadata_size = sizeof(struct gmalloc_region)
+        + bitmap_words * sizeof(uint64_t) + slot_count * sizeof(struct gmalloc_slot);
+    struct gmalloc_region *region = map_metadata(metadata_size);
+    if (region == NULL) {
+        return NULL;
+    }
+
+    char *region_base = slab_arena.base + slab_arena.region_count * GMALLOC_REGION_SIZE;
+    if (gmalloc_allow_reads && mprotect(region_base, GMALLOC_REGION_SIZE, PROT_READ) < 0) {
+        munmap(region, metadata_size);
+        return NULL;
+    }
+
+    region->slots = region_base + vm_page_size;
+    region->slot_size = slot_size;
+    region->stride = stride;
+    region->slot_count = slot_count;
+    region->free_count = slot_count;
+    region->free_bitmap = (uint64_t *) (region + 1);
+    region->slot_info = (struct gmalloc_slot *) (region->free_bitmap + bitmap_words);
+    for (size_t i = 0; i < slot_count; i++) {
+        region->free_bitmap[i / 64] |= 1ULL << (i % 64);
+    }
+
+    slab_arena.regions[slab_arena.region_count++] = region;
+    return region;
+}
+
+static int slab_class_for(size_t pages) {
+    int size_class = 0;
+
+    while (((size_t) 1 << size_class) < pages) {
+        size_class++;
+    }
+    return size_class;
+}
+
+// Called with the arena locked
+static void slab_release(struct gmalloc_region *region, size_t index) {
+    region->free_bitmap[index / 64] |= 1ULL << (index % 64);
+    if (region->free_count++ == 0) {
+        int size_class = slab_class_for(region->slot_size / vm_page_size);
+        region->next_free = slab_arena.free_regions[size_class];
+        slab_arena.free_regions[size_class] = region;
+    }
+}
+
+// Returns the given number of accessible pages from a slot, or NULL to have the
+// allocation mapped on its own. Only those pages are unprotected, right against the
+// guard page the payload gets placed next to, so the rest of a larger slot still
+// faults like the guard page does.
+static char *slab_alloc(size_t pages, struct gmalloc_region **region_out, size_t *index_out) {
+    if (pages > GMALLOC_SLAB_MAX_PAGES) {
+        return NULL;
+    }
+
+    int size_class = slab_class_for(pages);
+
+    os_unfair_lock_lock(&slab_arena.lock);
+
+    struct gmalloc_region *region = slab_arena.free_regions[size_class];
+    if (region == NULL) {
+        region = slab_region_create(size_class);
+        if (region == NULL) {
+            os_unfair_lock_unlock(&slab_arena.lock);
+            return NULL;
+        }
+        slab_arena.free_regions[size_class] = region;
+    }
+
+    size_t word = 0;
+    while (region->free_bitmap[word] == 0) {
+        word++;
+    }
+    size_t index = word * 64 + __builtin_ctzll(region->free_bitmap[word]);
+
+    region->free_bitmap[word] &= ~(1ULL << (index % 64));
+    if (--region->free_count == 0) {
+        slab_arena.free_regions[size_class] = region->next_free;
+        region->next_free = NULL;
+    }
+    region->slot_info[index].in_use = true;
+
+    os_unfair_lock_unlock(&slab_arena.lock);
+
+    char *slot = region->slots + index * region->stride;
+    char *accessible = gmalloc_protect_before ? slot : slot + region->slot_size - pages * vm_page_size;
+    if (mprotect(accessible, pages * vm_page_size, PROT_READ | PROT_WRITE) < 0) {
+        os_unfair_lock_lock(&slab_arena.lock);
+        region->slot_info[index].in_use = false;
+        slab_release(region, index);
+        os_unfair_lock_unlock(&slab_arena.lock);
+        return NULL;
+    }
+
+    *region_out = region;
+    *index_out = index;
+    return accessible;
+}
+
+static struct gmalloc_region *slab_region_for(const void *ptr, size_t *index_out) {
+    size_t offset = (const char *) ptr - slab_arena.base;
+    size_t region_index = offset / GMALLOC_REGION_SIZE;
+
+    if (region_index >= slab_arena.region_count) {
+        return NULL;
+    }
+
+    struct gmalloc_region *region = slab_arena.regions[region_index];
+    size_t slot_offset = (const char *) ptr - region->slots;
+    if ((const char *) ptr < region->slots || slot_offset / region->stride >= region->slot_count) {
+        return NULL;
+    }
+
+    *index_out = slot_offset / region->stride;
+    return region;
+}
+
+static size_t slab_allocation_size(const void *ptr) {
+    size_t index;
+    struct gmalloc_region *region = slab_region_for(ptr, &index);
+
+    return region ? region->slot_info[index].size : 0;
+}
+
+static void slab_free(void *ptr) {
+    size_t index;
+    struct gmalloc_region *region = slab_region_for(ptr, &index);
+    struct gmalloc_slot *info = region ? &region->slot_info[index] : NULL;
+
+    // A double free, or a pointer that was never handed out
+    if (info == NULL || !info->in_use || info->payload != ptr) {
+        if (gmalloc_check_header) {
+            abort();
+        }
+        return;
+    }
+
+    // Freed slots look like guard pages, so they merge with them into one VMA. Small
+    // slots keep their pages, which the next allocation from them reuses without faulting.
+    char *slot = region->slots + index * region->stride;
+    mprotect(slot, region->slot_size, gmalloc_allow_reads ? PROT_READ : PROT_NONE);
+    if (region->slot_size >= GMALLOC_SLAB_MADVISE_PAGES * vm_page_size) {
+        madvise(slot, region->slot_size, MADV_FREE);
+    }
+
+    os_unfair_lock_lock(&slab_arena.lock);
+    info->in_use = false;
+
+    if (gmalloc_quarantine_slots == 0) {
+        slab_release(region, index);
+    } else {
+        if (slab_arena.quarantine_count == gmalloc_quarantine_slots) {
+            struct gmalloc_quarantined *oldest = &slab_arena.quarantine[slab_arena.quarantine_head];
+            slab_release(slab_arena.regions[oldest->region], oldest->slot);
+            slab_arena.quarantine_head = (slab_arena.quarantine_head + 1) % gmalloc_quarantine_slots;
+            slab_arena.quarantine_count--;
+        }
+
+        struct gmalloc_quarantined *entry = &slab_arena.quarantine[
+            (slab_arena.quarantine_head + slab_arena.quarantine_count++) % gmalloc_quarantine_slots];
+        entry->region = (uint32_t) (((char *) ptr - slab_arena.base) / GMALLOC_REGION_SIZE);
+        entry->slot = (uint32_t) index;
+    }
+
+    os_unfair_lock_unlock(&slab_arena.lock);
+}
+
 static void *do_alloc(size_t payload_size, size_t align) {
     // Decide how much memory we're going to allocate,
     // not counting the guard page.
@@ -69,6 +600,26 @@ static void *do_alloc(size_t payload_size, size_t align) {
     }
     accessible_size = round_up(accessible_size, vm_page_size);
 
+    // Slab slots keep their bookkeeping out of band, so they need no room for the header
+    struct gmalloc_region *region;
+    size_t index;
+    size_t pages = round_up(round_up(payload_size, align), vm_page_size) / vm_page_size;
+    if (pages == 0) {
+        pages = 1;
+    }
+    char *slot = align > vm_page_size ? NULL : slab_alloc(pages, &region, &index);
+    if (slot != NULL) {
+        void *payload = gmalloc_protect_before ? slot : round_down(slot + pages * vm_page_size - payload_size, align);
+
+        if (gmalloc_fill_space) {
+            memset(slot, 0x55, pages * vm_page_size);
+        }
+
+        region->slot_info[index].payload = payload;
+        region->slot_info[index].size = payload_size;
+        return payload;
+    }
+
     void *mmap_base = mmap(
         NULL, accessible_size + vm_page_size,
         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON,
@@ -106,6 +657,11 @@ static void *do_alloc(size_t payload_size, size_t align) {
 }
 
 void *aligned_alloc(size_t align, size_t size) {
+    if (gmalloc_sample_rate) {
+        void *ptr = sample_alloc(size, align);
+        return ptr ? ptr : system_zone->memalign(system_zone, align, size);
+    }
+
     void *ptr = do_alloc(size, align);
 
     if (ptr == NULL) {
@@ -124,8 +680,18 @@ void *aligned_alloc(size_t align, size_t size) {
     return ptr;
 }
 
+// The alignment of malloc() and calloc() results, which MALLOC_STRICT_SIZE drops
+// so that the payload ends right at the guard page
+static inline size_t default_alignment(void) {
+    return gmalloc_strict_size ? 1 : 16;
+}
+
 void *malloc(size_t size) {
-    return aligned_alloc(gmalloc_strict_size ? 1 : 16, size);
+    if (gmalloc_sample_rate) {
+        void *ptr = sample_alloc(size, default_alignment());
+        return ptr ? ptr : system_zone->malloc(system_zone, size);
+    }
+    return aligned_alloc(default_alignment(), size);
 }
 
 int posix_memalign(void **ptr, size_t align, size_t size) {
@@ -137,6 +703,16 @@ int posix_memalign(void **ptr, size_t align, size_t size) {
 }
 
 void *calloc(size_t num, size_t size) {
+    if (gmalloc_sample_rate) {
+        size_t total;
+        void *ptr = os_mul_overflow(num, size, &total) ? NULL : sample_alloc(total, default_alignment());
+        if (ptr == NULL) {
+            return system_zone->calloc(system_zone, num, size);
+        }
+        memset(ptr, 0, total);
+        return ptr;
+    }
+
     void *ptr = malloc(num * size);
     memset(ptr, 0, num * size);
     return ptr;
@@ -156,11 +732,31 @@ static void unlock_and_check_header(const struct gmalloc_header *header) {
     }
 }
 
+// In sampling mode, whatever neither the pool nor the default zone owns
+// was allocated before sampling was set up
+static inline bool owned_by_system_zone(void *ptr) {
+    return gmalloc_sample_rate && !sample_pool_contains(ptr) && !slab_arena_contains(ptr)
+        && system_zone->size(system_zone, ptr) != 0;
+}
+
 void free(void *ptr) {
     if (ptr == NULL) {
         return;
     }
 
+    if (sample_pool_contains(ptr)) {
+        sample_free(ptr);
+        return;
+    }
+    if (slab_arena_contains(ptr)) {
+        slab_free(ptr);
+        return;
+    }
+    if (owned_by_system_zone(ptr)) {
+        system_zone->free(system_zone, ptr);
+        return;
+    }
+
     struct gmalloc_header *header = header_for_ptr(ptr);
     unlock_and_check_header(header);
 
@@ -168,9 +764,18 @@ void free(void *ptr) {
 }
 
 void *realloc(void *old_ptr, size_t new_size) {
+    if (old_ptr != NULL && owned_by_system_zone(old_ptr)) {
+        return system_zone->realloc(system_zone, old_ptr, new_size);
+    }
+
     size_t size_to_copy;
     if (old_ptr == NULL) {
         size_to_copy = 0;
+    } else if (sample_pool_contains(old_ptr)) {
+        size_t index = ((char *) old_ptr - sample_pool.base - vm_page_size) / sample_pool.stride;
+        size_to_copy = sample_pool.slots[index].size;
+    } else if (slab_arena_contains(old_ptr)) {
+        size_to_copy = slab_allocation_size(old_ptr);
     } else {
         struct gmalloc_header *header = header_for_ptr(old_ptr);
         unlock_and_check_header(header);
@@ -215,7 +820,6 @@ void *reallocarrayf(void *old_ptr, size_t num, size_t size) {
 }
 
 // Zone versions
-typedef void malloc_zone_t;
 void *malloc_zone_malloc(malloc_zone_t *zone, size_t size) {
     (void) zone;
     return malloc(size);
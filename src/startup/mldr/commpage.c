@@ -8,6 +8,13 @@
 #include <cpuid.h>
 #include <unistd.h>
 #include <sys/sysinfo.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <x86intrin.h>
 
 // Include commpage definitions
 #define PRIVATE
@@ -17,9 +24,23 @@ static const char* SIGNATURE32 = "commpage 32-bit";
 static const char* SIGNATURE64 = "commpage 64-bit";
 
 static uint64_t get_cpu_caps(void);
+static void time_setup(uint8_t* commpage);
+static void time_update(void);
+static void* time_update_thread(void* arg);
 
 #define CGET(p) (commpage + ((p)-_COMM_PAGE_START_ADDRESS))
 
+#define NSEC_PER_SEC 1000000000ull
+#define NSEC_PER_USEC 1000ull
+
+// Time data state (see time_setup())
+static uint8_t* time_commpage;
+static uint32_t time_scale;
+static bool time_published;
+static bool time_estimated;
+static uint64_t time_calib_tsc, time_calib_ns;
+static bool time_updater_started;
+
 void commpage_setup(bool _64bit)
 {
 	uint8_t* commpage;
@@ -80,6 +101,8 @@ void commpage_setup(bool _64bit)
 		uint64_t* memsize = (uint64_t*)CGET(_COMM_PAGE_MEMORY_SIZE);
 		*memsize = si.totalram * si.mem_unit;
 	}
+
+	time_setup(commpage);
 }
 
 uint64_t get_cpu_caps(void)
@@ -154,6 +177,354 @@ uint64_t get_cpu_caps(void)
 	return caps;
 }
 
+// The nanotime data lets mach_absolute_time() (and, through it, mach_continuous_time()
+// and gettimeofday()) compute the time from the TSC without entering the kernel:
+//
+//   ns = NT_NS_BASE + (((rdtsc() - NT_TSC_BASE) * NT_SCALE) >> 32)
+//
+// Readers retry while NT_GENERATION changes under them and spin while it is zero, so once
+// published it must never be left at zero. A zero GTOD_GENERATION on the other hand just
+// sends gettimeofday() to the syscall. We only ever publish data if Linux itself trusts the TSC
+// for its vDSO clocks, and we take the TSC rate from the kernel when possible, so that
+// we produce the same clock as CLOCK_MONOTONIC (which the slow path returns).
+static bool tsc_usable(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+	char clocksource[16];
+	ssize_t len;
+	int fd;
+
+	// Invariant TSC (CPUID.80000007H:EDX[8])
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+		return false;
+	__cpuid(0x80000007, eax, ebx, ecx, edx);
+	if (!(edx & (1 << 8)))
+		return false;
+
+	fd = open("/sys/devices/system/clocksource/clocksource0/current_clocksource", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	len = read(fd, clocksource, sizeof(clocksource) - 1);
+	close(fd);
+
+	return len >= 4 && memcmp(clocksource, "tsc\n", 4) == 0;
+}
+
+// Returns the TSC to nanoseconds factor as a 32.32 fixed point number, or 0 if unknown.
+// *exact is set if it is the kernel's own factor rather than a nominal frequency.
+static uint32_t tsc_scale(bool* exact)
+{
+	struct perf_event_attr attr;
+	struct perf_event_mmap_page* pc;
+	uint32_t eax, ebx, ecx, edx;
+	uint64_t scale = 0;
+	int fd;
+
+	// The perf user page exports the exact mult/shift pair the kernel uses to convert
+	// TSC ticks to nanoseconds.
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_SW_DUMMY;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	if (fd >= 0)
+	{
+		pc = (struct perf_event_mmap_page*) mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (pc != MAP_FAILED)
+		{
+			if (pc->cap_user_time && pc->time_mult != 0)
+			{
+				if (pc->time_shift <= 32)
+					scale = (uint64_t)pc->time_mult << (32 - pc->time_shift);
+				else
+					scale = (uint64_t)pc->time_mult >> (pc->time_shift - 32);
+			}
+			munmap(pc, sysconf(_SC_PAGESIZE));
+		}
+	}
+
+	*exact = scale != 0;
+
+	// Otherwise take a nominal frequency: what the kernel measured at boot (only exported by
+	// some kernels), the crystal clock * EBX / EAX, or the processor base frequency
+	if (scale == 0)
+	{
+		char khz[24];
+		ssize_t len;
+
+		fd = open("/sys/devices/system/cpu/cpu0/tsc_freq_khz", O_RDONLY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			len = read(fd, khz, sizeof(khz) - 1);
+			close(fd);
+			if (len > 0)
+			{
+				khz[len] = '\0';
+				uint64_t freq = strtoull(khz, NULL, 10) * 1000;
+				if (freq != 0)
+					scale = (NSEC_PER_SEC << 32) / freq;
+			}
+		}
+	}
+	if (scale == 0 && __get_cpuid_max(0, NULL) >= 0x15)
+	{
+		__cpuid(0x15, eax, ebx, ecx, edx);
+		if (eax != 0 && ebx != 0 && ecx != 0)
+		{
+			uint64_t freq = (uint64_t)ecx * ebx / eax;
+			scale = (NSEC_PER_SEC << 32) / freq;
+		}
+	}
+	if (scale == 0 && __get_cpuid_max(0, NULL) >= 0x16)
+	{
+		__cpuid(0x16, eax, ebx, ecx, edx);
+		if ((eax & 0xffff) != 0)
+			scale = (NSEC_PER_SEC << 32) / ((uint64_t)(eax & 0xffff) * 1000000);
+	}
+
+	// A TSC slower than 1 GHz doesn't fit the 64-bit nanotime format (it'd need NT_SHIFT)
+	return (scale > 0 && scale <= UINT32_MAX) ? (uint32_t)scale : 0;
+}
+
+// Reads the TSC and CLOCK_MONOTONIC (plus optionally CLOCK_REALTIME) as close together as we can.
+static uint64_t tsc_sample(struct timespec* mono, struct timespec* real)
+{
+	uint64_t best_tsc = 0, best_delta = UINT64_MAX;
+
+	for (int i = 0; i < 3; i++)
+	{
+		struct timespec m;
+		uint64_t t0, t1;
+
+		_mm_lfence();
+		t0 = __rdtsc();
+		_mm_lfence();
+		clock_gettime(CLOCK_MONOTONIC, &m);
+		_mm_lfence();
+		t1 = __rdtsc();
+
+		if (t1 - t0 < best_delta)
+		{
+			best_delta = t1 - t0;
+			best_tsc = t0 + (t1 - t0) / 2;
+			*mono = m;
+		}
+	}
+
+	if (real != NULL)
+		clock_gettime(CLOCK_REALTIME, real);
+
+	return best_tsc;
+}
+
+static uint64_t timespec_ns(const struct timespec* ts)
+{
+	return (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+// Same computation as the userspace readers.
+static uint64_t nanotime(uint8_t* commpage, uint64_t tsc)
+{
+	uint64_t delta = tsc - *(uint64_t*)CGET(_COMM_PAGE_NT_TSC_BASE);
+	uint64_t scale = *(uint32_t*)CGET(_COMM_PAGE_NT_SCALE);
+
+	// (delta * scale) >> 32 without a 128-bit multiply
+	return *(uint64_t*)CGET(_COMM_PAGE_NT_NS_BASE)
+		+ (delta >> 32) * scale + (((delta & UINT32_MAX) * scale) >> 32);
+}
+
+static void begin_update(uint32_t* generation)
+{
+	__atomic_store_n(generation, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_update(uint32_t* generation, uint32_t* counter)
+{
+	if (++*counter == 0)
+		*counter = 1;
+	__atomic_store_n(generation, *counter, __ATOMIC_RELEASE);
+}
+
+// Returns elapsed_ns / elapsed_tsc as a 32.32 fixed point number, or 0 if the rate is out of range.
+static uint32_t calibrated_scale(uint64_t elapsed_tsc, uint64_t elapsed_ns)
+{
+	// Check the rate is in range (> 1 GHz)
+	if (elapsed_tsc <= elapsed_ns)
+		return 0;
+
+	// elapsed_ns * 2^32 / elapsed_tsc, keeping the intermediate value within 64 bits
+	while (elapsed_ns >= (1ull << 32))
+	{
+		elapsed_ns >>= 1;
+		elapsed_tsc >>= 1;
+	}
+	return (uint32_t)((elapsed_ns << 32) / elapsed_tsc);
+}
+
+// The child's copy of the commpage keeps the parent's data, which is still a valid TSC clock,
+// but nothing refreshes it anymore. Make gettimeofday() use the syscall until the child
+// gets its own updater (see commpage_start_time_updates()).
+static void time_atfork_child(void)
+{
+	uint8_t* commpage = time_commpage;
+
+	time_updater_started = false;
+	begin_update((uint32_t*)CGET(_COMM_PAGE_GTOD_GENERATION));
+
+	if (time_estimated)
+		commpage_start_time_updates();
+}
+
+static void time_setup(uint8_t* commpage)
+{
+	struct timespec mono;
+	bool exact;
+
+	if (!tsc_usable())
+		return;
+
+	time_scale = tsc_scale(&exact);
+	if (time_scale == 0)
+		return;
+
+	time_commpage = commpage;
+	time_update();
+
+	pthread_atfork(NULL, NULL, time_atfork_child);
+
+	// A nominal frequency is off by a few hundred ppm, which adds up quickly. Measure the real
+	// rate against CLOCK_MONOTONIC from here on, which needs the updater whether or not
+	// the process ever creates a thread of its own.
+	if (!exact)
+	{
+		time_estimated = true;
+		time_calib_tsc = tsc_sample(&mono, NULL);
+		time_calib_ns = timespec_ns(&mono);
+		commpage_start_time_updates();
+	}
+}
+
+static void time_update(void)
+{
+	static uint32_t nt_counter, gtod_counter;
+	uint8_t* commpage = time_commpage;
+	uint32_t* nt_generation = (uint32_t*)CGET(_COMM_PAGE_NT_GENERATION);
+	uint32_t* gtod_generation = (uint32_t*)CGET(_COMM_PAGE_GTOD_GENERATION);
+	struct timespec mono, real;
+	uint64_t tsc, ns;
+	uint32_t scale;
+
+	tsc = tsc_sample(&mono, &real);
+	ns = timespec_ns(&mono);
+
+	// Measure a nominal rate over everything since startup, so it only gets more accurate
+	if (time_estimated && ns - time_calib_ns >= NSEC_PER_SEC / 10)
+	{
+		scale = calibrated_scale(tsc - time_calib_tsc, ns - time_calib_ns);
+		if (scale != 0)
+			time_scale = scale;
+	}
+	scale = time_scale;
+
+	// Rebase on CLOCK_MONOTONIC to follow its NTP adjustments, but never let time go backwards.
+	// If we are ahead, run slower until the next update (a second from now) to catch up.
+	if (time_published)
+	{
+		uint64_t current = nanotime(commpage, tsc);
+		if (current > ns)
+		{
+			uint64_t ahead = current - ns;
+			if (ahead > NSEC_PER_SEC / 2)
+				ahead = NSEC_PER_SEC / 2;
+			scale -= (uint32_t)((uint64_t)scale * ahead / NSEC_PER_SEC);
+			ns = current;
+		}
+	}
+
+	begin_update(nt_generation);
+	*(uint64_t*)CGET(_COMM_PAGE_NT_TSC_BASE) = tsc;
+	*(uint32_t*)CGET(_COMM_PAGE_NT_SCALE) = scale;
+	*(uint32_t*)CGET(_COMM_PAGE_NT_SHIFT) = 0;
+	*(uint64_t*)CGET(_COMM_PAGE_NT_NS_BASE) = ns;
+	end_update(nt_generation, &nt_counter);
+	time_published = true;
+
+#ifdef _COMM_PAGE_CONT_TIMEBASE
+	{
+		// mach_continuous_time() = mach_absolute_time() + time spent asleep
+		struct timespec boot;
+		clock_gettime(CLOCK_BOOTTIME, &boot);
+
+		__atomic_store_n((uint64_t*)CGET(_COMM_PAGE_CONT_TIMEBASE),
+				timespec_ns(&boot) - timespec_ns(&mono), __ATOMIC_RELEASE);
+#ifdef _COMM_PAGE_BOOTTIME_USEC
+		*(uint64_t*)CGET(_COMM_PAGE_BOOTTIME_USEC) = (timespec_ns(&real) - timespec_ns(&boot)) / NSEC_PER_USEC;
+#endif
+	}
+#endif
+
+	// gettimeofday() data is only valid until the next second boundary,
+	// readers fall back to the syscall once that is crossed
+	begin_update(gtod_generation);
+	*(uint64_t*)CGET(_COMM_PAGE_GTOD_NS_BASE) = ns - real.tv_nsec;
+	*(uint64_t*)CGET(_COMM_PAGE_GTOD_SEC_BASE) = real.tv_sec;
+	end_update(gtod_generation, &gtod_counter);
+}
+
+static void* time_update_thread(void* arg)
+{
+	for (;;)
+	{
+		struct timespec now, next;
+
+		time_update();
+
+		// Wake up right at the next second boundary to refresh the gettimeofday() data
+		clock_gettime(CLOCK_REALTIME, &now);
+		next.tv_sec = now.tv_sec + 1;
+		next.tv_nsec = 0;
+
+		while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next, NULL) == EINTR);
+	}
+	return NULL;
+}
+
+void commpage_start_time_updates(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all, old;
+
+	if (time_commpage == NULL || __atomic_exchange_n(&time_updater_started, true, __ATOMIC_RELAXED))
+		return;
+
+	// This is a plain Linux thread that is invisible to darlingserver;
+	// make sure no (Darwin) signal is ever delivered to it.
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if (pthread_create(&thread, &attr, time_update_thread, NULL) != 0)
+	{
+		// Leave the nanotime data in place (it stays valid), but stop gettimeofday() from using stale data
+		uint8_t* commpage = time_commpage;
+		begin_update((uint32_t*)CGET(_COMM_PAGE_GTOD_GENERATION));
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
 unsigned long commpage_address(bool _64bit)
 {
 	return _64bit ? _COMM_PAGE64_BASE_ADDRESS : _COMM_PAGE32_BASE_ADDRESS;
@@ -10,6 +10,12 @@ extern "C" {
 void commpage_setup(bool _64bit);
 unsigned long commpage_address(bool _64bit);
 
+// Starts the thread that keeps the commpage time data up to date, unless it is already running.
+// Called when a process creates its first thread (again after fork). It is started right away
+// if the TSC rate had to be estimated, otherwise single-threaded processes make do with
+// the data published at startup.
+void commpage_start_time_updates(void);
+
 union cpu_flags1 {
   struct {
 	uint8_t step: 4;
@@ -1,4 +1,8 @@
+#define _GNU_SOURCE
 #include <dlfcn.h>
+#include <link.h>
+#include <elf.h>
+#include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -8,6 +12,7 @@
 #include <unistd.h>
 #include "elfcalls.h"
 #include "threads.h"
+#include "../startup_trace.h"
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <fcntl.h>
@@ -51,6 +56,130 @@ static int dlclose_fatal(void* handle)
 	return 0;
 }
 
+static int compare_names(const void* key, const void* member)
+{
+	return strcmp((const char*) key, *(const char* const*) member);
+}
+
+// Number of entries in the dynamic symbol table, which is only recorded in the hash tables.
+static size_t dynsym_count(const ElfW(Word)* hash, const uint32_t* gnu_hash)
+{
+	if (hash != NULL)
+		return hash[1]; // nchain
+
+	if (gnu_hash != NULL)
+	{
+		uint32_t nbuckets = gnu_hash[0];
+		uint32_t symoffset = gnu_hash[1];
+		uint32_t bloom_size = gnu_hash[2];
+		const uint32_t* buckets = (const uint32_t*) ((const ElfW(Addr)*) &gnu_hash[4] + bloom_size);
+		const uint32_t* chain = buckets + nbuckets;
+		uint32_t last = 0;
+
+		for (uint32_t i = 0; i < nbuckets; i++)
+		{
+			if (buckets[i] > last)
+				last = buckets[i];
+		}
+
+		if (last < symoffset)
+			return symoffset;
+
+		// the last chain ends with an entry that has the lowest bit set
+		while (!(chain[last - symoffset] & 1))
+			last++;
+
+		return last + 1;
+	}
+
+	return 0;
+}
+
+static size_t dlsym_bulk(void* lib, const char* const* names, void** out, size_t count)
+{
+	struct link_map* lm;
+	const ElfW(Sym)* symtab = NULL;
+	const char* strtab = NULL;
+	const ElfW(Word)* hash = NULL;
+	const uint32_t* gnu_hash = NULL;
+	const ElfW(Half)* versym = NULL;
+	size_t resolved = 0;
+
+	memset(out, 0, count * sizeof(*out));
+
+	if (dlinfo(lib, RTLD_DI_LINKMAP, &lm) == 0)
+	{
+		for (const ElfW(Dyn)* dyn = lm->l_ld; dyn->d_tag != DT_NULL; dyn++)
+		{
+			// glibc relocates these entries in place on most platforms, but not everywhere
+			ElfW(Addr) ptr = dyn->d_un.d_ptr;
+			if (ptr < lm->l_addr)
+				ptr += lm->l_addr;
+
+			switch (dyn->d_tag)
+			{
+				case DT_SYMTAB:
+					symtab = (const ElfW(Sym)*) ptr;
+					break;
+				case DT_STRTAB:
+					strtab = (const char*) ptr;
+					break;
+				case DT_HASH:
+					hash = (const ElfW(Word)*) ptr;
+					break;
+				case DT_GNU_HASH:
+					gnu_hash = (const uint32_t*) ptr;
+					break;
+				case DT_VERSYM:
+					versym = (const ElfW(Half)*) ptr;
+					break;
+			}
+		}
+	}
+
+	if (symtab != NULL && strtab != NULL)
+	{
+		size_t nsyms = dynsym_count(hash, gnu_hash);
+
+		for (size_t i = 1; i < nsyms; i++)
+		{
+			const ElfW(Sym)* sym = &symtab[i];
+			const char* const* match;
+			int type = ELF32_ST_TYPE(sym->st_info);
+
+			if (sym->st_shndx == SHN_UNDEF || sym->st_value == 0)
+				continue;
+			if (type != STT_FUNC && type != STT_OBJECT)
+				continue;
+			if (ELF32_ST_BIND(sym->st_info) != STB_GLOBAL && ELF32_ST_BIND(sym->st_info) != STB_WEAK)
+				continue;
+			// only take the default version of versioned symbols, like dlsym() does
+			if (versym != NULL && (versym[i] & 0x8000))
+				continue;
+
+			match = bsearch(strtab + sym->st_name, names, count, sizeof(*names), compare_names);
+			if (match != NULL && out[match - names] == NULL)
+			{
+				out[match - names] = (void*) (lm->l_addr + sym->st_value);
+				resolved++;
+			}
+		}
+	}
+
+	// whatever we couldn't find ourselves (e.g. IFUNCs) is left to dlsym()
+	for (size_t i = 0; i < count; i++)
+	{
+		if (out[i] == NULL)
+		{
+			out[i] = dlsym(lib, names[i]);
+			if (out[i] != NULL)
+				resolved++;
+		}
+	}
+
+	return resolved;
+}
+
 static int get_errno(void)
 {
 	return errno;
@@ -63,6 +192,7 @@ static const void* __dserver_socket_address(void) {
 };
 
 extern void __mldr_close_rpc_socket(int socket);
+extern void __mldr_socket_stats(struct mldr_socket_stats* stats);
 
 extern int __mldr_create_process_lifetime_pipe(int* fds);
 extern void __mldr_close_process_lifetime_pipe(int fd);
@@ -126,4 +256,8 @@ void elfcalls_make(struct elf_calls* calls)
 	calls->dserver_get_process_lifetime_pipe = __dserver_get_process_lifetime_pipe;
 	calls->dserver_process_lifetime_pipe_refresh = __dserver_process_lifetime_pipe_refresh;
 	calls->dserver_close_process_lifetime_pipe = __mldr_close_process_lifetime_pipe;
+
+	calls->startup_trace_mark = startup_trace_mark;
+	calls->dlsym_bulk = dlsym_bulk;
+	calls->dserver_socket_stats = __mldr_socket_stats;
 }
@@ -14,6 +14,17 @@ struct darling_thread_create_callbacks {
 
 typedef const struct darling_thread_create_callbacks* darling_thread_create_callbacks_t;
 
+// Usage counters of the FD allocator used for darlingserver RPC sockets and lifetime pipes
+struct mldr_socket_stats {
+	size_t capacity;
+	size_t in_use;
+	// deepest slot ever handed out; the lowest free slots are reused first, so this
+	// follows the most FDs that have been in use at once
+	size_t peak;
+	size_t allocations;
+	size_t failures;
+};
+
 struct elf_calls
 {
 	// ELF dynamic loader access
@@ -71,6 +82,17 @@ struct elf_calls
 	int (*dserver_get_process_lifetime_pipe)(void);
 	int (*dserver_process_lifetime_pipe_refresh)(void);
 	void (*dserver_close_process_lifetime_pipe)(int fd);
+
+	// Startup timing instrumentation (does nothing unless MLDR_STARTUP_TRACE is set)
+	void (*startup_trace_mark)(const char* phase);
+
+	// Looks up `count` symbols (`names` must be sorted by strcmp) defined by `lib` itself in one pass
+	// over its symbol table. Symbols that can't be resolved are left as NULL in `out`.
+	// Returns the number of resolved symbols.
+	size_t (*dlsym_bulk)(void* lib, const char* const* names, void** out, size_t count);
+
+	// darlingserver RPC socket allocator usage, for monitoring
+	void (*dserver_socket_stats)(struct mldr_socket_stats* stats);
 };
 
 #endif
@@ -34,10 +34,12 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <fcntl.h>
 
 #include "dthreads.h"
+#include "../commpage.h"
 
 #include <darlingserver/rpc.h>
 
 extern int __mldr_create_rpc_socket(void);
+extern void __mldr_start_rpc_socket_pool(void);
 extern void __mldr_close_rpc_socket(int socket);
 
 // The point of this file is build macOS threads on top of native libc's threads,
@@ -113,21 +115,127 @@ static dthread_t dthread_structure_init(dthread_t dthread, size_t guard_size, vo
 	return dthread;
 };
 
+// Thread stacks we allocate ourselves are recycled instead of being unmapped when their thread exits.
+// Short-lived threads (e.g. GCD overcommit workers) would otherwise pay for an mmap/mprotect/munmap
+// sequence (plus the resulting TLB shootdowns) every time.
+#define DTHREAD_CACHE_MAX_ENTRIES 16
+#define DTHREAD_CACHE_MAX_BYTES (32 * 1024 * 1024)
+
+// Placed at the very end of the (page-rounded) allocation so we can recognize our own allocations
+// when they're freed (libpthread may also hand us memory it has allocated itself).
+// libpthread recomputes the allocation size of workqueue threads itself, rounding it to whole pages,
+// which is why we round our allocations the same way.
+struct dthread_trailer {
+	uintptr_t magic;
+	size_t total_size;
+	size_t guard_size;
+};
+
+#define DTHREAD_TRAILER_MAGIC ((uintptr_t)0x64746872u)
+
+struct dthread_cache_entry {
+	void* base_addr;
+	size_t total_size;
+	size_t guard_size;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	struct dthread_cache_entry entries[DTHREAD_CACHE_MAX_ENTRIES];
+	size_t count;
+	size_t bytes;
+} dthread_cache = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static size_t dthread_round_page(size_t size) {
+	size_t page_size = getpagesize();
+	return (size + page_size - 1) & ~(page_size - 1);
+};
+
+static struct dthread_trailer* dthread_trailer_of(void* base_addr, size_t total_size) {
+	return (struct dthread_trailer*)((char*)base_addr + dthread_round_page(total_size) - sizeof(struct dthread_trailer));
+};
+
+static void* dthread_cache_get(size_t total_size, size_t guard_size) {
+	void* base_addr = NULL;
+
+	pthread_mutex_lock(&dthread_cache.mutex);
+
+	// search from the end to reuse the most recently freed (i.e. cache-hot) stack
+	for (size_t i = dthread_cache.count; i > 0; --i) {
+		struct dthread_cache_entry* entry = &dthread_cache.entries[i - 1];
+
+		if (entry->total_size == total_size && entry->guard_size == guard_size) {
+			base_addr = entry->base_addr;
+			dthread_cache.bytes -= total_size;
+			*entry = dthread_cache.entries[--dthread_cache.count];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&dthread_cache.mutex);
+
+	return base_addr;
+};
+
+// Either caches or unmaps the given thread memory.
+static void dthread_structure_free(void* base_addr, size_t total_size) {
+	struct dthread_trailer* trailer;
+
+	if (base_addr == NULL || total_size == 0) {
+		return;
+	}
+
+	trailer = dthread_trailer_of(base_addr, total_size);
+
+	if (trailer->magic == (DTHREAD_TRAILER_MAGIC ^ (uintptr_t)base_addr) && trailer->total_size == dthread_round_page(total_size)) {
+		total_size = trailer->total_size;
+
+		pthread_mutex_lock(&dthread_cache.mutex);
+
+		if (dthread_cache.count < DTHREAD_CACHE_MAX_ENTRIES && dthread_cache.bytes + total_size <= DTHREAD_CACHE_MAX_BYTES) {
+			dthread_cache.entries[dthread_cache.count++] = (struct dthread_cache_entry) {
+				.base_addr = base_addr,
+				.total_size = total_size,
+				.guard_size = trailer->guard_size,
+			};
+			dthread_cache.bytes += total_size;
+			base_addr = NULL;
+		}
+
+		pthread_mutex_unlock(&dthread_cache.mutex);
+	}
+
+	if (base_addr != NULL) {
+		munmap(base_addr, total_size);
+	}
+};
+
 static dthread_t dthread_structure_allocate(size_t stack_size, size_t guard_size, void** stack_addr) {
-	size_t total_size = guard_size + stack_size + sizeof(struct _dthread);
+	size_t total_size = dthread_round_page(guard_size + stack_size + sizeof(struct _dthread) + sizeof(struct dthread_trailer));
 
-	// allocate our stack, guard page, and dthread structure
-	void* base_addr = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	void* base_addr = dthread_cache_get(total_size, guard_size);
 
-	// protect our guard page
-	mprotect(base_addr, guard_size, PROT_NONE);
+	if (base_addr == NULL) {
+		// allocate our stack, guard page, and dthread structure
+		base_addr = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		// protect our guard page
+		mprotect(base_addr, guard_size, PROT_NONE);
+
+		struct dthread_trailer* trailer = dthread_trailer_of(base_addr, total_size);
+		trailer->magic = DTHREAD_TRAILER_MAGIC ^ (uintptr_t)base_addr;
+		trailer->total_size = total_size;
+		trailer->guard_size = guard_size;
+	}
 
 	/**
 	 * memory layout of newly allocated block:
 	 *
-	 * [base_addr]         [base_addr + total_size]
-	 * --------------------------------------------
-	 * | guard page |       stack       | dthread |
+	 * [base_addr]                       [base_addr + total_size]
+	 * ----------------------------------------------------------
+	 * | guard page |       stack       | dthread | ... | trailer |
 	 */
 
 	// stack_addr points to the top of the stack (i.e. the highest address)
@@ -188,6 +296,10 @@ void* __darling_thread_create(unsigned long stack_size, unsigned long pth_obj_si
 
 	// std::cout << "Allocated stack at " << pth << ", size " << stack_size << std::endl;
 
+	// only multithreaded processes are worth the helper threads for these
+	commpage_start_time_updates();
+	__mldr_start_rpc_socket_pool();
+
 	pthread_attr_setstacksize(&attr, 4096);
 
 	//pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
@@ -249,7 +361,7 @@ static void* darling_thread_entry(void* p)
 	if (setjmp(t_jmpbuf))
 	{
 		// Terminate the Linux thread
-		munmap(t_freeaddr, t_freesize);
+		dthread_structure_free(t_freeaddr, t_freesize);
 		pthread_detach(pthread_self());
 		return NULL;
 	}
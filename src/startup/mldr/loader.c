@@ -10,8 +10,10 @@
 #include <string.h>
 
 #include "loader.h"
+#include "loadplan.h"
 
 static int native_prot(int prot);
+static int segment_prot(const struct load_plan_segment* seg);
 static void load(const char* path, cpu_type_t cpu, bool expect_dylinker, char** argv, struct load_results* lr);
 static void setup_space(struct load_results* lr, bool is_64_bit);
 static void* compatible_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
@@ -24,6 +26,7 @@ static void* compatible_mmap(void *addr, size_t length, int prot, int flags, int
 
 // Definitions:
 // FUNCTION_NAME (load32/load64)
+// PLAN_FUNCTION_NAME (plan32/plan64)
 // SEGMENT_STRUCT (segment_command/SEGMENT_STRUCT)
 // SEGMENT_COMMAND (LC_SEGMENT/SEGMENT_COMMAND)
 // MACH_HEADER_STRUCT (mach_header/MACH_HEADER_STRUCT)
@@ -31,6 +34,7 @@ static void* compatible_mmap(void *addr, size_t length, int prot, int flags, int
 
 #if defined(GEN_64BIT)
 #   define FUNCTION_NAME load64
+#   define PLAN_FUNCTION_NAME plan64
 #   define SEGMENT_STRUCT segment_command_64
 #   define SEGMENT_COMMAND LC_SEGMENT_64
 #   define MACH_HEADER_STRUCT mach_header_64
@@ -38,6 +42,7 @@ static void* compatible_mmap(void *addr, size_t length, int prot, int flags, int
 #	define MAP_EXTRA 0
 #elif defined(GEN_32BIT)
 #   define FUNCTION_NAME load32
+#   define PLAN_FUNCTION_NAME plan32
 #   define SEGMENT_STRUCT segment_command
 #   define SEGMENT_COMMAND LC_SEGMENT
 #   define MACH_HEADER_STRUCT mach_header
@@ -47,43 +52,22 @@ static void* compatible_mmap(void *addr, size_t length, int prot, int flags, int
 #   error See above
 #endif
 
-void FUNCTION_NAME(int fd, bool expect_dylinker, struct load_results* lr)
+// Collects everything we need from the load commands into `plan`.
+static void PLAN_FUNCTION_NAME(int fd, uint32_t fat_offset, struct load_plan* plan)
 {
 	struct MACH_HEADER_STRUCT header;
 	uint8_t* cmds;
-	uintptr_t entryPoint = 0, entryPointDylinker = 0;
-	struct MACH_HEADER_STRUCT* mappedHeader = NULL;
-	uintptr_t slide = 0;
-	uintptr_t mmapSize = 0;
-	bool pie = false;
-	uint32_t fat_offset;
 	void* tmp_map_base = NULL;
 
-	if (!expect_dylinker)
-	{
-#if defined(GEN_64BIT)
-		setup_space(lr, true);
-#elif defined(GEN_32BIT)
-		lr->_32on64 = true;
-		setup_space(lr, false);
-#else
-		#error Unsupported architecture
-#endif
-	}
-
-	fat_offset = lseek(fd, 0, SEEK_CUR);
-
-	if (read(fd, &header, sizeof(header)) != sizeof(header))
+	if (pread(fd, &header, sizeof(header), fat_offset) != sizeof(header))
 	{
 		fprintf(stderr, "Cannot read the mach header.\n");
 		exit(1);
 	}
 
-	if (header.filetype != (expect_dylinker ? MH_DYLINKER : MH_EXECUTE))
-	{
-		fprintf(stderr, "Found unexpected Mach-O file type: %u\n", header.filetype);
-		exit(1);
-	}
+	plan->cputype = header.cputype;
+	plan->filetype = header.filetype;
+	plan->flags = header.flags;
 
 	tmp_map_base = mmap(NULL, PAGE_ROUNDUP(sizeof(header) + header.sizeofcmds), PROT_READ, MAP_PRIVATE, fd, fat_offset);
 	if (tmp_map_base == MAP_FAILED) {
@@ -93,7 +77,6 @@ void FUNCTION_NAME(int fd, bool expect_dylinker, struct load_results* lr)
 
 	cmds = (void*)((char*)tmp_map_base + sizeof(header));
 
-	if ((header.filetype == MH_EXECUTE && header.flags & MH_PIE) || header.filetype == MH_DYLINKER)
 	{
 		uintptr_t base = -1;
 
@@ -111,30 +94,16 @@ void FUNCTION_NAME(int fd, bool expect_dylinker, struct load_results* lr)
 					//if (base != 0 && header.filetype == MH_DYLINKER)
 					//	goto no_slide;
 				}
-				mmapSize = seg->vmaddr + seg->vmsize - base;
+				plan->mmap_size = seg->vmaddr + seg->vmsize - base;
 			}
 
 			p += seg->cmdsize;
 		}
 
-		slide = (uintptr_t) mmap((void*) base, mmapSize, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_EXTRA, -1, 0);
-		if (slide == (uintptr_t)MAP_FAILED)
-		{
-			fprintf(stderr, "Cannot mmap anonymous memory range: %s\n", strerror(errno));
-			exit(1);
-		}
-
-		// unmap it so we can map the actual segments later using MAP_FIXED_NOREPLACE;
-		// we're the only thread running, so there's no chance this memory range will become occupied from now until then
-		munmap((void*)slide, mmapSize);
-
-		if (slide + mmapSize > lr->vm_addr_max)
-			lr->vm_addr_max = lr->base = slide + mmapSize;
-		slide -= base;
-
-		pie = true;
+		if (plan->mmap_size != 0)
+			plan->base = base;
+		plan->pie = (header.filetype == MH_EXECUTE && header.flags & MH_PIE) || header.filetype == MH_DYLINKER;
 	}
-no_slide:
 
 	for (uint32_t i = 0, p = 0; i < header.ncmds && p < header.sizeofcmds; i++)
 	{
@@ -147,85 +116,17 @@ no_slide:
 			case SEGMENT_COMMAND:
 			{
 				struct SEGMENT_STRUCT* seg = (struct SEGMENT_STRUCT*) lc;
-				void* rv;
+				struct load_plan_segment ps;
 
-				// This logic is wrong and made up. But it's the only combination where
-				// some apps stop crashing (TBD why) and LLDB recognized the memory layout
-				// of processes started as suspended.
-				int maxprot = native_prot(seg->maxprot);
-				int initprot = native_prot(seg->initprot);
-				int useprot = (initprot & PROT_EXEC) ? maxprot : initprot;
+				memcpy(ps.segname, seg->segname, sizeof(ps.segname));
+				ps.vmaddr = seg->vmaddr;
+				ps.vmsize = seg->vmsize;
+				ps.fileoff = seg->fileoff;
+				ps.filesize = seg->filesize;
+				ps.maxprot = seg->maxprot;
+				ps.initprot = seg->initprot;
 
-				if (seg->filesize < seg->vmsize)
-				{
-					unsigned long map_addr;
-					if (slide != 0)
-					{
-						unsigned long addr = seg->vmaddr;
-
-						if (addr != 0)
-							addr += slide;
-
-						// Some segments' filesize != vmsize, thus this mprotect().
-						rv = compatible_mmap((void*)addr, seg->vmsize, useprot, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED_NOREPLACE, -1, 0);
-						if (rv == (void*)MAP_FAILED)
-						{
-							if (seg->vmaddr == 0 && useprot == 0) {
-								// this is the PAGEZERO segment;
-								// if we can't map it, assume everything is fine and the system has already made that area inaccessible
-								rv = 0;
-							} else {
-								fprintf(stderr, "Cannot mmap segment %s at %p: %s\n", seg->segname, (void*)(uintptr_t)seg->vmaddr, strerror(errno));
-								exit(1);
-							}
-						}
-					}
-					else
-					{
-						size_t size = seg->vmsize - seg->filesize;
-						rv = compatible_mmap((void*) PAGE_ALIGN(seg->vmaddr + seg->vmsize - size), PAGE_ROUNDUP(size), useprot,
-								MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED_NOREPLACE, -1, 0);
-						if (rv == (void*)MAP_FAILED)
-						{
-							if (seg->vmaddr == 0 && useprot == 0) {
-								// this is the PAGEZERO segment;
-								// if we can't map it, assume everything is fine and the system has already made that area inaccessible
-								rv = 0;
-							} else {
-								fprintf(stderr, "Cannot mmap segment %s at %p: %s\n", seg->segname, (void*)(uintptr_t)seg->vmaddr, strerror(errno));
-								exit(1);
-							}
-						}
-					}
-				}
-
-				if (seg->filesize > 0)
-				{
-					unsigned long addr = seg->vmaddr + slide;
-					int flag = MAP_FIXED_NOREPLACE;
-					if (seg->filesize < seg->vmsize) {
-						flag = MAP_FIXED;
-					}
-					rv = compatible_mmap((void*)addr, seg->filesize, useprot,
-							flag | MAP_PRIVATE, fd, seg->fileoff + fat_offset);
-					if (rv == (void*)MAP_FAILED)
-					{
-						if (seg->vmaddr == 0 && useprot == 0) {
-							// this is the PAGEZERO segment;
-							// if we can't map it, assume everything is fine and the system has already made that area inaccessible
-							rv = 0;
-						} else {
-							fprintf(stderr, "Cannot mmap segment %s at %p: %s\n", seg->segname, (void*)(uintptr_t)seg->vmaddr, strerror(errno));
-							exit(1);
-						}
-					}
-
-					if (seg->fileoff == 0)
-						mappedHeader = (struct MACH_HEADER_STRUCT*) (seg->vmaddr + slide);
-				}
-
-				if (seg->vmaddr + slide + seg->vmsize > lr->vm_addr_max)
-					lr->vm_addr_max = seg->vmaddr + slide + seg->vmsize;
+				load_plan_add_segment(plan, &ps);
 
 				if (strcmp(SEG_DATA, seg->segname) == 0)
 				{
@@ -237,8 +138,8 @@ no_slide:
 					{
 						if (strncmp(sect->sectname, "__all_image_info", 16) == 0)
 						{
-							lr->dyld_all_image_location = slide + sect->addr;
-							lr->dyld_all_image_size = sect->size;
+							plan->dyld_all_image_location = sect->addr;
+							plan->dyld_all_image_size = sect->size;
 							break;
 						}
 						sect++;
@@ -249,12 +150,11 @@ no_slide:
 			case LC_UNIXTHREAD:
 			{
 #ifdef GEN_64BIT
-				entryPoint = ((uint64_t*) lc)[18];
+				plan->entry_point = ((uint64_t*) lc)[18];
 #endif
 #ifdef GEN_32BIT
-				entryPoint = ((uint32_t*) lc)[14];
+				plan->entry_point = ((uint32_t*) lc)[14];
 #endif
-				entryPoint += slide;
 				break;
 			}
 			case LC_LOAD_DYLINKER:
@@ -267,65 +167,29 @@ no_slide:
 				}
 
 				struct dylinker_command* dy = (struct dylinker_command*) lc;
-				char* path;
-				size_t length;
-				static char path_buffer[4096];
-
-				if (lr->root_path != NULL)
-				{
-					const size_t root_len = strlen(lr->root_path);
-					const size_t linker_len = dy->cmdsize - dy->name.offset;
-
-					length = linker_len + root_len;
-					if (length > sizeof(path_buffer) - 1) {
-						fprintf(stderr, "Dynamic loader path too long");
-						exit(1);
-					}
-					path = path_buffer;
+				size_t length = dy->cmdsize - dy->name.offset;
 
-					// Concat root path and linker path
-					memcpy(path, lr->root_path, root_len);
-					memcpy(path + root_len, ((char*) dy) + dy->name.offset, linker_len);
-					path[length] = '\0';
-				}
-
-				if (path == NULL)
-				{
-					length = dy->cmdsize - dy->name.offset;
-					if (length > sizeof(path_buffer) - 1) {
-						fprintf(stderr, "Dynamic loader path too long");
-						exit(1);
-					}
-					path = path_buffer;
-
-					memcpy(path, ((char*) dy) + dy->name.offset, length);
-					path[length] = '\0';
-				}
-
-				if (path == NULL)
-				{
-					fprintf(stderr, "Failed to load dynamic linker for executable\n");
+				if (length > sizeof(plan->dylinker) - 1) {
+					fprintf(stderr, "Dynamic loader path too long");
 					exit(1);
 				}
 
-				load(path, header.cputype, true, NULL, lr);
-
+				memcpy(plan->dylinker, ((char*) dy) + dy->name.offset, length);
+				plan->dylinker[length] = '\0';
 				break;
 			}
 			case LC_MAIN:
 			{
 				struct entry_point_command* ee = (struct entry_point_command*) lc;
-				if (ee->stacksize > lr->stack_size)
-					lr->stack_size = ee->stacksize;
+				plan->stack_size = ee->stacksize;
 				break;
 			}
 			case LC_UUID:
 			{
-				if (header.filetype == MH_EXECUTE)
-				{
-					struct uuid_command* ue = (struct uuid_command*) lc;
-					memcpy(lr->uuid, ue->uuid, sizeof(ue->uuid));
-				}
+				struct uuid_command* ue = (struct uuid_command*) lc;
+				memcpy(plan->uuid, ue->uuid, sizeof(ue->uuid));
+				plan->uuid_offset = sizeof(header) + p + offsetof(struct uuid_command, uuid);
+				plan->has_uuid = true;
 				break;
 			}
 		}
@@ -333,17 +197,200 @@ no_slide:
 		p += lc->cmdsize;
 	}
 
-	if (header.filetype == MH_EXECUTE)
+	munmap(tmp_map_base, PAGE_ROUNDUP(sizeof(header) + header.sizeofcmds));
+}
+
+void FUNCTION_NAME(int fd, bool expect_dylinker, struct load_results* lr)
+{
+	struct load_plan plan;
+	uintptr_t entryPoint = 0;
+	struct MACH_HEADER_STRUCT* mappedHeader = NULL;
+	uintptr_t slide = 0;
+	uint32_t fat_offset;
+
+	if (!expect_dylinker)
+	{
+#if defined(GEN_64BIT)
+		setup_space(lr, true);
+#elif defined(GEN_32BIT)
+		lr->_32on64 = true;
+		setup_space(lr, false);
+#else
+		#error Unsupported architecture
+#endif
+	}
+
+	fat_offset = lseek(fd, 0, SEEK_CUR);
+
+	// Short-lived tools are started over and over again; parsing their load commands every time is wasted work
+	load_plan_init(&plan);
+	if (!load_plan_lookup(fd, fat_offset, &plan))
+	{
+		PLAN_FUNCTION_NAME(fd, fat_offset, &plan);
+		load_plan_store(fd, fat_offset, &plan);
+	}
+
+	if (plan.filetype != (expect_dylinker ? MH_DYLINKER : MH_EXECUTE))
+	{
+		fprintf(stderr, "Found unexpected Mach-O file type: %u\n", plan.filetype);
+		exit(1);
+	}
+
+	// Reserve the whole image at once, so that the segments can be mapped into it with MAP_FIXED
+	// and nothing else can end up in the gaps between them
+	if (plan.mmap_size != 0)
+	{
+		void* reservation;
+
+		if (plan.pie)
+			reservation = mmap((void*) (uintptr_t) plan.base, PAGE_ROUNDUP(plan.mmap_size), PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_EXTRA, -1, 0);
+		else
+			reservation = compatible_mmap((void*) (uintptr_t) plan.base, PAGE_ROUNDUP(plan.mmap_size), PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED_NOREPLACE, -1, 0);
+
+		if (reservation == MAP_FAILED)
+		{
+			fprintf(stderr, "Cannot mmap anonymous memory range: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		if (plan.pie)
+		{
+			slide = (uintptr_t) reservation;
+			if (slide + plan.mmap_size > lr->vm_addr_max)
+				lr->vm_addr_max = lr->base = slide + plan.mmap_size;
+			slide -= plan.base;
+		}
+	}
+
+	for (uint32_t i = 0, next; i < plan.segment_count; i = next)
+	{
+		struct load_plan_segment* seg = &plan.segments[i];
+		bool reserved = plan.mmap_size != 0 && strcmp(seg->segname, "__PAGEZERO") != 0;
+		int useprot = segment_prot(seg);
+		uint64_t vmsize = seg->vmsize;
+		uint64_t filesize = seg->filesize;
+		unsigned long addr = seg->vmaddr;
+		int flags = reserved ? MAP_FIXED : MAP_FIXED_NOREPLACE;
+		void* rv;
+
+		// Segments that continue the same range of the file with the same protection share one mapping
+		for (next = i + 1; reserved && next < plan.segment_count; next++)
+		{
+			struct load_plan_segment* other = &plan.segments[next];
+
+			if (filesize != vmsize || vmsize % PAGE_SIZE != 0 || other->filesize == 0
+					|| other->vmaddr != seg->vmaddr + vmsize || other->fileoff != seg->fileoff + filesize
+					|| segment_prot(other) != useprot || strcmp(other->segname, "__PAGEZERO") == 0)
+				break;
+
+			vmsize += other->vmsize;
+			filesize += other->filesize;
+		}
+
+		// __PAGEZERO stays where it is
+		if (addr != 0 || reserved)
+			addr += slide;
+
+		if (filesize < vmsize)
+		{
+			// Some segments' filesize != vmsize, so the rest of them is anonymous memory.
+			size_t size = vmsize - filesize;
+			rv = compatible_mmap((void*) PAGE_ALIGN(addr + vmsize - size), PAGE_ROUNDUP(size), useprot,
+					MAP_ANONYMOUS | MAP_PRIVATE | flags, -1, 0);
+			if (rv == (void*)MAP_FAILED)
+			{
+				if (seg->vmaddr == 0 && useprot == 0) {
+					// this is the PAGEZERO segment;
+					// if we can't map it, assume everything is fine and the system has already made that area inaccessible
+					rv = 0;
+				} else {
+					fprintf(stderr, "Cannot mmap segment %.16s at %p: %s\n", seg->segname, (void*)(uintptr_t)seg->vmaddr, strerror(errno));
+					exit(1);
+				}
+			}
+		}
+
+		if (filesize > 0)
+		{
+			if (filesize < vmsize)
+				flags = MAP_FIXED;
+			rv = compatible_mmap((void*)addr, filesize, useprot,
+					flags | MAP_PRIVATE, fd, seg->fileoff + fat_offset);
+			if (rv == (void*)MAP_FAILED)
+			{
+				if (seg->vmaddr == 0 && useprot == 0) {
+					// this is the PAGEZERO segment;
+					// if we can't map it, assume everything is fine and the system has already made that area inaccessible
+					rv = 0;
+				} else {
+					fprintf(stderr, "Cannot mmap segment %.16s at %p: %s\n", seg->segname, (void*)(uintptr_t)seg->vmaddr, strerror(errno));
+					exit(1);
+				}
+			}
+		}
+
+		for (uint32_t j = i; j < next; j++)
+		{
+			seg = &plan.segments[j];
+
+			if (seg->filesize > 0 && seg->fileoff == 0)
+				mappedHeader = (struct MACH_HEADER_STRUCT*) (seg->vmaddr + slide);
+
+			if (seg->vmaddr + slide + seg->vmsize > lr->vm_addr_max)
+				lr->vm_addr_max = seg->vmaddr + slide + seg->vmsize;
+		}
+	}
+
+	if (plan.dyld_all_image_location != 0)
+	{
+		lr->dyld_all_image_location = slide + plan.dyld_all_image_location;
+		lr->dyld_all_image_size = plan.dyld_all_image_size;
+	}
+
+	if (plan.entry_point != 0)
+		entryPoint = plan.entry_point + slide;
+
+	if (plan.stack_size > lr->stack_size)
+		lr->stack_size = plan.stack_size;
+
+	if (plan.has_uuid && plan.filetype == MH_EXECUTE)
+		memcpy(lr->uuid, plan.uuid, sizeof(plan.uuid));
+
+	if (plan.dylinker[0] != '\0')
+	{
+		static char path_buffer[4096];
+		const char* path = plan.dylinker;
+
+		if (lr->root_path != NULL)
+		{
+			const size_t root_len = strlen(lr->root_path);
+			const size_t linker_len = strlen(plan.dylinker);
+
+			if (root_len + linker_len > sizeof(path_buffer) - 1) {
+				fprintf(stderr, "Dynamic loader path too long");
+				exit(1);
+			}
+
+			// Concat root path and linker path
+			memcpy(path_buffer, lr->root_path, root_len);
+			memcpy(path_buffer + root_len, plan.dylinker, linker_len + 1);
+			path = path_buffer;
+		}
+
+		load(path, plan.cputype, true, NULL, lr);
+	}
+
+	if (plan.filetype == MH_EXECUTE)
 		lr->mh = (uintptr_t) mappedHeader;
 	if (entryPoint && !lr->entry_point)
 		lr->entry_point = entryPoint;
 
-	if (tmp_map_base)
-		munmap(tmp_map_base, PAGE_ROUNDUP(sizeof(header) + header.sizeofcmds));
+	load_plan_destroy(&plan);
 }
 
 
 #undef FUNCTION_NAME
+#undef PLAN_FUNCTION_NAME
 #undef SEGMENT_STRUCT
 #undef SEGMENT_COMMAND
 #undef MACH_HEADER_STRUCT
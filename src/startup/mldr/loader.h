@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "elfcalls/elfcalls.h"
 
 struct load_results {
 	unsigned long mh;
@@ -30,4 +31,6 @@ struct load_results {
 	char** envp;
 };
 
+void __mldr_socket_stats(struct mldr_socket_stats* stats);
+
 #endif // _MLDR_LOADER_H_
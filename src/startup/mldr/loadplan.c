@@ -0,0 +1,224 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "loadplan.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOAD_PLAN_MAGIC 0x6c706c6d // "mlpl"
+#define LOAD_PLAN_VERSION 2
+#define LOAD_PLAN_MAX_SEGMENTS 256
+#define LOAD_PLAN_INITIAL_SEGMENTS 8
+
+struct load_plan_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t plan_size;
+	uint32_t segment_size;
+
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t offset;
+};
+
+void load_plan_init(struct load_plan* plan) {
+	memset(plan, 0, sizeof(*plan));
+};
+
+void load_plan_add_segment(struct load_plan* plan, const struct load_plan_segment* segment) {
+	// start with room for LOAD_PLAN_INITIAL_SEGMENTS, then double it whenever it runs out
+	if (plan->segment_count == 0 || (plan->segment_count >= LOAD_PLAN_INITIAL_SEGMENTS && (plan->segment_count & (plan->segment_count - 1)) == 0)) {
+		size_t capacity = plan->segment_count ? plan->segment_count * 2 : LOAD_PLAN_INITIAL_SEGMENTS;
+		void* ptr = realloc(plan->segments, capacity * sizeof(*segment));
+
+		if (!ptr) {
+			fprintf(stderr, "Cannot allocate memory for the load plan\n");
+			exit(1);
+		}
+
+		plan->segments = ptr;
+	}
+
+	plan->segments[plan->segment_count++] = *segment;
+};
+
+void load_plan_destroy(struct load_plan* plan) {
+	free(plan->segments);
+	plan->segments = NULL;
+	plan->segment_count = 0;
+};
+
+static bool load_plan_path(int fd, uint64_t offset, char* path, size_t path_size, struct load_plan_file_header* header) {
+	const char* dir = getenv("MLDR_LOAD_PLAN_CACHE");
+	struct stat st;
+
+	if (dir == NULL || dir[0] == '\0') {
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		return false;
+	}
+
+	memset(header, 0, sizeof(*header));
+	header->magic = LOAD_PLAN_MAGIC;
+	header->version = LOAD_PLAN_VERSION;
+	header->plan_size = sizeof(struct load_plan);
+	header->segment_size = sizeof(struct load_plan_segment);
+	header->dev = st.st_dev;
+	header->ino = st.st_ino;
+	header->size = st.st_size;
+	header->mtime_sec = st.st_mtim.tv_sec;
+	header->mtime_nsec = st.st_mtim.tv_nsec;
+	header->offset = offset;
+
+	// mldr and mldr32 have different struct layouts, so they keep separate plans
+	return snprintf(path, path_size, "%s/%llx-%llx-%llx-%zu.plan", dir,
+			(unsigned long long)header->dev, (unsigned long long)header->ino,
+			(unsigned long long)offset, sizeof(void*) * 8) < path_size;
+};
+
+bool load_plan_lookup(int fd, uint64_t offset, struct load_plan* plan) {
+	struct load_plan_file_header expected, header;
+	char path[4096];
+	uint8_t uuid[16];
+	struct iovec iov[2];
+	struct stat st;
+	int plan_fd;
+	bool ok = false;
+
+	if (!load_plan_path(fd, offset, path, sizeof(path), &expected)) {
+		return false;
+	}
+
+	plan_fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (plan_fd < 0) {
+		return false;
+	}
+
+	// plans are mapped without any further checks, so only trust the ones we've written ourselves
+	if (fstat(plan_fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		close(plan_fd);
+		return false;
+	}
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = plan;
+	iov[1].iov_len = sizeof(*plan);
+
+	if (readv(plan_fd, iov, 2) != sizeof(header) + sizeof(*plan)) {
+		goto out;
+	}
+
+	plan->segments = NULL;
+
+	if (memcmp(&header, &expected, sizeof(header)) != 0 || plan->segment_count > LOAD_PLAN_MAX_SEGMENTS || !plan->has_uuid) {
+		goto out;
+	}
+
+	plan->dylinker[sizeof(plan->dylinker) - 1] = '\0';
+
+	plan->segments = malloc(plan->segment_count * sizeof(struct load_plan_segment));
+	if (plan->segments == NULL) {
+		goto out;
+	}
+
+	if (read(plan_fd, plan->segments, plan->segment_count * sizeof(struct load_plan_segment)) != plan->segment_count * sizeof(struct load_plan_segment)) {
+		goto out;
+	}
+
+	// the file could have been modified without changing its mtime (e.g. with a tool that preserves it)
+	if (pread(fd, uuid, sizeof(uuid), offset + plan->uuid_offset) != sizeof(uuid) || memcmp(uuid, plan->uuid, sizeof(uuid)) != 0) {
+		goto out;
+	}
+
+	ok = true;
+
+out:
+	close(plan_fd);
+
+	if (!ok) {
+		free(plan->segments);
+		load_plan_init(plan);
+	}
+
+	return ok;
+};
+
+void load_plan_store(int fd, uint64_t offset, const struct load_plan* plan) {
+	struct load_plan_file_header header;
+	struct load_plan copy;
+	char path[4096], tmp_path[4096 + 32];
+	struct iovec iov[3];
+	ssize_t total;
+	int plan_fd;
+
+	// without a UUID, we can't tell if the plan is still valid
+	if (!plan->has_uuid || plan->segment_count > LOAD_PLAN_MAX_SEGMENTS) {
+		return;
+	}
+
+	if (!load_plan_path(fd, offset, path, sizeof(path), &header)) {
+		return;
+	}
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid()) >= sizeof(tmp_path)) {
+		return;
+	}
+
+	mkdir(getenv("MLDR_LOAD_PLAN_CACHE"), 0700);
+
+	plan_fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (plan_fd < 0) {
+		return;
+	}
+
+	copy = *plan;
+	copy.segments = NULL;
+
+	iov[0].iov_base = &header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = &copy;
+	iov[1].iov_len = sizeof(copy);
+	iov[2].iov_base = plan->segments;
+	iov[2].iov_len = plan->segment_count * sizeof(struct load_plan_segment);
+	total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+	// write to a temporary file and rename it so that readers never see a partial plan
+	if (writev(plan_fd, iov, 3) != total) {
+		close(plan_fd);
+		unlink(tmp_path);
+		return;
+	}
+
+	if (close(plan_fd) < 0 || rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+	}
+};
@@ -0,0 +1,80 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MLDR_LOADPLAN_H_
+#define _MLDR_LOADPLAN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A load plan is everything the loader needs from a Mach-O file's load commands.
+// All addresses are unslid.
+//
+// Plans can be persisted in the directory named by MLDR_LOAD_PLAN_CACHE, keyed by the file's
+// device, inode, size, modification time and (fat) slice offset; a plan is only used if the
+// UUID recorded in it still matches the one in the file, and if the plan file belongs to the
+// current user and is not writable by anyone else.
+
+struct load_plan_segment {
+	char segname[16];
+	uint64_t vmaddr;
+	uint64_t vmsize;
+	uint64_t fileoff;
+	uint64_t filesize;
+	int32_t maxprot;
+	int32_t initprot;
+};
+
+struct load_plan {
+	uint32_t cputype;
+	uint32_t filetype;
+	uint32_t flags;
+	bool pie;
+
+	// Range covered by all segments but __PAGEZERO, reserved before they get mapped; it is only
+	// slid for PIE images
+	uint64_t base;
+	uint64_t mmap_size;
+
+	uint64_t entry_point;
+	uint64_t stack_size;
+	uint64_t dyld_all_image_location;
+	uint64_t dyld_all_image_size;
+
+	bool has_uuid;
+	uint8_t uuid[16];
+	// Offset of the UUID bytes from the start of the Mach-O header
+	uint64_t uuid_offset;
+
+	// Empty if there's no LC_LOAD_DYLINKER
+	char dylinker[4096];
+
+	uint32_t segment_count;
+	struct load_plan_segment* segments;
+};
+
+void load_plan_init(struct load_plan* plan);
+void load_plan_add_segment(struct load_plan* plan, const struct load_plan_segment* segment);
+void load_plan_destroy(struct load_plan* plan);
+
+// `fd` is the Mach-O file and `offset` is the offset of the Mach-O header in it.
+bool load_plan_lookup(int fd, uint64_t offset, struct load_plan* plan);
+void load_plan_store(int fd, uint64_t offset, const struct load_plan* plan);
+
+#endif // _MLDR_LOADPLAN_H_
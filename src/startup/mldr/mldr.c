@@ -34,6 +34,7 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <endian.h>
 #include "commpage.h"
 #include "loader.h"
+#include "startup_trace.h"
 #include <sys/resource.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
@@ -41,6 +42,8 @@ along with Darling.  If not, see <http://www.gnu.org/licenses/>.
 #include <darlingserver/rpc.h>
 #include <sys/ptrace.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <sys/utsname.h>
 
 #ifndef PAGE_SIZE
@@ -151,6 +154,9 @@ int main(int argc, char** argv, char** envp)
 		strcpy(filename, argv[1]);
 	}
 
+	startup_trace_init(filename);
+	startup_trace_mark("mldr_entry");
+
 	// allow any process to ptrace us
 	// the only process we really care about being able to do this is the server,
 	// but we can't just use the server's PID, since it lies outside our PID namespace.
@@ -164,6 +170,8 @@ int main(int argc, char** argv, char** envp)
 	load(filename, 0, false, argv, &mldr_load_results);
 #endif
 
+	startup_trace_mark("macho_map");
+
 	// this was previously necessary when we were loading the binary from the LKM
 	// (presumably because the break was detected incorrectly)
 	// but this shouldn't be necessary for loading Mach-O's from userspace (the heap space should already be set up properly).
@@ -267,6 +275,8 @@ int main(int argc, char** argv, char** envp)
 
 	__mldr_main_stack_top = (void*)mldr_load_results.stack_top;
 
+	startup_trace_mark("dyld_start");
+
 	start_thread(&mldr_load_results);
 
 	__builtin_unreachable();
@@ -465,6 +475,17 @@ int native_prot(int prot)
 	return protOut;
 }
 
+int segment_prot(const struct load_plan_segment* seg)
+{
+	// This logic is wrong and made up. But it's the only combination where
+	// some apps stop crashing (TBD why) and LLDB recognized the memory layout
+	// of processes started as suspended.
+	int maxprot = native_prot(seg->maxprot);
+	int initprot = native_prot(seg->initprot);
+
+	return (initprot & PROT_EXEC) ? maxprot : initprot;
+}
+
 static void reexec32(char** argv)
 {
 	char selfpath[1024];
@@ -535,162 +556,200 @@ static void unset_special_env() {
 	unsetenv("__mldr_lifetime_pipe");
 };
 
+#define SOCKET_BITMAP_WORD_BITS (sizeof(unsigned long) * 8)
+#define SOCKET_BITMAP_MAX_WORDS 1024
+#define SOCKET_STATS_STRIPES 16
+
+/**
+ * Hands out FD numbers from the top of the FD table (the highest FD has index 0),
+ * so that our sockets stay out of the way of the program's own descriptors.
+ *
+ * The bitmap is a fixed array of words that are updated with atomic operations;
+ * every thread starts searching at the word it last allocated from, so concurrent thread
+ * creations don't serialize on a single lock.
+ */
 typedef struct socket_bitmap {
-	pthread_mutex_t mutex;
+	pthread_once_t init_once;
+	unsigned long words[SOCKET_BITMAP_MAX_WORDS];
+	size_t word_count;
+	int highest;
+
 	/**
-	 * This is always next lowest available index.
-	 * If this is equal to #bit_length, then the bitmap is full.
+	 * Lowest word that may have free bits (only a hint).
 	 */
-	size_t next_index;
-	uint8_t* bits;
-	size_t bit_length;
-	int highest;
+	size_t first_free_word;
+
+	/**
+	 * Usage counters. Threads count into their own stripe so that they don't all write
+	 * the same cache line; in_use is counted from the words when the stats are read.
+	 */
+	size_t capacity;
+	size_t peak;
+	struct {
+		size_t allocations;
+		size_t failures;
+	} __attribute__((aligned(64))) stripes[SOCKET_STATS_STRIPES];
+	size_t next_stripe;
 } socket_bitmap_t;
 
 static socket_bitmap_t socket_bitmap = {
-	.mutex = PTHREAD_MUTEX_INITIALIZER,
-	.next_index = 0,
-	.bits = NULL,
-	.bit_length = 0,
+	.init_once = PTHREAD_ONCE_INIT,
 	.highest = -1,
 };
 
-static int socket_bitmap_get(socket_bitmap_t* bitmap) {
-	int fd = -1;
-	bool updated = false;
+static __thread size_t socket_bitmap_hint = SIZE_MAX;
+static __thread size_t socket_bitmap_stripe = SIZE_MAX;
+
+static void socket_bitmap_count(socket_bitmap_t* bitmap, bool failed) {
+	if (socket_bitmap_stripe == SIZE_MAX) {
+		socket_bitmap_stripe = __atomic_fetch_add(&bitmap->next_stripe, 1, __ATOMIC_RELAXED) % SOCKET_STATS_STRIPES;
+	}
 
-	pthread_mutex_lock(&bitmap->mutex);
+	if (failed) {
+		__atomic_fetch_add(&bitmap->stripes[socket_bitmap_stripe].failures, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_add(&bitmap->stripes[socket_bitmap_stripe].allocations, 1, __ATOMIC_RELAXED);
+	}
+};
 
-	if (bitmap->highest == -1) {
-		// we need to initialize this bitmap
-		struct rlimit limit;
+static void socket_bitmap_init(void) {
+	socket_bitmap_t* bitmap = &socket_bitmap;
+	struct rlimit limit;
+	size_t capacity;
 
-		if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
-			goto out;
-		}
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+		return;
+	}
 
-		if (limit.rlim_cur == RLIM_INFINITY) {
-			// just default to 1024
-			limit.rlim_cur = 1024;
-		}
+	if (limit.rlim_cur == RLIM_INFINITY) {
+		// just default to 1024
+		limit.rlim_cur = 1024;
+	}
 
-		bitmap->highest = limit.rlim_cur - 1;
+	capacity = limit.rlim_cur;
+	if (capacity > SOCKET_BITMAP_MAX_WORDS * SOCKET_BITMAP_WORD_BITS) {
+		capacity = SOCKET_BITMAP_MAX_WORDS * SOCKET_BITMAP_WORD_BITS;
 	}
 
-	if (bitmap->next_index >= bitmap->bit_length) {
-		// we need to grow the bitmap
+	bitmap->word_count = (capacity + SOCKET_BITMAP_WORD_BITS - 1) / SOCKET_BITMAP_WORD_BITS;
 
-		if ((bitmap->bit_length % 8) == 0) {
-			// we need to allocate an additional byte
+	// mark the bits past the capacity in the last word as used
+	if (capacity % SOCKET_BITMAP_WORD_BITS) {
+		bitmap->words[bitmap->word_count - 1] = ~0UL << (capacity % SOCKET_BITMAP_WORD_BITS);
+	}
 
-			void* ptr = realloc(bitmap->bits, (bitmap->bit_length / 8) + 1);
-			if (!ptr) {
-				goto out;
-			}
+	bitmap->capacity = capacity;
+	__atomic_store_n(&bitmap->highest, (int)(limit.rlim_cur - 1), __ATOMIC_RELEASE);
+};
 
-			bitmap->bits = ptr;
+static int socket_bitmap_get(socket_bitmap_t* bitmap) {
+	size_t start;
 
-			bitmap->bits[bitmap->bit_length / 8] = 0;
-		} else {
-			// we just need to increment the bit length
-		}
+	pthread_once(&bitmap->init_once, socket_bitmap_init);
 
-		++bitmap->bit_length;
+	if (bitmap->highest == -1) {
+		socket_bitmap_count(bitmap, true);
+		return -1;
 	}
 
-	fd = bitmap->highest - bitmap->next_index;
+	start = socket_bitmap_hint;
+	if (start >= bitmap->word_count) {
+		start = __atomic_load_n(&bitmap->first_free_word, __ATOMIC_RELAXED);
+	}
 
-	bitmap->bits[bitmap->next_index / 8] |= 1 << (bitmap->next_index % 8);
+	for (size_t n = 0; n < bitmap->word_count; ++n) {
+		size_t i = (start + n) % bitmap->word_count;
+		unsigned long word = __atomic_load_n(&bitmap->words[i], __ATOMIC_RELAXED);
 
-	// update the next available index
-	for (size_t i = bitmap->next_index + 1; i < bitmap->bit_length; ++i) {
-		size_t byte = i / 8;
-		uint8_t bit = i % 8;
+		while (~word != 0) {
+			unsigned long bit = 1UL << __builtin_ctzl(~word);
 
-		if (bit == 0) {
-			// check the entire byte at once so we can avoid unnecessary iteration
-			if (bitmap->bits[byte] == 0xff) {
-				// this byte is full, skip it
-				i += 7;
+			// only one thread can flip a given bit from 0 to 1
+			word = __atomic_fetch_or(&bitmap->words[i], bit, __ATOMIC_ACQUIRE);
+			if (word & bit) {
 				continue;
 			}
-		}
 
-		if ((bitmap->bits[byte] & (1 << bit)) == 0) {
-			// this index is unused
-			bitmap->next_index = i;
-			updated = true;
-			break;
-		}
-	}
+			size_t index = i * SOCKET_BITMAP_WORD_BITS + __builtin_ctzl(bit);
+			size_t peak = __atomic_load_n(&bitmap->peak, __ATOMIC_RELAXED);
 
-	if (!updated) {
-		// all of our entries are currently in-use
-		bitmap->next_index = bitmap->bit_length;
-	}
+			// only written when it grows, which stops happening once the process has warmed up
+			while (index + 1 > peak && !__atomic_compare_exchange_n(&bitmap->peak, &peak, index + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+			socket_bitmap_count(bitmap, false);
 
-out:
-	pthread_mutex_unlock(&bitmap->mutex);
+			if (~(word | bit) == 0) {
+				// this word is now full; move the shared hint past it
+				size_t expected = i;
+				__atomic_compare_exchange_n(&bitmap->first_free_word, &expected, i + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			}
 
-	return fd;
+			socket_bitmap_hint = i;
+			return bitmap->highest - index;
+		}
+	}
+
+	// all of our entries are currently in-use
+	socket_bitmap_count(bitmap, true);
+	return -1;
 };
 
 static void socket_bitmap_put(socket_bitmap_t* bitmap, int socket) {
-	size_t index;
+	size_t index = bitmap->highest - socket;
+	size_t word = index / SOCKET_BITMAP_WORD_BITS;
+	size_t first_free;
 
-	pthread_mutex_lock(&bitmap->mutex);
+	__atomic_fetch_and(&bitmap->words[word], ~(1UL << (index % SOCKET_BITMAP_WORD_BITS)), __ATOMIC_RELEASE);
 
-	index = bitmap->highest - socket;
+	// let the next thread without a hint of its own find this slot right away
+	first_free = __atomic_load_n(&bitmap->first_free_word, __ATOMIC_RELAXED);
+	while (word < first_free && !__atomic_compare_exchange_n(&bitmap->first_free_word, &first_free, word, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+};
 
-	bitmap->bits[index / 8] &= ~(1 << (index % 8));
+void __mldr_socket_stats(struct mldr_socket_stats* stats) {
+	socket_bitmap_t* bitmap = &socket_bitmap;
+	size_t used = 0;
 
-	if (index < bitmap->next_index) {
-		bitmap->next_index = index;
+	memset(stats, 0, sizeof(*stats));
+	if (__atomic_load_n(&bitmap->highest, __ATOMIC_ACQUIRE) == -1) {
+		return;
 	}
 
-	if (index == bitmap->bit_length - 1) {
-		// we can shrink the bitmap
-		size_t old_byte_size = (bitmap->bit_length + 7) / 8;
-		size_t new_byte_size = old_byte_size;
-
-		while (bitmap->bit_length > 0) {
-			size_t index = bitmap->bit_length - 1;
-
-			if ((bitmap->bit_length % 8) == 0) {
-				// check the entire byte at once to avoid unnecessary iteration
-				if (bitmap->bits[(bitmap->bit_length / 8) - 1] == 0) {
-					// remove this entire byte
-					bitmap->bit_length -= 8;
-					continue;
-				}
-			}
+	for (size_t i = 0; i < bitmap->word_count; ++i) {
+		used += __builtin_popcountl(__atomic_load_n(&bitmap->words[i], __ATOMIC_RELAXED));
+	}
+	for (size_t i = 0; i < SOCKET_STATS_STRIPES; ++i) {
+		stats->allocations += __atomic_load_n(&bitmap->stripes[i].allocations, __ATOMIC_RELAXED);
+		stats->failures += __atomic_load_n(&bitmap->stripes[i].failures, __ATOMIC_RELAXED);
+	}
 
-			if ((bitmap->bits[index / 8] & (1 << (index % 8))) == 0) {
-				// this bit is in-use, so we can't shrink any further
-				break;
-			}
+	stats->capacity = bitmap->capacity;
+	// the padding bits past the capacity are permanently set
+	stats->in_use = used - (bitmap->word_count * SOCKET_BITMAP_WORD_BITS - bitmap->capacity);
+	stats->peak = __atomic_load_n(&bitmap->peak, __ATOMIC_RELAXED);
+};
 
-			--bitmap->bit_length;
-		}
+// Marks an FD we already have (e.g. one inherited across exec) as used, so that it's never handed out.
+// Returns false if the FD lies outside of the bitmap or is already taken.
+static bool socket_bitmap_reserve(socket_bitmap_t* bitmap, int socket) {
+	size_t index;
+	unsigned long bit;
 
-		new_byte_size = (bitmap->bit_length + 7) / 8;
+	pthread_once(&bitmap->init_once, socket_bitmap_init);
 
-		if (old_byte_size != new_byte_size) {
-			// we can free one or more bytes from the bitmap
-			void* ptr = realloc(bitmap->bits, new_byte_size);
-			if (!ptr) {
-				goto out;
-			}
+	if (bitmap->highest == -1 || socket < 0 || socket > bitmap->highest) {
+		return false;
+	}
 
-			bitmap->bits = ptr;
-		}
+	index = bitmap->highest - socket;
+	if (index >= bitmap->word_count * SOCKET_BITMAP_WORD_BITS) {
+		return false;
 	}
 
-out:
-	pthread_mutex_unlock(&bitmap->mutex);
+	bit = 1UL << (index % SOCKET_BITMAP_WORD_BITS);
+	return !(__atomic_fetch_or(&bitmap->words[index / SOCKET_BITMAP_WORD_BITS], bit, __ATOMIC_ACQUIRE) & bit);
 };
 
-int __mldr_create_rpc_socket(void) {
+static int rpc_socket_create(void) {
 	int pre_fd = -1;
 	int fd = -1;
 
@@ -745,6 +804,148 @@ err_out:
 	return -1;
 };
 
+/**
+ * A few sockets are created and bound ahead of time by a helper thread,
+ * so that creating a thread doesn't have to wait for socket(), dup2(), fcntl() and bind().
+ *
+ * The pool is only started once the process creates its first secondary thread (long after checkin),
+ * so single-threaded processes don't pay for it. It is tied to the process that filled it:
+ * a forked child must not use sockets it shares with its parent, so it throws away what it
+ * inherited and starts its own pool with its own first thread.
+ */
+#define RPC_SOCKET_POOL_SIZE 4
+
+void __mldr_close_rpc_socket(int socket);
+
+static struct {
+	int fds[RPC_SOCKET_POOL_SIZE];
+	/**
+	 * Process the pool belongs to; 0 before it has been started (or after a fork), -1 while it is being started.
+	 */
+	pid_t pid;
+	sem_t refill;
+} rpc_socket_pool = {
+	.fds = { [0 ... RPC_SOCKET_POOL_SIZE - 1] = -1 },
+	.pid = 0,
+};
+
+static void* rpc_socket_pool_thread(void* arg) {
+	while (true) {
+		for (size_t i = 0; i < RPC_SOCKET_POOL_SIZE; ++i) {
+			int expected = -1;
+			int fd;
+
+			if (__atomic_load_n(&rpc_socket_pool.fds[i], __ATOMIC_RELAXED) != -1) {
+				continue;
+			}
+
+			fd = rpc_socket_create();
+			if (fd < 0) {
+				// try again on the next request
+				break;
+			}
+
+			if (!__atomic_compare_exchange_n(&rpc_socket_pool.fds[i], &expected, fd, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+				__mldr_close_rpc_socket(fd);
+			}
+		}
+
+		while (sem_wait(&rpc_socket_pool.refill) < 0 && errno == EINTR);
+	}
+
+	return NULL;
+};
+
+static void rpc_socket_pool_discard(void) {
+	for (size_t i = 0; i < RPC_SOCKET_POOL_SIZE; ++i) {
+		int fd = __atomic_exchange_n(&rpc_socket_pool.fds[i], -1, __ATOMIC_ACQUIRE);
+
+		if (fd >= 0) {
+			__mldr_close_rpc_socket(fd);
+		}
+	}
+};
+
+static void rpc_socket_pool_atfork_child(void) {
+	// the refill thread didn't make it into the child, and the pooled sockets belong to the parent
+	rpc_socket_pool_discard();
+	__atomic_store_n(&rpc_socket_pool.pid, 0, __ATOMIC_RELEASE);
+};
+
+static void rpc_socket_pool_register_atfork(void) {
+	pthread_atfork(NULL, NULL, rpc_socket_pool_atfork_child);
+};
+
+void __mldr_start_rpc_socket_pool(void) {
+	static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all, old;
+	pid_t pid = getpid();
+	pid_t old_pid = __atomic_load_n(&rpc_socket_pool.pid, __ATOMIC_ACQUIRE);
+
+	if (old_pid == pid || old_pid == -1 || !__atomic_compare_exchange_n(&rpc_socket_pool.pid, &old_pid, -1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		// already running, or someone else is starting it
+		return;
+	}
+
+	pthread_once(&atfork_once, rpc_socket_pool_register_atfork);
+
+	// in case we were forked without running the atfork handlers
+	if (old_pid != 0) {
+		rpc_socket_pool_discard();
+	}
+
+	sem_init(&rpc_socket_pool.refill, 0, 0);
+
+	// this is a plain Linux thread; don't let it receive any (Darwin) signals
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if (pthread_create(&thread, &attr, rpc_socket_pool_thread, NULL) == 0) {
+		__atomic_store_n(&rpc_socket_pool.pid, pid, __ATOMIC_RELEASE);
+	} else {
+		// leave the pool disabled; sockets are simply created inline
+		sem_destroy(&rpc_socket_pool.refill);
+		__atomic_store_n(&rpc_socket_pool.pid, 0, __ATOMIC_RELEASE);
+	}
+
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+};
+
+static int rpc_socket_pool_take(void) {
+	if (__atomic_load_n(&rpc_socket_pool.pid, __ATOMIC_ACQUIRE) != getpid()) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < RPC_SOCKET_POOL_SIZE; ++i) {
+		int fd = __atomic_exchange_n(&rpc_socket_pool.fds[i], -1, __ATOMIC_ACQUIRE);
+
+		if (fd >= 0) {
+			sem_post(&rpc_socket_pool.refill);
+			return fd;
+		}
+	}
+
+	sem_post(&rpc_socket_pool.refill);
+	return -1;
+};
+
+int __mldr_create_rpc_socket(void) {
+	int fd = rpc_socket_pool_take();
+
+	if (fd < 0) {
+		fd = rpc_socket_create();
+	}
+
+	return fd;
+};
+
 void __mldr_close_rpc_socket(int socket) {
 	close(socket);
 	socket_bitmap_put(&socket_bitmap, socket);
@@ -805,6 +1006,7 @@ void __mldr_close_process_lifetime_pipe(int fd) {
 
 static void setup_space(struct load_results* lr, bool is_64_bit) {
 	commpage_setup(is_64_bit);
+	startup_trace_mark("commpage_setup");
 
 	// Using the default stack top would cause the stack to be placed just above the commpage
 	// and would collide with it eventually.
@@ -832,6 +1034,9 @@ static void setup_space(struct load_results* lr, bool is_64_bit) {
 
 	unset_special_env();
 
+	// make sure none of our own FDs end up on top of the lifetime pipe we've inherited
+	bool lifetime_pipe_reserved = lr->lifetime_pipe != -1 && socket_bitmap_reserve(&socket_bitmap, lr->lifetime_pipe);
+
 	lr->kernfd = __mldr_create_rpc_socket();
 	if (lr->kernfd < 0) {
 		fprintf(stderr, "Failed to create socket\n");
@@ -839,6 +1044,7 @@ static void setup_space(struct load_results* lr, bool is_64_bit) {
 	}
 
 	__dserver_main_thread_socket_fd = lr->kernfd;
+	startup_trace_mark("rpc_socket");
 
 	int lifetime_pipe[2];
 
@@ -846,17 +1052,22 @@ static void setup_space(struct load_results* lr, bool is_64_bit) {
 	// darlingserver should already have the read pipe, so we don't need
 	// to check that in.
 	if (lr->lifetime_pipe != -1) {
-		lifetime_pipe[1] = socket_bitmap_get(&socket_bitmap);
-
-		if (lr->lifetime_pipe != lifetime_pipe[1]) {
-			// move the existing pipe to a higher fd number, and invalidate
-			// the old fd to prevent interfering with fds provided by
-			// socket_bitmap_get
-			if (dup2(lr->lifetime_pipe, lifetime_pipe[1]) == -1) {
-				fprintf(stderr, "Failed to dup process lifetime pipe: %d (%s)\n", errno, strerror(errno));
-				exit(1);
+		if (lifetime_pipe_reserved) {
+			// it's already within the range of the bitmap; keep it where it is
+			lifetime_pipe[1] = lr->lifetime_pipe;
+		} else {
+			lifetime_pipe[1] = socket_bitmap_get(&socket_bitmap);
+
+			if (lr->lifetime_pipe != lifetime_pipe[1]) {
+				// move the existing pipe to a higher fd number, and invalidate
+				// the old fd to prevent interfering with fds provided by
+				// socket_bitmap_get
+				if (dup2(lr->lifetime_pipe, lifetime_pipe[1]) == -1) {
+					fprintf(stderr, "Failed to dup process lifetime pipe: %d (%s)\n", errno, strerror(errno));
+					exit(1);
+				}
+				close(lr->lifetime_pipe);
 			}
-			close(lr->lifetime_pipe);
 		}
 
 		lifetime_pipe[0] = -1;
@@ -877,6 +1088,7 @@ static void setup_space(struct load_results* lr, bool is_64_bit) {
 		fprintf(stderr, "Failed to checkin with darlingserver\n");
 		exit(1);
 	}
+	startup_trace_mark("dserver_checkin");
 
 	// keep our write end while closing the unused read end.
 	__mldr_close_process_lifetime_pipe(lifetime_pipe[0]);
@@ -0,0 +1,102 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "startup_trace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+static const char* trace_path;
+static char trace_executable[1024];
+static uint64_t trace_entry_ns;
+static uint64_t trace_last_ns;
+
+static uint64_t trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+};
+
+// Copies `str` as the contents of a JSON string
+static void trace_escape(char* out, size_t out_size, const char* str) {
+	size_t pos = 0;
+
+	for (; *str && pos + 7 < out_size; ++str) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\') {
+			out[pos++] = '\\';
+			out[pos++] = c;
+		} else if (c < 0x20) {
+			pos += snprintf(out + pos, out_size - pos, "\\u%04x", c);
+		} else {
+			out[pos++] = c;
+		}
+	}
+
+	out[pos] = '\0';
+};
+
+void startup_trace_init(const char* executable) {
+	const char* path = getenv("MLDR_STARTUP_TRACE");
+
+	if (path == NULL || path[0] == '\0') {
+		return;
+	}
+
+	trace_path = path;
+	trace_escape(trace_executable, sizeof(trace_executable), executable);
+	trace_entry_ns = trace_last_ns = trace_now();
+};
+
+void startup_trace_mark(const char* phase) {
+	char line[sizeof(trace_executable) + 256];
+	char escaped_phase[64];
+	uint64_t now, last;
+	int len, fd;
+
+	if (trace_path == NULL) {
+		return;
+	}
+
+	now = trace_now();
+	last = __atomic_exchange_n(&trace_last_ns, now, __ATOMIC_RELAXED);
+
+	trace_escape(escaped_phase, sizeof(escaped_phase), phase);
+
+	len = snprintf(line, sizeof(line), "{\"pid\":%d,\"exe\":\"%s\",\"phase\":\"%s\",\"time_ns\":%llu,\"since_entry_ns\":%llu,\"delta_ns\":%llu}\n",
+			getpid(), trace_executable, escaped_phase, (unsigned long long)now,
+			(unsigned long long)(now - trace_entry_ns), (unsigned long long)(now - last));
+	if (len <= 0 || len >= sizeof(line)) {
+		return;
+	}
+
+	// O_APPEND keeps lines from concurrently starting processes intact
+	fd = open(trace_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return;
+	}
+
+	write(fd, line, len);
+	close(fd);
+};
@@ -0,0 +1,43 @@
+/*
+This file is part of Darling.
+
+Copyright (C) 2026 Darling Team
+
+Darling is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Darling is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MLDR_STARTUP_TRACE_H_
+#define _MLDR_STARTUP_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Startup timing: if MLDR_STARTUP_TRACE is set to a file path, a JSON line is appended to that file
+// at the end of every startup phase, e.g.
+//
+// {"pid":42,"exe":"/bin/ls","phase":"commpage_setup","time_ns":123456789,"since_entry_ns":51234,"delta_ns":40100}
+//
+// `time_ns` is CLOCK_MONOTONIC, `delta_ns` is the time since the previous phase ended (i.e. the phase's duration).
+// Phases recorded by mldr, in order: mldr_entry, commpage_setup, rpc_socket, dserver_checkin, macho_map, dyld_start.
+// libSystem reports libsystem_init through elf_calls.
+
+void startup_trace_init(const char* executable);
+void startup_trace_mark(const char* phase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _MLDR_STARTUP_TRACE_H_
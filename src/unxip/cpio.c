@@ -0,0 +1,510 @@
+//
+//  cpio.c
+//  unxip
+//
+//  Licensed under GPLv3, full text at http://www.gnu.org/licenses/gpl-3.0.txt
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "cpio.h"
+#define min(A,B) ({ __typeof__(A) __a = (A); __typeof__(B) __b = (B); __a < __b ? __a : __b; })
+#define err(c, m) if (c) { fprintf(stderr, m"\n"); exit(__COUNTER__ + 101); }
+#define ODC_HEADER_SIZE 76
+#define NEWC_HEADER_SIZE 110
+#define MAGIC_SIZE 6
+#define MAX_SYMLINK_SIZE (1024 * 1024)
+#define LINK_BUCKETS 4096
+
+enum { FORMAT_UNKNOWN, FORMAT_ODC, FORMAT_NEWC };
+enum { STATE_HEADER, STATE_NAME, STATE_DATA, STATE_DONE };
+
+struct entry {
+    uint64_t dev, ino, rdev, size, mtime;
+    uint32_t mode, uid, gid, nlink, namesize;
+};
+
+// Directories get their final permissions and times once everything in them exists
+struct dir_meta {
+    char *path;
+    uint32_t mode, uid, gid;
+    uint64_t mtime;
+};
+
+// First path extracted for each (dev, ino) that has more than one link
+struct link_node {
+    uint64_t dev, ino;
+    char *path;
+    char has_data;
+    struct link_node *next;
+};
+
+struct cpio_extractor {
+    int state, format;
+    char header[NEWC_HEADER_SIZE];
+    size_t header_size, have, skip;
+    struct entry e;
+    char *name, *target;
+    size_t name_cap;
+    uint64_t remaining;
+    int fd;
+    char discard;
+    struct dir_meta *dirs;
+    size_t dir_count, dir_cap;
+    struct link_node *links[LINK_BUCKETS];
+    size_t errors;
+    char root;
+    // Longest parent directory known to have no symlinks in it, "" is the destination
+    char *safe;
+    size_t safe_len, safe_cap;
+};
+
+static uint64_t parse_number(const char *field, size_t length, int base) {
+    char buffer[16];
+    memcpy(buffer, field, length);
+    buffer[length] = 0;
+    char *end;
+    uint64_t value = strtoull(buffer, &end, base);
+    err(*end, "Malformed cpio header");
+    return value;
+}
+
+static void parse_header(struct cpio_extractor *x) {
+    const char *h = x->header + MAGIC_SIZE;
+    struct entry *e = &x->e;
+    if (x->format == FORMAT_ODC) {
+        e->dev = parse_number(h, 6, 8);
+        e->ino = parse_number(h + 6, 6, 8);
+        e->mode = parse_number(h + 12, 6, 8);
+        e->uid = parse_number(h + 18, 6, 8);
+        e->gid = parse_number(h + 24, 6, 8);
+        e->nlink = parse_number(h + 30, 6, 8);
+        e->rdev = parse_number(h + 36, 6, 8);
+        e->mtime = parse_number(h + 42, 11, 8);
+        e->namesize = parse_number(h + 53, 6, 8);
+        e->size = parse_number(h + 59, 11, 8);
+    } else {
+        e->ino = parse_number(h, 8, 16);
+        e->mode = parse_number(h + 8, 8, 16);
+        e->uid = parse_number(h + 16, 8, 16);
+        e->gid = parse_number(h + 24, 8, 16);
+        e->nlink = parse_number(h + 32, 8, 16);
+        e->mtime = parse_number(h + 40, 8, 16);
+        e->size = parse_number(h + 48, 8, 16);
+        e->dev = parse_number(h + 56, 8, 16) << 32 | parse_number(h + 64, 8, 16);
+        e->rdev = makedev(parse_number(h + 72, 8, 16), parse_number(h + 80, 8, 16));
+        e->namesize = parse_number(h + 88, 8, 16);
+    }
+    err(e->namesize == 0, "Malformed cpio header");
+}
+
+// newc pads the header + name and the data to 4 bytes
+static size_t padding(struct cpio_extractor *x, uint64_t size) {
+    return x->format == FORMAT_NEWC ? (4 - size % 4) % 4 : 0;
+}
+
+static void fail(struct cpio_extractor *x, const char *what, const char *path) {
+    fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+    x->errors++;
+}
+
+static void make_parents(const char *path) {
+    char *copy = strdup(path);
+    err(!copy, "Out of memory");
+    for (char *slash = strchr(copy + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = 0;
+        mkdir(copy, 0755);
+        *slash = '/';
+    }
+    free(copy);
+}
+
+static void set_times(const char *path, int fd, uint64_t mtime) {
+    struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+    if (fd >= 0)
+        futimens(fd, times);
+    else
+        utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static struct link_node **link_bucket(struct cpio_extractor *x, uint64_t dev, uint64_t ino) {
+    return &x->links[(ino ^ dev * 0x9e3779b97f4a7c15ULL) % LINK_BUCKETS];
+}
+
+static struct link_node *find_link(struct cpio_extractor *x, uint64_t dev, uint64_t ino) {
+    for (struct link_node *node = *link_bucket(x, dev, ino); node; node = node->next)
+        if (node->dev == dev && node->ino == ino)
+            return node;
+    return NULL;
+}
+
+static int open_file(struct cpio_extractor *x, const char *path) {
+    unlink(path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == ENOENT) {
+        make_parents(path);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+    if (fd < 0)
+        fail(x, "Cannot create", path);
+    return fd;
+}
+
+static void begin_regular(struct cpio_extractor *x) {
+    struct entry *e = &x->e;
+    struct link_node *node = e->nlink > 1 ? find_link(x, e->dev, e->ino) : NULL;
+
+    if (!node) {
+        x->fd = open_file(x, x->name);
+        if (x->fd >= 0 && e->nlink > 1) {
+            err(!(node = malloc(sizeof(*node))) || !(node->path = strdup(x->name)), "Out of memory");
+            node->dev = e->dev;
+            node->ino = e->ino;
+            node->has_data = e->size > 0;
+            node->next = *link_bucket(x, e->dev, e->ino);
+            *link_bucket(x, e->dev, e->ino) = node;
+        }
+        return;
+    }
+
+    unlink(x->name);
+    int ret = link(node->path, x->name);
+    if (ret < 0 && errno == ENOENT) {
+        make_parents(x->name);
+        ret = link(node->path, x->name);
+    }
+    if (ret < 0) {
+        fail(x, "Cannot link", x->name);
+        return;
+    }
+
+    // odc repeats the contents for every link, newc only has them on the last one
+    if (e->size > 0 && !node->has_data) {
+        x->fd = open(x->name, O_WRONLY | O_TRUNC | O_CLOEXEC);
+        if (x->fd < 0)
+            fail(x, "Cannot open", x->name);
+        node->has_data = 1;
+    }
+}
+
+static void begin_entry(struct cpio_extractor *x) {
+    struct entry *e = &x->e;
+    x->fd = -1;
+    x->discard = 1;
+    x->remaining = e->size;
+
+    if (S_ISREG(e->mode)) {
+        begin_regular(x);
+        x->discard = x->fd < 0;
+    } else if (S_ISLNK(e->mode)) {
+        err(e->size > MAX_SYMLINK_SIZE, "Symlink target too long");
+        err(!(x->target = malloc(e->size + 1)), "Out of memory");
+        x->discard = 0;
+    } else if (S_ISDIR(e->mode)) {
+        // writable until its contents are in place
+        if (mkdir(x->name, 0700) < 0 && errno == ENOENT) {
+            make_parents(x->name);
+            mkdir(x->name, 0700);
+        }
+        struct stat st;
+        if (lstat(x->name, &st) < 0 || !S_ISDIR(st.st_mode)) {
+            fail(x, "Cannot create directory", x->name);
+            return;
+        }
+        if (x->dir_count == x->dir_cap) {
+            x->dir_cap = x->dir_cap ? x->dir_cap * 2 : 256;
+            err(!(x->dirs = realloc(x->dirs, x->dir_cap * sizeof(*x->dirs))), "Out of memory");
+        }
+        struct dir_meta *dir = &x->dirs[x->dir_count++];
+        err(!(dir->path = strdup(x->name)), "Out of memory");
+        dir->mode = e->mode;
+        dir->uid = e->uid;
+        dir->gid = e->gid;
+        dir->mtime = e->mtime;
+    } else {
+        unlink(x->name);
+        int ret = mknod(x->name, e->mode, e->rdev);
+        if (ret < 0 && errno == ENOENT) {
+            make_parents(x->name);
+            ret = mknod(x->name, e->mode, e->rdev);
+        }
+        if (ret < 0)
+            fail(x, "Cannot create", x->name);
+        else {
+            if (x->root)
+                lchown(x->name, e->uid, e->gid);
+            set_times(x->name, -1, e->mtime);
+        }
+    }
+}
+
+static void end_entry(struct cpio_extractor *x) {
+    struct entry *e = &x->e;
+
+    if (S_ISLNK(e->mode)) {
+        x->target[e->size] = 0;
+        unlink(x->name);
+        int ret = symlink(x->target, x->name);
+        if (ret < 0 && errno == ENOENT) {
+            make_parents(x->name);
+            ret = symlink(x->target, x->name);
+        }
+        if (ret < 0)
+            fail(x, "Cannot create symlink", x->name);
+        else {
+            // it may be one of the directories that were checked
+            x->safe_len = 0;
+            if (x->root)
+                lchown(x->name, e->uid, e->gid);
+            set_times(x->name, -1, e->mtime);
+        }
+        free(x->target);
+        x->target = NULL;
+    } else if (x->fd >= 0) {
+        // chown first, it clears the setuid and setgid bits
+        if (x->root)
+            fchown(x->fd, e->uid, e->gid);
+        fchmod(x->fd, e->mode & 07777);
+        set_times(x->name, x->fd, e->mtime);
+        if (close(x->fd) < 0)
+            fail(x, "Cannot write", x->name);
+        x->fd = -1;
+    }
+
+    x->skip += padding(x, e->size);
+    x->state = STATE_HEADER;
+    x->have = 0;
+}
+
+// Makes the name relative and refuses to leave the current directory
+static int sanitize_name(struct cpio_extractor *x) {
+    char *name = x->name;
+    err(name[x->e.namesize - 1], "Malformed cpio name");
+    while (name[0] == '/')
+        name++;
+    while (name[0] == '.' && name[1] == '/')
+        name += 2;
+    memmove(x->name, name, strlen(name) + 1);
+
+    if (!x->name[0] || !strcmp(x->name, "."))
+        return 0;
+    for (const char *part = x->name; part; ) {
+        if (part[0] == '.' && part[1] == '.' && (part[2] == '/' || part[2] == 0)) {
+            fprintf(stderr, "Skipping %s: path leaves the destination\n", x->name);
+            x->errors++;
+            return 0;
+        }
+        if ((part = strchr(part, '/')))
+            part++;
+    }
+    return 1;
+}
+
+// Refuses names that would be created through a symlink an earlier entry left behind
+static int check_parents(struct cpio_extractor *x) {
+    const char *name = x->name, *end = strrchr(name, '/');
+    size_t length = end ? end - name : 0, i = 0;
+    if (x->safe_len && length >= x->safe_len && !memcmp(name, x->safe, x->safe_len) && (length == x->safe_len || name[x->safe_len] == '/'))
+        i = x->safe_len;
+    if (i == length)
+        return 1;
+
+    char *copy = strndup(name, length);
+    err(!copy, "Out of memory");
+    for (char *slash = copy + i; slash; ) {
+        if ((slash = strchr(slash + 1, '/')))
+            *slash = 0;
+        struct stat st;
+        if (lstat(copy, &st) < 0)
+            break;
+        if (S_ISLNK(st.st_mode)) {
+            fprintf(stderr, "Skipping %s: %s is a symlink\n", name, copy);
+            x->errors++;
+            free(copy);
+            return 0;
+        }
+        if (slash)
+            *slash = '/';
+    }
+
+    // anything missing gets created by make_parents as a plain directory
+    if (x->safe_cap <= length) {
+        x->safe_cap = length + 1;
+        err(!(x->safe = realloc(x->safe, x->safe_cap)), "Out of memory");
+    }
+    memcpy(x->safe, name, length);
+    x->safe[length] = 0;
+    x->safe_len = length;
+    free(copy);
+    return 1;
+}
+
+static void name_complete(struct cpio_extractor *x) {
+    x->skip = padding(x, x->header_size + x->e.namesize);
+    if (!strcmp(x->name, "TRAILER!!!")) {
+        x->state = STATE_DONE;
+        return;
+    }
+
+    x->state = STATE_DATA;
+    if (sanitize_name(x) && check_parents(x))
+        begin_entry(x);
+    else {
+        x->fd = -1;
+        x->discard = 1;
+        x->remaining = x->e.size;
+        x->e.mode = 0;
+    }
+    if (!x->remaining)
+        end_entry(x);
+}
+
+static void write_data(struct cpio_extractor *x, const char *buffer, size_t size) {
+    if (S_ISLNK(x->e.mode) && x->target) {
+        memcpy(x->target + (x->e.size - x->remaining), buffer, size);
+        return;
+    }
+    while (size && x->fd >= 0) {
+        ssize_t written = write(x->fd, buffer, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0) {
+            fail(x, "Cannot write", x->name);
+            close(x->fd);
+            x->fd = -1;
+            break;
+        }
+        buffer += written;
+        size -= written;
+    }
+}
+
+struct cpio_extractor *cpio_extractor_new(void) {
+    struct cpio_extractor *x = calloc(1, sizeof(*x));
+    err(!x, "Out of memory");
+    x->fd = -1;
+    x->root = geteuid() == 0;
+    return x;
+}
+
+void cpio_extractor_feed(struct cpio_extractor *x, const char *buffer, size_t size) {
+    while (size && x->state != STATE_DONE) {
+        if (x->skip) {
+            size_t n = min(size, x->skip);
+            buffer += n;
+            size -= n;
+            x->skip -= n;
+            continue;
+        }
+
+        if (x->state == STATE_HEADER) {
+            size_t want = x->format == FORMAT_UNKNOWN || x->have < MAGIC_SIZE ? MAGIC_SIZE : x->header_size;
+            size_t n = min(size, want - x->have);
+            memcpy(x->header + x->have, buffer, n);
+            buffer += n;
+            size -= n;
+            x->have += n;
+            if (x->have == MAGIC_SIZE && want == MAGIC_SIZE) {
+                if (!memcmp(x->header, "070707", MAGIC_SIZE))
+                    x->format = FORMAT_ODC, x->header_size = ODC_HEADER_SIZE;
+                else if (!memcmp(x->header, "070701", MAGIC_SIZE) || !memcmp(x->header, "070702", MAGIC_SIZE))
+                    x->format = FORMAT_NEWC, x->header_size = NEWC_HEADER_SIZE;
+                else
+                    err(1, "Unsupported cpio format");
+            } else if (x->have == x->header_size) {
+                parse_header(x);
+                if (x->name_cap < x->e.namesize) {
+                    x->name_cap = x->e.namesize;
+                    err(!(x->name = realloc(x->name, x->name_cap)), "Out of memory");
+                }
+                x->state = STATE_NAME;
+                x->have = 0;
+            }
+        } else if (x->state == STATE_NAME) {
+            size_t n = min(size, x->e.namesize - x->have);
+            memcpy(x->name + x->have, buffer, n);
+            buffer += n;
+            size -= n;
+            x->have += n;
+            if (x->have == x->e.namesize)
+                name_complete(x);
+        } else {
+            size_t n = min((uint64_t)size, x->remaining);
+            if (!x->discard)
+                write_data(x, buffer, n);
+            buffer += n;
+            size -= n;
+            x->remaining -= n;
+            if (!x->remaining)
+                end_entry(x);
+        }
+    }
+}
+
+struct dir_job {
+    struct cpio_extractor *x;
+    size_t first, stride;
+};
+
+static void *apply_dir_meta(void *arg) {
+    struct dir_job *job = arg;
+    struct cpio_extractor *x = job->x;
+    for (size_t i = job->first; i < x->dir_count; i += job->stride) {
+        struct dir_meta *dir = &x->dirs[i];
+        if (x->root)
+            chown(dir->path, dir->uid, dir->gid);
+        chmod(dir->path, dir->mode & 07777);
+        set_times(dir->path, -1, dir->mtime);
+    }
+    return NULL;
+}
+
+size_t cpio_extractor_finish(struct cpio_extractor *x, size_t threads) {
+    if (x->state != STATE_DONE) {
+        fprintf(stderr, "Archive is truncated\n");
+        x->errors++;
+        if (x->fd >= 0)
+            close(x->fd);
+    }
+
+    // Nothing else touches the tree any more, so the directories are independent
+    threads = min(threads ? threads : 1, x->dir_count ? x->dir_count : 1);
+    pthread_t tids[threads];
+    struct dir_job jobs[threads];
+    for (size_t t = 0; t < threads; t++)
+        jobs[t] = (struct dir_job){ x, t, threads };
+    size_t started = 1;
+    while (started < threads && pthread_create(&tids[started], NULL, apply_dir_meta, &jobs[started]) == 0)
+        started++;
+    // the first slice, plus any that didn't get a thread, run here
+    for (size_t t = started; t < threads; t++)
+        apply_dir_meta(&jobs[t]);
+    apply_dir_meta(&jobs[0]);
+    for (size_t t = 1; t < started; t++)
+        pthread_join(tids[t], NULL);
+
+    size_t errors = x->errors;
+    for (size_t i = 0; i < x->dir_count; i++)
+        free(x->dirs[i].path);
+    free(x->dirs);
+    for (size_t b = 0; b < LINK_BUCKETS; b++) {
+        for (struct link_node *node = x->links[b], *next; node; node = next) {
+            next = node->next;
+            free(node->path);
+            free(node);
+        }
+    }
+    free(x->target);
+    free(x->safe);
+    free(x->name);
+    free(x);
+    return errors;
+}
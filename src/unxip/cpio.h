@@ -0,0 +1,25 @@
+//
+//  cpio.h
+//  unxip
+//
+//  Licensed under GPLv3, full text at http://www.gnu.org/licenses/gpl-3.0.txt
+//
+
+#ifndef UNXIP_CPIO_H
+#define UNXIP_CPIO_H
+
+#include <stddef.h>
+
+// Extracts a cpio archive (odc or newc) into the current directory as it is
+// fed in arbitrary pieces, so it can consume the payload while it is still
+// being decompressed
+struct cpio_extractor;
+
+struct cpio_extractor *cpio_extractor_new(void);
+void cpio_extractor_feed(struct cpio_extractor *x, const char *buffer, size_t size);
+// Applies directory metadata (which has to wait until their contents exist)
+// on up to `threads` threads and frees the extractor. Returns how many
+// entries could not be extracted.
+size_t cpio_extractor_finish(struct cpio_extractor *x, size_t threads);
+
+#endif
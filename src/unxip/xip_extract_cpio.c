@@ -10,12 +10,35 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <xar/xar.h>
 #include <lzma.h>
+#include "cpio.h"
 #define min(A,B) ({ __typeof__(A) __a = (A); __typeof__(B) __b = (B); __a < __b ? __a : __b; })
 #define err(c, m) if (c) { fprintf(stderr, m"\n"); exit(__COUNTER__ + 1); }
 #define XBSZ 4 * 1024
-#define ZBSZ 1024 * XBSZ
+#define MAX_WORKERS 64
+
+// pbzx chunks are independent XZ streams, so they are decompressed on a pool of
+// workers while the payload is still being read, and passed on in order to be
+// extracted (or written to stdout with -c)
+struct chunk {
+    char *in, *out;
+    size_t in_size, in_cap, out_size, out_cap;
+    uint64_t size;
+    char plain, done;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct chunk *chunks;
+    size_t window, next_read, next_decode, next_write;
+    char eof;
+    // NULL when the archive goes to stdout as is
+    struct cpio_extractor *extractor;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
 
 static inline void xar_read(char *buffer, uint32_t size, xar_stream *stream) {
     stream->next_out = buffer;
@@ -37,12 +60,88 @@ static inline uint64_t xar_read_64(xar_stream *stream) {
     return __builtin_bswap64(*(uint64_t *)t);
 }
 
+static void decode(struct chunk *c, lzma_stream *zs) {
+    err(lzma_stream_decoder(zs, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK, "LZMA init failed");
+    if (c->out_cap < c->size) {
+        err(!(c->out = realloc(c->out, c->out_cap = c->size)), "Out of memory");
+    }
+    zs->next_in = (typeof(zs->next_in))c->in;
+    zs->avail_in = c->in_size;
+    zs->next_out = (typeof(zs->next_out))c->out;
+    zs->avail_out = c->out_cap;
+    for (;;) {
+        lzma_ret ret = lzma_code(zs, LZMA_FINISH);
+        if (ret == LZMA_STREAM_END)
+            break;
+        err(ret != LZMA_OK && !(ret == LZMA_BUF_ERROR && !zs->avail_out), "LZMA failure");
+        if (zs->avail_out)
+            continue;
+        // more data than the chunk header said
+        size_t used = c->out_cap - zs->avail_out;
+        err(!(c->out = realloc(c->out, c->out_cap *= 2)), "Out of memory");
+        zs->next_out = (typeof(zs->next_out))c->out + used;
+        zs->avail_out = c->out_cap - used;
+    }
+    c->out_size = c->out_cap - zs->avail_out;
+}
+
+static void *worker(void *arg) {
+    lzma_stream zs = LZMA_STREAM_INIT;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.next_decode == pool.next_read && !pool.eof)
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        if (pool.next_decode == pool.next_read)
+            break;
+        struct chunk *c = &pool.chunks[pool.next_decode++ % pool.window];
+        pthread_mutex_unlock(&pool.lock);
+        if (!c->plain)
+            decode(c, &zs);
+        pthread_mutex_lock(&pool.lock);
+        c->done = 1;
+        pthread_cond_broadcast(&pool.cond);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    lzma_end(&zs);
+    return NULL;
+}
+
+static void *writer(void *arg) {
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (!(pool.next_write < pool.next_read && pool.chunks[pool.next_write % pool.window].done)) {
+            if (pool.eof && pool.next_write == pool.next_read) {
+                pthread_mutex_unlock(&pool.lock);
+                return NULL;
+            }
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        }
+        struct chunk *c = &pool.chunks[pool.next_write % pool.window];
+        pthread_mutex_unlock(&pool.lock);
+        char *data = c->plain ? c->in : c->out;
+        size_t size = c->plain ? c->in_size : c->out_size;
+        if (pool.extractor)
+            cpio_extractor_feed(pool.extractor, data, size);
+        else
+            cpio_out(data, size);
+        pthread_mutex_lock(&pool.lock);
+        c->done = 0;
+        pool.next_write++;
+        pthread_cond_broadcast(&pool.cond);
+    }
+}
+
 int main(int argc, const char * argv[])
 {
-    char xbuf[XBSZ], *zbuf = malloc(ZBSZ);
+    char xbuf[XBSZ];
     xar_t x;
-    err(argc < 2, "No file specified");
-    err(!(x = xar_open(argv[1], READ)), "XAR open failure");
+    int opt, to_stdout = 0;
+    while ((opt = getopt(argc, (char * const *)argv, "c")) != -1) {
+        err(opt != 'c', "Usage: xip_extract_cpio [-c] <xip-file>");
+        to_stdout = 1;
+    }
+    err(optind >= argc, "No file specified");
+    err(!(x = xar_open(argv[optind], READ)), "XAR open failure");
     xar_iter_t i = xar_iter_new();
     xar_file_t f = xar_file_first(x, i);
     char *path;
@@ -56,36 +155,59 @@ int main(int argc, const char * argv[])
     err(xar_extract_tostream_init(x, f, &xs) != XAR_STREAM_OK, "XAR init failed");
     xar_read(xbuf, 4, &xs);
     err(strncmp(xbuf, "pbzx", 4), "Not a pbzx stream");
-    uint64_t length = 0, flags = xar_read_64(&xs), last = 0;
-    lzma_stream zs = LZMA_STREAM_INIT;
-    err(lzma_stream_decoder(&zs, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK, "LZMA init failed");
+    uint64_t length = 0, flags = xar_read_64(&xs);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = min(cpus > 0 ? (size_t)cpus : 1, (size_t)MAX_WORKERS);
+    pthread_t threads[MAX_WORKERS + 1];
+    // enough chunks in flight to keep every worker busy while one is read and one is written
+    pool.window = workers * 2 + 2;
+    err(!(pool.chunks = calloc(pool.window, sizeof(*pool.chunks))), "Out of memory");
+    for (size_t t = 0; t < workers; t++)
+        err(pthread_create(&threads[t], NULL, worker, NULL), "Thread creation failed");
+    if (!to_stdout)
+        pool.extractor = cpio_extractor_new();
+    err(pthread_create(&threads[workers], NULL, writer, NULL), "Thread creation failed");
+
     while (flags & 1 << 24) {
         flags = xar_read_64(&xs);
         length = xar_read_64(&xs);
-        char plain = length == 0x1000000;
-        xar_read(xbuf, min(XBSZ, (uint32_t)length), &xs);
-        err(!plain && strncmp(xbuf, "\xfd""7zXZ\0", 6), "Header is not <FD>7zXZ<00>");
-        while (length) {
-            if (plain)
-                cpio_out(xbuf, min(XBSZ, length));
-            else {
-                zs.next_in = (typeof(zs.next_in))xbuf;
-                zs.avail_in = min(XBSZ, length);
-                while (zs.avail_in) {
-                    zs.next_out = (typeof(zs.next_out))zbuf;
-                    zs.avail_out = ZBSZ;
-                    err(lzma_code(&zs, LZMA_RUN) != LZMA_OK, "LZMA failure");
-                    cpio_out(zbuf, ZBSZ - zs.avail_out);
-                }
-            }
-            length -= last = min(XBSZ, length);
-            xar_read(xbuf, min(XBSZ, (uint32_t)length), &xs);
+        pthread_mutex_lock(&pool.lock);
+        while (pool.next_read - pool.next_write >= pool.window)
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        struct chunk *c = &pool.chunks[pool.next_read % pool.window];
+        pthread_mutex_unlock(&pool.lock);
+
+        c->plain = length == 0x1000000;
+        c->size = flags;
+        if (c->in_cap < length) {
+            err(!(c->in = realloc(c->in, c->in_cap = length)), "Out of memory");
         }
-        err(!plain && strncmp(xbuf + last - 2, "YZ", 2), "Footer is not YZ");
+        for (c->in_size = 0; c->in_size < length; c->in_size += min(length - c->in_size, (uint64_t)UINT32_MAX))
+            xar_read(c->in + c->in_size, min(length - c->in_size, (uint64_t)UINT32_MAX), &xs);
+        err(!c->plain && (length < 6 || strncmp(c->in, "\xfd""7zXZ\0", 6)), "Header is not <FD>7zXZ<00>");
+        err(!c->plain && strncmp(c->in + length - 2, "YZ", 2), "Footer is not YZ");
+
+        pthread_mutex_lock(&pool.lock);
+        pool.next_read++;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.eof = 1;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+    for (size_t t = 0; t <= workers; t++)
+        pthread_join(threads[t], NULL);
+
+    size_t failed = pool.extractor ? cpio_extractor_finish(pool.extractor, workers) : 0;
+    for (size_t t = 0; t < pool.window; t++) {
+        free(pool.chunks[t].in);
+        free(pool.chunks[t].out);
     }
+    free(pool.chunks);
     xar_extract_tostream_end(&xs);
-    free(zbuf);
-    lzma_end(&zs);
     xar_close(x);
-    return 0;
+    return failed ? 1 : 0;
 }